@@ -0,0 +1,286 @@
+#include "harness.h"
+
+#include <json.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <nyoravim/mem.h>
+#include <nyoravim/util.h>
+
+/* a batch has to run at least this long for clock overhead to stop mattering */
+#define MIN_BATCH_NS 2000
+#define MAX_BATCH_SIZE (1 << 24)
+
+/* upper bound on samples kept per case */
+#define MAX_SAMPLES (1 << 20)
+
+#define DEFAULT_WARMUP_NS (100 * 1000 * 1000)
+#define DEFAULT_MEASURE_NS (1000 * 1000 * 1000)
+
+struct bench_info {
+    char* key;
+    char* value;
+};
+
+typedef struct bench_suite {
+    struct bench_options options;
+
+    struct bench_result* results;
+    size_t num_results, results_capacity;
+
+    struct bench_info* info;
+    size_t num_info;
+
+    /* per operation time of each batch */
+    double* samples;
+} bench_suite_t;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+bench_suite_t* bench_suite_create(const struct bench_options* options) {
+    bench_suite_t* suite = nv_alloc(sizeof(bench_suite_t));
+    assert(suite);
+    memset(suite, 0, sizeof(bench_suite_t));
+
+    if (options) {
+        memcpy(&suite->options, options, sizeof(struct bench_options));
+    }
+
+    if (suite->options.warmup_ns == 0) {
+        suite->options.warmup_ns = DEFAULT_WARMUP_NS;
+    }
+
+    if (suite->options.measure_ns == 0) {
+        suite->options.measure_ns = DEFAULT_MEASURE_NS;
+    }
+
+    suite->samples = nv_alloc(MAX_SAMPLES * sizeof(double));
+    assert(suite->samples);
+
+    return suite;
+}
+
+void bench_suite_free(bench_suite_t* suite) {
+    if (!suite) {
+        return;
+    }
+
+    for (size_t i = 0; i < suite->num_info; i++) {
+        nv_free(suite->info[i].key);
+        nv_free(suite->info[i].value);
+    }
+
+    nv_free(suite->info);
+    nv_free(suite->results);
+    nv_free(suite->samples);
+    nv_free(suite);
+}
+
+void bench_suite_add_info(bench_suite_t* suite, const char* key, const char* value) {
+    suite->info = nv_realloc(suite->info, (suite->num_info + 1) * sizeof(struct bench_info));
+    assert(suite->info);
+
+    struct bench_info* info = &suite->info[suite->num_info++];
+    info->key = nv_strdup(key);
+    info->value = nv_strdup(value);
+}
+
+static uint64_t run_batch(const struct bench_case* bench, size_t batch_size) {
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < batch_size; i++) {
+        bench->run(bench->user);
+    }
+
+    return now_ns() - start;
+}
+
+/* smallest power of two batch that takes at least MIN_BATCH_NS */
+static size_t calibrate_batch(const struct bench_case* bench) {
+    size_t batch_size = 1;
+    while (batch_size < MAX_BATCH_SIZE && run_batch(bench, batch_size) < MIN_BATCH_NS) {
+        batch_size <<= 1;
+    }
+
+    return batch_size;
+}
+
+static int compare_samples(const void* lhs, const void* rhs) {
+    double a = *(const double*)lhs;
+    double b = *(const double*)rhs;
+
+    return (a > b) - (a < b);
+}
+
+/* nearest rank on sorted samples */
+static double percentile(const double* sorted, size_t count, double p) {
+    size_t rank = (size_t)(p * (double)count);
+    return sorted[rank < count ? rank : count - 1];
+}
+
+static void print_result(const struct bench_result* result) {
+    printf("%-36s %12.1f ns/op  p50 %10.1f  p99 %10.1f  p999 %10.1f  %14.0f ops/s", result->name,
+           result->mean, result->p50, result->p99, result->p999, result->ops_per_sec);
+
+    if (result->bytes > 0) {
+        printf("  %9.1f MB/s", result->mb_per_sec);
+    }
+
+    putchar('\n');
+    fflush(stdout);
+}
+
+bool bench_suite_run(bench_suite_t* suite, const struct bench_case* bench) {
+    if (suite->options.filter && !strstr(bench->name, suite->options.filter)) {
+        return false;
+    }
+
+    uint64_t deadline = now_ns() + suite->options.warmup_ns;
+    while (now_ns() < deadline) {
+        bench->run(bench->user);
+    }
+
+    size_t batch_size = calibrate_batch(bench);
+
+    size_t num_samples = 0;
+    uint64_t total_ns = 0;
+
+    deadline = now_ns() + suite->options.measure_ns;
+    while (num_samples < MAX_SAMPLES && (num_samples == 0 || now_ns() < deadline)) {
+        uint64_t elapsed = run_batch(bench, batch_size);
+
+        suite->samples[num_samples++] = (double)elapsed / (double)batch_size;
+        total_ns += elapsed;
+    }
+
+    /* percentiles are over batch means; with small batches that is close enough to per op */
+    qsort(suite->samples, num_samples, sizeof(double), compare_samples);
+
+    if (suite->num_results >= suite->results_capacity) {
+        suite->results_capacity = suite->results_capacity > 0 ? suite->results_capacity * 2 : 16;
+        suite->results =
+            nv_realloc(suite->results, suite->results_capacity * sizeof(struct bench_result));
+
+        assert(suite->results);
+    }
+
+    struct bench_result* result = &suite->results[suite->num_results++];
+    result->name = bench->name;
+    result->operations = (uint64_t)num_samples * batch_size;
+    result->batch_size = batch_size;
+    result->bytes = bench->bytes;
+
+    result->mean = (double)total_ns / (double)result->operations;
+    result->min = suite->samples[0];
+    result->max = suite->samples[num_samples - 1];
+
+    result->p50 = percentile(suite->samples, num_samples, 0.5);
+    result->p90 = percentile(suite->samples, num_samples, 0.9);
+    result->p99 = percentile(suite->samples, num_samples, 0.99);
+    result->p999 = percentile(suite->samples, num_samples, 0.999);
+
+    result->ops_per_sec = result->mean > 0 ? 1e9 / result->mean : 0;
+    result->mb_per_sec = (double)bench->bytes * result->ops_per_sec / (1024 * 1024);
+
+    print_result(result);
+    return true;
+}
+
+size_t bench_suite_get_num_results(const bench_suite_t* suite) { return suite->num_results; }
+
+const struct bench_result* bench_suite_get_results(const bench_suite_t* suite) {
+    return suite->results;
+}
+
+static void add_double(json_object* object, const char* key, double value) {
+    json_object* field = json_object_new_double(value);
+    assert(field);
+
+    json_object_object_add(object, key, field);
+}
+
+static void add_int(json_object* object, const char* key, int64_t value) {
+    json_object* field = json_object_new_int64(value);
+    assert(field);
+
+    json_object_object_add(object, key, field);
+}
+
+static void add_string(json_object* object, const char* key, const char* value) {
+    json_object* field = json_object_new_string(value);
+    assert(field);
+
+    json_object_object_add(object, key, field);
+}
+
+static json_object* serialize_result(const struct bench_result* result) {
+    json_object* object = json_object_new_object();
+    assert(object);
+
+    add_string(object, "name", result->name);
+    add_int(object, "operations", (int64_t)result->operations);
+    add_int(object, "batch_size", (int64_t)result->batch_size);
+    add_int(object, "bytes_per_op", (int64_t)result->bytes);
+
+    add_double(object, "mean_ns", result->mean);
+    add_double(object, "min_ns", result->min);
+    add_double(object, "max_ns", result->max);
+    add_double(object, "p50_ns", result->p50);
+    add_double(object, "p90_ns", result->p90);
+    add_double(object, "p99_ns", result->p99);
+    add_double(object, "p999_ns", result->p999);
+
+    add_double(object, "ops_per_sec", result->ops_per_sec);
+    if (result->bytes > 0) {
+        add_double(object, "mb_per_sec", result->mb_per_sec);
+    }
+
+    return object;
+}
+
+bool bench_suite_write_json(const bench_suite_t* suite, const char* path) {
+    json_object* root = json_object_new_object();
+    assert(root);
+
+    add_int(root, "timestamp", (int64_t)time(NULL));
+    add_string(root, "compiler", __VERSION__);
+    add_int(root, "cpus", (int64_t)sysconf(_SC_NPROCESSORS_ONLN));
+
+    char hostname[256];
+    if (gethostname(hostname, sizeof(hostname)) == 0) {
+        hostname[sizeof(hostname) - 1] = '\0';
+        add_string(root, "host", hostname);
+    }
+
+    json_object* info = json_object_new_object();
+    assert(info);
+
+    for (size_t i = 0; i < suite->num_info; i++) {
+        add_string(info, suite->info[i].key, suite->info[i].value);
+    }
+
+    json_object_object_add(root, "info", info);
+
+    json_object* results = json_object_new_array();
+    assert(results);
+
+    for (size_t i = 0; i < suite->num_results; i++) {
+        json_object_array_add(results, serialize_result(&suite->results[i]));
+    }
+
+    json_object_object_add(root, "results", results);
+
+    bool success = json_object_to_file_ext(path, root, JSON_C_TO_STRING_PRETTY) == 0;
+    json_object_put(root);
+
+    return success;
+}
@@ -0,0 +1,67 @@
+#ifndef _BENCH_HARNESS_H
+#define _BENCH_HARNESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* runs one operation. called in tight batches, so anything not being measured belongs in setup */
+typedef void (*bench_callback)(void* user);
+
+struct bench_case {
+    const char* name;
+
+    bench_callback run;
+    void* user;
+
+    /* bytes processed per operation, for throughput. 0 if it doesnt make sense */
+    size_t bytes;
+};
+
+struct bench_options {
+    /* time spent running the case before measuring, in nanoseconds */
+    uint64_t warmup_ns;
+
+    /* time spent measuring, in nanoseconds */
+    uint64_t measure_ns;
+
+    /* only cases whose name contains this run. can be NULL */
+    const char* filter;
+};
+
+struct bench_result {
+    const char* name;
+
+    uint64_t operations;
+    size_t batch_size;
+    size_t bytes;
+
+    /* per operation, in nanoseconds */
+    double mean, min, max;
+    double p50, p90, p99, p999;
+
+    double ops_per_sec;
+    double mb_per_sec;
+};
+
+typedef struct bench_suite bench_suite_t;
+
+bench_suite_t* bench_suite_create(const struct bench_options* options);
+void bench_suite_free(bench_suite_t* suite);
+
+/* extra context for the json output, like which kernels were selected. strings are copied */
+void bench_suite_add_info(bench_suite_t* suite, const char* key, const char* value);
+
+/* measures the case immediately and prints a line of results. returns false if filtered out */
+bool bench_suite_run(bench_suite_t* suite, const struct bench_case* bench);
+
+size_t bench_suite_get_num_results(const bench_suite_t* suite);
+const struct bench_result* bench_suite_get_results(const bench_suite_t* suite);
+
+/* writes every result along with some machine information so runs can be compared */
+bool bench_suite_write_json(const bench_suite_t* suite, const char* path);
+
+/* keeps the compiler from optimizing away a result */
+#define bench_do_not_optimize(value) __asm__ volatile("" : : "g"(value) : "memory")
+
+#endif
@@ -0,0 +1,953 @@
+#include "harness.h"
+
+#include "core/base64.h"
+#include "core/compress.h"
+#include "core/hashmap.h"
+#include "core/record.h"
+#include "core/shm_ring.h"
+
+#include "discord/bot.h"
+#include "discord/command.h"
+#include "discord/component.h"
+#include "discord/credentials.h"
+#include "discord/custom_id.h"
+#include "discord/dispatch.h"
+#include "discord/interaction_stream.h"
+
+#include "discord/types/interaction.h"
+#include "discord/types/snowflake.h"
+#include "discord/types/user.h"
+
+#include "status.h"
+
+#include <log.h>
+
+#include <json.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <nyoravim/map.h>
+#include <nyoravim/mem.h>
+#include <nyoravim/util.h>
+
+#define FIXTURE(name) TASKS_BENCH_FIXTURES "/" name
+
+/* must match application_id in the interaction fixtures or command_invoke bails early */
+#define FIXTURE_APP_ID 1296939722491195435
+
+#define SMALL_BUFFER_SIZE 64
+#define LARGE_BUFFER_SIZE 4096
+
+/* random lengths up to a few avx2 blocks, so every kernel hands a partial block to the scalar
+ * code at some point */
+#define BASE64_VERIFY_ROUNDS 2000
+#define BASE64_VERIFY_MAX_SIZE 300
+
+/* smaller than the bot's, to suit a fixture of a few hundred records */
+#define STATUS_DICTIONARY_SIZE (4 * 1024)
+
+/* roughly an entity cache, in flight REST requests and the command registry */
+#define MAP_SNOWFLAKES 4096
+#define MAP_POINTERS 64
+#define MAP_STRINGS 16
+
+struct fixtures {
+    json_object* command_interaction;
+    json_object* component_interaction;
+    json_object* user;
+    json_object* snowflake;
+    json_object* statuses;
+};
+
+struct buffer_bench {
+    uint8_t* data;
+    size_t size;
+
+    char* encoded;
+    size_t encoded_length;
+
+    uint8_t* decoded;
+};
+
+HASHMAP_DECLARE(bench_id_map, uint64_t, void*, hashmap_hash_u64, HASHMAP_EQUALS_SCALAR)
+HASHMAP_DECLARE(bench_ptr_map, void*, void*, hashmap_hash_ptr, HASHMAP_EQUALS_SCALAR)
+HASHMAP_DECLARE(bench_str_map, const char*, void*, hashmap_hash_string, HASHMAP_EQUALS_STRING)
+
+/* the same keys in an nv_map and in the specialized map for its key type. lookups cycle through
+ * every key */
+struct map_bench {
+    size_t count, next;
+
+    nv_map_t* nv;
+
+    uint64_t* ids;
+    bench_id_map_t id_map;
+
+    void** pointers;
+    bench_ptr_map_t ptr_map;
+
+    /* lookups use copies, so comparisons cannot short circuit on the pointer */
+    char** names;
+    char** lookup_names;
+    bench_str_map_t str_map;
+};
+
+/* one process on both ends, so this is the cost of a handoff without the wakeup */
+struct ring_bench {
+    shm_ring_t* ring;
+
+    const char* message;
+    size_t size;
+
+    char* buffer;
+};
+
+struct status_bench {
+    size_t count, next;
+
+    struct status* statuses;
+
+    /* encoded with whichever compressor is set when the bench is prepared */
+    uint8_t** records;
+    size_t* sizes;
+};
+
+struct interaction_bench {
+    bot_t* bot;
+    command_t* cmd;
+
+    const json_object* data;
+    struct interaction parsed;
+};
+
+static json_object* load_fixture(const char* path) {
+    json_object* fixture = json_object_from_file(path);
+    if (!fixture) {
+        log_fatal("failed to load fixture %s: %s", path, json_util_get_last_err());
+        exit(1);
+    }
+
+    return fixture;
+}
+
+static void load_fixtures(struct fixtures* fixtures) {
+    fixtures->command_interaction = load_fixture(FIXTURE("interaction_command.json"));
+    fixtures->component_interaction = load_fixture(FIXTURE("interaction_component.json"));
+    fixtures->user = load_fixture(FIXTURE("user.json"));
+    fixtures->statuses = load_fixture(FIXTURE("statuses.json"));
+
+    fixtures->snowflake = json_object_new_string("1301958117541875814");
+    assert(fixtures->snowflake);
+
+    /* the captured custom_id depends on the encoding, so mint a fresh one the way a button would */
+    struct record_writer payload;
+    record_writer_init(&payload, 64);
+    record_write_string(&payload, 1, "nelly");
+
+    char custom_id[CUSTOM_ID_MAX_LENGTH + 1];
+    bool encoded = custom_id_encode(1, payload.data, payload.size, custom_id);
+    record_writer_cleanup(&payload);
+
+    if (!encoded) {
+        log_fatal("failed to encode fixture custom_id");
+        exit(1);
+    }
+
+    json_object* data = json_object_object_get(fixtures->component_interaction, "data");
+    assert(data);
+
+    json_object* field = json_object_new_string(custom_id);
+    assert(field);
+    json_object_object_add(data, "custom_id", field);
+}
+
+static void free_fixtures(const struct fixtures* fixtures) {
+    json_object_put(fixtures->command_interaction);
+    json_object_put(fixtures->component_interaction);
+    json_object_put(fixtures->user);
+    json_object_put(fixtures->snowflake);
+    json_object_put(fixtures->statuses);
+}
+
+static void bench_interaction_parse(void* user) {
+    struct interaction_bench* bench = user;
+
+    struct interaction interaction;
+    if (interaction_parse(&interaction, bench->data)) {
+        interaction_cleanup(&interaction);
+    }
+}
+
+static void bench_user_parse(void* user) {
+    struct user parsed;
+    if (user_parse(&parsed, user)) {
+        user_cleanup(&parsed);
+    }
+}
+
+static void bench_snowflake_parse(void* user) {
+    uint64_t id;
+    snowflake_parse(&id, user);
+
+    bench_do_not_optimize(id);
+}
+
+static void bench_component_serialize(void* user) {
+    json_object* serialized = component_serialize(user);
+    json_object_put(serialized);
+}
+
+static void bench_base64_encode(void* user) {
+    struct buffer_bench* bench = user;
+
+    size_t length = base64_encode_to(bench->data, bench->size, bench->encoded);
+    bench_do_not_optimize(length);
+}
+
+static void bench_base64_decode(void* user) {
+    struct buffer_bench* bench = user;
+
+    size_t size;
+    base64_decode_to(bench->encoded, bench->encoded_length, bench->decoded,
+                     BASE64_DECODED_MAX_SIZE(bench->encoded_length), &size);
+
+    bench_do_not_optimize(size);
+}
+
+static void bench_dispatch_event(void* user) {
+    struct interaction_bench* bench = user;
+    dispatch_event(bot_get_gateway(bench->bot), "INTERACTION_CREATE", bench->data);
+}
+
+static void bench_command_invoke(void* user) {
+    struct interaction_bench* bench = user;
+    command_invoke(bench->cmd, &bench->parsed);
+}
+
+static void bench_ring_handoff(void* user) {
+    struct ring_bench* bench = user;
+    shm_ring_push(bench->ring, bench->message, bench->size);
+
+    size_t size;
+    shm_ring_pop(bench->ring, bench->buffer, &size, 0);
+    bench_do_not_optimize(size);
+}
+
+static size_t next_status(struct status_bench* bench) {
+    size_t index = bench->next;
+    bench->next = index + 1 < bench->count ? index + 1 : 0;
+
+    return index;
+}
+
+static void bench_status_encode(void* user) {
+    struct status_bench* bench = user;
+
+    size_t size;
+    uint8_t* record = status_encode(&bench->statuses[next_status(bench)], &size);
+
+    bench_do_not_optimize(record);
+    nv_free(record);
+}
+
+static void bench_status_decode(void* user) {
+    struct status_bench* bench = user;
+    size_t index = next_status(bench);
+
+    struct status status;
+    if (status_decode(bench->records[index], bench->sizes[index], &status)) {
+        status_cleanup(&status);
+    }
+}
+
+static size_t next_key(struct map_bench* bench) {
+    size_t index = bench->next;
+    bench->next = index + 1 < bench->count ? index + 1 : 0;
+
+    return index;
+}
+
+static void bench_nv_map_get_id(void* user) {
+    struct map_bench* bench = user;
+
+    void* value = NULL;
+    nv_map_get(bench->nv, &bench->ids[next_key(bench)], &value);
+
+    bench_do_not_optimize(value);
+}
+
+static void bench_hashmap_get_id(void* user) {
+    struct map_bench* bench = user;
+
+    void** value = bench_id_map_get(&bench->id_map, bench->ids[next_key(bench)]);
+    bench_do_not_optimize(value);
+}
+
+static void bench_nv_map_get_pointer(void* user) {
+    struct map_bench* bench = user;
+
+    void* value = NULL;
+    nv_map_get(bench->nv, bench->pointers[next_key(bench)], &value);
+
+    bench_do_not_optimize(value);
+}
+
+static void bench_hashmap_get_pointer(void* user) {
+    struct map_bench* bench = user;
+
+    void** value = bench_ptr_map_get(&bench->ptr_map, bench->pointers[next_key(bench)]);
+    bench_do_not_optimize(value);
+}
+
+/* a request finishing and another starting, as rest_poll and rest_send do */
+static void bench_nv_map_churn_pointer(void* user) {
+    struct map_bench* bench = user;
+    void* key = bench->pointers[next_key(bench)];
+
+    nv_map_remove(bench->nv, key);
+    nv_map_insert(bench->nv, key, key);
+}
+
+static void bench_hashmap_churn_pointer(void* user) {
+    struct map_bench* bench = user;
+    void* key = bench->pointers[next_key(bench)];
+
+    bench_ptr_map_remove(&bench->ptr_map, key, NULL);
+    bench_ptr_map_insert(&bench->ptr_map, key, key);
+}
+
+static void bench_nv_map_get_string(void* user) {
+    struct map_bench* bench = user;
+
+    void* value = NULL;
+    nv_map_get(bench->nv, bench->lookup_names[next_key(bench)], &value);
+
+    bench_do_not_optimize(value);
+}
+
+static void bench_hashmap_get_string(void* user) {
+    struct map_bench* bench = user;
+
+    void** value = bench_str_map_get(&bench->str_map, bench->lookup_names[next_key(bench)]);
+    bench_do_not_optimize(value);
+}
+
+static size_t hash_boxed_id(void* user, const void* key) { return *(const uint64_t*)key; }
+
+static bool boxed_ids_equal(void* user, const void* lhs, const void* rhs) {
+    return *(const uint64_t*)lhs == *(const uint64_t*)rhs;
+}
+
+static size_t hash_string_key(void* user, const void* key) { return nv_hash_string(key); }
+
+static bool string_keys_equal(void* user, const void* lhs, const void* rhs) {
+    return strcmp(lhs, rhs) == 0;
+}
+
+static void noop_interaction(const struct bot_context* context, const struct interaction* event) {}
+
+static void noop_command(const struct command_invocation_context* context) {}
+
+static void init_buffer_bench(struct buffer_bench* bench, size_t size) {
+    bench->size = size;
+    bench->data = nv_alloc(size);
+    assert(bench->data);
+
+    /* arbitrary but fixed so runs are comparable */
+    uint32_t state = 0x9e3779b9;
+    for (size_t i = 0; i < size; i++) {
+        state = state * 1664525 + 1013904223;
+        bench->data[i] = (uint8_t)(state >> 24);
+    }
+
+    bench->encoded = nv_alloc(BASE64_ENCODED_LENGTH(size) + 1);
+    assert(bench->encoded);
+    bench->encoded_length = base64_encode_to(bench->data, size, bench->encoded);
+
+    bench->decoded = nv_alloc(BASE64_DECODED_MAX_SIZE(bench->encoded_length));
+    assert(bench->decoded);
+}
+
+static void cleanup_buffer_bench(const struct buffer_bench* bench) {
+    nv_free(bench->data);
+    nv_free(bench->encoded);
+    nv_free(bench->decoded);
+}
+
+static void run_parse_benches(bench_suite_t* suite, const struct fixtures* fixtures) {
+    struct interaction_bench command;
+    command.data = fixtures->command_interaction;
+
+    struct interaction_bench component;
+    component.data = fixtures->component_interaction;
+
+    struct bench_case benches[] = {
+        { "interaction_parse/command", bench_interaction_parse, &command, 0 },
+        { "interaction_parse/component", bench_interaction_parse, &component, 0 },
+        { "user_parse", bench_user_parse, fixtures->user, 0 },
+        { "snowflake_parse", bench_snowflake_parse, fixtures->snowflake, 0 },
+    };
+
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        bench_suite_run(suite, &benches[i]);
+    }
+}
+
+static void run_component_benches(bench_suite_t* suite) {
+    struct component buttons[5];
+    memset(buttons, 0, sizeof(buttons));
+
+    static const char* labels[] = { "one", "two", "three", "four", "five" };
+    for (size_t i = 0; i < 5; i++) {
+        buttons[i].type = COMPONENT_TYPE_BUTTON;
+        buttons[i].button.style = BUTTON_STYLE_SECONDARY;
+        buttons[i].button.label = labels[i];
+        buttons[i].button.route = (uint8_t)(i + 1);
+        buttons[i].button.data = labels[i];
+        buttons[i].button.data_size = strlen(labels[i]);
+    }
+
+    struct component row;
+    memset(&row, 0, sizeof(struct component));
+    row.type = COMPONENT_TYPE_ACTION_ROW;
+    row.action_row.num_children = 5;
+    row.action_row.children = buttons;
+
+    struct component text;
+    memset(&text, 0, sizeof(struct component));
+    text.type = COMPONENT_TYPE_TEXT_DISPLAY;
+    text.text_display.content = "nelly is working on the backlog";
+
+    struct bench_case benches[] = {
+        { "component_serialize/text_display", bench_component_serialize, &text, 0 },
+        { "component_serialize/action_row", bench_component_serialize, &row, 0 },
+    };
+
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        bench_suite_run(suite, &benches[i]);
+    }
+}
+
+/* the standard alphabet, which decoding accepts as well as the url one encoding produces */
+static void to_standard_alphabet(char* encoded, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (encoded[i] == '-') {
+            encoded[i] = '+';
+        } else if (encoded[i] == '_') {
+            encoded[i] = '/';
+        }
+    }
+}
+
+static bool check_base64_round_trip(const char* implementation, const uint8_t* data, size_t size,
+                                    const char* reference, size_t reference_length) {
+    char encoded[BASE64_ENCODED_LENGTH(BASE64_VERIFY_MAX_SIZE) + 1];
+    uint8_t decoded[BASE64_VERIFY_MAX_SIZE];
+
+    size_t length = base64_encode_to(data, size, encoded);
+    if (length != reference_length || memcmp(encoded, reference, length) != 0) {
+        log_error("base64 %s encoding of %zu bytes differs from scalar", implementation, size);
+        return false;
+    }
+
+    for (int alphabet = 0; alphabet < 2; alphabet++) {
+        size_t decoded_size;
+        if (!base64_decode_to(encoded, length, decoded, sizeof(decoded), &decoded_size) ||
+            decoded_size != size || memcmp(decoded, data, size) != 0) {
+            log_error("base64 %s round trip of %zu bytes (%s alphabet) failed", implementation,
+                      size, alphabet == 0 ? "url" : "standard");
+
+            return false;
+        }
+
+        to_standard_alphabet(encoded, length);
+    }
+
+    return true;
+}
+
+/* every kernel the cpu can run has to match the scalar code exactly; a benchmark of a wrong
+ * kernel means nothing */
+static bool verify_base64() {
+    static const char* implementations[] = { "scalar", "sse4.1", "avx2" };
+    const char* selected = base64_get_implementation();
+
+    const char* runnable[sizeof(implementations) / sizeof(implementations[0])];
+    size_t num_runnable = 0;
+
+    char names[64] = "";
+    size_t names_length = 0;
+
+    for (size_t i = 0; i < sizeof(implementations) / sizeof(implementations[0]); i++) {
+        if (base64_set_implementation(implementations[i])) {
+            runnable[num_runnable++] = implementations[i];
+            names_length += (size_t)snprintf(names + names_length, sizeof(names) - names_length,
+                                             "%s%s", names_length ? ", " : "", implementations[i]);
+        }
+    }
+
+    uint8_t data[BASE64_VERIFY_MAX_SIZE];
+    char reference[BASE64_ENCODED_LENGTH(BASE64_VERIFY_MAX_SIZE) + 1];
+
+    bool success = true;
+    uint32_t state = 0x85ebca6b;
+
+    for (size_t round = 0; round < BASE64_VERIFY_ROUNDS && success; round++) {
+        state = state * 1664525 + 1013904223;
+        size_t size = (state >> 8) % (BASE64_VERIFY_MAX_SIZE + 1);
+
+        for (size_t i = 0; i < size; i++) {
+            state = state * 1664525 + 1013904223;
+            data[i] = (uint8_t)(state >> 24);
+        }
+
+        base64_set_implementation("scalar");
+        size_t reference_length = base64_encode_to(data, size, reference);
+
+        for (size_t i = 0; i < num_runnable && success; i++) {
+            base64_set_implementation(runnable[i]);
+            success = check_base64_round_trip(runnable[i], data, size, reference,
+                                              reference_length);
+        }
+    }
+
+    base64_set_implementation(selected);
+    if (success) {
+        printf("base64 kernels match scalar over %d random lengths: %s\n", BASE64_VERIFY_ROUNDS,
+               names);
+    }
+
+    return success;
+}
+
+static void run_base64_benches(bench_suite_t* suite) {
+    bench_suite_add_info(suite, "base64_implementation", base64_get_implementation());
+
+    struct buffer_bench small, large;
+    init_buffer_bench(&small, SMALL_BUFFER_SIZE);
+    init_buffer_bench(&large, LARGE_BUFFER_SIZE);
+
+    struct bench_case benches[] = {
+        { "base64_encode/64", bench_base64_encode, &small, SMALL_BUFFER_SIZE },
+        { "base64_encode/4096", bench_base64_encode, &large, LARGE_BUFFER_SIZE },
+        { "base64_decode/64", bench_base64_decode, &small, SMALL_BUFFER_SIZE },
+        { "base64_decode/4096", bench_base64_decode, &large, LARGE_BUFFER_SIZE },
+    };
+
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        bench_suite_run(suite, &benches[i]);
+    }
+
+    cleanup_buffer_bench(&small);
+    cleanup_buffer_bench(&large);
+}
+
+static void init_map_bench(struct map_bench* bench, size_t count,
+                           const struct nv_map_callbacks* callbacks) {
+    memset(bench, 0, sizeof(struct map_bench));
+    bench->count = count;
+
+    bench->nv = nv_map_alloc(64, callbacks);
+    assert(bench->nv);
+}
+
+static void run_map_benches(bench_suite_t* suite) {
+    struct nv_map_callbacks callbacks;
+    memset(&callbacks, 0, sizeof(struct nv_map_callbacks));
+
+    /* snowflakes from one worker a few milliseconds apart, boxed for nv_map */
+    callbacks.hash = hash_boxed_id;
+    callbacks.equals = boxed_ids_equal;
+
+    struct map_bench ids;
+    init_map_bench(&ids, MAP_SNOWFLAKES, &callbacks);
+
+    ids.ids = nv_alloc(MAP_SNOWFLAKES * sizeof(uint64_t));
+    assert(ids.ids);
+
+    for (size_t i = 0; i < MAP_SNOWFLAKES; i++) {
+        ids.ids[i] = ((1300000000000ull + i * 7) << 22) | (1 << 17) | (i & 0xfff);
+
+        nv_map_insert(ids.nv, &ids.ids[i], &ids.ids[i]);
+        bench_id_map_insert(&ids.id_map, ids.ids[i], &ids.ids[i]);
+    }
+
+    /* heap pointers, like CURL handles */
+    memset(&callbacks, 0, sizeof(struct nv_map_callbacks));
+
+    struct map_bench pointers;
+    init_map_bench(&pointers, MAP_POINTERS, &callbacks);
+
+    pointers.pointers = nv_alloc(MAP_POINTERS * sizeof(void*));
+    assert(pointers.pointers);
+
+    for (size_t i = 0; i < MAP_POINTERS; i++) {
+        pointers.pointers[i] = nv_alloc(256);
+        assert(pointers.pointers[i]);
+
+        nv_map_insert(pointers.nv, pointers.pointers[i], pointers.pointers[i]);
+        bench_ptr_map_insert(&pointers.ptr_map, pointers.pointers[i], pointers.pointers[i]);
+    }
+
+    /* command names */
+    callbacks.hash = hash_string_key;
+    callbacks.equals = string_keys_equal;
+
+    struct map_bench names;
+    init_map_bench(&names, MAP_STRINGS, &callbacks);
+
+    names.names = nv_alloc(MAP_STRINGS * sizeof(char*));
+    names.lookup_names = nv_alloc(MAP_STRINGS * sizeof(char*));
+    assert(names.names && names.lookup_names);
+
+    static const char* command_names[] = { "status", "fill-form", "remind", "tasks" };
+    for (size_t i = 0; i < MAP_STRINGS; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "%s-%zu", command_names[i % 4], i);
+
+        names.names[i] = nv_strdup(name);
+        names.lookup_names[i] = nv_strdup(name);
+
+        nv_map_insert(names.nv, names.names[i], names.names[i]);
+        bench_str_map_insert(&names.str_map, names.names[i], names.names[i]);
+    }
+
+    struct bench_case benches[] = {
+        { "map_get/snowflake/nv_map", bench_nv_map_get_id, &ids, 0 },
+        { "map_get/snowflake/hashmap", bench_hashmap_get_id, &ids, 0 },
+        { "map_get/pointer/nv_map", bench_nv_map_get_pointer, &pointers, 0 },
+        { "map_get/pointer/hashmap", bench_hashmap_get_pointer, &pointers, 0 },
+        { "map_churn/pointer/nv_map", bench_nv_map_churn_pointer, &pointers, 0 },
+        { "map_churn/pointer/hashmap", bench_hashmap_churn_pointer, &pointers, 0 },
+        { "map_get/string/nv_map", bench_nv_map_get_string, &names, 0 },
+        { "map_get/string/hashmap", bench_hashmap_get_string, &names, 0 },
+    };
+
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        bench_suite_run(suite, &benches[i]);
+    }
+
+    for (size_t i = 0; i < MAP_POINTERS; i++) {
+        nv_free(pointers.pointers[i]);
+    }
+
+    for (size_t i = 0; i < MAP_STRINGS; i++) {
+        nv_free(names.names[i]);
+        nv_free(names.lookup_names[i]);
+    }
+
+    nv_free(ids.ids);
+    nv_free(pointers.pointers);
+    nv_free(names.names);
+    nv_free(names.lookup_names);
+
+    struct map_bench* maps[] = { &ids, &pointers, &names };
+    for (size_t i = 0; i < 3; i++) {
+        nv_map_free(maps[i]->nv);
+
+        bench_id_map_free(&maps[i]->id_map);
+        bench_ptr_map_free(&maps[i]->ptr_map);
+        bench_str_map_free(&maps[i]->str_map);
+    }
+}
+
+static void run_ring_benches(bench_suite_t* suite, const struct fixtures* fixtures) {
+    struct ring_bench bench;
+    bench.ring = shm_ring_create("/tasks-bench", 64, STREAM_RING_SLOT_SIZE);
+
+    if (!bench.ring) {
+        log_error("failed to create shared memory ring; skipping ring benchmarks");
+        return;
+    }
+
+    bench.message = json_object_to_json_string_length(fixtures->command_interaction,
+                                                      JSON_C_TO_STRING_PLAIN, &bench.size);
+
+    bench.buffer = nv_alloc(shm_ring_get_max_size(bench.ring));
+    assert(bench.buffer);
+
+    struct bench_case handoff = { "shm_ring/handoff/interaction", bench_ring_handoff, &bench,
+                                  bench.size };
+
+    bench_suite_run(suite, &handoff);
+
+    nv_free(bench.buffer);
+    shm_ring_close(bench.ring);
+}
+
+static char* dup_status_field(const json_object* status, const char* name) {
+    json_object* field = json_object_object_get(status, name);
+    return nv_strdup(field ? json_object_get_string(field) : "");
+}
+
+static void init_status_bench(struct status_bench* bench, const json_object* statuses) {
+    memset(bench, 0, sizeof(struct status_bench));
+    bench->count = json_object_array_length(statuses);
+
+    bench->statuses = nv_alloc(bench->count * sizeof(struct status));
+    bench->records = nv_calloc(bench->count, sizeof(uint8_t*));
+    bench->sizes = nv_alloc(bench->count * sizeof(size_t));
+    assert(bench->statuses && bench->records && bench->sizes);
+
+    for (size_t i = 0; i < bench->count; i++) {
+        const json_object* status = json_object_array_get_idx(statuses, i);
+
+        bench->statuses[i].display_name = dup_status_field(status, "display_name");
+        bench->statuses[i].status_description = dup_status_field(status, "status_description");
+        bench->statuses[i].current_thought = dup_status_field(status, "current_thought");
+    }
+}
+
+/* with the current compressor. returns the mean record size */
+static double encode_status_records(struct status_bench* bench) {
+    size_t total = 0;
+    for (size_t i = 0; i < bench->count; i++) {
+        nv_free(bench->records[i]);
+
+        bench->records[i] = status_encode(&bench->statuses[i], &bench->sizes[i]);
+        total += bench->sizes[i];
+    }
+
+    return (double)total / (double)bench->count;
+}
+
+static void cleanup_status_bench(const struct status_bench* bench) {
+    for (size_t i = 0; i < bench->count; i++) {
+        status_cleanup(&bench->statuses[i]);
+        nv_free(bench->records[i]);
+    }
+
+    nv_free(bench->statuses);
+    nv_free(bench->records);
+    nv_free(bench->sizes);
+}
+
+/* a dictionary trained on the fixture's own uncompressed payloads, as train-status-dict would */
+static compressor_t* create_status_compressor(const struct status_bench* bench) {
+    struct record_writer samples;
+    record_writer_init(&samples, 4096);
+
+    size_t* sample_sizes = nv_alloc(bench->count * sizeof(size_t));
+    assert(sample_sizes);
+
+    for (size_t i = 0; i < bench->count; i++) {
+        record_write_raw(&samples, bench->records[i] + 1, bench->sizes[i] - 1);
+        sample_sizes[i] = bench->sizes[i] - 1;
+    }
+
+    void* dictionary = nv_alloc(STATUS_DICTIONARY_SIZE);
+    assert(dictionary);
+
+    size_t size = compress_train_dictionary(dictionary, STATUS_DICTIONARY_SIZE, samples.data,
+                                            sample_sizes, bench->count);
+
+    compressor_t* comp = size > 0 ? compressor_create(dictionary, size, 0) : NULL;
+
+    nv_free(dictionary);
+    nv_free(sample_sizes);
+    record_writer_cleanup(&samples);
+
+    return comp;
+}
+
+/* the sizes are what the status benchmarks are for; the timings show what each step costs */
+static void run_status_benches(bench_suite_t* suite, const struct fixtures* fixtures) {
+    struct status_bench bench;
+    init_status_bench(&bench, fixtures->statuses);
+
+    if (bench.count == 0) {
+        log_error("no statuses in the fixture; skipping status benchmarks");
+
+        cleanup_status_bench(&bench);
+        return;
+    }
+
+    /* the legacy hash stores each field's name next to its value */
+    size_t raw_total = 0;
+    for (size_t i = 0; i < bench.count; i++) {
+        const struct status* status = &bench.statuses[i];
+
+        raw_total += strlen("display") + strlen(status->display_name);
+        raw_total += strlen("status") + strlen(status->status_description);
+        raw_total += strlen("thought") + strlen(status->current_thought);
+    }
+
+    double raw = (double)raw_total / (double)bench.count;
+    double varint = encode_status_records(&bench);
+
+    struct bench_case varint_benches[] = {
+        { "status_encode/varint", bench_status_encode, &bench, 0 },
+        { "status_decode/varint", bench_status_decode, &bench, 0 },
+    };
+
+    bool ran = false;
+    for (size_t i = 0; i < sizeof(varint_benches) / sizeof(varint_benches[0]); i++) {
+        ran |= bench_suite_run(suite, &varint_benches[i]);
+    }
+
+    char line[256];
+    int length = snprintf(line, sizeof(line), "status bytes per record (%zu records): raw %.1f, "
+                                              "varint %.1f", bench.count, raw, varint);
+
+    compressor_t* comp = compress_available() ? create_status_compressor(&bench) : NULL;
+    if (comp) {
+        status_set_compressor(comp);
+        double compressed = encode_status_records(&bench);
+
+        struct bench_case zstd_benches[] = {
+            { "status_encode/zstd_dict", bench_status_encode, &bench, 0 },
+            { "status_decode/zstd_dict", bench_status_decode, &bench, 0 },
+        };
+
+        for (size_t i = 0; i < sizeof(zstd_benches) / sizeof(zstd_benches[0]); i++) {
+            ran |= bench_suite_run(suite, &zstd_benches[i]);
+        }
+
+        snprintf(line + length, sizeof(line) - (size_t)length, ", zstd with dictionary %.1f",
+                 compressed);
+
+        status_set_compressor(NULL);
+        compressor_free(comp);
+    } else {
+        snprintf(line + length, sizeof(line) - (size_t)length, ", zstd unavailable");
+    }
+
+    if (ran) {
+        printf("%s\n", line);
+        bench_suite_add_info(suite, "status_record_size", line);
+    }
+
+    cleanup_status_bench(&bench);
+}
+
+static void run_bot_benches(bench_suite_t* suite, const struct fixtures* fixtures) {
+    struct credentials creds;
+    memset(&creds, 0, sizeof(struct credentials));
+    creds.token = "offline";
+    creds.app_id = FIXTURE_APP_ID;
+
+    struct bot_callbacks callbacks;
+    memset(&callbacks, 0, sizeof(struct bot_callbacks));
+    callbacks.on_interaction = noop_interaction;
+
+    struct bot_spec spec;
+    memset(&spec, 0, sizeof(struct bot_spec));
+    spec.creds = &creds;
+    spec.callbacks = &callbacks;
+    spec.offline = true;
+
+    struct interaction_bench bench;
+    memset(&bench, 0, sizeof(struct interaction_bench));
+    bench.data = fixtures->command_interaction;
+
+    bench.bot = bot_create(&spec);
+    if (!bench.bot) {
+        log_error("failed to create offline bot; skipping dispatch and command benchmarks");
+        return;
+    }
+
+    struct command_spec cmd_spec;
+    memset(&cmd_spec, 0, sizeof(struct command_spec));
+    cmd_spec.bot = bench.bot;
+    cmd_spec.callback = noop_command;
+    cmd_spec.name = "status";
+    cmd_spec.type = COMMAND_TYPE_CHAT_INPUT;
+
+    /* first, so the fixture's command name resolves to it */
+    bench.cmd = command_create(&cmd_spec);
+
+    if (!interaction_parse(&bench.parsed, bench.data)) {
+        log_error("failed to parse command fixture; skipping dispatch and command benchmarks");
+
+        command_free(bench.cmd);
+        bot_destroy(bench.bot);
+        return;
+    }
+
+    struct bench_case benches[] = {
+        { "dispatch_event/interaction_create", bench_dispatch_event, &bench, 0 },
+        { "command_invoke/options", bench_command_invoke, &bench, 0 },
+    };
+
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        bench_suite_run(suite, &benches[i]);
+    }
+
+    interaction_cleanup(&bench.parsed);
+    command_free(bench.cmd);
+    bot_destroy(bench.bot);
+}
+
+static void print_usage(const char* program) {
+    fprintf(stderr, "usage: %s [--filter <substring>] [--time <ms>] [--json <path>]\n", program);
+}
+
+int main(int argc, const char** argv) {
+    struct bench_options options;
+    memset(&options, 0, sizeof(struct bench_options));
+
+    const char* json_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--json") == 0 && value) {
+            json_path = value;
+        } else if (strcmp(arg, "--filter") == 0 && value) {
+            options.filter = value;
+        } else if (strcmp(arg, "--time") == 0 && value) {
+            options.measure_ns = strtoull(value, NULL, 10) * 1000 * 1000;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+
+        i++;
+    }
+
+    /* the code under test logs on every call at trace level */
+    log_set_level(LOG_WARN);
+
+    /* no redis; every payload here fits inline */
+    custom_id_init(NULL, 0, 0);
+
+    struct fixtures fixtures;
+    load_fixtures(&fixtures);
+
+    /* before anything is timed, so a broken kernel fails the run instead of looking fast */
+    if (!verify_base64()) {
+        free_fixtures(&fixtures);
+        custom_id_shutdown();
+
+        return 1;
+    }
+
+    bench_suite_t* suite = bench_suite_create(&options);
+
+    run_parse_benches(suite, &fixtures);
+    run_component_benches(suite);
+    run_base64_benches(suite);
+    run_map_benches(suite);
+    run_ring_benches(suite, &fixtures);
+    run_status_benches(suite, &fixtures);
+    run_bot_benches(suite, &fixtures);
+
+    int status = 0;
+    if (json_path) {
+        if (bench_suite_write_json(suite, json_path)) {
+            printf("wrote %zu results to %s\n", bench_suite_get_num_results(suite), json_path);
+        } else {
+            log_error("failed to write results to %s", json_path);
+            status = 1;
+        }
+    }
+
+    bench_suite_free(suite);
+    free_fixtures(&fixtures);
+    custom_id_shutdown();
+
+    return status;
+}
@@ -0,0 +1,858 @@
+#include "log.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+
+/* bytes per thread; a power of two. when it is full, records below warn are dropped and counted */
+#define RING_SIZE (256 * 1024)
+
+/* largest encoded record; long string arguments are truncated to fit */
+#define MAX_RECORD_SIZE (16 * 1024)
+
+/* largest formatted line */
+#define MAX_LINE_LENGTH (16 * 1024)
+
+/* output is written in chunks this large, or whenever the rings run dry */
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+/* the writer sleeps at most this long when nothing wakes it */
+#define IDLE_WAIT_MS 100
+
+#define ALIGN(x) (((x) + 7) & ~(size_t)7)
+
+volatile int log_runtime_level = LOG_LEVEL_TRACE;
+static atomic_bool quiet = false;
+
+struct record_header {
+    /* of the whole record, aligned. 0 marks padding up to the end of the ring */
+    uint32_t size;
+    int32_t level;
+    int32_t line;
+    uint32_t reserved;
+
+    const char* file;
+    const char* fmt;
+
+    struct timespec time;
+};
+
+/* single producer, single consumer */
+struct log_ring {
+    uint8_t* data;
+
+    /* byte counts; head is only written by the owning thread, tail only by the writer */
+    atomic_size_t head;
+    atomic_size_t tail;
+
+    atomic_uint_fast64_t dropped;
+    uint64_t dropped_reported;
+
+    struct log_ring* next;
+};
+
+enum {
+    LENGTH_NONE,
+    LENGTH_HH,
+    LENGTH_H,
+    LENGTH_L,
+    LENGTH_LL,
+    LENGTH_J,
+    LENGTH_Z,
+    LENGTH_T,
+    LENGTH_LONG_DOUBLE,
+};
+
+struct conversion {
+    /* from the '%' through the conversion character */
+    const char* start;
+    size_t length;
+
+    int length_modifier;
+    char type;
+
+    /* '*' widths and precisions, each an int argument ahead of the value */
+    int stars;
+};
+
+static pthread_once_t start_once = PTHREAD_ONCE_INIT;
+static pthread_t writer_thread;
+static atomic_bool running = false;
+
+/* guards additions to the ring list and the writer's sleep */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static atomic_bool writer_sleeping = false;
+
+/* prepended under the mutex, read without it */
+static _Atomic(struct log_ring*) rings = NULL;
+static _Thread_local struct log_ring* local_ring = NULL;
+
+static const char* level_strings[] = { "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL" };
+static const char* level_colors[] = { "\x1b[94m", "\x1b[36m", "\x1b[32m",
+                                      "\x1b[33m", "\x1b[31m", "\x1b[35m" };
+
+/* fmt points just past a '%'. returns the character after the conversion, or NULL if the format
+ * is malformed or uses something unsupported */
+static const char* parse_conversion(const char* fmt, struct conversion* conv) {
+    conv->start = fmt - 1;
+    conv->stars = 0;
+    conv->length_modifier = LENGTH_NONE;
+
+    while (*fmt && strchr("-+ #0'", *fmt)) {
+        fmt++;
+    }
+
+    if (*fmt == '*') {
+        conv->stars++;
+        fmt++;
+    } else {
+        while (*fmt >= '0' && *fmt <= '9') {
+            fmt++;
+        }
+    }
+
+    if (*fmt == '.') {
+        fmt++;
+
+        if (*fmt == '*') {
+            conv->stars++;
+            fmt++;
+        } else {
+            while (*fmt >= '0' && *fmt <= '9') {
+                fmt++;
+            }
+        }
+    }
+
+    switch (*fmt) {
+    case 'h':
+        fmt++;
+        conv->length_modifier = *fmt == 'h' ? LENGTH_HH : LENGTH_H;
+        fmt += conv->length_modifier == LENGTH_HH;
+        break;
+    case 'l':
+        fmt++;
+        conv->length_modifier = *fmt == 'l' ? LENGTH_LL : LENGTH_L;
+        fmt += conv->length_modifier == LENGTH_LL;
+        break;
+    case 'j':
+        conv->length_modifier = LENGTH_J;
+        fmt++;
+        break;
+    case 'z':
+        conv->length_modifier = LENGTH_Z;
+        fmt++;
+        break;
+    case 't':
+        conv->length_modifier = LENGTH_T;
+        fmt++;
+        break;
+    case 'L':
+        conv->length_modifier = LENGTH_LONG_DOUBLE;
+        fmt++;
+        break;
+    }
+
+    conv->type = *fmt;
+    if (!conv->type || !strchr("diouxXcsfFeEgGaAp%", conv->type)) {
+        return NULL;
+    }
+
+    /* wide characters and strings */
+    if ((conv->type == 'c' || conv->type == 's') && conv->length_modifier != LENGTH_NONE) {
+        return NULL;
+    }
+
+    fmt++;
+    conv->length = (size_t)(fmt - conv->start);
+
+    return fmt;
+}
+
+struct encoder {
+    uint8_t* data;
+    size_t size;
+};
+
+static void put_u64(struct encoder* enc, uint64_t value) {
+    if (enc->size + sizeof(value) <= MAX_RECORD_SIZE) {
+        memcpy(enc->data + enc->size, &value, sizeof(value));
+    }
+
+    enc->size += sizeof(value);
+}
+
+static void put_bytes(struct encoder* enc, const void* data, size_t size) {
+    if (enc->size + ALIGN(size) <= MAX_RECORD_SIZE) {
+        memcpy(enc->data + enc->size, data, size);
+    }
+
+    enc->size += ALIGN(size);
+}
+
+static void put_string(struct encoder* enc, const char* str) {
+    if (!str) {
+        str = "(null)";
+    }
+
+    /* length, then the string and its terminator. sizes stay multiples of 8, so this is exactly
+     * what fits */
+    size_t used = enc->size + sizeof(uint64_t);
+    size_t room = used < MAX_RECORD_SIZE ? MAX_RECORD_SIZE - used - 1 : 0;
+
+    size_t length = strlen(str);
+    if (length > room) {
+        length = room;
+    }
+
+    put_u64(enc, length);
+
+    if (enc->size + ALIGN(length + 1) <= MAX_RECORD_SIZE) {
+        memcpy(enc->data + enc->size, str, length);
+        enc->data[enc->size + length] = '\0';
+    }
+
+    enc->size += ALIGN(length + 1);
+}
+
+static int64_t get_signed(va_list* args, int length_modifier) {
+    switch (length_modifier) {
+    case LENGTH_L:
+        return va_arg(*args, long);
+    case LENGTH_LL:
+        return va_arg(*args, long long);
+    case LENGTH_J:
+        return va_arg(*args, intmax_t);
+    case LENGTH_Z:
+        return va_arg(*args, ssize_t);
+    case LENGTH_T:
+        return va_arg(*args, ptrdiff_t);
+    default:
+        /* char and short are promoted */
+        return va_arg(*args, int);
+    }
+}
+
+static uint64_t get_unsigned(va_list* args, int length_modifier) {
+    switch (length_modifier) {
+    case LENGTH_L:
+        return va_arg(*args, unsigned long);
+    case LENGTH_LL:
+        return va_arg(*args, unsigned long long);
+    case LENGTH_J:
+        return va_arg(*args, uintmax_t);
+    case LENGTH_Z:
+        return va_arg(*args, size_t);
+    case LENGTH_T:
+        return (uint64_t)va_arg(*args, ptrdiff_t);
+    default:
+        return va_arg(*args, unsigned int);
+    }
+}
+
+/* arguments in the order the format consumes them, each widened to 8 bytes; strings are copied */
+static void encode_arguments(struct encoder* enc, const char* fmt, va_list* args) {
+    while ((fmt = strchr(fmt, '%'))) {
+        struct conversion conv;
+        fmt = parse_conversion(fmt + 1, &conv);
+
+        if (!fmt) {
+            /* the writer stops at the same place and prints the rest verbatim */
+            return;
+        }
+
+        for (int i = 0; i < conv.stars; i++) {
+            put_u64(enc, (uint64_t)(int64_t)va_arg(*args, int));
+        }
+
+        switch (conv.type) {
+        case 'd':
+        case 'i':
+            put_u64(enc, (uint64_t)get_signed(args, conv.length_modifier));
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            put_u64(enc, get_unsigned(args, conv.length_modifier));
+            break;
+        case 'c':
+            put_u64(enc, (uint64_t)(int64_t)va_arg(*args, int));
+            break;
+        case 's':
+            put_string(enc, va_arg(*args, const char*));
+            break;
+        case 'p':
+            put_u64(enc, (uint64_t)(uintptr_t)va_arg(*args, void*));
+            break;
+        case '%':
+            break;
+        default:
+            if (conv.length_modifier == LENGTH_LONG_DOUBLE) {
+                long double value = va_arg(*args, long double);
+                put_bytes(enc, &value, sizeof(value));
+            } else {
+                double value = va_arg(*args, double);
+                put_bytes(enc, &value, sizeof(value));
+            }
+
+            break;
+        }
+    }
+}
+
+static void wake_writer() {
+    if (atomic_load_explicit(&writer_sleeping, memory_order_acquire)) {
+        pthread_mutex_lock(&mutex);
+        pthread_cond_signal(&wake);
+        pthread_mutex_unlock(&mutex);
+    }
+}
+
+static void* writer_main(void* arg);
+
+static void stop_writer() {
+    if (!atomic_exchange(&running, false)) {
+        return;
+    }
+
+    pthread_mutex_lock(&mutex);
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&mutex);
+
+    pthread_join(writer_thread, NULL);
+}
+
+static void start_writer() {
+    atomic_store(&running, true);
+
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0) {
+        fputs("log: failed to start writer thread\n", stderr);
+        abort();
+    }
+
+    atexit(stop_writer);
+}
+
+static struct log_ring* create_local_ring() {
+    struct log_ring* ring = calloc(1, sizeof(struct log_ring));
+    if (!ring || !(ring->data = malloc(RING_SIZE))) {
+        fputs("log: out of memory\n", stderr);
+        abort();
+    }
+
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->dropped, 0);
+
+    pthread_mutex_lock(&mutex);
+    ring->next = atomic_load_explicit(&rings, memory_order_relaxed);
+    atomic_store_explicit(&rings, ring, memory_order_release);
+    pthread_mutex_unlock(&mutex);
+
+    return ring;
+}
+
+static bool push_record(struct log_ring* ring, const uint8_t* record, size_t size) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    /* records are contiguous; skip to the start if this one would wrap */
+    size_t offset = head & (RING_SIZE - 1);
+    size_t padding = offset + size > RING_SIZE ? RING_SIZE - offset : 0;
+
+    if (head + padding + size - tail > RING_SIZE) {
+        return false;
+    }
+
+    if (padding > 0) {
+        uint32_t marker = 0;
+        memcpy(ring->data + offset, &marker, sizeof(marker));
+
+        offset = 0;
+    }
+
+    memcpy(ring->data + offset, record, size);
+    atomic_store_explicit(&ring->head, head + padding + size, memory_order_release);
+
+    return true;
+}
+
+void log_log(int level, const char* file, int line, const char* fmt, ...) {
+    pthread_once(&start_once, start_writer);
+
+    if (!local_ring) {
+        local_ring = create_local_ring();
+    }
+
+    static _Thread_local uint8_t record[MAX_RECORD_SIZE];
+
+    struct record_header header;
+    memset(&header, 0, sizeof(header));
+
+    header.level = level;
+    header.line = line;
+    header.file = file;
+    header.fmt = fmt;
+    clock_gettime(CLOCK_REALTIME, &header.time);
+
+    struct encoder enc;
+    enc.data = record;
+    enc.size = sizeof(header);
+
+    va_list args;
+    va_start(args, fmt);
+    encode_arguments(&enc, fmt, &args);
+    va_end(args);
+
+    if (enc.size > MAX_RECORD_SIZE) {
+        /* only possible with a great many arguments */
+        atomic_fetch_add_explicit(&local_ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    header.size = (uint32_t)enc.size;
+    memcpy(record, &header, sizeof(header));
+
+    /* warnings and worse wait for room rather than vanish */
+    struct timespec pause = { 0, 100000 };
+    while (!push_record(local_ring, record, enc.size)) {
+        if (level < LOG_LEVEL_WARN || !atomic_load(&running)) {
+            atomic_fetch_add_explicit(&local_ring->dropped, 1, memory_order_relaxed);
+            return;
+        }
+
+        wake_writer();
+        nanosleep(&pause, NULL);
+    }
+
+    if (level >= LOG_LEVEL_FATAL) {
+        log_flush();
+    } else {
+        wake_writer();
+    }
+}
+
+void log_set_level(int level) { log_runtime_level = level; }
+void log_set_quiet(bool enable) { atomic_store(&quiet, enable); }
+
+void log_flush() {
+    if (!atomic_load(&running)) {
+        return;
+    }
+
+    /* rings are never freed, and new ones hold nothing logged before this call */
+    struct log_ring* first = atomic_load_explicit(&rings, memory_order_acquire);
+
+    size_t count = 0;
+    for (struct log_ring* ring = first; ring; ring = ring->next) {
+        count++;
+    }
+
+    size_t* targets = malloc((count > 0 ? count : 1) * sizeof(size_t));
+    if (!targets) {
+        return;
+    }
+
+    size_t i = 0;
+    for (struct log_ring* ring = first; ring; ring = ring->next) {
+        targets[i++] = atomic_load_explicit(&ring->head, memory_order_acquire);
+    }
+
+    pthread_mutex_lock(&mutex);
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&mutex);
+
+    struct timespec pause = { 0, 1000000 };
+    for (bool done = false; !done && atomic_load(&running);) {
+        done = true;
+        i = 0;
+
+        for (struct log_ring* ring = first; ring && i < count; ring = ring->next) {
+            if (atomic_load_explicit(&ring->tail, memory_order_acquire) < targets[i++]) {
+                done = false;
+            }
+        }
+
+        if (!done) {
+            wake_writer();
+            nanosleep(&pause, NULL);
+        }
+    }
+
+    free(targets);
+}
+
+struct output {
+    char data[OUTPUT_BUFFER_SIZE];
+    size_t size;
+    bool color;
+};
+
+static void flush_output(struct output* out) {
+    size_t written = 0;
+    while (written < out->size) {
+        ssize_t result = write(STDERR_FILENO, out->data + written, out->size - written);
+        if (result <= 0) {
+            break;
+        }
+
+        written += (size_t)result;
+    }
+
+    out->size = 0;
+}
+
+static void write_output(struct output* out, const char* data, size_t size) {
+    if (out->size + size > OUTPUT_BUFFER_SIZE) {
+        flush_output(out);
+    }
+
+    if (size > OUTPUT_BUFFER_SIZE) {
+        size = OUTPUT_BUFFER_SIZE;
+    }
+
+    memcpy(out->data + out->size, data, size);
+    out->size += size;
+}
+
+struct decoder {
+    const uint8_t* data;
+    size_t offset, size;
+};
+
+static uint64_t get_u64(struct decoder* dec) {
+    uint64_t value = 0;
+    if (dec->offset + sizeof(value) <= dec->size) {
+        memcpy(&value, dec->data + dec->offset, sizeof(value));
+    }
+
+    dec->offset += sizeof(value);
+    return value;
+}
+
+static void get_bytes(struct decoder* dec, void* data, size_t size) {
+    if (dec->offset + size <= dec->size) {
+        memcpy(data, dec->data + dec->offset, size);
+    } else {
+        memset(data, 0, size);
+    }
+
+    dec->offset += ALIGN(size);
+}
+
+static const char* get_string(struct decoder* dec) {
+    uint64_t length = get_u64(dec);
+    if (dec->offset + length + 1 > dec->size) {
+        return "";
+    }
+
+    const char* str = (const char*)dec->data + dec->offset;
+    dec->offset += ALIGN(length + 1);
+
+    return str;
+}
+
+/* the conversion with each '*' replaced by its argument */
+static void copy_conversion(const struct conversion* conv, struct decoder* dec, char* spec,
+                            size_t capacity) {
+    size_t length = 0;
+    for (size_t i = 0; i < conv->length && length + 12 < capacity; i++) {
+        if (conv->start[i] == '*') {
+            length += (size_t)snprintf(spec + length, capacity - length, "%d",
+                                       (int)(int64_t)get_u64(dec));
+        } else {
+            spec[length++] = conv->start[i];
+        }
+    }
+
+    spec[length] = '\0';
+}
+
+static int format_value(char* dst, size_t capacity, const char* spec,
+                        const struct conversion* conv, struct decoder* dec) {
+    switch (conv->type) {
+    case 'd':
+    case 'i': {
+        int64_t value = (int64_t)get_u64(dec);
+        switch (conv->length_modifier) {
+        case LENGTH_L:
+            return snprintf(dst, capacity, spec, (long)value);
+        case LENGTH_LL:
+            return snprintf(dst, capacity, spec, (long long)value);
+        case LENGTH_J:
+            return snprintf(dst, capacity, spec, (intmax_t)value);
+        case LENGTH_Z:
+            return snprintf(dst, capacity, spec, (ssize_t)value);
+        case LENGTH_T:
+            return snprintf(dst, capacity, spec, (ptrdiff_t)value);
+        default:
+            return snprintf(dst, capacity, spec, (int)value);
+        }
+    }
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X': {
+        uint64_t value = get_u64(dec);
+        switch (conv->length_modifier) {
+        case LENGTH_L:
+            return snprintf(dst, capacity, spec, (unsigned long)value);
+        case LENGTH_LL:
+            return snprintf(dst, capacity, spec, (unsigned long long)value);
+        case LENGTH_J:
+            return snprintf(dst, capacity, spec, (uintmax_t)value);
+        case LENGTH_Z:
+            return snprintf(dst, capacity, spec, (size_t)value);
+        case LENGTH_T:
+            return snprintf(dst, capacity, spec, (ptrdiff_t)value);
+        default:
+            return snprintf(dst, capacity, spec, (unsigned int)value);
+        }
+    }
+    case 'c':
+        return snprintf(dst, capacity, spec, (int)(int64_t)get_u64(dec));
+    case 's':
+        return snprintf(dst, capacity, spec, get_string(dec));
+    case 'p':
+        return snprintf(dst, capacity, spec, (void*)(uintptr_t)get_u64(dec));
+    case '%':
+        return snprintf(dst, capacity, "%%");
+    default:
+        if (conv->length_modifier == LENGTH_LONG_DOUBLE) {
+            long double value;
+            get_bytes(dec, &value, sizeof(value));
+
+            return snprintf(dst, capacity, spec, value);
+        } else {
+            double value;
+            get_bytes(dec, &value, sizeof(value));
+
+            return snprintf(dst, capacity, spec, value);
+        }
+    }
+}
+
+static size_t format_message(char* dst, size_t capacity, const char* fmt, struct decoder* dec) {
+    size_t length = 0;
+
+    while (*fmt && length + 1 < capacity) {
+        const char* percent = strchr(fmt, '%');
+        size_t literal = percent ? (size_t)(percent - fmt) : strlen(fmt);
+
+        if (literal > capacity - 1 - length) {
+            literal = capacity - 1 - length;
+        }
+
+        memcpy(dst + length, fmt, literal);
+        length += literal;
+        fmt += literal;
+
+        if (!percent || fmt != percent) {
+            break;
+        }
+
+        struct conversion conv;
+        const char* next = parse_conversion(fmt + 1, &conv);
+
+        if (!next) {
+            /* unsupported; print the remainder as is */
+            size_t rest = strlen(fmt);
+            if (rest > capacity - 1 - length) {
+                rest = capacity - 1 - length;
+            }
+
+            memcpy(dst + length, fmt, rest);
+            length += rest;
+            break;
+        }
+
+        char spec[64];
+        copy_conversion(&conv, dec, spec, sizeof(spec));
+
+        int written = format_value(dst + length, capacity - length, spec, &conv, dec);
+        if (written > 0) {
+            length += (size_t)written < capacity - length ? (size_t)written : capacity - 1 - length;
+        }
+
+        fmt = next;
+    }
+
+    dst[length] = '\0';
+    return length;
+}
+
+static void write_record(struct output* out, const struct record_header* header,
+                         const uint8_t* record) {
+    if (atomic_load_explicit(&quiet, memory_order_relaxed)) {
+        return;
+    }
+
+    static char line[MAX_LINE_LENGTH];
+
+    struct tm tm;
+    localtime_r(&header->time.tv_sec, &tm);
+
+    char time_string[16];
+    strftime(time_string, sizeof(time_string), "%H:%M:%S", &tm);
+
+    int level = header->level >= 0 && header->level <= LOG_LEVEL_FATAL ? header->level : 0;
+    int length;
+
+    if (out->color) {
+        length = snprintf(line, sizeof(line), "%s.%03ld %s%-5s\x1b[0m \x1b[90m%s:%d:\x1b[0m ",
+                          time_string, header->time.tv_nsec / 1000000, level_colors[level],
+                          level_strings[level], header->file, header->line);
+    } else {
+        length = snprintf(line, sizeof(line), "%s.%03ld %-5s %s:%d: ", time_string,
+                          header->time.tv_nsec / 1000000, level_strings[level], header->file,
+                          header->line);
+    }
+
+    if (length < 0 || (size_t)length >= sizeof(line)) {
+        length = 0;
+    }
+
+    struct decoder dec;
+    dec.data = record;
+    dec.offset = sizeof(struct record_header);
+    dec.size = header->size;
+
+    /* room for the newline */
+    size_t total = (size_t)length;
+    total += format_message(line + total, sizeof(line) - total - 1, header->fmt, &dec);
+    line[total++] = '\n';
+
+    write_output(out, line, total);
+}
+
+/* the next record in ring, skipping padding; NULL if it is empty */
+static const struct record_header* peek_record(struct log_ring* ring) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (tail == head) {
+        return NULL;
+    }
+
+    size_t offset = tail & (RING_SIZE - 1);
+
+    uint32_t size;
+    memcpy(&size, ring->data + offset, sizeof(size));
+
+    if (size == 0) {
+        tail += RING_SIZE - offset;
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+        if (tail == head) {
+            return NULL;
+        }
+
+        offset = 0;
+    }
+
+    return (const struct record_header*)(ring->data + offset);
+}
+
+static bool is_earlier(const struct timespec* lhs, const struct timespec* rhs) {
+    return lhs->tv_sec < rhs->tv_sec || (lhs->tv_sec == rhs->tv_sec && lhs->tv_nsec < rhs->tv_nsec);
+}
+
+static void report_dropped(struct output* out, struct log_ring* first) {
+    for (struct log_ring* ring = first; ring; ring = ring->next) {
+        uint64_t dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+        if (dropped == ring->dropped_reported) {
+            continue;
+        }
+
+        char line[128];
+        int length = snprintf(line, sizeof(line), "log: dropped %llu records; ring was full\n",
+                              (unsigned long long)(dropped - ring->dropped_reported));
+
+        write_output(out, line, (size_t)length);
+        ring->dropped_reported = dropped;
+    }
+}
+
+/* writes records from every ring, oldest first. returns how many */
+static size_t drain(struct output* out) {
+    size_t count = 0;
+    while (true) {
+        /* again each time, in case a thread logged for the first time */
+        struct log_ring* first = atomic_load_explicit(&rings, memory_order_acquire);
+        struct log_ring* oldest = NULL;
+        const struct record_header* oldest_header = NULL;
+
+        for (struct log_ring* ring = first; ring; ring = ring->next) {
+            const struct record_header* header = peek_record(ring);
+            if (header && (!oldest_header || is_earlier(&header->time, &oldest_header->time))) {
+                oldest = ring;
+                oldest_header = header;
+            }
+        }
+
+        if (!oldest) {
+            break;
+        }
+
+        write_record(out, oldest_header, (const uint8_t*)oldest_header);
+
+        /* peek_record already moved tail past any padding */
+        size_t tail = atomic_load_explicit(&oldest->tail, memory_order_relaxed);
+        atomic_store_explicit(&oldest->tail, tail + oldest_header->size, memory_order_release);
+
+        count++;
+    }
+
+    report_dropped(out, atomic_load_explicit(&rings, memory_order_acquire));
+    flush_output(out);
+
+    return count;
+}
+
+static void* writer_main(void* arg) {
+    static struct output out;
+    out.size = 0;
+    out.color = isatty(STDERR_FILENO);
+
+    while (true) {
+        if (drain(&out) > 0) {
+            continue;
+        }
+
+        if (!atomic_load(&running)) {
+            break;
+        }
+
+        pthread_mutex_lock(&mutex);
+        atomic_store_explicit(&writer_sleeping, true, memory_order_release);
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+
+        deadline.tv_nsec += IDLE_WAIT_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+
+        if (atomic_load(&running)) {
+            pthread_cond_timedwait(&wake, &mutex, &deadline);
+        }
+
+        atomic_store_explicit(&writer_sleeping, false, memory_order_relaxed);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    /* anything logged while stopping */
+    drain(&out);
+    return NULL;
+}
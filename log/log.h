@@ -0,0 +1,68 @@
+#ifndef _LOG_H
+#define _LOG_H
+
+/* rxi/log.c pulled these in, and code written against it relies on that */
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+/* asynchronous logging. a call copies its format pointer and arguments into a ring owned by the
+ * calling thread and returns; a background thread formats records and writes them to stderr.
+ * strings are copied, so arguments may be freed as soon as the call returns.
+ *
+ * levels below LOG_COMPILE_LEVEL compile to dead code, so their arguments are never evaluated.
+ * levels below the runtime level are checked before the arguments are evaluated. the interface
+ * matches rxi/log.c, which this replaced */
+
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARN 3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_FATAL 5
+
+enum {
+    LOG_TRACE = LOG_LEVEL_TRACE,
+    LOG_DEBUG = LOG_LEVEL_DEBUG,
+    LOG_INFO = LOG_LEVEL_INFO,
+    LOG_WARN = LOG_LEVEL_WARN,
+    LOG_ERROR = LOG_LEVEL_ERROR,
+    LOG_FATAL = LOG_LEVEL_FATAL,
+};
+
+/* set by the build (TASKS_LOG_LEVEL) */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_TRACE
+#endif
+
+/* private; read by the macros below */
+extern volatile int log_runtime_level;
+
+#define LOG_AT(level, ...)                                                                         \
+    do {                                                                                           \
+        if ((level) >= LOG_COMPILE_LEVEL && (level) >= log_runtime_level) {                        \
+            log_log((level), __FILE__, __LINE__, __VA_ARGS__);                                     \
+        }                                                                                          \
+    } while (0)
+
+#define log_trace(...) LOG_AT(LOG_LEVEL_TRACE, __VA_ARGS__)
+#define log_debug(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define log_info(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_warn(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_error(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define log_fatal(...) LOG_AT(LOG_LEVEL_FATAL, __VA_ARGS__)
+
+/* fmt is a printf format without %n or wide strings. fmt and file are kept by pointer, so they
+ * must be string literals */
+void log_log(int level, const char* file, int line, const char* fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+void log_set_level(int level);
+void log_set_quiet(bool enable);
+
+/* blocks until everything logged before the call has been written. fatal records flush on their
+ * own, as does process exit */
+void log_flush();
+
+#endif
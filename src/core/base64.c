@@ -4,143 +4,447 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
+
+#include <log.h>
 
 #include <nyoravim/mem.h>
 
-/* im using http encoding just to be safe */
+#if defined(__x86_64__) || defined(__i386__)
+#define BASE64_X86
+#include <immintrin.h>
+#endif
+
+/* im using http encoding just to be safe. decoding accepts both alphabets */
+
+static const char encode_table[64] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                     "abcdefghijklmnopqrstuvwxyz"
+                                     "0123456789-_";
+
+/* 0xFF marks characters outside of either alphabet */
+static const uint8_t decode_table[256] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0x3E, 0xFF, 0x3F,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+    0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0x3F,
+    0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+/* block kernels only handle whole blocks and return how much input they consumed (a multiple of
+ * 3 bytes or 4 characters). the scalar code finishes whatever is left, so a decode kernel simply
+ * stops at the first block with an invalid character and lets the scalar path report it */
+typedef size_t (*encode_kernel)(const uint8_t* src, size_t size, char* dst);
+typedef size_t (*decode_kernel)(const char* src, size_t length, uint8_t* dst);
+
+struct kernels {
+    const char* name;
+
+    encode_kernel encode;
+    decode_kernel decode;
+};
+
+static size_t encode_blocks_scalar(const uint8_t* src, size_t size, char* dst) { return 0; }
+static size_t decode_blocks_scalar(const char* src, size_t length, uint8_t* dst) { return 0; }
+
+#ifdef BASE64_X86
+/* http://0x80.pl/notesen/2016-01-12-sse-base64-encoding.html and
+ * http://0x80.pl/notesen/2016-01-17-sse-base64-decoding.html, adapted to the url alphabet. the
+ * decoder classifies by range instead of nibble lookups so it can accept both alphabets */
+
+#define SSE_TARGET __attribute__((target("sse4.1")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+SSE_TARGET static inline __m128i split_sextets_sse(__m128i in) {
+    /* bytes [b1 b0 b2 b1] per lane so each 32-bit word holds one 3-byte group */
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003F03F0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+
+    return _mm_or_si128(t1, t3);
+}
+
+SSE_TARGET static inline __m128i sextets_to_ascii_sse(__m128i indices) {
+    /* 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12 */
+    __m128i reduced = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    reduced = _mm_or_si128(reduced, _mm_and_si128(less, _mm_set1_epi8(13)));
+
+    const __m128i offsets =
+        _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '-' - 62, '_' - 63, 'A', 0, 0);
+
+    return _mm_add_epi8(_mm_shuffle_epi8(offsets, reduced), indices);
+}
+
+SSE_TARGET static inline __m128i in_range_sse(__m128i c, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(lo - 1)),
+                         _mm_cmpgt_epi8(_mm_set1_epi8(hi + 1), c));
+}
 
-static bool to_base64(uint8_t number, char* c) {
-    if (number >= 64) {
+/* returns false if any lane is not a base64 character */
+SSE_TARGET static inline bool ascii_to_sextets_sse(__m128i c, __m128i* values) {
+    __m128i upper = in_range_sse(c, 'A', 'Z');
+    __m128i lower = in_range_sse(c, 'a', 'z');
+    __m128i digit = in_range_sse(c, '0', '9');
+
+    __m128i v62 = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('-')),
+                               _mm_cmpeq_epi8(c, _mm_set1_epi8('+')));
+    __m128i v63 = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('_')),
+                               _mm_cmpeq_epi8(c, _mm_set1_epi8('/')));
+
+    __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, v62));
+    valid = _mm_or_si128(valid, v63);
+
+    if (_mm_movemask_epi8(valid) != 0xFFFF) {
         return false;
     }
 
-    /* A-Z starts at 0 */
-    if (number < 26) {
-        *c = (char)number + 'A';
-        return true;
+    __m128i offset = _mm_blendv_epi8(_mm_set1_epi8(4), _mm_set1_epi8(-65), upper);
+    offset = _mm_blendv_epi8(offset, _mm_set1_epi8(-71), lower);
+
+    __m128i result = _mm_add_epi8(c, offset);
+    result = _mm_blendv_epi8(result, _mm_set1_epi8(62), v62);
+    result = _mm_blendv_epi8(result, _mm_set1_epi8(63), v63);
+
+    *values = result;
+    return true;
+}
+
+/* packs 16 sextets into 12 bytes at the bottom of the register */
+SSE_TARGET static inline __m128i pack_sextets_sse(__m128i values) {
+    __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+
+    return _mm_shuffle_epi8(merged,
+                            _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+SSE_TARGET static size_t encode_blocks_sse41(const uint8_t* src, size_t size, char* dst) {
+    size_t consumed = 0;
+
+    /* each load reads 16 bytes but only uses 12 */
+    while (size - consumed >= 16) {
+        __m128i in = _mm_loadu_si128((const __m128i*)(src + consumed));
+        __m128i out = sextets_to_ascii_sse(split_sextets_sse(in));
+
+        _mm_storeu_si128((__m128i*)dst, out);
+
+        consumed += 12;
+        dst += 16;
     }
 
-    /* a-z starts at 26 */
-    if (number < 52) {
-        *c = (char)(number - 26) + 'a';
-        return true;
+    return consumed;
+}
+
+SSE_TARGET static size_t decode_blocks_sse41(const char* src, size_t length, uint8_t* dst) {
+    size_t consumed = 0;
+
+    while (length - consumed >= 16) {
+        __m128i values;
+        if (!ascii_to_sextets_sse(_mm_loadu_si128((const __m128i*)(src + consumed)), &values)) {
+            break;
+        }
+
+        __m128i out = pack_sextets_sse(values);
+
+        /* exactly 12 bytes so we never write past the caller's buffer */
+        _mm_storel_epi64((__m128i*)dst, out);
+
+        uint32_t tail = (uint32_t)_mm_extract_epi32(out, 2);
+        memcpy(dst + 8, &tail, sizeof(uint32_t));
+
+        consumed += 16;
+        dst += 12;
     }
 
-    /* 0-9 starts at 52 */
-    if (number < 62) {
-        *c = (char)(number - 52) + '0';
-        return true;
+    return consumed;
+}
+
+AVX2_TARGET static inline __m256i in_range_avx2(__m256i c, char lo, char hi) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8(lo - 1)),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), c));
+}
+
+AVX2_TARGET static size_t encode_blocks_avx2(const uint8_t* src, size_t size, char* dst) {
+    const __m256i shuffle = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10, 1,
+                                             0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+
+    const __m256i offsets = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '-' - 62, '_' - 63, 'A', 0, 0, 'a' - 26, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '-' - 62, '_' - 63,
+        'A', 0, 0);
+
+    size_t consumed = 0;
+
+    /* two overlapping 16-byte loads, 12 bytes used from each */
+    while (size - consumed >= 28) {
+        __m128i lo = _mm_loadu_si128((const __m128i*)(src + consumed));
+        __m128i hi = _mm_loadu_si128((const __m128i*)(src + consumed + 12));
+
+        __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        in = _mm256_shuffle_epi8(in, shuffle);
+
+        __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0FC0FC00));
+        __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003F03F0));
+        __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        __m256i indices = _mm256_or_si256(t1, t3);
+
+        __m256i reduced = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        reduced = _mm256_or_si256(reduced, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+
+        __m256i out = _mm256_add_epi8(_mm256_shuffle_epi8(offsets, reduced), indices);
+        _mm256_storeu_si256((__m256i*)dst, out);
+
+        consumed += 24;
+        dst += 32;
     }
 
-    /* + or - = 62 */
-    if (number == 62) {
-        *c = '-';
-        return true;
+    return consumed;
+}
+
+AVX2_TARGET static size_t decode_blocks_avx2(const char* src, size_t length, uint8_t* dst) {
+    const __m256i pack_shuffle =
+        _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5, 4,
+                         10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+    size_t consumed = 0;
+
+    while (length - consumed >= 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i*)(src + consumed));
+
+        __m256i upper = in_range_avx2(c, 'A', 'Z');
+        __m256i lower = in_range_avx2(c, 'a', 'z');
+        __m256i digit = in_range_avx2(c, '0', '9');
+
+        __m256i v62 = _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('-')),
+                                      _mm256_cmpeq_epi8(c, _mm256_set1_epi8('+')));
+        __m256i v63 = _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('_')),
+                                      _mm256_cmpeq_epi8(c, _mm256_set1_epi8('/')));
+
+        __m256i valid = _mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(digit, v62));
+        valid = _mm256_or_si256(valid, v63);
+
+        if ((uint32_t)_mm256_movemask_epi8(valid) != 0xFFFFFFFF) {
+            break;
+        }
+
+        __m256i offset = _mm256_blendv_epi8(_mm256_set1_epi8(4), _mm256_set1_epi8(-65), upper);
+        offset = _mm256_blendv_epi8(offset, _mm256_set1_epi8(-71), lower);
+
+        __m256i values = _mm256_add_epi8(c, offset);
+        values = _mm256_blendv_epi8(values, _mm256_set1_epi8(62), v62);
+        values = _mm256_blendv_epi8(values, _mm256_set1_epi8(63), v63);
+
+        __m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+        merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+        merged = _mm256_shuffle_epi8(merged, pack_shuffle);
+
+        /* 12 bytes per lane; gather them into the low 24 bytes */
+        __m256i out =
+            _mm256_permutevar8x32_epi32(merged, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+
+        _mm_storeu_si128((__m128i*)dst, _mm256_castsi256_si128(out));
+        _mm_storel_epi64((__m128i*)(dst + 16), _mm256_extracti128_si256(out, 1));
+
+        consumed += 32;
+        dst += 24;
     }
 
-    /* / or _ = 63 */
-    *c = '_';
-    return true;
+    return consumed;
 }
+#endif
+
+static const struct kernels scalar_kernels = { "scalar", encode_blocks_scalar,
+                                                decode_blocks_scalar };
 
-static bool from_base64(char c, uint8_t* value) {
-    /* A-Z starts at 0 */
-    if (c >= 'A' && c <= 'Z') {
-        *value = (uint8_t)(c - 'A');
-        return true;
+#ifdef BASE64_X86
+static const struct kernels sse41_kernels = { "sse4.1", encode_blocks_sse41, decode_blocks_sse41 };
+static const struct kernels avx2_kernels = { "avx2", encode_blocks_avx2, decode_blocks_avx2 };
+#endif
+
+static struct kernels active_kernels;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+/* NULL if the cpu cannot run it */
+static const struct kernels* find_kernels(const char* name) {
+    if (strcmp(name, "scalar") == 0) {
+        return &scalar_kernels;
+    }
+
+#ifdef BASE64_X86
+    __builtin_cpu_init();
+
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        return &avx2_kernels;
     }
 
-    /* a-z starts at 26 */
-    if (c >= 'a' && c <= 'z') {
-        *value = (uint8_t)(c - 'a') + 26;
-        return true;
+    if (strcmp(name, "sse4.1") == 0 && __builtin_cpu_supports("sse4.1")) {
+        return &sse41_kernels;
     }
+#endif
+
+    return NULL;
+}
 
-    /* 0-9 starts at 52 */
-    if (c >= '0' && c <= '9') {
-        *value = (uint8_t)(c - '0') + 52;
-        return true;
+static void select_kernels() {
+    const struct kernels* kernels = find_kernels("avx2");
+    if (!kernels) {
+        kernels = find_kernels("sse4.1");
     }
 
-    switch (c) {
-    case '+':
-    case '-':
-        *value = 62;
-        return true;
-    case '/':
-    case '_':
-        *value = 63;
-        return true;
-    default:
+    active_kernels = kernels ? *kernels : scalar_kernels;
+    log_debug("base64 kernel: %s", active_kernels.name);
+}
+
+static const struct kernels* get_kernels() {
+    pthread_once(&kernels_once, select_kernels);
+    return &active_kernels;
+}
+
+const char* base64_get_implementation() { return get_kernels()->name; }
+
+bool base64_set_implementation(const char* name) {
+    /* selection has to have run, or it would overwrite this later */
+    get_kernels();
+
+    const struct kernels* kernels = find_kernels(name);
+    if (!kernels) {
         return false;
     }
+
+    active_kernels = *kernels;
+    return true;
 }
 
-static void encode_chunk(const uint8_t* src, size_t size, char* dst) {
-    for (size_t i = 0; i < 4; i++) {
-        if (i > size) {
-            dst[i] = '=';
-            continue;
-        }
+size_t base64_encode_to(const void* src, size_t size, char* dst) {
+    const uint8_t* in = src;
 
-        uint8_t value = 0;
-        if (i > 0) {
-            uint8_t mask = 0xFF >> (8 - i * 2);
-            uint8_t data = src[i - 1] & mask;
-            value |= data << (6 - i * 2);
-        }
+    size_t consumed = get_kernels()->encode(in, size, dst);
+    char* out = dst + consumed / 3 * 4;
+
+    for (; size - consumed >= 3; consumed += 3) {
+        uint32_t group = (uint32_t)in[consumed] << 16 | (uint32_t)in[consumed + 1] << 8 |
+                         (uint32_t)in[consumed + 2];
+
+        out[0] = encode_table[group >> 18];
+        out[1] = encode_table[(group >> 12) & 0x3F];
+        out[2] = encode_table[(group >> 6) & 0x3F];
+        out[3] = encode_table[group & 0x3F];
+        out += 4;
+    }
 
-        if (i < size) {
-            value |= src[i] >> ((i + 1) * 2);
+    size_t remainder = size - consumed;
+    if (remainder > 0) {
+        uint32_t group = (uint32_t)in[consumed] << 16;
+        if (remainder > 1) {
+            group |= (uint32_t)in[consumed + 1] << 8;
         }
 
-        assert(to_base64(value, &dst[i]));
+        out[0] = encode_table[group >> 18];
+        out[1] = encode_table[(group >> 12) & 0x3F];
+        out[2] = remainder > 1 ? encode_table[(group >> 6) & 0x3F] : '=';
+        out[3] = '=';
+        out += 4;
     }
+
+    *out = '\0';
+    return (size_t)(out - dst);
 }
 
 char* base64_encode(const void* src, size_t size) {
-    size_t chunk_count = size / 3;
-    if (size % 3 != 0) {
-        chunk_count++;
-    }
-
-    size_t output_length = chunk_count * 4;
+    size_t output_length = BASE64_ENCODED_LENGTH(size);
     char* dst = nv_alloc(output_length + 1);
-
     assert(dst);
-    dst[output_length] = '\0';
 
-    for (size_t i = 0; i < chunk_count; i++) {
-        size_t src_offset = i * 3;
-        size_t dst_offset = i * 4;
+    base64_encode_to(src, size, dst);
+    return dst;
+}
 
-        encode_chunk(src + src_offset, size - src_offset, dst + dst_offset);
+static size_t strip_padding(const char* src, size_t length) {
+    while (length > 0 && src[length - 1] == '=') {
+        length--;
     }
 
-    return dst;
+    return length;
 }
 
-static bool decode_chunk(const char* src, size_t size, uint8_t* dst) {
-    uint8_t data[size + 1];
-    for (size_t i = 0; i < size + 1; i++) {
-        if (!from_base64(src[i], &data[i])) {
+/* returns false if a single trailing character is left over, which encodes no full byte */
+static bool get_decoded_size(size_t length, size_t* size) {
+    size_t remainder = length % 4;
+    if (remainder == 1) {
+        return false;
+    }
+
+    *size = length / 4 * 3 + (remainder > 0 ? remainder - 1 : 0);
+    return true;
+}
+
+bool base64_decode_to(const char* src, size_t length, void* dst, size_t capacity, size_t* size) {
+    length = strip_padding(src, length);
+
+    size_t decoded_size;
+    if (!get_decoded_size(length, &decoded_size) || decoded_size > capacity) {
+        return false;
+    }
+
+    uint8_t* out = dst;
+    size_t consumed = get_kernels()->decode(src, length, out);
+    out += consumed / 4 * 3;
+
+    for (; length - consumed >= 4; consumed += 4) {
+        const uint8_t* c = (const uint8_t*)src + consumed;
+
+        uint32_t a = decode_table[c[0]], b = decode_table[c[1]];
+        uint32_t d = decode_table[c[2]], e = decode_table[c[3]];
+
+        if ((a | b | d | e) & 0x80) {
             return false;
         }
+
+        uint32_t group = a << 18 | b << 12 | d << 6 | e;
+        out[0] = (uint8_t)(group >> 16);
+        out[1] = (uint8_t)(group >> 8);
+        out[2] = (uint8_t)group;
+        out += 3;
     }
 
-    if (dst) {
-        for (size_t i = 0; i < size; i++) {
-            uint8_t current = data[i];
-            uint8_t next = data[i + 1];
+    size_t remainder = length - consumed;
+    if (remainder > 0) {
+        const uint8_t* c = (const uint8_t*)src + consumed;
 
-            uint8_t value = 0;
-            value |= current << ((i + 1) * 2);
-            value |= next >> (4 - i * 2);
+        uint32_t a = decode_table[c[0]], b = decode_table[c[1]];
+        uint32_t d = remainder > 2 ? decode_table[c[2]] : 0;
 
-            dst[i] = value;
+        if ((a | b | d) & 0x80) {
+            return false;
+        }
+
+        uint32_t group = a << 18 | b << 12 | d << 6;
+        *out++ = (uint8_t)(group >> 16);
+
+        if (remainder > 2) {
+            *out++ = (uint8_t)(group >> 8);
         }
     }
 
+    *size = decoded_size;
     return true;
 }
 
@@ -149,26 +453,27 @@ size_t base64_decode(const char* src, void* dst) {
         return 0;
     }
 
-    size_t length = 0;
-    for (const char* c = src; *c != '\0' && *c != '='; c++) {
-        length++;
+    size_t length = strlen(src);
+    if (dst) {
+        size_t size;
+        if (!base64_decode_to(src, length, dst, BASE64_DECODED_MAX_SIZE(length), &size)) {
+            /* decoding failed */
+            return 0;
+        }
+
+        return size;
     }
 
-    size_t chunk_count = length / 4;
-    size_t size = chunk_count * 3;
+    /* size query only; validate without writing anything */
+    length = strip_padding(src, length);
 
-    size_t remainder = length % 4;
-    if (remainder > 0) {
-        size += remainder - 1;
-        chunk_count++;
+    size_t size;
+    if (!get_decoded_size(length, &size)) {
+        return 0;
     }
 
-    for (size_t i = 0; i < chunk_count; i++) {
-        size_t src_offset = i * 4;
-        size_t dst_offset = i * 3;
-
-        if (!decode_chunk(src + src_offset, size - dst_offset, dst ? dst + dst_offset : NULL)) {
-            /* decoding failed */
+    for (size_t i = 0; i < length; i++) {
+        if (decode_table[(uint8_t)src[i]] & 0x80) {
             return 0;
         }
     }
@@ -2,12 +2,35 @@
 #define _BASE64_H
 
 #include <stddef.h>
+#include <stdbool.h>
+
+/* encoded length of size bytes, including padding but not the null terminator */
+#define BASE64_ENCODED_LENGTH(size) ((((size) + 2) / 3) * 4)
+
+/* enough room to decode length characters */
+#define BASE64_DECODED_MAX_SIZE(length) ((((length) + 3) / 4) * 3)
 
 /* return allocated with nv_alloc */
 char* base64_encode(const void* src, size_t size);
 
+/* dst must hold BASE64_ENCODED_LENGTH(size) + 1 bytes. returns the encoded length; dst is null
+ * terminated */
+size_t base64_encode_to(const void* src, size_t size, char* dst);
+
 /* dst can be null. if not null, expects enough memory to fill, as returned.
  * returns 0 in all cases if decoding fails */
 size_t base64_decode(const char* src, void* dst);
 
+/* decodes the first length characters of src (padding optional) straight into dst. fails if the
+ * input is invalid or the result does not fit in capacity; BASE64_DECODED_MAX_SIZE(length) is
+ * always enough */
+bool base64_decode_to(const char* src, size_t length, void* dst, size_t capacity, size_t* size);
+
+/* which kernel the current cpu ended up with; "avx2", "sse4.1" or "scalar" */
+const char* base64_get_implementation();
+
+/* switches to the named kernel, for checking them against each other. false, changing nothing, if
+ * the cpu cannot run it. not thread safe; nothing else may be using base64 meanwhile */
+bool base64_set_implementation(const char* name);
+
 #endif
@@ -0,0 +1,12 @@
+#ifndef _CLOCK_H
+#define _CLOCK_H
+
+#include <stdint.h>
+
+/* CLOCK_MONOTONIC, for timing and deadlines */
+uint64_t time_now_ns();
+
+/* CLOCK_REALTIME, for comparing against discord's timestamps and snowflakes */
+uint64_t time_unix_ms();
+
+#endif
@@ -0,0 +1,289 @@
+#include "compress.h"
+
+#include <log.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <nyoravim/mem.h>
+
+#ifdef TASKS_USE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+
+typedef struct compressor {
+    ZSTD_CCtx* cctx;
+    ZSTD_DCtx* dctx;
+
+    /* NULL when compressing without a dictionary */
+    ZSTD_CDict* cdict;
+
+    /* the cdict's and any added since, picked per frame by dictionary id */
+    ZSTD_DDict** ddicts;
+    size_t num_ddicts;
+
+    int level;
+} compressor_t;
+
+/* decompressed records are tiny; refuse anything claiming to be larger than this */
+#define MAX_DECOMPRESSED_SIZE (16 * 1024 * 1024)
+
+bool compress_available() { return true; }
+
+compressor_t* compressor_create(const void* dictionary, size_t size, int level) {
+    compressor_t* comp = nv_alloc(sizeof(compressor_t));
+    assert(comp);
+    memset(comp, 0, sizeof(compressor_t));
+
+    comp->level = level > 0 ? level : ZSTD_CLEVEL_DEFAULT;
+    comp->cctx = ZSTD_createCCtx();
+    comp->dctx = ZSTD_createDCtx();
+
+    if (!comp->cctx || !comp->dctx) {
+        log_error("failed to allocate zstd contexts");
+
+        compressor_free(comp);
+        return NULL;
+    }
+
+    if (dictionary && size > 0) {
+        comp->cdict = ZSTD_createCDict(dictionary, size, comp->level);
+
+        if (!comp->cdict || !compressor_add_dictionary(comp, dictionary, size)) {
+            log_error("failed to load zstd dictionary");
+
+            compressor_free(comp);
+            return NULL;
+        }
+    }
+
+    return comp;
+}
+
+static ZSTD_DDict* find_ddict(const compressor_t* comp, unsigned id) {
+    for (size_t i = 0; i < comp->num_ddicts; i++) {
+        if (ZSTD_getDictID_fromDDict(comp->ddicts[i]) == id) {
+            return comp->ddicts[i];
+        }
+    }
+
+    return NULL;
+}
+
+bool compressor_add_dictionary(compressor_t* comp, const void* dictionary, size_t size) {
+    unsigned id = ZSTD_getDictID_fromDict(dictionary, size);
+    if (id == 0) {
+        log_error("not a zstd dictionary");
+        return false;
+    }
+
+    if (find_ddict(comp, id)) {
+        return true;
+    }
+
+    ZSTD_DDict* ddict = ZSTD_createDDict(dictionary, size);
+    if (!ddict) {
+        log_error("failed to load zstd dictionary %u", id);
+        return false;
+    }
+
+    size_t new_size = (comp->num_ddicts + 1) * sizeof(ZSTD_DDict*);
+    comp->ddicts = comp->num_ddicts > 0 ? nv_realloc(comp->ddicts, new_size) : nv_alloc(new_size);
+    assert(comp->ddicts);
+
+    comp->ddicts[comp->num_ddicts++] = ddict;
+
+    log_debug("loaded zstd dictionary %u (%zu bytes)", id, size);
+    return true;
+}
+
+unsigned compressor_get_dictionary_id(const compressor_t* comp) {
+    return comp->cdict ? ZSTD_getDictID_fromCDict(comp->cdict) : 0;
+}
+
+unsigned compress_get_dictionary_id(const void* dictionary, size_t size) {
+    return ZSTD_getDictID_fromDict(dictionary, size);
+}
+
+void compressor_free(compressor_t* comp) {
+    if (!comp) {
+        return;
+    }
+
+    for (size_t i = 0; i < comp->num_ddicts; i++) {
+        ZSTD_freeDDict(comp->ddicts[i]);
+    }
+
+    nv_free(comp->ddicts);
+    ZSTD_freeCDict(comp->cdict);
+    ZSTD_freeCCtx(comp->cctx);
+    ZSTD_freeDCtx(comp->dctx);
+
+    nv_free(comp);
+}
+
+size_t compressor_compress(compressor_t* comp, const void* src, size_t size, void* dst,
+                           size_t capacity) {
+    size_t result;
+    if (comp->cdict) {
+        result = ZSTD_compress_usingCDict(comp->cctx, dst, capacity, src, size, comp->cdict);
+    } else {
+        result = ZSTD_compressCCtx(comp->cctx, dst, capacity, src, size, comp->level);
+    }
+
+    if (ZSTD_isError(result)) {
+        log_trace("zstd compression failed: %s", ZSTD_getErrorName(result));
+        return 0;
+    }
+
+    return result;
+}
+
+void* compressor_decompress(compressor_t* comp, const void* src, size_t size, size_t* result_size) {
+    unsigned long long content_size = ZSTD_getFrameContentSize(src, size);
+    if (content_size == ZSTD_CONTENTSIZE_ERROR || content_size == ZSTD_CONTENTSIZE_UNKNOWN ||
+        content_size > MAX_DECOMPRESSED_SIZE) {
+        log_error("invalid zstd frame");
+        return NULL;
+    }
+
+    /* always allocate at least a byte so empty frames still return non-NULL */
+    void* dst = nv_alloc(content_size > 0 ? (size_t)content_size : 1);
+    assert(dst);
+
+    /* frames name the dictionary they were made with, so older records outlive a retrain */
+    unsigned id = ZSTD_getDictID_fromFrame(src, size);
+    ZSTD_DDict* ddict = id != 0 ? find_ddict(comp, id) : NULL;
+
+    if (id != 0 && !ddict) {
+        log_error("zstd frame needs dictionary %u, which is not loaded", id);
+
+        nv_free(dst);
+        return NULL;
+    }
+
+    size_t result;
+    if (ddict) {
+        result = ZSTD_decompress_usingDDict(comp->dctx, dst, content_size, src, size, ddict);
+    } else {
+        result = ZSTD_decompressDCtx(comp->dctx, dst, content_size, src, size);
+    }
+
+    if (ZSTD_isError(result)) {
+        log_error("zstd decompression failed: %s", ZSTD_getErrorName(result));
+
+        nv_free(dst);
+        return NULL;
+    }
+
+    *result_size = result;
+    return dst;
+}
+
+size_t compress_train_dictionary(void* dictionary, size_t capacity, const void* samples,
+                                 const size_t* sample_sizes, size_t num_samples) {
+    size_t result =
+        ZDICT_trainFromBuffer(dictionary, capacity, samples, sample_sizes, (unsigned)num_samples);
+
+    if (ZDICT_isError(result)) {
+        log_error("failed to train dictionary: %s", ZDICT_getErrorName(result));
+        return 0;
+    }
+
+    return result;
+}
+#else
+bool compress_available() { return false; }
+
+compressor_t* compressor_create(const void* dictionary, size_t size, int level) {
+    log_warn("built without zstd; compression disabled");
+    return NULL;
+}
+
+bool compressor_add_dictionary(compressor_t* comp, const void* dictionary, size_t size) {
+    return false;
+}
+
+unsigned compressor_get_dictionary_id(const compressor_t* comp) { return 0; }
+unsigned compress_get_dictionary_id(const void* dictionary, size_t size) { return 0; }
+
+void compressor_free(compressor_t* comp) {}
+
+size_t compressor_compress(compressor_t* comp, const void* src, size_t size, void* dst,
+                           size_t capacity) {
+    return 0;
+}
+
+void* compressor_decompress(compressor_t* comp, const void* src, size_t size, size_t* result_size) {
+    log_error("cannot decompress; built without zstd");
+    return NULL;
+}
+
+size_t compress_train_dictionary(void* dictionary, size_t capacity, const void* samples,
+                                 const size_t* sample_sizes, size_t num_samples) {
+    return 0;
+}
+#endif
+
+/* returns a buffer allocated with nv_alloc, or NULL */
+static void* read_dictionary(const char* path, size_t* size) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        log_error("failed to open dictionary file: %s", path);
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    if (length <= 0) {
+        log_error("dictionary file is empty: %s", path);
+
+        fclose(file);
+        return NULL;
+    }
+
+    void* dictionary = nv_alloc((size_t)length);
+    assert(dictionary);
+
+    size_t read = fread(dictionary, 1, (size_t)length, file);
+    fclose(file);
+
+    if (read != (size_t)length) {
+        log_error("failed to read dictionary file: %s", path);
+
+        nv_free(dictionary);
+        return NULL;
+    }
+
+    *size = read;
+    return dictionary;
+}
+
+compressor_t* compressor_create_from_file(const char* path, int level) {
+    size_t size;
+    void* dictionary = read_dictionary(path, &size);
+    if (!dictionary) {
+        return NULL;
+    }
+
+    compressor_t* comp = compressor_create(dictionary, size, level);
+
+    nv_free(dictionary);
+    return comp;
+}
+
+bool compressor_add_dictionary_file(compressor_t* comp, const char* path) {
+    size_t size;
+    void* dictionary = read_dictionary(path, &size);
+    if (!dictionary) {
+        return false;
+    }
+
+    bool success = compressor_add_dictionary(comp, dictionary, size);
+
+    nv_free(dictionary);
+    return success;
+}
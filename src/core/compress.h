@@ -0,0 +1,44 @@
+#ifndef _COMPRESS_H
+#define _COMPRESS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* zstd compression, optionally primed with a trained dictionary. everything here degrades to a
+ * no-op when the build does not have zstd (TASKS_USE_ZSTD undefined): compress_available returns
+ * false and callers are expected to store data uncompressed */
+
+typedef struct compressor compressor_t;
+
+bool compress_available();
+
+/* dictionary may be NULL for plain zstd. the returned compressor keeps its own contexts and is
+ * not thread safe */
+compressor_t* compressor_create(const void* dictionary, size_t size, int level);
+compressor_t* compressor_create_from_file(const char* path, int level);
+void compressor_free(compressor_t* comp);
+
+/* also decompress frames made with this dictionary, though compression keeps using the one the
+ * compressor was created with. each frame names its dictionary by id, so data compressed before a
+ * retrain stays readable as long as the old dictionary is added here */
+bool compressor_add_dictionary(compressor_t* comp, const void* dictionary, size_t size);
+bool compressor_add_dictionary_file(compressor_t* comp, const char* path);
+
+/* of the dictionary compression uses; 0 for none */
+unsigned compressor_get_dictionary_id(const compressor_t* comp);
+
+/* 0 if it is not a zstd dictionary */
+unsigned compress_get_dictionary_id(const void* dictionary, size_t size);
+
+/* returns the compressed size, or 0 if compression failed or would not fit in capacity */
+size_t compressor_compress(compressor_t* comp, const void* src, size_t size, void* dst,
+                           size_t capacity);
+
+/* returns a buffer allocated with nv_alloc, or NULL on failure */
+void* compressor_decompress(compressor_t* comp, const void* src, size_t size, size_t* result_size);
+
+/* trains a dictionary from concatenated samples. returns the dictionary size or 0 on failure */
+size_t compress_train_dictionary(void* dictionary, size_t capacity, const void* samples,
+                                 const size_t* sample_sizes, size_t num_samples);
+
+#endif
@@ -1,8 +1,14 @@
 #include "database.h"
+#include "clock.h"
+#include "metrics.h"
+#include "trace.h"
 
 #include <nyoravim/mem.h>
 
 #include <assert.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
 
 #include <log.h>
 
@@ -38,3 +44,41 @@ void db_close(database_t* db) {
 }
 
 redisContext* db_get_context(const database_t* db) { return db->ctx; }
+
+static struct metric_family command_duration = METRIC_LATENCY_FAMILY(
+    "tasks_redis_command_duration_seconds", "redis round trip latency by command");
+
+static struct metric_family command_errors = METRIC_COUNTER_FAMILY(
+    "tasks_redis_errors_total", "redis commands that failed or replied with an error");
+
+#define MAX_COMMAND_LENGTH 16
+
+redisReply* db_command(redisContext* ctx, const char* format, ...) {
+    char labels[MAX_COMMAND_LENGTH + 16];
+    size_t length = 0;
+
+    /* formats always start with a literal command name */
+    while (length < MAX_COMMAND_LENGTH && isalpha((unsigned char)format[length])) {
+        length++;
+    }
+
+    snprintf(labels, sizeof(labels), "command=\"%.*s\"", (int)length, format);
+
+    va_list args;
+    va_start(args, format);
+
+    uint64_t start = time_now_ns();
+    redisReply* reply = redisvCommand(ctx, format, args);
+    uint64_t end = time_now_ns();
+
+    metric_observe(metric_get(&command_duration, labels), end - start);
+    trace_record("redis", trace_current(), start, end);
+
+    va_end(args);
+
+    if (!reply || reply->type == REDIS_REPLY_ERROR) {
+        metric_inc(metric_get(&command_errors, labels));
+    }
+
+    return reply;
+}
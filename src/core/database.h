@@ -6,6 +6,7 @@
 
 /* from hiredis/hiredis.h */
 typedef struct redisContext redisContext;
+typedef struct redisReply redisReply;
 
 enum {
     REDIS_VALUE_TYPE_STRING,
@@ -21,4 +22,7 @@ struct redis_value {
 
 bool db_get_hash_field(redisContext* ctx, struct redis_value* value);
 
+/* redisCommand, timed into tasks_redis_command_duration_seconds by the first word of format */
+redisReply* db_command(redisContext* ctx, const char* format, ...);
+
 #endif
@@ -0,0 +1,236 @@
+#ifndef _HASHMAP_H
+#define _HASHMAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+
+#include <nyoravim/mem.h>
+
+/* hash maps specialized on key and value type at compile time, for the lookups nv_map would route
+ * through function pointers and boxed keys. HASHMAP_DECLARE(name, key, value, hash, equals)
+ * generates name_t and static inline functions over it:
+ *
+ *   void name_init(name_t* map);
+ *   void name_free(name_t* map);                           frees the table, not keys or values
+ *   value* name_get(const name_t* map, key k);             NULL if absent
+ *   bool name_insert(name_t* map, key k, value v);         false if k is already present
+ *   bool name_remove(name_t* map, key k, value* removed);  removed may be NULL
+ *   size_t name_memory(const name_t* map);                 bytes held by the table
+ *
+ * hash is a function or macro from key to uint64_t and equals one from two keys to bool; both are
+ * inlined. the table is robin hood with linear probing and backward shift deletion: each slot
+ * keeps a byte holding its distance from home plus one (0 when empty), so a lookup stops as soon
+ * as it passes where the key would have been, and only compares keys in slots at exactly the
+ * probe's distance. the home slot comes from the top bits of a fibonacci multiply, so identity is
+ * a fine hash for snowflakes and pointers. the table holds at most 7/8 of its capacity.
+ *
+ * distinct keys must rarely share a full 64 bit hash; no amount of room fits more than
+ * HASHMAP_MAX_DISTANCE of them.
+ *
+ * iterate with HASHMAP_FOR_EACH. the map must not change while iterating */
+
+#define HASHMAP_MIN_CAPACITY 16
+
+/* longest probe before the table grows instead */
+#define HASHMAP_MAX_DISTANCE UINT8_MAX
+
+static inline uint64_t hashmap_hash_u64(uint64_t key) { return key; }
+static inline uint64_t hashmap_hash_ptr(const void* key) { return (uint64_t)(uintptr_t)key; }
+
+/* fnv-1a */
+static inline uint64_t hashmap_hash_string(const char* key) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const char* c = key; *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t)*c) * 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+#define HASHMAP_EQUALS_SCALAR(a, b) ((a) == (b))
+#define HASHMAP_EQUALS_STRING(a, b) (strcmp((a), (b)) == 0)
+
+/* for (size_t i = ...) over occupied slots; read map->keys[i] and map->values[i] */
+#define HASHMAP_FOR_EACH(map, i)                                                                   \
+    for (size_t i = 0; i < (map)->capacity; i++)                                                   \
+        if ((map)->distances[i] != 0)
+
+#define HASHMAP_DECLARE(name, key_type, value_type, hash, equals)                                  \
+    typedef struct name {                                                                          \
+        key_type* keys;                                                                            \
+        value_type* values;                                                                        \
+        uint8_t* distances;                                                                        \
+                                                                                                   \
+        size_t capacity, count;                                                                    \
+        uint32_t shift;                                                                            \
+    } name##_t;                                                                                    \
+                                                                                                   \
+    static inline void name##_init(name##_t* map) { memset(map, 0, sizeof(name##_t)); }           \
+                                                                                                   \
+    static inline void name##_free(name##_t* map) {                                                \
+        nv_free(map->keys);                                                                        \
+        nv_free(map->values);                                                                      \
+        nv_free(map->distances);                                                                   \
+                                                                                                   \
+        memset(map, 0, sizeof(name##_t));                                                          \
+    }                                                                                              \
+                                                                                                   \
+    static inline size_t name##_memory(const name##_t* map) {                                      \
+        return map->capacity * (sizeof(key_type) + sizeof(value_type) + sizeof(uint8_t));          \
+    }                                                                                              \
+                                                                                                   \
+    static inline size_t name##_home(const name##_t* map, key_type key) {                          \
+        return (size_t)(((uint64_t)hash(key) * 0x9E3779B97F4A7C15ull) >> map->shift);             \
+    }                                                                                              \
+                                                                                                   \
+    static inline value_type* name##_get(const name##_t* map, key_type key) {                      \
+        if (map->count == 0) {                                                                     \
+            return NULL;                                                                           \
+        }                                                                                          \
+                                                                                                   \
+        size_t mask = map->capacity - 1;                                                           \
+        size_t i = name##_home(map, key);                                                          \
+                                                                                                   \
+        for (uint32_t distance = 1; map->distances[i] >= distance; distance++) {                   \
+            if (map->distances[i] == distance && equals(map->keys[i], key)) {                      \
+                return &map->values[i];                                                            \
+            }                                                                                      \
+                                                                                                   \
+            i = (i + 1) & mask;                                                                    \
+        }                                                                                          \
+                                                                                                   \
+        return NULL;                                                                               \
+    }                                                                                              \
+                                                                                                   \
+    /* false if the probe ran too long, leaving whichever entry was displaced in key and value */  \
+    static inline bool name##_place(name##_t* map, key_type* key, value_type* value) {             \
+        size_t mask = map->capacity - 1;                                                           \
+        size_t i = name##_home(map, *key);                                                         \
+                                                                                                   \
+        for (uint32_t distance = 1; distance <= HASHMAP_MAX_DISTANCE; distance++) {                \
+            if (map->distances[i] == 0) {                                                          \
+                map->keys[i] = *key;                                                               \
+                map->values[i] = *value;                                                           \
+                map->distances[i] = (uint8_t)distance;                                             \
+                                                                                                   \
+                return true;                                                                       \
+            }                                                                                      \
+                                                                                                   \
+            /* take from the rich; the displaced entry carries on probing */                      \
+            if (map->distances[i] < distance) {                                                    \
+                key_type held_key = map->keys[i];                                                  \
+                value_type held_value = map->values[i];                                            \
+                uint32_t held_distance = map->distances[i];                                        \
+                                                                                                   \
+                map->keys[i] = *key;                                                               \
+                map->values[i] = *value;                                                           \
+                map->distances[i] = (uint8_t)distance;                                             \
+                                                                                                   \
+                *key = held_key;                                                                   \
+                *value = held_value;                                                               \
+                distance = held_distance;                                                          \
+            }                                                                                      \
+                                                                                                   \
+            i = (i + 1) & mask;                                                                    \
+        }                                                                                          \
+                                                                                                   \
+        return false;                                                                              \
+    }                                                                                              \
+                                                                                                   \
+    static inline void name##_resize(name##_t* map, size_t capacity) {                             \
+        name##_t old = *map;                                                                       \
+                                                                                                   \
+        for (;;) {                                                                                 \
+            map->capacity = capacity;                                                              \
+            map->shift = 64;                                                                       \
+                                                                                                   \
+            for (size_t c = capacity; c > 1; c >>= 1) {                                            \
+                map->shift--;                                                                      \
+            }                                                                                      \
+                                                                                                   \
+            map->keys = nv_alloc(capacity * sizeof(key_type));                                     \
+            map->values = nv_alloc(capacity * sizeof(value_type));                                 \
+            map->distances = nv_alloc(capacity);                                                   \
+            assert(map->keys && map->values && map->distances);                                    \
+                                                                                                   \
+            memset(map->distances, 0, capacity);                                                   \
+                                                                                                   \
+            bool placed = true;                                                                    \
+            for (size_t i = 0; i < old.capacity && placed; i++) {                                  \
+                if (old.distances[i] != 0) {                                                       \
+                    key_type key = old.keys[i];                                                    \
+                    value_type value = old.values[i];                                              \
+                                                                                                   \
+                    placed = name##_place(map, &key, &value);                                      \
+                }                                                                                  \
+            }                                                                                      \
+                                                                                                   \
+            if (placed) {                                                                          \
+                break;                                                                             \
+            }                                                                                      \
+                                                                                                   \
+            /* pathological clustering; start over with more room */                              \
+            nv_free(map->keys);                                                                    \
+            nv_free(map->values);                                                                  \
+            nv_free(map->distances);                                                               \
+                                                                                                   \
+            capacity *= 2;                                                                         \
+                                                                                                   \
+            /* room cannot help once too many keys share a full 64 bit hash */                    \
+            assert(capacity / 64 <= old.count + HASHMAP_MIN_CAPACITY);                             \
+        }                                                                                          \
+                                                                                                   \
+        nv_free(old.keys);                                                                         \
+        nv_free(old.values);                                                                       \
+        nv_free(old.distances);                                                                    \
+    }                                                                                              \
+                                                                                                   \
+    static inline bool name##_insert(name##_t* map, key_type key, value_type value) {              \
+        if (name##_get(map, key)) {                                                                \
+            return false;                                                                          \
+        }                                                                                          \
+                                                                                                   \
+        if ((map->count + 1) * 8 > map->capacity * 7) {                                            \
+            name##_resize(map, map->capacity > 0 ? map->capacity * 2 : HASHMAP_MIN_CAPACITY);      \
+        }                                                                                          \
+                                                                                                   \
+        while (!name##_place(map, &key, &value)) {                                                 \
+            name##_resize(map, map->capacity * 2);                                                 \
+        }                                                                                          \
+                                                                                                   \
+        map->count++;                                                                              \
+        return true;                                                                               \
+    }                                                                                              \
+                                                                                                   \
+    static inline bool name##_remove(name##_t* map, key_type key, value_type* removed) {           \
+        value_type* slot = name##_get(map, key);                                                   \
+        if (!slot) {                                                                               \
+            return false;                                                                          \
+        }                                                                                          \
+                                                                                                   \
+        if (removed) {                                                                             \
+            *removed = *slot;                                                                      \
+        }                                                                                          \
+                                                                                                   \
+        size_t mask = map->capacity - 1;                                                           \
+        size_t i = (size_t)(slot - map->values);                                                   \
+                                                                                                   \
+        /* everything after the hole that is away from home moves one closer */                   \
+        for (size_t next = (i + 1) & mask; map->distances[next] > 1; next = (next + 1) & mask) {   \
+            map->keys[i] = map->keys[next];                                                        \
+            map->values[i] = map->values[next];                                                    \
+            map->distances[i] = map->distances[next] - 1;                                          \
+                                                                                                   \
+            i = next;                                                                              \
+        }                                                                                          \
+                                                                                                   \
+        map->distances[i] = 0;                                                                     \
+        map->count--;                                                                              \
+                                                                                                   \
+        return true;                                                                               \
+    }
+
+#endif
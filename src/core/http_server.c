@@ -0,0 +1,882 @@
+/* https://datatracker.ietf.org/doc/html/rfc9112
+ * https://datatracker.ietf.org/doc/html/rfc6455 */
+
+/* memmem, strcasestr, accept4 */
+#define _GNU_SOURCE
+
+#include "http_server.h"
+
+#include <log.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include <openssl/evp.h>
+
+#include <nyoravim/mem.h>
+
+#define MAX_EVENTS 64
+#define MAX_HEADERS 32
+#define MAX_HEADER_SIZE (16 * 1024)
+/* interaction payloads are a few kilobytes; this leaves room for large resolved data */
+#define MAX_BODY_SIZE (256 * 1024)
+#define READ_CHUNK_SIZE (16 * 1024)
+
+/* one request or frame; a peer that has more than this buffered is not waiting on us */
+#define MAX_INPUT_SIZE (MAX_HEADER_SIZE + MAX_BODY_SIZE + 16)
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+enum {
+    WS_OPCODE_CONTINUATION = 0x0,
+    WS_OPCODE_TEXT = 0x1,
+    WS_OPCODE_BINARY = 0x2,
+    WS_OPCODE_CLOSE = 0x8,
+    WS_OPCODE_PING = 0x9,
+    WS_OPCODE_PONG = 0xA,
+};
+
+struct buffer {
+    uint8_t* data;
+    size_t size, capacity;
+};
+
+typedef struct http_connection {
+    http_server_t* server;
+    int fd;
+
+    struct buffer in, out;
+
+    /* bytes at the front of out already sent */
+    size_t out_offset;
+
+    bool websocket;
+    bool awaiting_response;
+    bool close_after_response;
+
+    /* close once out is flushed */
+    bool closing;
+
+    /* the peer is gone; free without flushing */
+    bool dead;
+
+    bool want_write;
+
+    /* fragmented websocket message being reassembled */
+    struct buffer message;
+    uint8_t message_opcode;
+
+    void* user;
+
+    struct http_connection* prev;
+    struct http_connection* next;
+} http_connection_t;
+
+typedef struct http_server {
+    int fd, epoll;
+    uint16_t port;
+
+    struct http_server_callbacks callbacks;
+
+    /* all open connections, for cleanup and deferred input */
+    http_connection_t* connections;
+} http_server_t;
+
+static void buffer_reserve(struct buffer* buffer, size_t additional) {
+    size_t required = buffer->size + additional;
+    if (required <= buffer->capacity) {
+        return;
+    }
+
+    size_t capacity = buffer->capacity > 0 ? buffer->capacity : 1024;
+    while (capacity < required) {
+        capacity *= 2;
+    }
+
+    buffer->data = buffer->data ? nv_realloc(buffer->data, capacity) : nv_alloc(capacity);
+    assert(buffer->data);
+
+    buffer->capacity = capacity;
+}
+
+static void buffer_append(struct buffer* buffer, const void* data, size_t size) {
+    buffer_reserve(buffer, size);
+
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+static void buffer_consume(struct buffer* buffer, size_t size) {
+    memmove(buffer->data, buffer->data + size, buffer->size - size);
+    buffer->size -= size;
+}
+
+static bool set_events(http_connection_t* conn, bool want_write) {
+    if (conn->want_write == want_write) {
+        return true;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP | (want_write ? EPOLLOUT : 0);
+    event.data.ptr = conn;
+
+    if (epoll_ctl(conn->server->epoll, EPOLL_CTL_MOD, conn->fd, &event) != 0) {
+        log_error("failed to update epoll events: %s", strerror(errno));
+        return false;
+    }
+
+    conn->want_write = want_write;
+    return true;
+}
+
+static void flush_connection(http_connection_t* conn) {
+    while (conn->out_offset < conn->out.size) {
+        ssize_t sent = send(conn->fd, conn->out.data + conn->out_offset,
+                            conn->out.size - conn->out_offset, MSG_NOSIGNAL);
+
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+
+            log_debug("send failed on connection %d: %s", conn->fd, strerror(errno));
+            conn->dead = true;
+
+            return;
+        }
+
+        conn->out_offset += (size_t)sent;
+    }
+
+    if (conn->out_offset >= conn->out.size) {
+        conn->out.size = 0;
+        conn->out_offset = 0;
+    }
+
+    set_events(conn, conn->out.size > 0);
+}
+
+static void free_connection(http_connection_t* conn) {
+    http_server_t* server = conn->server;
+    if (server->callbacks.on_close) {
+        server->callbacks.on_close(server->callbacks.user, conn);
+    }
+
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        server->connections = conn->next;
+    }
+
+    if (conn->next) {
+        conn->next->prev = conn->prev;
+    }
+
+    epoll_ctl(server->epoll, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+
+    nv_free(conn->in.data);
+    nv_free(conn->out.data);
+    nv_free(conn->message.data);
+    nv_free(conn);
+}
+
+static const char* get_status_text(uint32_t status) {
+    switch (status) {
+    case 101:
+        return "Switching Protocols";
+    case 200:
+        return "OK";
+    case 201:
+        return "Created";
+    case 204:
+        return "No Content";
+    case 400:
+        return "Bad Request";
+    case 401:
+        return "Unauthorized";
+    case 404:
+        return "Not Found";
+    case 405:
+        return "Method Not Allowed";
+    case 413:
+        return "Content Too Large";
+    case 429:
+        return "Too Many Requests";
+    case 431:
+        return "Request Header Fields Too Large";
+    case 500:
+        return "Internal Server Error";
+    case 503:
+        return "Service Unavailable";
+    default:
+        return "Unknown";
+    }
+}
+
+bool http_server_respond(http_connection_t* conn, uint32_t status, const char* content_type,
+                         const void* body, size_t size) {
+    if (!conn->awaiting_response) {
+        log_warn("connection %d is not awaiting a response; ignoring", conn->fd);
+        return false;
+    }
+
+    char header[512];
+    int length = snprintf(header, sizeof(header), "HTTP/1.1 %" PRIu32 " %s\r\n", status,
+                          get_status_text(status));
+
+    if (content_type && size > 0) {
+        length += snprintf(header + length, sizeof(header) - length, "Content-Type: %s\r\n",
+                           content_type);
+    }
+
+    length += snprintf(header + length, sizeof(header) - length, "Content-Length: %zu\r\n%s\r\n",
+                       size, conn->close_after_response ? "Connection: close\r\n" : "");
+
+    buffer_append(&conn->out, header, (size_t)length);
+    if (size > 0) {
+        buffer_append(&conn->out, body, size);
+    }
+
+    conn->awaiting_response = false;
+    if (conn->close_after_response) {
+        conn->closing = true;
+    }
+
+    flush_connection(conn);
+    return true;
+}
+
+const char* http_server_get_header(const struct http_server_request* req, const char* name) {
+    for (size_t i = 0; i < req->num_headers; i++) {
+        if (strcasecmp(req->headers[i].name, name) == 0) {
+            return req->headers[i].value;
+        }
+    }
+
+    return NULL;
+}
+
+static void send_error(http_connection_t* conn, uint32_t status) {
+    conn->awaiting_response = true;
+    conn->close_after_response = true;
+
+    const char* text = get_status_text(status);
+    http_server_respond(conn, status, "text/plain", text, strlen(text));
+}
+
+static bool make_accept_key(const char* key, char* dst) {
+    char input[128];
+    int length = snprintf(input, sizeof(input), "%s" WS_GUID, key);
+    if (length < 0 || (size_t)length >= sizeof(input)) {
+        return false;
+    }
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_size;
+
+    if (!EVP_Digest(input, (size_t)length, digest, &digest_size, EVP_sha1(), NULL)) {
+        return false;
+    }
+
+    /* the handshake wants the standard alphabet with padding, unlike core/base64.h */
+    EVP_EncodeBlock((unsigned char*)dst, digest, (int)digest_size);
+    return true;
+}
+
+static bool header_contains(const struct http_server_request* req, const char* name,
+                            const char* token) {
+    const char* value = http_server_get_header(req, name);
+    return value && strcasestr(value, token);
+}
+
+static void upgrade_connection(http_connection_t* conn, const struct http_server_request* req) {
+    const char* key = http_server_get_header(req, "Sec-WebSocket-Key");
+
+    char accept[64];
+    if (!key || !make_accept_key(key, accept)) {
+        send_error(conn, 400);
+        return;
+    }
+
+    char response[256];
+    int length = snprintf(response, sizeof(response),
+                          "HTTP/1.1 101 Switching Protocols\r\n"
+                          "Upgrade: websocket\r\n"
+                          "Connection: Upgrade\r\n"
+                          "Sec-WebSocket-Accept: %s\r\n\r\n",
+                          accept);
+
+    buffer_append(&conn->out, response, (size_t)length);
+    conn->websocket = true;
+
+    http_server_t* server = conn->server;
+    server->callbacks.on_ws_open(server->callbacks.user, conn, req);
+
+    flush_connection(conn);
+}
+
+/* parses the header block in place. returns false on malformed input */
+static bool parse_head(char* head, struct http_server_request* req, struct http_header* headers,
+                       const char** version) {
+    char* line_end = strstr(head, "\r\n");
+    if (line_end) {
+        *line_end = '\0';
+    }
+
+    char* method = head;
+    char* path = strchr(method, ' ');
+    if (!path) {
+        return false;
+    }
+
+    *path++ = '\0';
+    char* version_start = strchr(path, ' ');
+    if (!version_start) {
+        return false;
+    }
+
+    *version_start++ = '\0';
+    *version = version_start;
+
+    req->method = method;
+    req->path = path;
+    req->num_headers = 0;
+    req->headers = headers;
+
+    char* line = line_end ? line_end + 2 : NULL;
+    while (line && *line) {
+        line_end = strstr(line, "\r\n");
+        if (line_end) {
+            *line_end = '\0';
+        }
+
+        char* colon = strchr(line, ':');
+        if (colon && req->num_headers < MAX_HEADERS) {
+            *colon = '\0';
+
+            char* value = colon + 1;
+            while (*value == ' ' || *value == '\t') {
+                value++;
+            }
+
+            headers[req->num_headers].name = line;
+            headers[req->num_headers].value = value;
+            req->num_headers++;
+        }
+
+        line = line_end ? line_end + 2 : NULL;
+    }
+
+    return true;
+}
+
+/* returns false if more input is needed or the connection can't take another request */
+static bool process_request(http_connection_t* conn) {
+    struct buffer* in = &conn->in;
+
+    uint8_t* terminator = memmem(in->data, in->size, "\r\n\r\n", 4);
+    if (!terminator) {
+        if (in->size > MAX_HEADER_SIZE) {
+            send_error(conn, 431);
+        }
+
+        return false;
+    }
+
+    size_t head_size = (size_t)(terminator - in->data) + 4;
+    if (head_size > MAX_HEADER_SIZE) {
+        send_error(conn, 431);
+        return false;
+    }
+
+    /* parse a copy; headers are modified in place */
+    char head[MAX_HEADER_SIZE + 1];
+    memcpy(head, in->data, head_size - 2);
+    head[head_size - 2] = '\0';
+
+    struct http_header headers[MAX_HEADERS];
+    struct http_server_request req;
+    const char* version;
+
+    if (!parse_head(head, &req, headers, &version)) {
+        send_error(conn, 400);
+        return false;
+    }
+
+    size_t body_size = 0;
+    const char* content_length = http_server_get_header(&req, "Content-Length");
+
+    if (content_length) {
+        char* end;
+        unsigned long long value = strtoull(content_length, &end, 10);
+
+        if (end == content_length || value > MAX_BODY_SIZE) {
+            send_error(conn, value > MAX_BODY_SIZE ? 413 : 400);
+            return false;
+        }
+
+        body_size = (size_t)value;
+    }
+
+    if (in->size < head_size + body_size) {
+        return false;
+    }
+
+    /* the body is passed in place, terminated in the byte after it for the callback's duration */
+    buffer_reserve(in, 1);
+
+    char* body = (char*)in->data + head_size;
+    char saved = body[body_size];
+    body[body_size] = '\0';
+
+    req.body = body;
+    req.body_size = body_size;
+
+    conn->awaiting_response = true;
+    conn->close_after_response =
+        header_contains(&req, "Connection", "close") || strcmp(version, "HTTP/1.0") == 0;
+
+    http_server_t* server = conn->server;
+    if (header_contains(&req, "Upgrade", "websocket")) {
+        conn->awaiting_response = false;
+
+        if (server->callbacks.on_ws_open) {
+            upgrade_connection(conn, &req);
+        } else {
+            send_error(conn, 404);
+        }
+    } else if (server->callbacks.on_request) {
+        server->callbacks.on_request(server->callbacks.user, conn, &req);
+    } else {
+        send_error(conn, 404);
+    }
+
+    body[body_size] = saved;
+    buffer_consume(in, head_size + body_size);
+
+    return !conn->awaiting_response && !conn->closing && !conn->dead;
+}
+
+static void ws_write_frame(http_connection_t* conn, uint8_t opcode, const void* data, size_t size) {
+    uint8_t header[10];
+    size_t header_size = 2;
+
+    header[0] = 0x80 | opcode;
+    if (size < 126) {
+        header[1] = (uint8_t)size;
+    } else if (size <= UINT16_MAX) {
+        header[1] = 126;
+        header[2] = (uint8_t)(size >> 8);
+        header[3] = (uint8_t)size;
+
+        header_size = 4;
+    } else {
+        header[1] = 127;
+        for (size_t i = 0; i < 8; i++) {
+            header[2 + i] = (uint8_t)((uint64_t)size >> (56 - i * 8));
+        }
+
+        header_size = 10;
+    }
+
+    buffer_append(&conn->out, header, header_size);
+    if (size > 0) {
+        buffer_append(&conn->out, data, size);
+    }
+}
+
+bool http_server_ws_send(http_connection_t* conn, const void* data, size_t size, bool text) {
+    if (!conn->websocket || conn->closing || conn->dead) {
+        return false;
+    }
+
+    ws_write_frame(conn, text ? WS_OPCODE_TEXT : WS_OPCODE_BINARY, data, size);
+    flush_connection(conn);
+
+    return !conn->dead;
+}
+
+static void deliver_message(http_connection_t* conn, uint8_t opcode, uint8_t* data, size_t size) {
+    http_server_t* server = conn->server;
+    if (!server->callbacks.on_ws_message) {
+        return;
+    }
+
+    /* there is always a spare byte; see process_frame */
+    data[size] = '\0';
+    server->callbacks.on_ws_message(server->callbacks.user, conn, (const char*)data, size,
+                                    opcode == WS_OPCODE_TEXT);
+}
+
+/* returns false if more input is needed */
+static bool process_frame(http_connection_t* conn) {
+    struct buffer* in = &conn->in;
+    if (in->size < 2) {
+        return false;
+    }
+
+    bool fin = (in->data[0] & 0x80) != 0;
+    uint8_t opcode = in->data[0] & 0x0F;
+    bool masked = (in->data[1] & 0x80) != 0;
+
+    uint64_t length = in->data[1] & 0x7F;
+    size_t offset = 2;
+
+    if (length == 126) {
+        if (in->size < 4) {
+            return false;
+        }
+
+        length = ((uint64_t)in->data[2] << 8) | in->data[3];
+        offset = 4;
+    } else if (length == 127) {
+        if (in->size < 10) {
+            return false;
+        }
+
+        length = 0;
+        for (size_t i = 0; i < 8; i++) {
+            length = (length << 8) | in->data[2 + i];
+        }
+
+        offset = 10;
+    }
+
+    if (length > MAX_BODY_SIZE) {
+        log_warn("websocket frame of %" PRIu64 " bytes is too large; closing", length);
+
+        conn->dead = true;
+        return false;
+    }
+
+    uint8_t mask[4] = { 0 };
+    if (masked) {
+        if (in->size < offset + 4) {
+            return false;
+        }
+
+        memcpy(mask, in->data + offset, 4);
+        offset += 4;
+    }
+
+    if (in->size < offset + length) {
+        return false;
+    }
+
+    /* reserve a byte past the payload so it can be null terminated in place */
+    buffer_reserve(in, 1);
+
+    uint8_t* payload = in->data + offset;
+    for (size_t i = 0; masked && i < length; i++) {
+        payload[i] ^= mask[i & 3];
+    }
+
+    size_t frame_size = offset + (size_t)length;
+    switch (opcode) {
+    case WS_OPCODE_CLOSE:
+        /* echo the status code back and hang up */
+        ws_write_frame(conn, WS_OPCODE_CLOSE, payload, length >= 2 ? 2 : 0);
+        conn->closing = true;
+
+        break;
+    case WS_OPCODE_PING:
+        ws_write_frame(conn, WS_OPCODE_PONG, payload, (size_t)length);
+        break;
+    case WS_OPCODE_PONG:
+        break;
+    case WS_OPCODE_CONTINUATION:
+        buffer_append(&conn->message, payload, (size_t)length);
+        if (fin) {
+            buffer_reserve(&conn->message, 1);
+            deliver_message(conn, conn->message_opcode, conn->message.data, conn->message.size);
+
+            conn->message.size = 0;
+        }
+
+        break;
+    default:
+        if (fin) {
+            uint8_t saved = payload[length];
+            deliver_message(conn, opcode, payload, (size_t)length);
+
+            payload[length] = saved;
+        } else {
+            conn->message.size = 0;
+            conn->message_opcode = opcode;
+
+            buffer_append(&conn->message, payload, (size_t)length);
+        }
+
+        break;
+    }
+
+    buffer_consume(in, frame_size);
+    return !conn->closing && !conn->dead;
+}
+
+static void process_input(http_connection_t* conn) {
+    while (conn->in.size > 0 && !conn->awaiting_response && !conn->closing && !conn->dead) {
+        bool progressed = conn->websocket ? process_frame(conn) : process_request(conn);
+        if (!progressed) {
+            break;
+        }
+    }
+
+    flush_connection(conn);
+}
+
+static void read_connection(http_connection_t* conn) {
+    while (!conn->dead && !conn->closing) {
+        if (conn->in.size >= MAX_INPUT_SIZE) {
+            /* handle what is there to make room; if that does not, nothing will */
+            process_input(conn);
+
+            if (conn->in.size >= MAX_INPUT_SIZE) {
+                log_warn("connection %d sent more than %d bytes unprompted; closing", conn->fd,
+                         MAX_INPUT_SIZE);
+
+                conn->dead = true;
+                return;
+            }
+
+            continue;
+        }
+
+        size_t available = MAX_INPUT_SIZE - conn->in.size;
+        size_t chunk = available < READ_CHUNK_SIZE ? available : READ_CHUNK_SIZE;
+        buffer_reserve(&conn->in, chunk);
+
+        ssize_t received = recv(conn->fd, conn->in.data + conn->in.size, chunk, 0);
+        if (received > 0) {
+            conn->in.size += (size_t)received;
+            continue;
+        }
+
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+
+        /* orderly shutdown or a real error */
+        conn->dead = true;
+        break;
+    }
+
+    process_input(conn);
+}
+
+static void accept_connections(http_server_t* server) {
+    while (true) {
+        int fd = accept4(server->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                log_error("accept failed: %s", strerror(errno));
+            }
+
+            return;
+        }
+
+        int enable = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+        http_connection_t* conn = nv_alloc(sizeof(http_connection_t));
+        assert(conn);
+        memset(conn, 0, sizeof(http_connection_t));
+
+        conn->server = server;
+        conn->fd = fd;
+
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.ptr = conn;
+
+        if (epoll_ctl(server->epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+            log_error("failed to watch connection: %s", strerror(errno));
+
+            close(fd);
+            nv_free(conn);
+
+            continue;
+        }
+
+        conn->next = server->connections;
+        if (conn->next) {
+            conn->next->prev = conn;
+        }
+
+        server->connections = conn;
+        log_trace("accepted connection %d", fd);
+    }
+}
+
+static bool connection_finished(const http_connection_t* conn) {
+    return conn->dead || (conn->closing && conn->out.size == 0);
+}
+
+http_server_t* http_server_create(const char* address, uint16_t port,
+                                  const struct http_server_callbacks* callbacks) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+
+    if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) {
+        log_error("invalid listen address: %s", address);
+        return NULL;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_error("failed to create socket: %s", strerror(errno));
+        return NULL;
+    }
+
+    int enable = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        log_error("failed to listen on %s:%" PRIu16 ": %s", address, port, strerror(errno));
+
+        close(fd);
+        return NULL;
+    }
+
+    socklen_t addr_size = sizeof(addr);
+    getsockname(fd, (struct sockaddr*)&addr, &addr_size);
+
+    int epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll < 0) {
+        log_error("failed to create epoll instance: %s", strerror(errno));
+
+        close(fd);
+        return NULL;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event);
+
+    http_server_t* server = nv_alloc(sizeof(http_server_t));
+    assert(server);
+    memset(server, 0, sizeof(http_server_t));
+
+    server->fd = fd;
+    server->epoll = epoll;
+    server->port = ntohs(addr.sin_port);
+
+    if (callbacks) {
+        memcpy(&server->callbacks, callbacks, sizeof(struct http_server_callbacks));
+    }
+
+    log_debug("http server listening on %s:%" PRIu16, address, server->port);
+    return server;
+}
+
+void http_server_free(http_server_t* server) {
+    if (!server) {
+        return;
+    }
+
+    while (server->connections) {
+        free_connection(server->connections);
+    }
+
+    close(server->epoll);
+    close(server->fd);
+
+    nv_free(server);
+}
+
+uint16_t http_server_get_port(const http_server_t* server) { return server->port; }
+
+/* input left over from a request that was answered after its callback returned */
+static bool process_deferred(http_server_t* server) {
+    bool processed = false;
+
+    http_connection_t* conn = server->connections;
+    while (conn) {
+        http_connection_t* next = conn->next;
+
+        if (conn->in.size > 0 && !conn->awaiting_response && !conn->closing && !conn->dead) {
+            process_input(conn);
+            processed = true;
+        }
+
+        if (connection_finished(conn)) {
+            free_connection(conn);
+        }
+
+        conn = next;
+    }
+
+    return processed;
+}
+
+bool http_server_poll(http_server_t* server, int32_t timeout_ms) {
+    if (process_deferred(server)) {
+        timeout_ms = 0;
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    int count = epoll_wait(server->epoll, events, MAX_EVENTS, timeout_ms);
+
+    if (count < 0) {
+        if (errno == EINTR) {
+            return true;
+        }
+
+        log_error("epoll_wait failed: %s", strerror(errno));
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        http_connection_t* conn = events[i].data.ptr;
+        if (!conn) {
+            accept_connections(server);
+            continue;
+        }
+
+        if (events[i].events & EPOLLOUT) {
+            flush_connection(conn);
+        }
+
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            read_connection(conn);
+        }
+
+        if (connection_finished(conn)) {
+            free_connection(conn);
+        }
+    }
+
+    return true;
+}
+
+void http_server_close(http_connection_t* conn) {
+    conn->closing = true;
+    flush_connection(conn);
+}
+
+void http_connection_set_user(http_connection_t* conn, void* user) { conn->user = user; }
+void* http_connection_get_user(const http_connection_t* conn) { return conn->user; }
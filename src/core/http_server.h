@@ -0,0 +1,76 @@
+#ifndef _HTTP_SERVER_H
+#define _HTTP_SERVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* a small single threaded epoll http/1.1 server with websocket upgrades. everything happens on
+ * whichever thread calls http_server_poll; nothing here is thread safe */
+
+typedef struct http_server http_server_t;
+typedef struct http_connection http_connection_t;
+
+struct http_header {
+    const char* name;
+    const char* value;
+};
+
+/* only valid for the duration of the callback */
+struct http_server_request {
+    const char* method;
+
+    /* including the query string */
+    const char* path;
+
+    size_t num_headers;
+    const struct http_header* headers;
+
+    /* null terminated for convenience, but can contain nulls */
+    const char* body;
+    size_t body_size;
+};
+
+struct http_server_callbacks {
+    /* must respond with http_server_respond, either before returning or later. further requests on
+     * the same connection wait until it does */
+    void (*on_request)(void* user, http_connection_t* conn, const struct http_server_request* req);
+
+    /* websocket upgrades are refused unless this is set */
+    void (*on_ws_open)(void* user, http_connection_t* conn, const struct http_server_request* req);
+    void (*on_ws_message)(void* user, http_connection_t* conn, const char* data, size_t size,
+                          bool text);
+
+    /* any connection, right before it is freed */
+    void (*on_close)(void* user, http_connection_t* conn);
+
+    void* user;
+};
+
+/* port 0 picks a free one; see http_server_get_port */
+http_server_t* http_server_create(const char* address, uint16_t port,
+                                  const struct http_server_callbacks* callbacks);
+
+void http_server_free(http_server_t* server);
+
+uint16_t http_server_get_port(const http_server_t* server);
+
+/* waits at most timeout_ms (-1 forever) for activity and handles it */
+bool http_server_poll(http_server_t* server, int32_t timeout_ms);
+
+/* case insensitive; NULL if missing */
+const char* http_server_get_header(const struct http_server_request* req, const char* name);
+
+/* content_type can be NULL when there is no body */
+bool http_server_respond(http_connection_t* conn, uint32_t status, const char* content_type,
+                         const void* body, size_t size);
+
+bool http_server_ws_send(http_connection_t* conn, const void* data, size_t size, bool text);
+
+/* flushes anything queued, then closes */
+void http_server_close(http_connection_t* conn);
+
+void http_connection_set_user(http_connection_t* conn, void* user);
+void* http_connection_get_user(const http_connection_t* conn);
+
+#endif
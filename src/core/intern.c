@@ -0,0 +1,72 @@
+#include "intern.h"
+
+#include "hashmap.h"
+
+#include <assert.h>
+#include <pthread.h>
+
+#include <nyoravim/mem.h>
+#include <nyoravim/util.h>
+
+/* keys are the canonical copies; values are unused */
+HASHMAP_DECLARE(intern_map, const char*, bool, hashmap_hash_string, HASHMAP_EQUALS_STRING)
+
+static pthread_rwlock_t table_lock = PTHREAD_RWLOCK_INITIALIZER;
+static intern_map_t table = { 0 };
+
+static const char* find_locked(const char* str) {
+    bool* value = intern_map_get(&table, str);
+    if (!value) {
+        return NULL;
+    }
+
+    /* keys and values share a slot index */
+    return table.keys[value - table.values];
+}
+
+const char* intern(const char* str) {
+    assert(str);
+
+    const char* found = intern_find(str);
+    if (found) {
+        return found;
+    }
+
+    pthread_rwlock_wrlock(&table_lock);
+
+    /* someone may have added it between the locks */
+    found = find_locked(str);
+    if (!found) {
+        found = nv_strdup(str);
+        assert(found);
+
+        intern_map_insert(&table, found, true);
+    }
+
+    pthread_rwlock_unlock(&table_lock);
+    return found;
+}
+
+const char* intern_find(const char* str) {
+    if (!str) {
+        return NULL;
+    }
+
+    pthread_rwlock_rdlock(&table_lock);
+    const char* found = find_locked(str);
+    pthread_rwlock_unlock(&table_lock);
+
+    return found;
+}
+
+void intern_shutdown() {
+    pthread_rwlock_wrlock(&table_lock);
+
+    HASHMAP_FOR_EACH(&table, i) {
+        nv_free((void*)table.keys[i]);
+    }
+
+    intern_map_free(&table);
+
+    pthread_rwlock_unlock(&table_lock);
+}
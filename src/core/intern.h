@@ -0,0 +1,24 @@
+#ifndef _INTERN_H
+#define _INTERN_H
+
+#include <stdbool.h>
+
+/* process wide table of canonical copies of strings, so that names known ahead of time compare
+ * by pointer. the table only grows: interned strings live until intern_shutdown, and two interned
+ * strings are equal exactly when they are the same pointer.
+ *
+ * names are interned when something is registered under them, e.g. commands and their options.
+ * inbound names from events are only looked up, never added, so the table stays bounded by what
+ * the bot registered and resolving a name allocates nothing. lookups take a read lock and may
+ * come from any thread */
+
+/* returns the canonical copy of str, adding it if it is new */
+const char* intern(const char* str);
+
+/* the canonical copy of str, or NULL if it was never interned */
+const char* intern_find(const char* str);
+
+/* frees every interned string; nothing may hold one past this */
+void intern_shutdown();
+
+#endif
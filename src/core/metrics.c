@@ -0,0 +1,446 @@
+/* https://prometheus.io/docs/instrumenting/exposition_formats/ */
+
+#include "metrics.h"
+
+#include "http_server.h"
+
+#include <log.h>
+
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <nyoravim/mem.h>
+#include <nyoravim/util.h>
+
+/* four buckets per power of two; values below 4 get one each */
+#define SUB_BUCKET_BITS 2
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define NUM_BUCKETS ((64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS)
+
+#define SERVER_POLL_MS 200
+
+typedef struct metric {
+    char* labels;
+    uint64_t hash;
+
+    /* counter value, or histogram observation count */
+    atomic_uint_fast64_t count;
+    atomic_int_fast64_t gauge;
+
+    /* histograms only */
+    atomic_uint_fast64_t sum;
+    atomic_uint_fast64_t* buckets;
+} metric_t;
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct metric_family* families = NULL;
+
+static uint64_t hash_labels(const char* labels) {
+    /* fnv-1a */
+    uint64_t hash = 14695981039346656037ull;
+    for (const char* c = labels; *c; c++) {
+        hash = (hash ^ (uint8_t)*c) * 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static metric_t* find_series(struct metric_family* family, const char* labels, uint64_t hash,
+                             size_t* free_slot) {
+    for (size_t i = 0; i < METRIC_MAX_SERIES; i++) {
+        size_t slot = (hash + i) & (METRIC_MAX_SERIES - 1);
+
+        metric_t* metric = atomic_load_explicit(&family->series[slot], memory_order_acquire);
+        if (!metric) {
+            *free_slot = slot;
+            return NULL;
+        }
+
+        if (metric->hash == hash && strcmp(metric->labels, labels) == 0) {
+            return metric;
+        }
+    }
+
+    *free_slot = METRIC_MAX_SERIES;
+    return NULL;
+}
+
+static metric_t* create_series(const struct metric_family* family, const char* labels,
+                               uint64_t hash) {
+    metric_t* metric = nv_alloc(sizeof(metric_t));
+    assert(metric);
+    memset(metric, 0, sizeof(metric_t));
+
+    metric->labels = nv_strdup(labels);
+    metric->hash = hash;
+
+    atomic_init(&metric->count, 0);
+    atomic_init(&metric->gauge, 0);
+    atomic_init(&metric->sum, 0);
+
+    if (family->type == METRIC_HISTOGRAM) {
+        metric->buckets = nv_alloc(NUM_BUCKETS * sizeof(atomic_uint_fast64_t));
+        assert(metric->buckets);
+
+        for (size_t i = 0; i < NUM_BUCKETS; i++) {
+            atomic_init(&metric->buckets[i], 0);
+        }
+    }
+
+    return metric;
+}
+
+metric_t* metric_get(struct metric_family* family, const char* labels) {
+    if (!labels) {
+        labels = "";
+    }
+
+    uint64_t hash = hash_labels(labels);
+
+    size_t free_slot;
+    metric_t* metric = find_series(family, labels, hash, &free_slot);
+    if (metric) {
+        return metric;
+    }
+
+    /* slow path; only the first time a label set is seen */
+    pthread_mutex_lock(&registry_mutex);
+
+    if (!atomic_load_explicit(&family->registered, memory_order_relaxed)) {
+        family->next = families;
+        families = family;
+
+        atomic_store_explicit(&family->registered, true, memory_order_release);
+    }
+
+    metric = find_series(family, labels, hash, &free_slot);
+    if (!metric && free_slot < METRIC_MAX_SERIES) {
+        metric = create_series(family, labels, hash);
+        atomic_store_explicit(&family->series[free_slot], metric, memory_order_release);
+    } else if (!metric) {
+        log_warn("metric %s has too many series; dropping {%s}", family->name, labels);
+    }
+
+    pthread_mutex_unlock(&registry_mutex);
+    return metric;
+}
+
+void metric_add(metric_t* metric, uint64_t value) {
+    if (metric) {
+        atomic_fetch_add_explicit(&metric->count, value, memory_order_relaxed);
+    }
+}
+
+void metric_inc(metric_t* metric) { metric_add(metric, 1); }
+
+void metric_set(metric_t* metric, int64_t value) {
+    if (metric) {
+        atomic_store_explicit(&metric->gauge, value, memory_order_relaxed);
+    }
+}
+
+void metric_gauge_add(metric_t* metric, int64_t value) {
+    if (metric) {
+        atomic_fetch_add_explicit(&metric->gauge, value, memory_order_relaxed);
+    }
+}
+
+static size_t get_bucket_index(uint64_t value) {
+    if (value < SUB_BUCKETS) {
+        return (size_t)value;
+    }
+
+    uint32_t exponent = 63 - (uint32_t)__builtin_clzll(value);
+    size_t sub_bucket = (size_t)(value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+
+    return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub_bucket;
+}
+
+/* largest value that lands in the bucket */
+static uint64_t get_bucket_max(size_t index) {
+    if (index < SUB_BUCKETS) {
+        return index;
+    }
+
+    uint32_t exponent = (uint32_t)(index / SUB_BUCKETS) + SUB_BUCKET_BITS - 1;
+    uint64_t sub_bucket = index % SUB_BUCKETS;
+
+    uint64_t width = 1ull << (exponent - SUB_BUCKET_BITS);
+    return (SUB_BUCKETS + sub_bucket + 1) * width - 1;
+}
+
+void metric_observe(metric_t* metric, uint64_t value) {
+    if (!metric || !metric->buckets) {
+        return;
+    }
+
+    atomic_fetch_add_explicit(&metric->buckets[get_bucket_index(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&metric->sum, value, memory_order_relaxed);
+    atomic_fetch_add_explicit(&metric->count, 1, memory_order_relaxed);
+}
+
+uint64_t metric_quantile(const metric_t* metric, double quantile) {
+    if (!metric || !metric->buckets) {
+        return 0;
+    }
+
+    uint64_t counts[NUM_BUCKETS];
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        counts[i] = atomic_load_explicit(&metric->buckets[i], memory_order_relaxed);
+        total += counts[i];
+    }
+
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(quantile * (double)total);
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen > rank) {
+            return get_bucket_max(i);
+        }
+    }
+
+    return get_bucket_max(NUM_BUCKETS - 1);
+}
+
+struct text_buffer {
+    char* data;
+    size_t length, capacity;
+};
+
+static void append(struct text_buffer* buffer, const char* format, ...) {
+    while (true) {
+        va_list args;
+        va_start(args, format);
+
+        size_t available = buffer->capacity - buffer->length;
+        int written = vsnprintf(buffer->data + buffer->length, available, format, args);
+        va_end(args);
+
+        assert(written >= 0);
+        if ((size_t)written < available) {
+            buffer->length += (size_t)written;
+            return;
+        }
+
+        buffer->capacity = buffer->capacity * 2 + (size_t)written;
+        buffer->data = nv_realloc(buffer->data, buffer->capacity);
+        assert(buffer->data);
+    }
+}
+
+/* name{labels,extra} with the comma only when both are present */
+static void append_series_name(struct text_buffer* buffer, const char* name, const char* suffix,
+                               const char* labels, const char* extra) {
+    bool has_labels = labels[0] != '\0';
+    bool has_extra = extra && extra[0] != '\0';
+
+    append(buffer, "%s%s", name, suffix);
+    if (has_labels || has_extra) {
+        append(buffer, "{%s%s%s}", labels, has_labels && has_extra ? "," : "",
+               has_extra ? extra : "");
+    }
+}
+
+static void render_histogram(struct text_buffer* buffer, const struct metric_family* family,
+                             const metric_t* metric) {
+    uint64_t counts[NUM_BUCKETS];
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        counts[i] = atomic_load_explicit(&metric->buckets[i], memory_order_relaxed);
+    }
+
+    uint64_t cumulative = 0;
+    size_t bucket = 0;
+
+    char le[64];
+    for (uint32_t exponent = family->min_exponent; exponent <= family->max_exponent; exponent++) {
+        uint64_t bound = 1ull << exponent;
+
+        /* bucket boundaries line up with powers of two */
+        while (bucket < NUM_BUCKETS && get_bucket_max(bucket) < bound) {
+            cumulative += counts[bucket++];
+        }
+
+        snprintf(le, sizeof(le), "le=\"%.9g\"", (double)bound * family->scale);
+        append_series_name(buffer, family->name, "_bucket", metric->labels, le);
+        append(buffer, " %" PRIu64 "\n", cumulative);
+    }
+
+    uint64_t count = 0;
+    for (size_t i = 0; i < NUM_BUCKETS; i++) {
+        count += counts[i];
+    }
+
+    append_series_name(buffer, family->name, "_bucket", metric->labels, "le=\"+Inf\"");
+    append(buffer, " %" PRIu64 "\n", count);
+
+    uint64_t sum = atomic_load_explicit(&metric->sum, memory_order_relaxed);
+    append_series_name(buffer, family->name, "_sum", metric->labels, NULL);
+    append(buffer, " %.9g\n", (double)sum * family->scale);
+
+    append_series_name(buffer, family->name, "_count", metric->labels, NULL);
+    append(buffer, " %" PRIu64 "\n", count);
+}
+
+static const char* get_type_name(uint32_t type) {
+    switch (type) {
+    case METRIC_COUNTER:
+        return "counter";
+    case METRIC_GAUGE:
+        return "gauge";
+    case METRIC_HISTOGRAM:
+        return "histogram";
+    default:
+        return "untyped";
+    }
+}
+
+char* metrics_render(size_t* length) {
+    struct text_buffer buffer;
+    buffer.length = 0;
+    buffer.capacity = 4096;
+    buffer.data = nv_alloc(buffer.capacity);
+    assert(buffer.data);
+
+    buffer.data[0] = '\0';
+
+    /* series are never removed, so holding the lock only keeps the family list stable */
+    pthread_mutex_lock(&registry_mutex);
+
+    for (const struct metric_family* family = families; family; family = family->next) {
+        append(&buffer, "# HELP %s %s\n", family->name, family->help);
+        append(&buffer, "# TYPE %s %s\n", family->name, get_type_name(family->type));
+
+        for (size_t i = 0; i < METRIC_MAX_SERIES; i++) {
+            const metric_t* metric =
+                atomic_load_explicit(&family->series[i], memory_order_acquire);
+
+            if (!metric) {
+                continue;
+            }
+
+            switch (family->type) {
+            case METRIC_COUNTER:
+                append_series_name(&buffer, family->name, "", metric->labels, NULL);
+                append(&buffer, " %" PRIu64 "\n",
+                       (uint64_t)atomic_load_explicit(&metric->count, memory_order_relaxed));
+
+                break;
+            case METRIC_GAUGE:
+                append_series_name(&buffer, family->name, "", metric->labels, NULL);
+                append(&buffer, " %" PRId64 "\n",
+                       (int64_t)atomic_load_explicit(&metric->gauge, memory_order_relaxed));
+
+                break;
+            case METRIC_HISTOGRAM:
+                render_histogram(&buffer, family, metric);
+                break;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&registry_mutex);
+
+    *length = buffer.length;
+    return buffer.data;
+}
+
+struct metrics_server {
+    http_server_t* http;
+    pthread_t thread;
+
+    atomic_bool running;
+};
+
+static struct metrics_server* server = NULL;
+
+static void on_request(void* user, http_connection_t* conn, const struct http_server_request* req) {
+    if (strcmp(req->method, "GET") != 0) {
+        http_server_respond(conn, 405, NULL, NULL, 0);
+        return;
+    }
+
+    if (strcmp(req->path, "/metrics") != 0) {
+        http_server_respond(conn, 404, NULL, NULL, 0);
+        return;
+    }
+
+    size_t length;
+    char* text = metrics_render(&length);
+
+    http_server_respond(conn, 200, "text/plain; version=0.0.4", text, length);
+    nv_free(text);
+}
+
+static void* server_thread(void* arg) {
+    struct metrics_server* ms = arg;
+    while (atomic_load(&ms->running)) {
+        if (!http_server_poll(ms->http, SERVER_POLL_MS)) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+bool metrics_serve(const char* address, uint16_t port) {
+    if (server) {
+        log_warn("metrics already being served");
+        return false;
+    }
+
+    struct http_server_callbacks callbacks;
+    memset(&callbacks, 0, sizeof(struct http_server_callbacks));
+    callbacks.on_request = on_request;
+
+    http_server_t* http = http_server_create(address, port, &callbacks);
+    if (!http) {
+        log_error("failed to start metrics server");
+        return false;
+    }
+
+    struct metrics_server* ms = nv_alloc(sizeof(struct metrics_server));
+    assert(ms);
+
+    ms->http = http;
+    atomic_init(&ms->running, true);
+
+    if (pthread_create(&ms->thread, NULL, server_thread, ms) != 0) {
+        log_error("failed to start metrics thread");
+
+        http_server_free(http);
+        nv_free(ms);
+
+        return false;
+    }
+
+    log_info("serving metrics at http://%s:%" PRIu16 "/metrics", address,
+             http_server_get_port(http));
+
+    server = ms;
+    return true;
+}
+
+void metrics_stop() {
+    if (!server) {
+        return;
+    }
+
+    atomic_store(&server->running, false);
+    pthread_join(server->thread, NULL);
+
+    http_server_free(server->http);
+    nv_free(server);
+
+    server = NULL;
+}
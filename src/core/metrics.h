@@ -0,0 +1,72 @@
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/* process wide counters, gauges and log-bucketed histograms, exposed in prometheus text format.
+ * families are declared statically where they are used and register themselves on first use.
+ * looking up a labeled series is lock free once it exists, and updating one is a relaxed atomic,
+ * so recording from hot paths is cheap */
+
+enum {
+    METRIC_COUNTER,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM,
+};
+
+/* distinct label sets per family; past this, new series are dropped */
+#define METRIC_MAX_SERIES 256
+
+typedef struct metric metric_t;
+
+struct metric_family {
+    const char* name;
+    const char* help;
+    uint32_t type;
+
+    /* histograms only. raw values are multiplied by scale for exposition (1e-9 turns nanoseconds
+     * into seconds) and buckets are exported at powers of two from 2^min_exponent to
+     * 2^max_exponent raw units */
+    double scale;
+    uint8_t min_exponent, max_exponent;
+
+    /* private */
+    atomic_bool registered;
+    struct metric_family* next;
+    _Atomic(metric_t*) series[METRIC_MAX_SERIES];
+};
+
+#define METRIC_COUNTER_FAMILY(name, help) { (name), (help), METRIC_COUNTER, 1, 0, 0 }
+#define METRIC_GAUGE_FAMILY(name, help) { (name), (help), METRIC_GAUGE, 1, 0, 0 }
+
+/* observed in nanoseconds, exported in seconds from 1us to about 34s */
+#define METRIC_LATENCY_FAMILY(name, help) { (name), (help), METRIC_HISTOGRAM, 1e-9, 10, 35 }
+
+/* labels is the inside of the braces, e.g. `route="/users/:id",status="200"`, or NULL. values must
+ * already be escaped. returns NULL once the family is full; every function below accepts NULL as
+ * a no-op so that degrades quietly */
+metric_t* metric_get(struct metric_family* family, const char* labels);
+
+void metric_add(metric_t* metric, uint64_t value);
+void metric_inc(metric_t* metric);
+
+void metric_set(metric_t* metric, int64_t value);
+void metric_gauge_add(metric_t* metric, int64_t value);
+
+void metric_observe(metric_t* metric, uint64_t value);
+
+/* approximate, from the buckets; within about 20% */
+uint64_t metric_quantile(const metric_t* metric, double quantile);
+
+/* prometheus text exposition of every registered family. allocated with nv_alloc */
+char* metrics_render(size_t* length);
+
+/* serves metrics_render at /metrics from a background thread. address should usually be
+ * 127.0.0.1 */
+bool metrics_serve(const char* address, uint16_t port);
+void metrics_stop();
+
+#endif
@@ -0,0 +1,181 @@
+#include "record.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <nyoravim/mem.h>
+
+size_t record_encode_varint(uint64_t value, uint8_t* dst) {
+    size_t size = 0;
+    while (value >= 0x80) {
+        dst[size++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+
+    dst[size++] = (uint8_t)value;
+    return size;
+}
+
+size_t record_decode_varint(const uint8_t* src, size_t size, uint64_t* value) {
+    uint64_t result = 0;
+
+    size_t max_size = size < RECORD_MAX_VARINT_SIZE ? size : RECORD_MAX_VARINT_SIZE;
+    for (size_t i = 0; i < max_size; i++) {
+        uint8_t byte = src[i];
+        result |= (uint64_t)(byte & 0x7F) << (i * 7);
+
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return i + 1;
+        }
+    }
+
+    /* ran out of input or the varint does not fit in 64 bits */
+    return 0;
+}
+
+void record_writer_init(struct record_writer* writer, size_t initial_capacity) {
+    writer->size = 0;
+    writer->capacity = initial_capacity > 0 ? initial_capacity : 64;
+
+    writer->data = nv_alloc(writer->capacity);
+    assert(writer->data);
+}
+
+void record_writer_cleanup(const struct record_writer* writer) { nv_free(writer->data); }
+
+uint8_t* record_writer_release(struct record_writer* writer, size_t* size) {
+    uint8_t* data = writer->data;
+    *size = writer->size;
+
+    writer->data = NULL;
+    writer->size = 0;
+    writer->capacity = 0;
+
+    return data;
+}
+
+static void reserve(struct record_writer* writer, size_t additional) {
+    size_t required = writer->size + additional;
+    if (required <= writer->capacity) {
+        return;
+    }
+
+    size_t capacity = writer->capacity > 0 ? writer->capacity : 64;
+    while (capacity < required) {
+        capacity *= 2;
+    }
+
+    writer->data = writer->data ? nv_realloc(writer->data, capacity) : nv_alloc(capacity);
+    assert(writer->data);
+
+    writer->capacity = capacity;
+}
+
+void record_write_raw(struct record_writer* writer, const void* data, size_t size) {
+    if (size == 0) {
+        return;
+    }
+
+    reserve(writer, size);
+    memcpy(writer->data + writer->size, data, size);
+    writer->size += size;
+}
+
+void record_write_varint(struct record_writer* writer, uint64_t value) {
+    reserve(writer, RECORD_MAX_VARINT_SIZE);
+    writer->size += record_encode_varint(value, writer->data + writer->size);
+}
+
+static void write_key(struct record_writer* writer, uint32_t id, uint32_t wire_type) {
+    record_write_varint(writer, ((uint64_t)id << 3) | wire_type);
+}
+
+void record_write_uint(struct record_writer* writer, uint32_t id, uint64_t value) {
+    write_key(writer, id, RECORD_WIRE_VARINT);
+    record_write_varint(writer, value);
+}
+
+void record_write_bytes(struct record_writer* writer, uint32_t id, const void* data, size_t size) {
+    write_key(writer, id, RECORD_WIRE_BYTES);
+    record_write_varint(writer, size);
+    record_write_raw(writer, data, size);
+}
+
+void record_write_string(struct record_writer* writer, uint32_t id, const char* str) {
+    if (!str) {
+        return;
+    }
+
+    record_write_bytes(writer, id, str, strlen(str));
+}
+
+void record_reader_init(struct record_reader* reader, const void* data, size_t size) {
+    reader->data = data;
+    reader->size = size;
+    reader->offset = 0;
+}
+
+bool record_read_varint(struct record_reader* reader, uint64_t* value) {
+    size_t consumed = record_decode_varint(reader->data + reader->offset,
+                                           reader->size - reader->offset, value);
+
+    reader->offset += consumed;
+    return consumed > 0;
+}
+
+bool record_read_field(struct record_reader* reader, struct record_field* field) {
+    if (record_reader_done(reader)) {
+        return false;
+    }
+
+    uint64_t key;
+    if (!record_read_varint(reader, &key)) {
+        return false;
+    }
+
+    field->id = (uint32_t)(key >> 3);
+    field->wire_type = (uint32_t)(key & 0x7);
+
+    switch (field->wire_type) {
+    case RECORD_WIRE_VARINT:
+        field->bytes = NULL;
+        field->length = 0;
+
+        return record_read_varint(reader, &field->value);
+    case RECORD_WIRE_BYTES: {
+        uint64_t length;
+        if (!record_read_varint(reader, &length) || length > reader->size - reader->offset) {
+            return false;
+        }
+
+        field->value = 0;
+        field->bytes = reader->data + reader->offset;
+        field->length = (size_t)length;
+
+        reader->offset += field->length;
+        return true;
+    }
+    default:
+        /* unknown wire types cannot be skipped */
+        return false;
+    }
+}
+
+bool record_reader_done(const struct record_reader* reader) {
+    return reader->offset >= reader->size;
+}
+
+char* record_field_dup_string(const struct record_field* field) {
+    if (field->wire_type != RECORD_WIRE_BYTES) {
+        return NULL;
+    }
+
+    char* str = nv_alloc(field->length + 1);
+    assert(str);
+
+    memcpy(str, field->bytes, field->length);
+    str[field->length] = '\0';
+
+    return str;
+}
@@ -0,0 +1,75 @@
+#ifndef _RECORD_H
+#define _RECORD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* compact binary records. every field is a varint key (field id << 3 | wire type) followed by
+ * either a varint or a varint length and that many bytes. unknown field ids are skipped on read so
+ * new fields can be added without bumping the record version */
+
+enum {
+    RECORD_WIRE_VARINT = 0,
+    RECORD_WIRE_BYTES = 2,
+};
+
+/* a uint64 never takes more than 10 bytes as a varint */
+#define RECORD_MAX_VARINT_SIZE 10
+
+struct record_writer {
+    /* allocated with nv_alloc; owned by the writer until record_writer_release */
+    uint8_t* data;
+    size_t size, capacity;
+};
+
+struct record_reader {
+    const uint8_t* data;
+    size_t size, offset;
+};
+
+struct record_field {
+    uint32_t id;
+    uint32_t wire_type;
+
+    /* set for RECORD_WIRE_VARINT */
+    uint64_t value;
+
+    /* set for RECORD_WIRE_BYTES; points into the reader's buffer */
+    const void* bytes;
+    size_t length;
+};
+
+/* raw varints. encode returns the number of bytes written (dst must hold RECORD_MAX_VARINT_SIZE).
+ * decode returns the number of bytes consumed, or 0 if the varint is truncated or too long */
+size_t record_encode_varint(uint64_t value, uint8_t* dst);
+size_t record_decode_varint(const uint8_t* src, size_t size, uint64_t* value);
+
+void record_writer_init(struct record_writer* writer, size_t initial_capacity);
+void record_writer_cleanup(const struct record_writer* writer);
+
+/* hands the buffer to the caller (free with nv_free) and resets the writer */
+uint8_t* record_writer_release(struct record_writer* writer, size_t* size);
+
+void record_write_raw(struct record_writer* writer, const void* data, size_t size);
+void record_write_varint(struct record_writer* writer, uint64_t value);
+
+void record_write_uint(struct record_writer* writer, uint32_t id, uint64_t value);
+void record_write_bytes(struct record_writer* writer, uint32_t id, const void* data, size_t size);
+
+/* no-op if str is NULL */
+void record_write_string(struct record_writer* writer, uint32_t id, const char* str);
+
+void record_reader_init(struct record_reader* reader, const void* data, size_t size);
+
+bool record_read_varint(struct record_reader* reader, uint64_t* value);
+
+/* returns false at the end of the record or on malformed input; check record_reader_done to tell
+ * the two apart */
+bool record_read_field(struct record_reader* reader, struct record_field* field);
+bool record_reader_done(const struct record_reader* reader);
+
+/* allocated with nv_alloc; NULL if the field is not a byte field */
+char* record_field_dup_string(const struct record_field* field);
+
+#endif
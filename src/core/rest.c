@@ -1,6 +1,10 @@
 /* https://curl.se/libcurl/c/multi-app.html */
 
 #include "rest.h"
+#include "clock.h"
+#include "hashmap.h"
+#include "metrics.h"
+#include "trace.h"
 
 #include <log.h>
 
@@ -9,11 +13,17 @@
 #include <assert.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdio.h>
 
 #include <nyoravim/mem.h>
-#include <nyoravim/map.h>
 #include <nyoravim/util.h>
 
+/* method and templated route; the status is appended when the request finishes */
+#define MAX_LABELS_LENGTH 384
+
+/* path segments at least this long are tokens rather than names */
+#define MIN_TOKEN_LENGTH 32
+
 struct request {
     void* body;
     size_t body_size, body_offset;
@@ -22,8 +32,20 @@ struct request {
     struct curl_slist* headers;
 
     struct rest_callbacks callbacks;
+
+    uint64_t start_ns;
+    char labels[MAX_LABELS_LENGTH];
+
+    /* of whatever sent the request; 0 if untraced */
+    uint64_t trace_id;
 };
 
+static struct metric_family request_duration = METRIC_LATENCY_FAMILY(
+    "tasks_rest_request_duration_seconds", "REST request latency by method, route and status");
+
+static struct metric_family inflight_requests =
+    METRIC_GAUGE_FAMILY("tasks_rest_inflight_requests", "REST requests waiting on a response");
+
 static void free_request(CURLM* multi, struct request* req) {
     curl_multi_remove_handle(multi, req->handle);
     curl_easy_cleanup(req->handle);
@@ -33,15 +55,13 @@ static void free_request(CURLM* multi, struct request* req) {
     nv_free(req);
 }
 
-/* user: CURLM*
- * value: struct request* */
-static void rest_free_value(void* user, void* value) { free_request(user, value); }
+HASHMAP_DECLARE(request_map, CURL*, struct request*, hashmap_hash_ptr, HASHMAP_EQUALS_SCALAR)
 
 typedef struct rest {
     CURLM* multi;
 
     /* the CURL handle also serves as the key to the request state */
-    nv_map_t* requests;
+    request_map_t requests;
 } rest_t;
 
 static uint32_t curl_refs = 0;
@@ -92,18 +112,11 @@ rest_t* rest_init() {
         return NULL;
     }
 
-    struct nv_map_callbacks callbacks;
-    memset(&callbacks, 0, sizeof(struct nv_map_callbacks));
-
-    callbacks.user = multi;
-    callbacks.free_value = rest_free_value;
-
     rest_t* rest = nv_alloc(sizeof(rest_t));
     assert(rest);
 
     rest->multi = multi;
-    rest->requests = nv_map_alloc(64, &callbacks);
-    assert(rest->requests);
+    request_map_init(&rest->requests);
 
     return rest;
 }
@@ -113,23 +126,61 @@ void rest_shutdown(rest_t* rest) {
         return;
     }
 
-    nv_map_free(rest->requests);
+    HASHMAP_FOR_EACH(&rest->requests, i) {
+        free_request(rest->multi, rest->requests.values[i]);
+    }
+
+    request_map_free(&rest->requests);
     curl_multi_cleanup(rest->multi);
 
     nv_free(rest);
     rest_curl_unref();
 }
 
+static void trace_request(const struct request* req, uint64_t now) {
+    if (req->trace_id == 0) {
+        return;
+    }
+
+    /* curl times from the start of the transfer. everything before pretransfer is waiting on the
+     * multi handle, dns, connecting and tls; everything after is the request itself */
+    curl_off_t total_us = 0, pretransfer_us = 0;
+    curl_easy_getinfo(req->handle, CURLINFO_TOTAL_TIME_T, &total_us);
+    curl_easy_getinfo(req->handle, CURLINFO_PRETRANSFER_TIME_T, &pretransfer_us);
+
+    uint64_t transfer_ns = (uint64_t)(total_us - pretransfer_us) * 1000;
+    uint64_t transfer_start = now - req->start_ns > transfer_ns ? now - transfer_ns : req->start_ns;
+
+    trace_record("rest_request", req->trace_id, req->start_ns, now);
+    trace_record("rest_queue", req->trace_id, req->start_ns, transfer_start);
+    trace_record("curl_transfer", req->trace_id, transfer_start, now);
+}
+
+static void record_request(const struct request* req, long status) {
+    char labels[MAX_LABELS_LENGTH + 32];
+    snprintf(labels, sizeof(labels), "%s,status=\"%ld\"", req->labels, status);
+
+    uint64_t now = time_now_ns();
+    metric_observe(metric_get(&request_duration, labels), now - req->start_ns);
+    metric_gauge_add(metric_get(&inflight_requests, NULL), -1);
+
+    trace_request(req, now);
+}
+
 static bool dispatch_done(rest_t* rest, CURL* handle, CURLcode code) {
-    struct request* req;
-    if (!nv_map_get(rest->requests, handle, (void**)&req)) {
+    struct request** slot = request_map_get(&rest->requests, handle);
+    if (!slot) {
         return false;
     }
 
-    if (req->callbacks.done_callback) {
-        long status;
-        curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status);
+    struct request* req = *slot;
+
+    /* 0 if no response arrived at all */
+    long status = 0;
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status);
+    record_request(req, status);
 
+    if (req->callbacks.done_callback) {
         req->callbacks.done_callback(req->callbacks.user, code, (int64_t)status);
     } else if (code != CURLE_OK) {
         log_error("curl error: %s", curl_easy_strerror(code));
@@ -167,7 +218,10 @@ bool rest_poll(rest_t* rest) {
             log_warn("failed to dispatch \"done\" message on rest request");
         }
 
-        nv_map_remove(rest->requests, msg->easy_handle);
+        struct request* req;
+        if (request_map_remove(&rest->requests, msg->easy_handle, &req)) {
+            free_request(rest->multi, req);
+        }
     }
 
     return true;
@@ -213,6 +267,71 @@ static char* str_to_upper(const char* str) {
     return block;
 }
 
+static bool is_numeric(const char* str, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (!isdigit((unsigned char)str[i])) {
+            return false;
+        }
+    }
+
+    return length > 0;
+}
+
+/* /api/v10/interactions/123/<token>/callback becomes /interactions/:id/:token/callback. raw ids
+ * and tokens would make every request its own series */
+static void make_route(const char* url, char* dst, size_t capacity) {
+    const char* path = strstr(url, "://");
+    path = path ? strchr(path + 3, '/') : url;
+
+    if (!path) {
+        path = "/";
+    }
+
+    if (strncmp(path, "/api/", 5) == 0) {
+        path += 4;
+    }
+
+    if (path[0] == '/' && path[1] == 'v' && isdigit((unsigned char)path[2])) {
+        const char* slash = strchr(path + 1, '/');
+        path = slash ? slash : "/";
+    }
+
+    size_t length = 0;
+    while (*path && *path != '?' && length + 1 < capacity) {
+        /* path points at a slash */
+        dst[length++] = *path++;
+
+        size_t segment_length = strcspn(path, "/?");
+        const char* replacement = NULL;
+
+        if (is_numeric(path, segment_length)) {
+            replacement = ":id";
+        } else if (segment_length >= MIN_TOKEN_LENGTH) {
+            replacement = ":token";
+        }
+
+        if (replacement) {
+            size_t replacement_length = strlen(replacement);
+            if (length + replacement_length + 1 >= capacity) {
+                break;
+            }
+
+            memcpy(dst + length, replacement, replacement_length);
+            length += replacement_length;
+        } else {
+            for (size_t i = 0; i < segment_length && length + 1 < capacity; i++) {
+                /* keep the label value valid without escaping */
+                char c = path[i];
+                dst[length++] = (c == '"' || c == '\\') ? '_' : c;
+            }
+        }
+
+        path += segment_length;
+    }
+
+    dst[length] = '\0';
+}
+
 static struct curl_slist* create_header_list(const char* const* headers, size_t num) {
     struct curl_slist* list = NULL;
 
@@ -234,6 +353,9 @@ bool rest_send(rest_t* rest, const struct http_request* spec,
         return NULL;
     }
 
+    struct trace_span span;
+    trace_begin(&span, "rest_send");
+
     struct request* req = nv_alloc(sizeof(struct request));
     assert(req);
 
@@ -241,11 +363,17 @@ bool rest_send(rest_t* rest, const struct http_request* spec,
 
     req->handle = handle;
     req->body_offset = 0;
+    req->start_ns = time_now_ns();
+    req->trace_id = span.trace_id;
     req->headers = create_header_list(spec->headers, spec->num_headers);
 
     char* method_upper = str_to_upper(spec->method);
     bool is_get = strcmp(method_upper, "GET") == 0;
 
+    char route[256];
+    make_route(spec->url, route, sizeof(route));
+    snprintf(req->labels, sizeof(req->labels), "method=\"%s\",route=\"%s\"", method_upper, route);
+
     /* get method should send no data */
     if (is_get || spec->size == 0) {
         req->body_size = 0;
@@ -268,9 +396,11 @@ bool rest_send(rest_t* rest, const struct http_request* spec,
     curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, method_upper);
     curl_easy_setopt(handle, CURLOPT_HTTPHEADER, req->headers);
 
-    if (strcmp(method_upper, "POST") == 0) {
+    /* the size is known up front, so send a content length rather than a chunked body. custom
+     * methods such as patch only carry a body when curl is told to post one */
+    if (strcmp(method_upper, "POST") == 0 || req->body_size > 0) {
         curl_easy_setopt(handle, CURLOPT_POST, 1L);
-        curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE, -1L);
+        curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)req->body_size);
     }
 
     curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, rest_write_callback);
@@ -280,9 +410,14 @@ bool rest_send(rest_t* rest, const struct http_request* spec,
     curl_easy_setopt(handle, CURLOPT_READDATA, req);
 
     curl_multi_add_handle(rest->multi, handle);
-    assert(nv_map_insert(rest->requests, handle, req));
+    /* a fresh handle is never already a key */
+    request_map_insert(&rest->requests, handle, req);
+
+    metric_gauge_add(metric_get(&inflight_requests, NULL), 1);
 
     nv_free(method_upper);
+    trace_end(&span);
+
     return handle;
 }
 
@@ -0,0 +1,363 @@
+/* the slot protocol is dmitry vyukov's bounded mpmc queue:
+ * https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue */
+
+#include "shm_ring.h"
+
+#include "clock.h"
+
+#include <log.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <nyoravim/mem.h>
+#include <nyoravim/util.h>
+
+/* "tskring1" */
+#define RING_MAGIC 0x74736b72696e6731ull
+
+#define CACHE_LINE 64
+
+/* tries before a consumer goes to sleep; a handoff usually lands within these */
+#define SPIN_ITERATIONS 2000
+
+/* lives at the start of the segment. counters that different sides write get their own lines */
+struct ring_header {
+    _Atomic uint64_t magic;
+    uint64_t capacity;
+
+    /* bytes from one slot to the next */
+    uint64_t stride;
+
+    /* next position to push to */
+    alignas(CACHE_LINE) _Atomic uint64_t head;
+
+    /* next position to pop from */
+    alignas(CACHE_LINE) _Atomic uint64_t tail;
+
+    /* futex word, bumped by every push */
+    alignas(CACHE_LINE) _Atomic uint32_t signal;
+    _Atomic uint32_t sleepers;
+
+    /* set by the creator on close; nothing more will be pushed */
+    _Atomic uint32_t retired;
+};
+
+struct ring_slot {
+    /* position + 1 once a message at position is readable; position + capacity once it has been
+     * read and the slot can take the next lap's message */
+    _Atomic uint64_t sequence;
+    uint64_t size;
+
+    uint8_t data[];
+};
+
+typedef struct shm_ring {
+    struct ring_header* header;
+    size_t mapped_size;
+
+    /* NULL unless this process created the segment */
+    char* name;
+
+    /* attached processes only; what the name referred to when it was opened */
+    char* opened_name;
+    dev_t device;
+    ino_t inode;
+} shm_ring_t;
+
+static size_t round_up(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+static size_t get_header_size() { return round_up(sizeof(struct ring_header), CACHE_LINE); }
+
+static struct ring_slot* get_slot(const shm_ring_t* ring, uint64_t position) {
+    const struct ring_header* header = ring->header;
+    size_t index = (size_t)(position & (header->capacity - 1));
+
+    return (struct ring_slot*)((uint8_t*)header + get_header_size() + index * header->stride);
+}
+
+/* shared between processes, so not FUTEX_PRIVATE */
+static void futex_wait(_Atomic uint32_t* word, uint32_t expected, const struct timespec* timeout) {
+    syscall(SYS_futex, word, FUTEX_WAIT, expected, timeout, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t* word, int count) {
+    syscall(SYS_futex, word, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+shm_ring_t* shm_ring_create(const char* name, size_t capacity, size_t slot_size) {
+    size_t rounded = 1;
+    while (rounded < capacity) {
+        rounded <<= 1;
+    }
+
+    size_t stride = round_up(sizeof(struct ring_slot) + slot_size, CACHE_LINE);
+    size_t size = get_header_size() + rounded * stride;
+
+    /* a segment left behind by a crashed creator may be mid-operation; start over */
+    shm_unlink(name);
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        log_error("failed to create shared memory %s: %s", name, strerror(errno));
+        return NULL;
+    }
+
+    if (ftruncate(fd, (off_t)size) != 0) {
+        log_error("failed to size shared memory %s: %s", name, strerror(errno));
+
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        log_error("failed to map shared memory %s: %s", name, strerror(errno));
+
+        shm_unlink(name);
+        return NULL;
+    }
+
+    shm_ring_t* ring = nv_alloc(sizeof(shm_ring_t));
+    assert(ring);
+
+    ring->header = mapping;
+    ring->mapped_size = size;
+    ring->name = nv_strdup(name);
+    ring->opened_name = NULL;
+
+    /* ftruncate zeroed everything else */
+    struct ring_header* header = ring->header;
+    header->capacity = rounded;
+    header->stride = stride;
+
+    for (uint64_t i = 0; i < rounded; i++) {
+        atomic_init(&get_slot(ring, i)->sequence, i);
+    }
+
+    /* last, so nobody attaches to a half built ring */
+    atomic_store_explicit(&header->magic, RING_MAGIC, memory_order_release);
+    return ring;
+}
+
+shm_ring_t* shm_ring_open(const char* name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        log_error("failed to open shared memory %s: %s", name, strerror(errno));
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < get_header_size()) {
+        log_error("shared memory %s is not a ring", name);
+
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)info.st_size;
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        log_error("failed to map shared memory %s: %s", name, strerror(errno));
+        return NULL;
+    }
+
+    struct ring_header* header = mapping;
+    if (atomic_load_explicit(&header->magic, memory_order_acquire) != RING_MAGIC ||
+        get_header_size() + header->capacity * header->stride != size) {
+        log_error("shared memory %s is not a ring, or is still being created", name);
+
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    shm_ring_t* ring = nv_alloc(sizeof(shm_ring_t));
+    assert(ring);
+
+    ring->header = header;
+    ring->mapped_size = size;
+    ring->name = NULL;
+
+    ring->opened_name = nv_strdup(name);
+    ring->device = info.st_dev;
+    ring->inode = info.st_ino;
+
+    return ring;
+}
+
+void shm_ring_close(shm_ring_t* ring) {
+    if (!ring) {
+        return;
+    }
+
+    if (ring->name) {
+        atomic_store(&ring->header->retired, 1);
+        shm_unlink(ring->name);
+    }
+
+    munmap(ring->header, ring->mapped_size);
+
+    nv_free(ring->name);
+    nv_free(ring->opened_name);
+    nv_free(ring);
+}
+
+bool shm_ring_is_current(const shm_ring_t* ring) {
+    if (ring->name) {
+        return true;
+    }
+
+    if (atomic_load(&ring->header->retired)) {
+        return false;
+    }
+
+    /* a creator that crashed never retired its ring, but its successor replaced the name */
+    int fd = shm_open(ring->opened_name, O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    bool current = fstat(fd, &info) == 0 && info.st_dev == ring->device &&
+                   info.st_ino == ring->inode;
+
+    close(fd);
+    return current;
+}
+
+size_t shm_ring_get_max_size(const shm_ring_t* ring) {
+    return ring->header->stride - sizeof(struct ring_slot);
+}
+
+bool shm_ring_push(shm_ring_t* ring, const void* data, size_t size) {
+    if (size > shm_ring_get_max_size(ring)) {
+        return false;
+    }
+
+    struct ring_header* header = ring->header;
+
+    struct ring_slot* slot;
+    uint64_t position = atomic_load_explicit(&header->head, memory_order_relaxed);
+
+    for (;;) {
+        slot = get_slot(ring, position);
+
+        uint64_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        int64_t lag = (int64_t)(sequence - position);
+
+        if (lag == 0) {
+            if (atomic_compare_exchange_weak_explicit(&header->head, &position, position + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (lag < 0) {
+            /* the slot still holds last lap's message */
+            return false;
+        } else {
+            position = atomic_load_explicit(&header->head, memory_order_relaxed);
+        }
+    }
+
+    memcpy(slot->data, data, size);
+    slot->size = size;
+    atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+
+    /* sequentially consistent against the consumer's sleepers then signal, so either it sees
+     * the new signal or we see it sleeping */
+    atomic_fetch_add(&header->signal, 1);
+    if (atomic_load(&header->sleepers) > 0) {
+        futex_wake(&header->signal, 1);
+    }
+
+    return true;
+}
+
+static bool try_pop(shm_ring_t* ring, void* dst, size_t* size) {
+    struct ring_header* header = ring->header;
+
+    struct ring_slot* slot;
+    uint64_t position = atomic_load_explicit(&header->tail, memory_order_relaxed);
+
+    for (;;) {
+        slot = get_slot(ring, position);
+
+        uint64_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        int64_t lag = (int64_t)(sequence - (position + 1));
+
+        if (lag == 0) {
+            if (atomic_compare_exchange_weak_explicit(&header->tail, &position, position + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (lag < 0) {
+            /* nothing published here yet */
+            return false;
+        } else {
+            position = atomic_load_explicit(&header->tail, memory_order_relaxed);
+        }
+    }
+
+    *size = slot->size;
+    memcpy(dst, slot->data, slot->size);
+    atomic_store_explicit(&slot->sequence, position + header->capacity, memory_order_release);
+
+    return true;
+}
+
+bool shm_ring_pop(shm_ring_t* ring, void* dst, size_t* size, int32_t timeout_ms) {
+    for (uint32_t i = 0; i < SPIN_ITERATIONS; i++) {
+        if (try_pop(ring, dst, size)) {
+            return true;
+        }
+    }
+
+    struct ring_header* header = ring->header;
+    uint64_t deadline = time_now_ns() + (uint64_t)(timeout_ms > 0 ? timeout_ms : 0) * 1000000;
+
+    for (;;) {
+        atomic_fetch_add(&header->sleepers, 1);
+        uint32_t signal = atomic_load(&header->signal);
+
+        /* a push between the spin and now would otherwise go unnoticed */
+        bool popped = try_pop(ring, dst, size);
+
+        uint64_t now = time_now_ns();
+        if (!popped && (timeout_ms < 0 || now < deadline)) {
+            struct timespec remaining;
+            remaining.tv_sec = (time_t)((deadline - now) / 1000000000);
+            remaining.tv_nsec = (long)((deadline - now) % 1000000000);
+
+            futex_wait(&header->signal, signal, timeout_ms < 0 ? NULL : &remaining);
+        }
+
+        atomic_fetch_sub(&header->sleepers, 1);
+
+        if (popped) {
+            return true;
+        }
+
+        if (timeout_ms >= 0 && time_now_ns() >= deadline) {
+            return try_pop(ring, dst, size);
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef _SHM_RING_H
+#define _SHM_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* a bounded multi-producer, multi-consumer queue of byte messages in a named POSIX shared memory
+ * segment, for handing work between processes on one host. pushing and popping are lock free: a
+ * slot's sequence number says whether it is ready to be written or read, and producers and
+ * consumers each claim positions with a compare and swap. a consumer that finds the ring empty
+ * spins briefly, then sleeps on a futex in the segment that producers wake.
+ *
+ * messages are copied into fixed size slots, so a message larger than a slot cannot be pushed.
+ * nothing survives a crash of a process holding a claimed slot: a producer that dies between
+ * claiming and publishing stalls consumers at that slot. so a restarted creator makes a new segment
+ * rather than trusting the old one, and processes attached to the old one have to notice with
+ * shm_ring_is_current and open the new one */
+
+typedef struct shm_ring shm_ring_t;
+
+/* replaces any segment by this name. name is as for shm_open, e.g. "/tasks-interactions".
+ * capacity is rounded up to a power of two */
+shm_ring_t* shm_ring_create(const char* name, size_t capacity, size_t slot_size);
+
+/* attaches to a segment made by shm_ring_create */
+shm_ring_t* shm_ring_open(const char* name);
+
+/* unmaps; the creator also retires the ring and removes the name, while attached processes keep
+ * their mapping */
+void shm_ring_close(shm_ring_t* ring);
+
+/* false once the creator has closed the ring, or the name now refers to another segment. what is
+ * left in the ring can still be popped. always true for the creator */
+bool shm_ring_is_current(const shm_ring_t* ring);
+
+/* largest message that fits in a slot */
+size_t shm_ring_get_max_size(const shm_ring_t* ring);
+
+/* false if the ring is full or the message too large */
+bool shm_ring_push(shm_ring_t* ring, const void* data, size_t size);
+
+/* waits at most timeout_ms (-1 forever) for a message and copies it into dst, which must hold
+ * shm_ring_get_max_size bytes. false on timeout */
+bool shm_ring_pop(shm_ring_t* ring, void* dst, size_t* size, int32_t timeout_ms);
+
+#endif
@@ -0,0 +1,286 @@
+/* https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU */
+
+#define _GNU_SOURCE
+
+#include "trace.h"
+
+#include "clock.h"
+#include "metrics.h"
+
+#include <log.h>
+
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/syscall.h>
+
+#include <nyoravim/mem.h>
+
+#define DEFAULT_EVENTS_PER_THREAD 16384
+
+/* fields are relaxed atomics only so that a torn read, which the sequence check then throws away,
+ * is not undefined */
+struct trace_event {
+    /* index + 1 once written, 0 while being written */
+    atomic_uint_fast64_t sequence;
+
+    _Atomic(const char*) name;
+    atomic_uint_fast64_t trace_id;
+    atomic_uint_fast64_t start_ns, end_ns;
+};
+
+/* a plain copy of an event */
+struct trace_event_copy {
+    const char* name;
+    uint64_t trace_id;
+    uint64_t start_ns, end_ns;
+};
+
+struct trace_ring {
+    struct trace_event* events;
+    size_t capacity;
+
+    /* only the owning thread writes */
+    atomic_uint_fast64_t head;
+    pid_t tid;
+
+    struct trace_ring* next;
+};
+
+/* 0 when off. compared against a random 32 bit value */
+static atomic_uint_fast64_t sample_threshold = 0;
+static size_t ring_capacity = DEFAULT_EVENTS_PER_THREAD;
+
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_ring* rings = NULL;
+
+static _Atomic(const char*) pending_dump = NULL;
+
+static _Thread_local struct trace_ring* local_ring = NULL;
+static _Thread_local uint64_t current_id = 0;
+static _Thread_local uint64_t random_state = 0;
+
+void trace_init(double sample_rate, size_t events_per_thread) {
+    if (sample_rate < 0) {
+        sample_rate = 0;
+    } else if (sample_rate > 1) {
+        sample_rate = 1;
+    }
+
+    ring_capacity = events_per_thread > 0 ? events_per_thread : DEFAULT_EVENTS_PER_THREAD;
+    atomic_store(&sample_threshold, (uint64_t)(sample_rate * 4294967296.0));
+
+    if (sample_rate > 0) {
+        log_info("tracing %g of gateway frames, %zu events per thread", sample_rate,
+                 ring_capacity);
+    }
+}
+
+void trace_shutdown() {
+    atomic_store(&sample_threshold, 0);
+
+    /* only once every traced thread has stopped */
+    pthread_mutex_lock(&rings_mutex);
+
+    struct trace_ring* ring = rings;
+    while (ring) {
+        struct trace_ring* next = ring->next;
+
+        nv_free(ring->events);
+        nv_free(ring);
+
+        ring = next;
+    }
+
+    rings = NULL;
+    pthread_mutex_unlock(&rings_mutex);
+
+    local_ring = NULL;
+}
+
+static uint64_t next_random() {
+    /* xorshift64*; seeded lazily so each thread gets its own sequence */
+    if (random_state == 0) {
+        random_state = time_now_ns() ^ ((uint64_t)(uintptr_t)&random_state << 16) ^ 1;
+    }
+
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+
+    return random_state * 2685821657736338717ull;
+}
+
+void trace_root_begin(struct trace_span* span, const char* name) {
+    span->name = name;
+    span->previous_id = current_id;
+    span->trace_id = 0;
+
+    uint64_t threshold = atomic_load_explicit(&sample_threshold, memory_order_relaxed);
+    if (threshold == 0 || (next_random() >> 32) >= threshold) {
+        current_id = 0;
+        return;
+    }
+
+    /* never 0 */
+    span->trace_id = next_random() | 1;
+    span->start_ns = time_now_ns();
+
+    current_id = span->trace_id;
+}
+
+void trace_root_end(struct trace_span* span) {
+    trace_end(span);
+    current_id = span->previous_id;
+}
+
+void trace_begin(struct trace_span* span, const char* name) {
+    span->name = name;
+    span->trace_id = current_id;
+
+    if (span->trace_id != 0) {
+        span->start_ns = time_now_ns();
+    }
+}
+
+void trace_end(struct trace_span* span) {
+    if (span->trace_id != 0) {
+        trace_record(span->name, span->trace_id, span->start_ns, time_now_ns());
+    }
+}
+
+uint64_t trace_current() { return current_id; }
+
+static struct trace_ring* create_local_ring() {
+    struct trace_ring* ring = nv_alloc(sizeof(struct trace_ring));
+    assert(ring);
+
+    ring->capacity = ring_capacity;
+    ring->events = nv_alloc(ring->capacity * sizeof(struct trace_event));
+    assert(ring->events);
+
+    memset(ring->events, 0, ring->capacity * sizeof(struct trace_event));
+
+    atomic_init(&ring->head, 0);
+    ring->tid = (pid_t)syscall(SYS_gettid);
+
+    pthread_mutex_lock(&rings_mutex);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&rings_mutex);
+
+    return ring;
+}
+
+void trace_record(const char* name, uint64_t trace_id, uint64_t start_ns, uint64_t end_ns) {
+    if (trace_id == 0) {
+        return;
+    }
+
+    if (!local_ring) {
+        local_ring = create_local_ring();
+    }
+
+    struct trace_ring* ring = local_ring;
+    uint64_t index = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    struct trace_event* event = &ring->events[index % ring->capacity];
+
+    /* a seqlock, so a concurrent dump skips the slot rather than reading half an event */
+    atomic_store_explicit(&event->sequence, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    atomic_store_explicit(&event->name, name, memory_order_relaxed);
+    atomic_store_explicit(&event->trace_id, trace_id, memory_order_relaxed);
+    atomic_store_explicit(&event->start_ns, start_ns, memory_order_relaxed);
+    atomic_store_explicit(&event->end_ns, end_ns, memory_order_relaxed);
+
+    atomic_store_explicit(&event->sequence, index + 1, memory_order_release);
+    atomic_store_explicit(&ring->head, index + 1, memory_order_release);
+}
+
+static bool read_event(struct trace_event* event, struct trace_event_copy* copy) {
+    uint64_t before = atomic_load_explicit(&event->sequence, memory_order_acquire);
+    if (before == 0) {
+        return false;
+    }
+
+    copy->name = atomic_load_explicit(&event->name, memory_order_relaxed);
+    copy->trace_id = atomic_load_explicit(&event->trace_id, memory_order_relaxed);
+    copy->start_ns = atomic_load_explicit(&event->start_ns, memory_order_relaxed);
+    copy->end_ns = atomic_load_explicit(&event->end_ns, memory_order_relaxed);
+
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&event->sequence, memory_order_relaxed) == before;
+}
+
+static size_t write_ring(FILE* file, struct trace_ring* ring, pid_t pid, bool first) {
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t count = head < ring->capacity ? head : ring->capacity;
+
+    size_t written = 0;
+    for (uint64_t i = head - count; i < head; i++) {
+        struct trace_event_copy event;
+        if (!read_event(&ring->events[i % ring->capacity], &event)) {
+            continue;
+        }
+
+        /* microseconds, as the format wants */
+        fprintf(file,
+                "%s\n{\"name\":\"%s\",\"cat\":\"tasks\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                "\"pid\":%d,\"tid\":%d,\"args\":{\"trace\":\"%016" PRIx64 "\"}}",
+                first && written == 0 ? "" : ",", event.name, (double)event.start_ns / 1e3,
+                (double)(event.end_ns - event.start_ns) / 1e3, (int)pid, (int)ring->tid,
+                event.trace_id);
+
+        written++;
+    }
+
+    return written;
+}
+
+bool trace_dump(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        log_error("failed to open trace file: %s", path);
+        return false;
+    }
+
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", file);
+
+    pid_t pid = getpid();
+    size_t total = 0;
+
+    pthread_mutex_lock(&rings_mutex);
+    for (struct trace_ring* ring = rings; ring; ring = ring->next) {
+        total += write_ring(file, ring, pid, total == 0);
+    }
+
+    pthread_mutex_unlock(&rings_mutex);
+
+    fputs("\n]}\n", file);
+
+    bool success = ferror(file) == 0;
+    success = fclose(file) == 0 && success;
+
+    if (success) {
+        log_info("wrote %zu trace events to %s", total, path);
+    } else {
+        log_error("failed to write trace file: %s", path);
+    }
+
+    return success;
+}
+
+void trace_request_dump(const char* path) { atomic_store(&pending_dump, path); }
+
+void trace_poll() {
+    const char* path = atomic_exchange_explicit(&pending_dump, NULL, memory_order_acquire);
+    if (path) {
+        trace_dump(path);
+    }
+}
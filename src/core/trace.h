@@ -0,0 +1,49 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* sampled span tracing, dumped as chrome trace event json (chrome://tracing, ui.perfetto.dev).
+ * a root span decides whether the work it covers is sampled; spans begun on the same thread
+ * while it is open belong to the same trace. finished spans go into a ring per thread, so only
+ * the most recent events are kept and recording never allocates. when tracing is off or the
+ * current work was not sampled, a span costs a thread local load */
+
+struct trace_span {
+    const char* name;
+
+    /* 0 when not sampled */
+    uint64_t trace_id;
+    uint64_t start_ns;
+
+    /* roots only; the trace that was current when the root began */
+    uint64_t previous_id;
+};
+
+/* sample_rate is the fraction of roots traced, 0 to 1. events_per_thread of 0 picks a default */
+void trace_init(double sample_rate, size_t events_per_thread);
+void trace_shutdown();
+
+void trace_root_begin(struct trace_span* span, const char* name);
+void trace_root_end(struct trace_span* span);
+
+void trace_begin(struct trace_span* span, const char* name);
+void trace_end(struct trace_span* span);
+
+/* 0 unless the current work is being traced. for work that finishes somewhere else, e.g. an
+ * asynchronous request; carry the id along and pass it to trace_record */
+uint64_t trace_current();
+
+/* name must outlive the trace; string literals only */
+void trace_record(const char* name, uint64_t trace_id, uint64_t start_ns, uint64_t end_ns);
+
+/* writes every buffered event to path */
+bool trace_dump(const char* path);
+
+/* async signal safe. the next trace_poll dumps to path, which must stay valid */
+void trace_request_dump(const char* path);
+void trace_poll();
+
+#endif
@@ -8,17 +8,41 @@
 #include <log.h>
 
 #include <assert.h>
+#include <errno.h>
 #include <string.h>
 #include <unistd.h>
 #include <inttypes.h>
 
 #include <arpa/inet.h>
+#include <sys/epoll.h>
 
 #include <nyoravim/mem.h>
 
+struct ws_message {
+    struct ws_message* next;
+
+    uint32_t flags;
+    bool urgent;
+
+    /* curl may hold part of it, so nothing can go in front of it anymore */
+    bool started;
+
+    size_t size, offset;
+    char data[];
+};
+
 typedef struct ws {
     CURL* handle;
     struct websocket_callbacks callbacks;
+
+    /* watches the socket for writability while there is something queued */
+    int epoll;
+    curl_socket_t fd;
+    bool want_write;
+
+    struct ws_message* head;
+    struct ws_message* tail;
+    size_t queued_bytes;
 } ws_t;
 
 ws_t* ws_open(const char* url, const struct websocket_callbacks* callbacks) {
@@ -48,12 +72,36 @@ ws_t* ws_open(const char* url, const struct websocket_callbacks* callbacks) {
         return NULL;
     }
 
+    curl_socket_t fd;
+    result = curl_easy_getinfo(handle, CURLINFO_ACTIVESOCKET, &fd);
+
+    int epoll = result == CURLE_OK ? epoll_create1(EPOLL_CLOEXEC) : -1;
+    struct epoll_event event;
+    event.events = 0;
+    event.data.fd = fd;
+
+    if (epoll < 0 || epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+        log_error("failed to watch websocket socket: %s", strerror(errno));
+
+        if (epoll >= 0) {
+            close(epoll);
+        }
+
+        curl_easy_cleanup(handle);
+        rest_curl_unref();
+        return NULL;
+    }
+
     ws_t* ws = nv_alloc(sizeof(ws_t));
     assert(ws);
+    memset(ws, 0, sizeof(ws_t));
 
     memcpy(&ws->callbacks, callbacks, sizeof(struct websocket_callbacks));
 
     ws->handle = handle;
+    ws->epoll = epoll;
+    ws->fd = fd;
+
     return ws;
 }
 
@@ -91,6 +139,7 @@ void ws_close(ws_t* ws, uint16_t code, const char* reason) {
         log_debug("reason: %s", reason);
     }
 
+    /* whatever is still queued is dropped; the close frame cannot wait behind it */
     char buffer[256];
     size_t buffer_size = create_close_payload(buffer, sizeof(buffer), code, reason);
 
@@ -105,44 +154,168 @@ void ws_disconnect(ws_t* ws) {
         return;
     }
 
+    struct ws_message* message = ws->head;
+    while (message) {
+        struct ws_message* next = message->next;
+        nv_free(message);
+
+        message = next;
+    }
+
+    close(ws->epoll);
     curl_easy_cleanup(ws->handle);
     nv_free(ws);
 
     rest_curl_unref();
 }
 
-bool ws_send(ws_t* ws, const void* data, size_t size, uint32_t flags) {
-    while (size > 0) {
-        size_t sent;
-        CURLcode result = curl_ws_send(ws->handle, data, size, &sent, 0, flags);
+static bool set_want_write(ws_t* ws, bool want_write) {
+    if (ws->want_write == want_write) {
+        return true;
+    }
 
-        if (result == CURLE_AGAIN) {
-            log_warn("failed to send data on websocket; waiting a second...");
-            sleep(1);
+    struct epoll_event event;
+    event.events = want_write ? EPOLLOUT : 0;
+    event.data.fd = ws->fd;
+
+    if (epoll_ctl(ws->epoll, EPOLL_CTL_MOD, ws->fd, &event) != 0) {
+        log_error("failed to update websocket epoll events: %s", strerror(errno));
+        return false;
+    }
+
+    ws->want_write = want_write;
+    return true;
+}
+
+/* sends until done or the socket is full. false on error */
+static bool send_some(ws_t* ws, const char* data, size_t size, size_t* offset, uint32_t flags,
+                      bool* started) {
+    do {
+        size_t sent = 0;
+        CURLcode result =
+            curl_ws_send(ws->handle, data + *offset, size - *offset, &sent, 0, flags);
 
-            continue;
+        /* a frame that has been handed to curl at all has to be finished before the next */
+        *offset += sent;
+        *started = true;
+
+        if (result == CURLE_AGAIN) {
+            return true;
         }
 
         if (result != CURLE_OK) {
             log_error("curl_ws_send: %s", curl_easy_strerror(result));
             return false;
         }
+    } while (*offset < size);
+
+    return true;
+}
+
+static bool flush_queue(ws_t* ws) {
+    while (ws->head) {
+        struct ws_message* message = ws->head;
+        size_t offset = message->offset;
+
+        if (!send_some(ws, message->data, message->size, &message->offset, message->flags,
+                       &message->started)) {
+            return false;
+        }
+
+        ws->queued_bytes -= message->offset - offset;
+        if (message->offset < message->size) {
+            break;
+        }
+
+        ws->head = message->next;
+        if (!ws->head) {
+            ws->tail = NULL;
+        }
 
-        data += sent;
-        size -= sent;
+        nv_free(message);
     }
 
-    return true;
+    return set_want_write(ws, ws->head != NULL);
+}
+
+static void enqueue(ws_t* ws, struct ws_message* message) {
+    if (!message->urgent) {
+        if (ws->tail) {
+            ws->tail->next = message;
+        } else {
+            ws->head = message;
+        }
+
+        ws->tail = message;
+        return;
+    }
+
+    /* behind a started frame and earlier urgent ones, ahead of everything else */
+    struct ws_message** link = &ws->head;
+    while (*link && ((*link)->started || (*link)->urgent)) {
+        link = &(*link)->next;
+    }
+
+    message->next = *link;
+    *link = message;
+
+    if (!message->next) {
+        ws->tail = message;
+    }
+}
+
+enum ws_send_result ws_send(ws_t* ws, const void* data, size_t size, uint32_t flags,
+                            uint32_t priority) {
+    bool urgent = priority == WS_PRIORITY_URGENT;
+    if (!urgent && ws->queued_bytes >= WS_QUEUE_HIGH_WATER) {
+        log_warn("websocket send queue full (%zu bytes); refusing send", ws->queued_bytes);
+        return WS_SEND_BACKPRESSURE;
+    }
+
+    /* straight to the socket when nothing is waiting, so the common case copies nothing */
+    size_t offset = 0;
+    bool started = false;
+
+    if (!ws->head) {
+        if (!send_some(ws, data, size, &offset, flags, &started)) {
+            return WS_SEND_ERROR;
+        }
+
+        if (offset == size) {
+            return WS_SEND_OK;
+        }
+    }
+
+    struct ws_message* message = nv_alloc(sizeof(struct ws_message) + size);
+    assert(message);
+
+    message->next = NULL;
+    message->flags = flags;
+    message->urgent = urgent;
+    message->started = started;
+    message->size = size;
+    message->offset = offset;
+    memcpy(message->data, data, size);
+
+    enqueue(ws, message);
+    ws->queued_bytes += size - offset;
+
+    log_trace("queued %zu websocket bytes (%zu total)", size - offset, ws->queued_bytes);
+
+    /* ws_poll flushes once the socket can take more */
+    return set_want_write(ws, true) ? WS_SEND_OK : WS_SEND_ERROR;
 }
 
 bool ws_poll(ws_t* ws) {
     static char buffer[1024];
     size_t buffer_size = sizeof(buffer) - 1; /* to make room for '\0' */
 
-    size_t received = buffer_size;
+    size_t received;
     const struct curl_ws_frame* meta;
 
-    do {
+    /* drain everything that has arrived; stopping after one frame caps throughput at the rate the
+     * caller polls */
+    while (true) {
         CURLcode result = curl_ws_recv(ws->handle, buffer, buffer_size, &received, &meta);
         if (result == CURLE_AGAIN) {
             /* no more data */
@@ -160,7 +333,26 @@ bool ws_poll(ws_t* ws) {
 
             ws->callbacks.on_frame_received(ws->callbacks.user, buffer, received, meta);
         }
-    } while (received >= buffer_size);
+    }
+
+    if (!ws->head) {
+        return true;
+    }
+
+    struct epoll_event event;
+    int count = epoll_wait(ws->epoll, &event, 1, 0);
+
+    if (count < 0 && errno != EINTR) {
+        log_error("epoll_wait on websocket: %s", strerror(errno));
+        return false;
+    }
+
+    /* errors and hangups show up on the next recv */
+    if (count > 0 && (event.events & EPOLLOUT)) {
+        return flush_queue(ws);
+    }
 
     return true;
 }
+
+size_t ws_get_queued_bytes(const ws_t* ws) { return ws->queued_bytes; }
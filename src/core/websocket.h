@@ -9,6 +9,29 @@
 
 typedef struct ws ws_t;
 
+/* frames the socket would not take right away wait in an outbound queue, flushed from ws_poll
+ * when the socket is writable again. past this many queued bytes, normal sends are refused */
+#define WS_QUEUE_HIGH_WATER (256 * 1024)
+
+enum {
+    WS_PRIORITY_NORMAL,
+
+    /* goes ahead of everything queued but a frame already partly sent, and is never refused for
+     * backpressure. for heartbeats, which are late if they wait behind a backlog */
+    WS_PRIORITY_URGENT,
+};
+
+enum ws_send_result {
+    /* sent, or queued to be */
+    WS_SEND_OK,
+
+    /* not sent; the queue is over WS_QUEUE_HIGH_WATER */
+    WS_SEND_BACKPRESSURE,
+
+    /* the connection is broken */
+    WS_SEND_ERROR,
+};
+
 struct websocket_callbacks {
     void (*on_frame_received)(void* user, const char* data, size_t size,
                               const struct curl_ws_frame* meta);
@@ -24,8 +47,14 @@ void ws_close(ws_t* ws, uint16_t code, const char* reason);
 /* dirty disconnect (frees ws but does not send close message */
 void ws_disconnect(ws_t* ws);
 
-bool ws_send(ws_t* ws, const void* data, size_t size, uint32_t flags);
+/* never blocks. flags are CURLWS_* */
+enum ws_send_result ws_send(ws_t* ws, const void* data, size_t size, uint32_t flags,
+                            uint32_t priority);
 
+/* receives everything that has arrived and flushes what the socket will take. false once the
+ * connection is broken */
 bool ws_poll(ws_t* ws);
 
+size_t ws_get_queued_bytes(const ws_t* ws);
+
 #endif
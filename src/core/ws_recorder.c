@@ -0,0 +1,355 @@
+#include "ws_recorder.h"
+
+#include "clock.h"
+#include "compress.h"
+#include "record.h"
+
+#include <log.h>
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <nyoravim/mem.h>
+
+#define MAGIC "TWSR"
+#define MAGIC_SIZE 4
+#define VERSION 1
+#define HEADER_SIZE 8
+
+/* compressed blocks are flushed once they reach this much raw data */
+#define COMPRESSED_BLOCK_SIZE (64 * 1024)
+
+/* refuse blocks claiming to be larger than this when replaying */
+#define MAX_BLOCK_SIZE (64 * 1024 * 1024)
+
+typedef struct ws_recorder {
+    FILE* file;
+
+    /* NULL when recording uncompressed */
+    compressor_t* comp;
+
+    /* records not yet written */
+    struct record_writer block;
+
+    bool has_frame;
+    uint64_t last_frame_ns;
+} ws_recorder_t;
+
+typedef struct ws_replayer {
+    FILE* file;
+
+    /* created on the first compressed block */
+    compressor_t* comp;
+
+    uint8_t* block;
+    size_t block_size, block_offset;
+
+    uint64_t timestamp_ns;
+
+    /* copy of the current frame, for null termination */
+    char* frame;
+    size_t frame_capacity;
+} ws_replayer_t;
+
+ws_recorder_t* ws_recorder_open(const char* path, bool compress) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        log_error("failed to open recording for writing: %s", path);
+        return NULL;
+    }
+
+    uint8_t header[HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    memcpy(header, MAGIC, MAGIC_SIZE);
+    header[MAGIC_SIZE] = VERSION;
+
+    if (fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+        log_error("failed to write recording header: %s", path);
+
+        fclose(file);
+        return NULL;
+    }
+
+    ws_recorder_t* recorder = nv_alloc(sizeof(ws_recorder_t));
+    assert(recorder);
+    memset(recorder, 0, sizeof(ws_recorder_t));
+
+    recorder->file = file;
+    if (compress) {
+        if (compress_available()) {
+            recorder->comp = compressor_create(NULL, 0, 0);
+        } else {
+            log_warn("built without zstd; recording %s uncompressed", path);
+        }
+    }
+
+    record_writer_init(&recorder->block, recorder->comp ? COMPRESSED_BLOCK_SIZE + 1024 : 4096);
+
+    log_info("recording gateway frames to %s", path);
+    return recorder;
+}
+
+void ws_recorder_close(ws_recorder_t* recorder) {
+    if (!recorder) {
+        return;
+    }
+
+    ws_recorder_flush(recorder);
+    fclose(recorder->file);
+
+    record_writer_cleanup(&recorder->block);
+    compressor_free(recorder->comp);
+    nv_free(recorder);
+}
+
+static bool write_block(FILE* file, const void* data, size_t raw_size, size_t stored_size,
+                        bool compressed) {
+    uint8_t header[RECORD_MAX_VARINT_SIZE * 2];
+    size_t header_size = record_encode_varint(raw_size, header);
+    header_size += record_encode_varint(((uint64_t)stored_size << 1) | compressed,
+                                        header + header_size);
+
+    return fwrite(header, 1, header_size, file) == header_size &&
+           fwrite(data, 1, stored_size, file) == stored_size;
+}
+
+bool ws_recorder_flush(ws_recorder_t* recorder) {
+    struct record_writer* block = &recorder->block;
+    if (block->size == 0) {
+        return true;
+    }
+
+    bool success = false;
+    if (recorder->comp) {
+        void* compressed = nv_alloc(block->size);
+        assert(compressed);
+
+        /* 0 if it did not shrink; store raw instead */
+        size_t compressed_size =
+            compressor_compress(recorder->comp, block->data, block->size, compressed, block->size);
+
+        if (compressed_size > 0) {
+            success = write_block(recorder->file, compressed, block->size, compressed_size, true);
+        } else {
+            success = write_block(recorder->file, block->data, block->size, block->size, false);
+        }
+
+        nv_free(compressed);
+    } else {
+        success = write_block(recorder->file, block->data, block->size, block->size, false);
+    }
+
+    block->size = 0;
+    success = fflush(recorder->file) == 0 && success;
+
+    if (!success) {
+        log_error("failed to write gateway recording block");
+    }
+
+    return success;
+}
+
+bool ws_recorder_write(ws_recorder_t* recorder, const char* data, size_t size,
+                       const struct curl_ws_frame* meta) {
+    uint64_t now = time_now_ns();
+    uint64_t delta = recorder->has_frame ? now - recorder->last_frame_ns : 0;
+
+    recorder->has_frame = true;
+    recorder->last_frame_ns = now;
+
+    struct record_writer* block = &recorder->block;
+    record_write_varint(block, delta);
+    record_write_varint(block, (uint64_t)meta->flags);
+    record_write_varint(block, (uint64_t)meta->offset);
+    record_write_varint(block, (uint64_t)meta->bytesleft);
+    record_write_varint(block, size);
+    record_write_raw(block, data, size);
+
+    if (recorder->comp && block->size < COMPRESSED_BLOCK_SIZE) {
+        return true;
+    }
+
+    return ws_recorder_flush(recorder);
+}
+
+ws_replayer_t* ws_replayer_open(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        log_error("failed to open recording: %s", path);
+        return NULL;
+    }
+
+    uint8_t header[HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        memcmp(header, MAGIC, MAGIC_SIZE) != 0) {
+        log_error("not a gateway recording: %s", path);
+
+        fclose(file);
+        return NULL;
+    }
+
+    if (header[MAGIC_SIZE] != VERSION) {
+        log_error("unsupported recording version %u: %s", header[MAGIC_SIZE], path);
+
+        fclose(file);
+        return NULL;
+    }
+
+    ws_replayer_t* replayer = nv_alloc(sizeof(ws_replayer_t));
+    assert(replayer);
+    memset(replayer, 0, sizeof(ws_replayer_t));
+
+    replayer->file = file;
+    return replayer;
+}
+
+void ws_replayer_close(ws_replayer_t* replayer) {
+    if (!replayer) {
+        return;
+    }
+
+    fclose(replayer->file);
+    compressor_free(replayer->comp);
+
+    nv_free(replayer->block);
+    nv_free(replayer->frame);
+    nv_free(replayer);
+}
+
+/* eof is only clean before the first byte */
+static bool read_file_varint(FILE* file, uint64_t* value, bool* eof) {
+    uint8_t bytes[RECORD_MAX_VARINT_SIZE];
+    *eof = false;
+
+    for (size_t i = 0; i < RECORD_MAX_VARINT_SIZE; i++) {
+        int c = fgetc(file);
+        if (c == EOF) {
+            *eof = i == 0;
+            return false;
+        }
+
+        bytes[i] = (uint8_t)c;
+        if ((c & 0x80) == 0) {
+            return record_decode_varint(bytes, i + 1, value) > 0;
+        }
+    }
+
+    return false;
+}
+
+static bool load_block(ws_replayer_t* replayer) {
+    uint64_t raw_size, stored_field;
+
+    bool eof;
+    if (!read_file_varint(replayer->file, &raw_size, &eof)) {
+        if (!eof) {
+            log_error("truncated recording block header");
+        }
+
+        return false;
+    }
+
+    if (!read_file_varint(replayer->file, &stored_field, &eof)) {
+        log_error("truncated recording block header");
+        return false;
+    }
+
+    bool compressed = (stored_field & 1) != 0;
+    uint64_t stored_size = stored_field >> 1;
+
+    if (raw_size > MAX_BLOCK_SIZE || stored_size > MAX_BLOCK_SIZE) {
+        log_error("recording block of %" PRIu64 " bytes is too large", raw_size);
+        return false;
+    }
+
+    uint8_t* stored = nv_alloc(stored_size > 0 ? stored_size : 1);
+    assert(stored);
+
+    if (fread(stored, 1, stored_size, replayer->file) != stored_size) {
+        log_error("truncated recording block");
+
+        nv_free(stored);
+        return false;
+    }
+
+    uint8_t* block = stored;
+    size_t block_size = stored_size;
+
+    if (compressed) {
+        if (!replayer->comp) {
+            replayer->comp = compressor_create(NULL, 0, 0);
+        }
+
+        block = replayer->comp
+                    ? compressor_decompress(replayer->comp, stored, stored_size, &block_size)
+                    : NULL;
+
+        nv_free(stored);
+        if (!block || block_size != raw_size) {
+            log_error("failed to decompress recording block");
+
+            nv_free(block);
+            return false;
+        }
+    }
+
+    nv_free(replayer->block);
+    replayer->block = block;
+    replayer->block_size = block_size;
+    replayer->block_offset = 0;
+
+    return true;
+}
+
+static bool read_block_varint(ws_replayer_t* replayer, uint64_t* value) {
+    size_t read = record_decode_varint(replayer->block + replayer->block_offset,
+                                       replayer->block_size - replayer->block_offset, value);
+
+    replayer->block_offset += read;
+    return read > 0;
+}
+
+bool ws_replayer_next(ws_replayer_t* replayer, struct ws_recorded_frame* frame) {
+    while (replayer->block_offset >= replayer->block_size) {
+        if (!load_block(replayer)) {
+            return false;
+        }
+    }
+
+    uint64_t delta, flags, offset, bytes_left, size;
+    if (!read_block_varint(replayer, &delta) || !read_block_varint(replayer, &flags) ||
+        !read_block_varint(replayer, &offset) || !read_block_varint(replayer, &bytes_left) ||
+        !read_block_varint(replayer, &size) ||
+        size > replayer->block_size - replayer->block_offset) {
+        log_error("corrupt record in gateway recording");
+        return false;
+    }
+
+    if (size + 1 > replayer->frame_capacity) {
+        replayer->frame_capacity = size + 1;
+        replayer->frame = replayer->frame ? nv_realloc(replayer->frame, replayer->frame_capacity)
+                                          : nv_alloc(replayer->frame_capacity);
+
+        assert(replayer->frame);
+    }
+
+    memcpy(replayer->frame, replayer->block + replayer->block_offset, size);
+    replayer->frame[size] = '\0';
+    replayer->block_offset += size;
+
+    replayer->timestamp_ns += delta;
+
+    memset(&frame->meta, 0, sizeof(struct curl_ws_frame));
+    frame->meta.flags = (int)flags;
+    frame->meta.offset = (curl_off_t)offset;
+    frame->meta.bytesleft = (curl_off_t)bytes_left;
+    frame->meta.len = (size_t)size;
+
+    frame->timestamp_ns = replayer->timestamp_ns;
+    frame->data = replayer->frame;
+    frame->size = (size_t)size;
+
+    return true;
+}
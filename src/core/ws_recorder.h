@@ -0,0 +1,48 @@
+#ifndef _WS_RECORDER_H
+#define _WS_RECORDER_H
+
+#include <curl/curl.h>
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* append-only recordings of raw inbound websocket frames. the file is a short header followed by
+ * blocks of [varint raw size][varint stored size << 1 | compressed][bytes], and each block holds
+ * records of [varint ns since the previous frame][varint flags][varint offset][varint bytes left]
+ * [varint length][data]. uncompressed recordings write a block per frame so a crash loses nothing;
+ * compressed ones batch frames into larger zstd blocks */
+
+typedef struct ws_recorder ws_recorder_t;
+typedef struct ws_replayer ws_replayer_t;
+
+struct ws_recorded_frame {
+    /* since the first frame of the recording */
+    uint64_t timestamp_ns;
+
+    /* as curl reported them */
+    struct curl_ws_frame meta;
+
+    /* null terminated; valid until the next call to ws_replayer_next */
+    const char* data;
+    size_t size;
+};
+
+/* truncates path. compression is quietly skipped when zstd is unavailable */
+ws_recorder_t* ws_recorder_open(const char* path, bool compress);
+
+/* flushes and closes */
+void ws_recorder_close(ws_recorder_t* recorder);
+
+bool ws_recorder_write(ws_recorder_t* recorder, const char* data, size_t size,
+                       const struct curl_ws_frame* meta);
+
+bool ws_recorder_flush(ws_recorder_t* recorder);
+
+ws_replayer_t* ws_replayer_open(const char* path);
+void ws_replayer_close(ws_replayer_t* replayer);
+
+/* returns false at the end of the recording or if it is corrupt */
+bool ws_replayer_next(ws_replayer_t* replayer, struct ws_recorded_frame* frame);
+
+#endif
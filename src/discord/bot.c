@@ -1,8 +1,18 @@
 #include "bot.h"
+#include "cache.h"
 #include "credentials.h"
+#include "deadline.h"
+#include "dm_delivery.h"
+#include "followup.h"
 #include "gateway.h"
+#include "interaction_server.h"
+#include "interaction_stream.h"
+#include "member_request.h"
+#include "session_store.h"
 
 #include "../core/rest.h"
+#include "../core/trace.h"
+#include "../core/ws_recorder.h"
 
 #include <log.h>
 
@@ -17,18 +27,49 @@
 #include <nyoravim/mem.h>
 #include <nyoravim/util.h>
 
+/* https://discord.com/developers/docs/reference#api-reference-base-url */
+#define DEFAULT_API_URL "https://discord.com/api"
+
+#define LOOP_INTERVAL_MS 10
+
 typedef struct bot {
     struct credentials* creds;
+    char* api_url;
     struct bot_callbacks callbacks;
 
     rest_t* rest;
     gateway_t* gateway;
+
+    /* NULL unless the gateway session is persisted */
+    session_store_t* sessions;
     uint32_t api;
 
+    /* NULL unless recording */
+    ws_recorder_t* recorder;
+
+    /* NULL when offline */
+    deadline_watchdog_t* watchdog;
+
+    /* on rest */
+    followup_queue_t* followups;
+    dm_delivery_t* dms;
+
+    entity_cache_t* cache;
+    bool cache_members;
+
+    /* NULL unless interactions come over http */
+    interaction_server_t* interactions;
+
+    /* NULL unless configured */
+    interaction_stream_t* stream;
+
+    member_requests_t* member_requests;
+
     bool running;
 } bot_t;
 
 struct discord_rest_data {
+    const char* base_url;
     uint32_t api;
     const char* path;
 
@@ -44,7 +85,7 @@ static int64_t send_discord_rest_request(rest_t* rest, const struct discord_rest
     const char* path = data->path[0] == '/' ? data->path + 1 : data->path;
 
     static char url[2048];
-    snprintf(url, sizeof(url), "https://discord.com/api/v%" PRIu32 "/%s", data->api, path);
+    snprintf(url, sizeof(url), "%s/v%" PRIu32 "/%s", data->base_url, data->api, path);
 
     char auth_header[256];
     snprintf(auth_header, sizeof(auth_header), "Authorization: Bot %s", data->token);
@@ -81,29 +122,57 @@ static int64_t send_discord_rest_request(rest_t* rest, const struct discord_rest
     return response.status;
 }
 
-static char* get_url_from_gateway_response(const json_object* object, uint32_t api) {
+static uint64_t get_uint64_field(const json_object* object, const char* key) {
+    json_object* field;
+    if (!json_object_object_get_ex(object, key, &field)) {
+        return 0;
+    }
+
+    return json_object_get_uint64(field);
+}
+
+static bool parse_gateway_info(const json_object* object, uint32_t api,
+                               struct gateway_info* info) {
+    memset(info, 0, sizeof(struct gateway_info));
     if (!object) {
-        return NULL;
+        return false;
     }
 
     json_object* url_field;
     if (!json_object_object_get_ex(object, "url", &url_field)) {
-        return NULL;
+        return false;
     }
 
     const char* returned_url = json_object_get_string(url_field);
     if (!returned_url) {
-        return NULL;
+        return false;
     }
 
     char buffer[256];
     snprintf(buffer, 256, "%s/?v=%" PRIu32 "&encoding=json", returned_url, api);
 
-    return nv_strdup(buffer);
+    info->url = nv_strdup(buffer);
+    info->shards = (uint32_t)get_uint64_field(object, "shards");
+
+    /* a mock without it is treated as unlimited */
+    json_object* limit;
+    if (json_object_object_get_ex(object, "session_start_limit", &limit)) {
+        info->total_starts = (uint32_t)get_uint64_field(limit, "total");
+        info->remaining_starts = (int64_t)get_uint64_field(limit, "remaining");
+        info->reset_after_ms = get_uint64_field(limit, "reset_after");
+        info->max_concurrency = (uint32_t)get_uint64_field(limit, "max_concurrency");
+    } else {
+        info->total_starts = UINT32_MAX;
+        info->remaining_starts = UINT32_MAX;
+    }
+
+    return true;
 }
 
-static char* get_gateway_url(rest_t* rest, const char* token, uint32_t api) {
+static bool fetch_gateway_info(rest_t* rest, const char* base_url, const char* token,
+                               uint32_t api, struct gateway_info* info) {
     struct discord_rest_data data;
+    data.base_url = base_url;
     data.path = "/gateway/bot";
     data.method = "GET";
     data.token = token;
@@ -115,35 +184,97 @@ static char* get_gateway_url(rest_t* rest, const char* token, uint32_t api) {
 
     if (status < 0) {
         log_error("somehow failed to talk to discord retrieving gateway url");
-        return NULL;
+        return false;
     }
 
     if (status != 200) {
         log_error("discord authentication failed (%" PRIi64 "): %s", status,
                   response ? json_object_to_json_string(response) : "<null>");
 
-        return NULL;
+        json_object_put(response);
+        return false;
     }
 
-    char* url = get_url_from_gateway_response(response, api);
+    bool success = parse_gateway_info(response, api, info);
     json_object_put(response);
 
-    return url;
+    return success;
+}
+
+/* from the cache when there is one, so that a restart does not wait on discord first */
+static bool get_gateway_info(bot_t* bot, struct gateway_info* info) {
+    if (bot->sessions && session_store_load_gateway_info(bot->sessions, info)) {
+        log_debug("using cached gateway info");
+        return true;
+    }
+
+    if (!fetch_gateway_info(bot->rest, bot->api_url, bot->creds->token, bot->api, info)) {
+        return false;
+    }
+
+    if (bot->sessions) {
+        session_store_save_gateway_info(bot->sessions, info);
+    }
+
+    return true;
+}
+
+/* a restart picks up where the last process left off, without asking for the gateway url or
+ * identifying again */
+static gateway_t* resume_gateway(bot_t* bot) {
+    struct saved_session saved;
+    if (!session_store_load(bot->sessions, &saved)) {
+        return NULL;
+    }
+
+    log_info("resuming saved gateway session %s", saved.id);
+
+    gateway_t* gw = gateway_resume(&saved, bot);
+    saved_session_cleanup(&saved);
+
+    if (!gw) {
+        log_warn("failed to reach the saved session's resume url; starting a new session");
+        session_store_clear(bot->sessions);
+    }
+
+    return gw;
 }
 
 static gateway_t* open_gateway(bot_t* bot) {
+    if (bot->sessions) {
+        gateway_t* gw = resume_gateway(bot);
+        if (gw) {
+            return gw;
+        }
+    }
+
     log_debug("opening gateway with api version %" PRIu32, bot->api);
 
-    char* url = get_gateway_url(bot->rest, bot->creds->token, bot->api);
-    if (!url) {
+    struct gateway_info info;
+    if (!get_gateway_info(bot, &info)) {
         log_error("failed to retrieve gateway url from discord!");
         return NULL;
     }
 
-    log_debug("discord gateway url: %s", url);
+    log_debug("discord gateway url: %s (%" PRIu32 " shards recommended)", info.url, info.shards);
+
+    /* identifying past the limit resets the token; better to not start, so that a supervisor
+     * restarting a crashing bot cannot run through the rest of the day's starts */
+    if (info.remaining_starts <= 0) {
+        log_error("no session starts left; the limit resets in %" PRIu64 " s",
+                  info.reset_after_ms / 1000);
 
-    gateway_t* gw = gateway_open(url, bot);
-    nv_free(url);
+        gateway_info_cleanup(&info);
+        return NULL;
+    }
+
+    if (info.remaining_starts < info.total_starts / 10) {
+        log_warn("%" PRIi64 " of %" PRIu32 " session starts left", info.remaining_starts,
+                 info.total_starts);
+    }
+
+    gateway_t* gw = gateway_open(info.url, bot);
+    gateway_info_cleanup(&info);
 
     if (!gw) {
         log_error("failed to open gateway websocket!");
@@ -159,9 +290,24 @@ bot_t* bot_create(const struct bot_spec* spec) {
 
     bot->rest = NULL;
     bot->gateway = NULL;
+    bot->sessions = NULL;
+    bot->recorder = NULL;
+    bot->watchdog = NULL;
+    bot->followups = NULL;
+    bot->dms = NULL;
+    bot->cache = NULL;
+    bot->interactions = NULL;
+    bot->stream = NULL;
+    bot->member_requests = NULL;
 
     bot->creds = credentials_dup(spec->creds);
-    log_info("authenticating as app %" PRIu64, bot->creds);
+    bot->api_url = nv_strdup(spec->api_url ? spec->api_url : DEFAULT_API_URL);
+
+    if (spec->api_url) {
+        log_info("using api url %s", bot->api_url);
+    }
+
+    log_info("authenticating as app %" PRIu64, bot->creds->app_id);
 
     /* https://discord.com/developers/docs/reference#api-versioning */
     uint32_t api = spec->api > 0 ? spec->api : 10;
@@ -175,11 +321,34 @@ bot_t* bot_create(const struct bot_spec* spec) {
     }
 
     memcpy(&bot->callbacks, spec->callbacks, sizeof(struct bot_callbacks));
+    bot->followups = followup_queue_create(bot->rest, bot->api_url, api, bot->creds->token);
+
+    struct dm_delivery_spec dms;
+    memset(&dms, 0, sizeof(struct dm_delivery_spec));
+
+    dms.rest = bot->rest;
+    dms.base_url = bot->api_url;
+    dms.api = api;
+    dms.token = bot->creds->token;
+    dms.db = spec->dm_channel_db;
+
+    bot->dms = dm_delivery_create(&dms);
+
+    /* before the gateway, which asks for intents based on it */
+    bot->cache = entity_cache_create(spec->cache_max_bytes);
+    bot->cache_members = spec->cache_members;
 
     bot->api = api;
     bot->running = false;
 
-    bot->gateway = open_gateway(bot);
+    bool worker = spec->stream && spec->stream->role == INTERACTION_STREAM_WORKER;
+    bool connect = !spec->offline && !spec->interactions_only && !worker;
+
+    if (connect && spec->session_db) {
+        bot->sessions = session_store_create(spec->session_db, bot->creds->app_id);
+    }
+
+    bot->gateway = connect ? open_gateway(bot) : gateway_open(NULL, bot);
     if (!bot->gateway) {
         log_error("failed to open discord gateway!");
 
@@ -187,6 +356,49 @@ bot_t* bot_create(const struct bot_spec* spec) {
         return NULL;
     }
 
+    gateway_set_session_store(bot->gateway, bot->sessions);
+    bot->member_requests = member_requests_create(bot->gateway);
+
+    if (spec->record_path) {
+        /* not fatal; the bot works fine without it */
+        bot->recorder = ws_recorder_open(spec->record_path, spec->record_compressed);
+        gateway_set_recorder(bot->gateway, bot->recorder);
+    }
+
+    if (!spec->offline) {
+        uint32_t budget =
+            spec->response_budget_ms > 0 ? spec->response_budget_ms : DEFAULT_RESPONSE_BUDGET_MS;
+
+        /* also not fatal; slow handlers just time out */
+        bot->watchdog =
+            deadline_watchdog_create(bot->api_url, bot->api, bot->creds->token, budget);
+    }
+
+    if (spec->stream) {
+        bot->stream = interaction_stream_create(bot, spec->stream);
+        if (!bot->stream) {
+            bot_destroy(bot);
+            return NULL;
+        }
+    }
+
+    if (spec->interactions_port > 0) {
+        const char* address = spec->interactions_address ? spec->interactions_address : "0.0.0.0";
+
+        bot->interactions = interaction_server_create(bot, address, spec->interactions_port,
+                                                      bot->creds->public_key);
+
+        if (!bot->interactions) {
+            bot_destroy(bot);
+            return NULL;
+        }
+    } else if (spec->interactions_only) {
+        log_error("interactions only, but no port to receive them on!");
+
+        bot_destroy(bot);
+        return NULL;
+    }
+
     return bot;
 }
 
@@ -195,10 +407,21 @@ void bot_destroy(bot_t* bot) {
         return;
     }
 
+    /* before the gateway, so no handler can still hold a deadline */
+    interaction_server_free(bot->interactions);
+    interaction_stream_free(bot->stream);
+    member_requests_free(bot->member_requests);
     gateway_close(bot->gateway);
+    session_store_free(bot->sessions);
+    deadline_watchdog_free(bot->watchdog);
+    ws_recorder_close(bot->recorder);
     rest_shutdown(bot->rest);
+    followup_queue_free(bot->followups);
+    dm_delivery_free(bot->dms);
+    entity_cache_free(bot->cache);
 
     credentials_free(bot->creds);
+    nv_free(bot->api_url);
     nv_free(bot);
 }
 
@@ -207,15 +430,49 @@ uint64_t bot_get_app_id(const bot_t* bot) { return bot->creds->app_id; }
 
 const struct bot_callbacks* bot_get_callbacks(const bot_t* bot) { return &bot->callbacks; }
 
+gateway_t* bot_get_gateway(const bot_t* bot) { return bot->gateway; }
+
+bool bot_get_latency(const bot_t* bot, struct gateway_latency* latency) {
+    return gateway_get_latency(bot->gateway, latency);
+}
+
 uint32_t bot_get_api_version(const bot_t* bot) { return bot->api; }
 
+deadline_watchdog_t* bot_get_deadline_watchdog(const bot_t* bot) { return bot->watchdog; }
+
+followup_queue_t* bot_get_followup_queue(const bot_t* bot) { return bot->followups; }
+dm_delivery_t* bot_get_dm_delivery(const bot_t* bot) { return bot->dms; }
+
+entity_cache_t* bot_get_cache(const bot_t* bot) { return bot->cache; }
+interaction_stream_t* bot_get_interaction_stream(const bot_t* bot) { return bot->stream; }
+bool bot_caches_members(const bot_t* bot) { return bot->cache_members; }
+
+member_requests_t* bot_get_member_requests(const bot_t* bot) { return bot->member_requests; }
+
 void bot_start(bot_t* bot) {
     bot->running = true;
     while (bot->running) {
         rest_poll(bot->rest);
         gateway_poll(bot->gateway);
-
-        usleep(10000);
+        member_requests_poll(bot->member_requests);
+        dm_delivery_poll(bot->dms);
+
+        if (bot->interactions && !interaction_server_poll(bot->interactions)) {
+            log_error("interactions server failed; stopping");
+            break;
+        }
+
+        trace_poll();
+
+        /* the stream read waits for entries in place of the sleep */
+        if (bot->stream && interaction_stream_get_role(bot->stream) == INTERACTION_STREAM_WORKER) {
+            if (!interaction_stream_poll(bot->stream, LOOP_INTERVAL_MS)) {
+                log_error("interaction stream failed; stopping");
+                break;
+            }
+        } else {
+            usleep(LOOP_INTERVAL_MS * 1000);
+        }
     }
 }
 
@@ -226,6 +483,7 @@ static bool is_status_ok(int64_t status) { return status >= 200 && status < 300;
 json_object* bot_send_api_request(bot_t* bot, const char* path, const char* method,
                                   json_object* body) {
     struct discord_rest_data data;
+    data.base_url = bot->api_url;
     data.path = path;
     data.method = method;
     data.body = body;
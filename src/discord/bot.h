@@ -2,11 +2,16 @@
 #define _BOT_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 
 #include <json.h>
 
 typedef struct bot bot_t;
 
+/* discord gives up on an interaction after 3 seconds */
+#define DEFAULT_RESPONSE_BUDGET_MS 1500
+
 struct bot_context {
     void* user;
     bot_t* bot;
@@ -29,6 +34,9 @@ struct bot_ready_event {
 /* from types/interaction.h */
 struct interaction;
 
+/* from hiredis/hiredis.h */
+typedef struct redisContext redisContext;
+
 struct bot_callbacks {
     void* user;
 
@@ -43,6 +51,50 @@ struct bot_spec {
 
     const struct credentials* creds;
     const struct bot_callbacks* callbacks;
+
+    /* base of every rest url, without the version. NULL for discord; the gateway url is whatever
+     * /gateway/bot at this base returns, so pointing it at tools/mock redirects everything */
+    const char* api_url;
+
+    /* record raw gateway frames here for tools/replay. NULL disables recording */
+    const char* record_path;
+    bool record_compressed;
+
+    /* do not talk to discord at all; the gateway is offline. for benchmarks and tooling */
+    bool offline;
+
+    /* time a handler has to respond to an interaction before it is deferred for it. 0 for
+     * DEFAULT_RESPONSE_BUDGET_MS */
+    uint32_t response_budget_ms;
+
+    /* bound on the entity cache; 0 for DEFAULT_CACHE_MAX_BYTES */
+    size_t cache_max_bytes;
+
+    /* also cache every guild member, not just those seen in interactions. needs the privileged
+     * server members intent */
+    bool cache_members;
+
+    /* also accept interactions as http webhooks on this address and port; see
+     * interaction_server.h. 0 disables. needs a public key in the credentials */
+    const char* interactions_address;
+    uint16_t interactions_port;
+
+    /* do not connect to the gateway. interactions only arrive over http, and on_ready never
+     * fires */
+    bool interactions_only;
+
+    /* hand interactions from the gateway to other processes, or be one of those processes; see
+     * interaction_stream.h. NULL handles them here. workers do not connect to the gateway */
+    const struct interaction_stream_spec* stream;
+
+    /* checkpoint the gateway session here and resume it on the next start; see session_store.h.
+     * a resumed session gets no READY, so on_ready does not fire. borrowed, and used from the
+     * thread that runs the bot. NULL does not persist it */
+    redisContext* session_db;
+
+    /* remember users' DM channels here across restarts; see dm_delivery.h. borrowed, like
+     * session_db. NULL keeps them in memory only */
+    redisContext* dm_channel_db;
 };
 
 bot_t* bot_create(const struct bot_spec* spec);
@@ -53,8 +105,51 @@ uint64_t bot_get_app_id(const bot_t* bot);
 
 const struct bot_callbacks* bot_get_callbacks(const bot_t* bot);
 
+/* from gateway.h */
+typedef struct gateway gateway_t;
+
+gateway_t* bot_get_gateway(const bot_t* bot);
+
+struct gateway_latency;
+
+/* heartbeat round trip to the gateway; false before the first ack */
+bool bot_get_latency(const bot_t* bot, struct gateway_latency* latency);
+
 uint32_t bot_get_api_version(const bot_t* bot);
 
+/* from deadline.h */
+typedef struct deadline_watchdog deadline_watchdog_t;
+
+/* NULL when offline */
+deadline_watchdog_t* bot_get_deadline_watchdog(const bot_t* bot);
+
+/* from followup.h */
+typedef struct followup_queue followup_queue_t;
+
+followup_queue_t* bot_get_followup_queue(const bot_t* bot);
+
+/* from dm_delivery.h */
+typedef struct dm_delivery dm_delivery_t;
+
+dm_delivery_t* bot_get_dm_delivery(const bot_t* bot);
+
+/* from cache.h */
+typedef struct entity_cache entity_cache_t;
+
+entity_cache_t* bot_get_cache(const bot_t* bot);
+
+/* from interaction_stream.h */
+typedef struct interaction_stream interaction_stream_t;
+
+/* NULL unless configured */
+interaction_stream_t* bot_get_interaction_stream(const bot_t* bot);
+bool bot_caches_members(const bot_t* bot);
+
+/* from member_request.h */
+typedef struct member_requests member_requests_t;
+
+member_requests_t* bot_get_member_requests(const bot_t* bot);
+
 void bot_start(bot_t* bot);
 void bot_stop(bot_t* bot);
 
@@ -0,0 +1,586 @@
+/* https://discord.com/developers/docs/events/gateway-events#guilds */
+
+#include "cache.h"
+
+#include "types/interaction.h"
+#include "types/member.h"
+#include "types/snowflake.h"
+
+#include "../core/hashmap.h"
+#include "../core/metrics.h"
+
+#include <log.h>
+
+#include <assert.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include <nyoravim/mem.h>
+#include <nyoravim/util.h>
+
+enum {
+    ENTITY_USER,
+    ENTITY_MEMBER,
+    ENTITY_GUILD,
+    ENTITY_CHANNEL,
+};
+
+struct entity;
+
+/* keys are snowflakes */
+HASHMAP_DECLARE(entity_table, uint64_t, struct entity*, hashmap_hash_u64, HASHMAP_EQUALS_SCALAR)
+
+struct guild_entity {
+    struct cached_guild guild;
+
+    /* by user id */
+    entity_table_t members;
+};
+
+struct entity {
+    uint32_t kind;
+
+    /* set on lookup, cleared as the clock hand passes */
+    bool referenced;
+
+    size_t clock_index;
+    size_t size;
+
+    union {
+        struct user user;
+        struct cached_member member;
+        struct guild_entity guild;
+        struct cached_channel channel;
+    };
+};
+
+typedef struct entity_cache {
+    entity_table_t users, guilds, channels;
+
+    /* every entity, in no particular order; the clock sweeps over it */
+    struct entity** ring;
+    size_t ring_count, ring_capacity;
+    size_t hand;
+
+    /* entities and member tables; the top level tables are added on top */
+    size_t bytes, max_bytes;
+
+    size_t counts[4];
+    uint64_t evictions;
+
+    metric_t* hits;
+    metric_t* misses;
+    metric_t* evicted;
+    metric_t* size_gauge;
+} entity_cache_t;
+
+static struct metric_family lookups = METRIC_COUNTER_FAMILY(
+    "tasks_cache_lookups_total", "entity cache lookups by result");
+
+static struct metric_family evictions = METRIC_COUNTER_FAMILY(
+    "tasks_cache_evictions_total", "entities evicted to stay within the cache's memory bound");
+
+static struct metric_family cache_bytes =
+    METRIC_GAUGE_FAMILY("tasks_cache_bytes", "approximate memory held by the entity cache");
+
+static struct entity* table_find(const entity_table_t* table, uint64_t id) {
+    struct entity** entity = entity_table_get(table, id);
+    return entity ? *entity : NULL;
+}
+
+static size_t string_size(const char* string) { return string ? strlen(string) + 1 : 0; }
+
+static size_t entity_size(const struct entity* entity) {
+    size_t size = sizeof(struct entity);
+
+    switch (entity->kind) {
+    case ENTITY_USER:
+        size += string_size(entity->user.username) + string_size(entity->user.discriminator) +
+                string_size(entity->user.global_name);
+        break;
+    case ENTITY_MEMBER:
+        size += string_size(entity->member.nick);
+        break;
+    case ENTITY_GUILD:
+        size += string_size(entity->guild.guild.name);
+        break;
+    case ENTITY_CHANNEL:
+        size += string_size(entity->channel.name);
+        break;
+    }
+
+    return size;
+}
+
+static size_t current_bytes(const entity_cache_t* cache) {
+    return cache->bytes + entity_table_memory(&cache->users) + entity_table_memory(&cache->guilds) +
+           entity_table_memory(&cache->channels);
+}
+
+static void ring_push(entity_cache_t* cache, struct entity* entity) {
+    if (cache->ring_count >= cache->ring_capacity) {
+        cache->ring_capacity = cache->ring_capacity > 0 ? cache->ring_capacity * 2 : 256;
+        cache->ring = nv_realloc(cache->ring, cache->ring_capacity * sizeof(struct entity*));
+        assert(cache->ring);
+    }
+
+    entity->clock_index = cache->ring_count;
+    cache->ring[cache->ring_count++] = entity;
+}
+
+static void ring_remove(entity_cache_t* cache, struct entity* entity) {
+    struct entity* last = cache->ring[--cache->ring_count];
+
+    cache->ring[entity->clock_index] = last;
+    last->clock_index = entity->clock_index;
+}
+
+static struct entity* new_entity(entity_cache_t* cache, uint32_t kind) {
+    struct entity* entity = nv_alloc(sizeof(struct entity));
+    assert(entity);
+
+    memset(entity, 0, sizeof(struct entity));
+    entity->kind = kind;
+
+    ring_push(cache, entity);
+    cache->counts[kind]++;
+
+    return entity;
+}
+
+/* after its strings change */
+static void resize_entity(entity_cache_t* cache, struct entity* entity) {
+    size_t size = entity_size(entity);
+
+    cache->bytes = cache->bytes - entity->size + size;
+    entity->size = size;
+}
+
+/* unlinks and frees entity. a guild takes its members with it */
+static void remove_entity(entity_cache_t* cache, struct entity* entity) {
+    switch (entity->kind) {
+    case ENTITY_USER:
+        entity_table_remove(&cache->users, entity->user.id, NULL);
+        user_cleanup(&entity->user);
+        break;
+    case ENTITY_MEMBER: {
+        struct entity* guild = table_find(&cache->guilds, entity->member.guild_id);
+        assert(guild);
+
+        entity_table_remove(&guild->guild.members, entity->member.user_id, NULL);
+        guild->guild.guild.num_members--;
+
+        nv_free(entity->member.nick);
+        break;
+    }
+    case ENTITY_GUILD: {
+        entity_table_t* members = &entity->guild.members;
+        HASHMAP_FOR_EACH(members, i) {
+            struct entity* member = members->values[i];
+            ring_remove(cache, member);
+
+            cache->bytes -= member->size;
+            cache->counts[ENTITY_MEMBER]--;
+
+            nv_free(member->member.nick);
+            nv_free(member);
+        }
+
+        cache->bytes -= entity_table_memory(members);
+        entity_table_free(members);
+
+        entity_table_remove(&cache->guilds, entity->guild.guild.id, NULL);
+        nv_free(entity->guild.guild.name);
+        break;
+    }
+    case ENTITY_CHANNEL:
+        entity_table_remove(&cache->channels, entity->channel.id, NULL);
+        nv_free(entity->channel.name);
+        break;
+    }
+
+    ring_remove(cache, entity);
+
+    cache->bytes -= entity->size;
+    cache->counts[entity->kind]--;
+
+    nv_free(entity);
+}
+
+static void enforce_bounds(entity_cache_t* cache) {
+    while (current_bytes(cache) > cache->max_bytes && cache->ring_count > 0) {
+        if (cache->hand >= cache->ring_count) {
+            cache->hand = 0;
+        }
+
+        struct entity* entity = cache->ring[cache->hand];
+        if (entity->referenced) {
+            /* a second chance */
+            entity->referenced = false;
+            cache->hand++;
+
+            continue;
+        }
+
+        /* the last entity takes its slot, so the hand stays put */
+        remove_entity(cache, entity);
+
+        cache->evictions++;
+        metric_inc(cache->evicted);
+    }
+
+    metric_set(cache->size_gauge, (int64_t)current_bytes(cache));
+}
+
+static char* dup_string_field(const json_object* data, const char* name) {
+    json_object* field = json_object_object_get(data, name);
+    if (!field || json_object_get_type(field) != json_type_string) {
+        return NULL;
+    }
+
+    return nv_strdup(json_object_get_string(field));
+}
+
+static uint64_t get_id_field(const json_object* data, const char* name) {
+    uint64_t id;
+    if (!snowflake_parse(&id, json_object_object_get(data, name))) {
+        return 0;
+    }
+
+    return id;
+}
+
+/* takes ownership of the strings in user */
+static void store_user(entity_cache_t* cache, struct user* user) {
+    struct entity* entity = table_find(&cache->users, user->id);
+
+    if (entity) {
+        user_cleanup(&entity->user);
+    } else {
+        entity = new_entity(cache, ENTITY_USER);
+        entity_table_insert(&cache->users, user->id, entity);
+    }
+
+    memcpy(&entity->user, user, sizeof(struct user));
+    resize_entity(cache, entity);
+}
+
+/* user id, or 0 if the user could not be parsed */
+static uint64_t put_user(entity_cache_t* cache, const json_object* data) {
+    struct user user;
+    if (!user_parse(&user, data)) {
+        return 0;
+    }
+
+    store_user(cache, &user);
+    return user.id;
+}
+
+/* takes ownership of nick. members of guilds that are not cached are dropped */
+static void store_member(entity_cache_t* cache, uint64_t guild_id, uint64_t user_id, char* nick) {
+    struct entity* guild = table_find(&cache->guilds, guild_id);
+    if (!guild) {
+        nv_free(nick);
+        return;
+    }
+
+    entity_table_t* members = &guild->guild.members;
+    struct entity* entity = table_find(members, user_id);
+
+    if (entity) {
+        nv_free(entity->member.nick);
+    } else {
+        entity = new_entity(cache, ENTITY_MEMBER);
+        entity->member.guild_id = guild_id;
+        entity->member.user_id = user_id;
+
+        size_t previous_bytes = entity_table_memory(members);
+        entity_table_insert(members, user_id, entity);
+
+        cache->bytes += entity_table_memory(members) - previous_bytes;
+        guild->guild.guild.num_members++;
+    }
+
+    entity->member.nick = nick;
+    resize_entity(cache, entity);
+}
+
+/* a guild member object, or anything shaped like one */
+static void put_member(entity_cache_t* cache, uint64_t guild_id, const json_object* data) {
+    uint64_t user_id = put_user(cache, json_object_object_get(data, "user"));
+    if (user_id == 0) {
+        return;
+    }
+
+    store_member(cache, guild_id, user_id, dup_string_field(data, "nick"));
+}
+
+static void put_members(entity_cache_t* cache, uint64_t guild_id, const json_object* data) {
+    if (!data || json_object_get_type(data) != json_type_array) {
+        return;
+    }
+
+    size_t count = json_object_array_length(data);
+    for (size_t i = 0; i < count; i++) {
+        put_member(cache, guild_id, json_object_array_get_idx(data, i));
+    }
+}
+
+static void put_channel(entity_cache_t* cache, uint64_t guild_id, const json_object* data) {
+    uint64_t id = get_id_field(data, "id");
+    if (id == 0) {
+        return;
+    }
+
+    struct entity* entity = table_find(&cache->channels, id);
+    if (entity) {
+        nv_free(entity->channel.name);
+    } else {
+        entity = new_entity(cache, ENTITY_CHANNEL);
+        entity->channel.id = id;
+
+        entity_table_insert(&cache->channels, id, entity);
+    }
+
+    /* guild channels in GUILD_CREATE leave out guild_id */
+    uint64_t own_guild_id = get_id_field(data, "guild_id");
+    entity->channel.guild_id = own_guild_id != 0 ? own_guild_id : guild_id;
+
+    json_object* field = json_object_object_get(data, "type");
+    entity->channel.type = field ? (uint32_t)json_object_get_int(field) : 0;
+    entity->channel.name = dup_string_field(data, "name");
+
+    resize_entity(cache, entity);
+}
+
+static void put_channels(entity_cache_t* cache, uint64_t guild_id, const json_object* data) {
+    if (!data || json_object_get_type(data) != json_type_array) {
+        return;
+    }
+
+    size_t count = json_object_array_length(data);
+    for (size_t i = 0; i < count; i++) {
+        put_channel(cache, guild_id, json_object_array_get_idx(data, i));
+    }
+}
+
+/* guild id, or 0 if the guild is unavailable or could not be parsed */
+static uint64_t put_guild(entity_cache_t* cache, const json_object* data) {
+    json_object* field = json_object_object_get(data, "unavailable");
+    if (field && json_object_get_boolean(field)) {
+        return 0;
+    }
+
+    uint64_t id = get_id_field(data, "id");
+    if (id == 0) {
+        return 0;
+    }
+
+    struct entity* entity = table_find(&cache->guilds, id);
+    if (entity) {
+        nv_free(entity->guild.guild.name);
+    } else {
+        entity = new_entity(cache, ENTITY_GUILD);
+        entity->guild.guild.id = id;
+
+        entity_table_insert(&cache->guilds, id, entity);
+    }
+
+    entity->guild.guild.owner_id = get_id_field(data, "owner_id");
+    entity->guild.guild.name = dup_string_field(data, "name");
+
+    resize_entity(cache, entity);
+    return id;
+}
+
+static void remove_guild(entity_cache_t* cache, uint64_t id) {
+    struct entity* guild = table_find(&cache->guilds, id);
+    if (guild) {
+        remove_entity(cache, guild);
+    }
+
+    /* channels are not kept per guild; deleting a guild is rare enough to scan for them */
+    size_t count = 0;
+    struct entity** doomed = nv_alloc((cache->channels.count + 1) * sizeof(struct entity*));
+    assert(doomed);
+
+    HASHMAP_FOR_EACH(&cache->channels, i) {
+        if (cache->channels.values[i]->channel.guild_id == id) {
+            doomed[count++] = cache->channels.values[i];
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        remove_entity(cache, doomed[i]);
+    }
+
+    nv_free(doomed);
+}
+
+static void remove_member(entity_cache_t* cache, uint64_t guild_id, uint64_t user_id) {
+    struct entity* guild = table_find(&cache->guilds, guild_id);
+    if (!guild) {
+        return;
+    }
+
+    struct entity* member = table_find(&guild->guild.members, user_id);
+    if (member) {
+        remove_entity(cache, member);
+    }
+}
+
+static void remove_channel(entity_cache_t* cache, uint64_t id) {
+    struct entity* channel = table_find(&cache->channels, id);
+    if (channel) {
+        remove_entity(cache, channel);
+    }
+}
+
+entity_cache_t* entity_cache_create(size_t max_bytes) {
+    entity_cache_t* cache = nv_alloc(sizeof(entity_cache_t));
+    assert(cache);
+
+    memset(cache, 0, sizeof(entity_cache_t));
+    cache->max_bytes = max_bytes > 0 ? max_bytes : DEFAULT_CACHE_MAX_BYTES;
+
+    cache->hits = metric_get(&lookups, "result=\"hit\"");
+    cache->misses = metric_get(&lookups, "result=\"miss\"");
+    cache->evicted = metric_get(&evictions, NULL);
+    cache->size_gauge = metric_get(&cache_bytes, NULL);
+
+    log_debug("entity cache limited to %zu bytes", cache->max_bytes);
+    return cache;
+}
+
+void entity_cache_free(entity_cache_t* cache) {
+    if (!cache) {
+        return;
+    }
+
+    /* members only exist while their guild does, so any order works */
+    while (cache->ring_count > 0) {
+        remove_entity(cache, cache->ring[cache->ring_count - 1]);
+    }
+
+    entity_table_free(&cache->users);
+    entity_table_free(&cache->guilds);
+    entity_table_free(&cache->channels);
+
+    nv_free(cache->ring);
+    nv_free(cache);
+}
+
+bool entity_cache_update(entity_cache_t* cache, const char* type, const json_object* data) {
+    if (strcmp(type, "GUILD_CREATE") == 0) {
+        uint64_t id = put_guild(cache, data);
+        if (id != 0) {
+            put_channels(cache, id, json_object_object_get(data, "channels"));
+            put_channels(cache, id, json_object_object_get(data, "threads"));
+            put_members(cache, id, json_object_object_get(data, "members"));
+        }
+    } else if (strcmp(type, "GUILD_UPDATE") == 0) {
+        put_guild(cache, data);
+    } else if (strcmp(type, "GUILD_DELETE") == 0) {
+        remove_guild(cache, get_id_field(data, "id"));
+    } else if (strcmp(type, "GUILD_MEMBER_ADD") == 0 || strcmp(type, "GUILD_MEMBER_UPDATE") == 0) {
+        put_member(cache, get_id_field(data, "guild_id"), data);
+    } else if (strcmp(type, "GUILD_MEMBER_REMOVE") == 0) {
+        json_object* user = json_object_object_get(data, "user");
+        remove_member(cache, get_id_field(data, "guild_id"), user ? get_id_field(user, "id") : 0);
+    } else if (strcmp(type, "GUILD_MEMBERS_CHUNK") == 0) {
+        put_members(cache, get_id_field(data, "guild_id"), json_object_object_get(data, "members"));
+    } else if (strcmp(type, "CHANNEL_CREATE") == 0 || strcmp(type, "CHANNEL_UPDATE") == 0 ||
+               strcmp(type, "THREAD_CREATE") == 0 || strcmp(type, "THREAD_UPDATE") == 0) {
+        put_channel(cache, 0, data);
+    } else if (strcmp(type, "CHANNEL_DELETE") == 0 || strcmp(type, "THREAD_DELETE") == 0) {
+        remove_channel(cache, get_id_field(data, "id"));
+    } else if (strcmp(type, "USER_UPDATE") == 0) {
+        put_user(cache, data);
+    } else if (strcmp(type, "READY") == 0) {
+        put_user(cache, json_object_object_get(data, "user"));
+    } else {
+        return false;
+    }
+
+    enforce_bounds(cache);
+    return true;
+}
+
+static void copy_user(struct user* dst, const struct user* src) {
+    dst->id = src->id;
+    dst->username = src->username ? nv_strdup(src->username) : NULL;
+    dst->discriminator = src->discriminator ? nv_strdup(src->discriminator) : NULL;
+    dst->global_name = src->global_name ? nv_strdup(src->global_name) : NULL;
+}
+
+void entity_cache_put_interaction(entity_cache_t* cache, const struct interaction* interaction) {
+    const struct user* user = interaction->member ? interaction->member->user : interaction->user;
+    if (!user) {
+        return;
+    }
+
+    struct user copy;
+    copy_user(&copy, user);
+    store_user(cache, &copy);
+
+    if (interaction->member && interaction->guild_id != 0) {
+        const char* nick = interaction->member->nick;
+        store_member(cache, interaction->guild_id, user->id, nick ? nv_strdup(nick) : NULL);
+    }
+
+    enforce_bounds(cache);
+}
+
+static struct entity* lookup(entity_cache_t* cache, const entity_table_t* table, uint64_t id) {
+    struct entity* entity = table_find(table, id);
+
+    if (entity) {
+        entity->referenced = true;
+        metric_inc(cache->hits);
+    } else {
+        metric_inc(cache->misses);
+    }
+
+    return entity;
+}
+
+const struct user* entity_cache_get_user(entity_cache_t* cache, uint64_t id) {
+    struct entity* entity = lookup(cache, &cache->users, id);
+    return entity ? &entity->user : NULL;
+}
+
+const struct cached_guild* entity_cache_get_guild(entity_cache_t* cache, uint64_t id) {
+    struct entity* entity = lookup(cache, &cache->guilds, id);
+    return entity ? &entity->guild.guild : NULL;
+}
+
+const struct cached_channel* entity_cache_get_channel(entity_cache_t* cache, uint64_t id) {
+    struct entity* entity = lookup(cache, &cache->channels, id);
+    return entity ? &entity->channel : NULL;
+}
+
+const struct cached_member* entity_cache_get_member(entity_cache_t* cache, uint64_t guild_id,
+                                                    uint64_t user_id) {
+    struct entity* guild = table_find(&cache->guilds, guild_id);
+    if (!guild) {
+        metric_inc(cache->misses);
+        return NULL;
+    }
+
+    /* a hot member keeps its guild, and so itself, from being evicted */
+    guild->referenced = true;
+
+    struct entity* entity = lookup(cache, &guild->guild.members, user_id);
+    return entity ? &entity->member : NULL;
+}
+
+void entity_cache_get_stats(const entity_cache_t* cache, struct entity_cache_stats* stats) {
+    stats->users = cache->counts[ENTITY_USER];
+    stats->members = cache->counts[ENTITY_MEMBER];
+    stats->guilds = cache->counts[ENTITY_GUILD];
+    stats->channels = cache->counts[ENTITY_CHANNEL];
+
+    stats->bytes = current_bytes(cache);
+    stats->max_bytes = cache->max_bytes;
+    stats->evictions = cache->evictions;
+}
@@ -0,0 +1,89 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <json.h>
+
+#include "types/user.h"
+
+/* users, guilds, guild members and channels seen on the gateway, keyed by snowflake. populated from
+ * GUILD_CREATE and the guild, member and channel events that follow it, and from the member or
+ * user attached to each interaction.
+ *
+ * memory is bounded: once entities take more than the configured number of bytes, CLOCK eviction
+ * drops the ones that have not been looked up since the hand last passed them. evicting a guild
+ * evicts its members with it.
+ *
+ * lookups hand out pointers into the cache rather than copies. the cache is only changed while a
+ * gateway event is dispatched, so a pointer stays valid until the handler that looked it up
+ * returns; keep ids, not pointers, past that */
+
+typedef struct entity_cache entity_cache_t;
+
+struct cached_guild {
+    uint64_t id;
+    uint64_t owner_id;
+
+    /* NULL if unavailable */
+    char* name;
+
+    /* as cached, not as discord counts them */
+    size_t num_members;
+};
+
+struct cached_member {
+    uint64_t guild_id;
+    uint64_t user_id;
+
+    /* NULL if unset */
+    char* nick;
+};
+
+struct cached_channel {
+    uint64_t id;
+
+    /* 0 outside of guilds */
+    uint64_t guild_id;
+
+    uint32_t type;
+
+    /* NULL for DMs */
+    char* name;
+};
+
+struct entity_cache_stats {
+    size_t users, members, guilds, channels;
+
+    size_t bytes, max_bytes;
+    uint64_t evictions;
+};
+
+/* about 64 bytes per user and member with short names */
+#define DEFAULT_CACHE_MAX_BYTES (32 * 1024 * 1024)
+
+/* 0 for DEFAULT_CACHE_MAX_BYTES */
+entity_cache_t* entity_cache_create(size_t max_bytes);
+void entity_cache_free(entity_cache_t* cache);
+
+/* type is an uppercase dispatch event name. false if the cache does not care about it */
+bool entity_cache_update(entity_cache_t* cache, const char* type, const json_object* data);
+
+/* from types/interaction.h */
+struct interaction;
+
+void entity_cache_put_interaction(entity_cache_t* cache, const struct interaction* interaction);
+
+/* NULL on a miss */
+const struct user* entity_cache_get_user(entity_cache_t* cache, uint64_t id);
+const struct cached_guild* entity_cache_get_guild(entity_cache_t* cache, uint64_t id);
+const struct cached_channel* entity_cache_get_channel(entity_cache_t* cache, uint64_t id);
+
+const struct cached_member* entity_cache_get_member(entity_cache_t* cache, uint64_t guild_id,
+                                                    uint64_t user_id);
+
+void entity_cache_get_stats(const entity_cache_t* cache, struct entity_cache_stats* stats);
+
+#endif
@@ -5,6 +5,9 @@
 #include "types/interaction.h"
 #include "types/snowflake.h"
 
+#include "../core/intern.h"
+#include "../core/trace.h"
+
 #include <string.h>
 #include <stdio.h>
 #include <inttypes.h>
@@ -16,7 +19,8 @@
 #include <nyoravim/util.h>
 
 typedef struct command {
-    char* name;
+    /* interned */
+    const char* name;
 
     uint64_t app_id;
     uint64_t guild_id;
@@ -155,10 +159,19 @@ command_t* command_register(const struct command_spec* spec) {
         return NULL;
     }
 
+    return command_create(spec);
+}
+
+command_t* command_create(const struct command_spec* spec) {
     command_t* cmd = nv_alloc(sizeof(command_t));
     assert(cmd);
 
-    cmd->name = nv_strdup(spec->name);
+    /* inbound invocations resolve to these */
+    cmd->name = intern(spec->name);
+    for (size_t i = 0; i < spec->num_options; i++) {
+        intern(spec->options[i].name);
+    }
+
     cmd->app_id = bot_get_app_id(spec->bot);
     cmd->guild_id = spec->guild_id;
 
@@ -175,62 +188,26 @@ void command_free(command_t* cmd) {
         return;
     }
 
-    nv_free(cmd->name);
     nv_free(cmd);
 }
 
 const char* command_get_name(const command_t* cmd) { return cmd->name; }
 
-static void command_option_data_free_callback(void* user, void* value) { nv_free(value); }
-
-static bool strings_equal(void* user, const void* lhs, const void* rhs) {
-    return strcmp(lhs, rhs) == 0;
-}
-
-static size_t hash_string(void* user, const void* key) { return nv_hash_string(key); }
-
 static bool invoke_command(command_t* cmd, const struct interaction* event) {
     struct interaction_command_data* data = event->command_data;
-    if (strcmp(data->name, cmd->name) != 0) {
+    if (data->name != cmd->name) {
         log_warn("command names dont match; disregarding invocation");
         return false;
     }
 
-    struct nv_map_callbacks callbacks;
-    callbacks.equals = strings_equal;
-    callbacks.hash = hash_string;
-    callbacks.free_key = command_option_data_free_callback;
-    callbacks.free_value = command_option_data_free_callback;
-
-    char buffer[256];
-    size_t buffer_length = sizeof(buffer) - 1;
-    buffer[buffer_length] = '\0';
-
-    nv_map_t* options = nv_map_alloc(64, &callbacks);
-    for (size_t i = 0; i < data->num_options; i++) {
-        const struct command_option_data* option = &data->options[i];
-
-        const char* prev_value;
-        if (nv_map_get(options, option->name, (void**)&prev_value)) {
-            log_trace("multiple option values exist; concatenating with a semicolon delimiter");
-            snprintf(buffer, buffer_length, "%s;%s", prev_value, option->value);
-
-            /* nv_map_set frees previous value */
-            assert(nv_map_set(options, option->name, nv_strdup(buffer)));
-        } else {
-            assert(nv_map_insert(options, nv_strdup(option->name), nv_strdup(option->value)));
-        }
-    }
-
     struct command_invocation_context ic;
     ic.cmd = cmd;
     ic.user = cmd->user;
-    ic.options = options;
     ic.interaction = event;
+    ic.num_options = data->num_options;
+    ic.options = data->options;
 
     cmd->callback(&ic);
-    nv_map_free(options);
-
     return true;
 }
 
@@ -241,10 +218,36 @@ bool command_invoke(command_t* cmd, const struct interaction* event) {
     }
 
     switch (event->type) {
-    case INTERACTION_TYPE_APPLICATION_COMMAND:
-        return invoke_command(cmd, event);
+    case INTERACTION_TYPE_APPLICATION_COMMAND: {
+        struct trace_span span;
+        trace_begin(&span, "command_invoke");
+
+        bool success = invoke_command(cmd, event);
+
+        trace_end(&span);
+        return success;
+    }
     default:
         log_warn("this event does not concern this command; disregarding");
         return false;
     }
 }
+
+bool command_get_option(const struct command_invocation_context* context, const char* name,
+                        const char** value) {
+    /* options are matched by pointer, so a name that was never interned matches nothing */
+    const char* interned = intern_find(name);
+    if (!interned) {
+        return false;
+    }
+
+    for (size_t i = 0; i < context->num_options; i++) {
+        const struct command_option_data* option = &context->options[i];
+        if (option->name == interned) {
+            *value = option->value;
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -31,12 +31,18 @@ typedef struct command command_t;
 /* from bot.h */
 typedef struct bot bot_t;
 
+/* from types/interaction.h */
+struct command_option_data;
+
 struct command_invocation_context {
     command_t* cmd;
     void* user;
 
     const struct interaction* interaction;
-    const nv_map_t* options;
+
+    /* as sent; see command_get_option */
+    size_t num_options;
+    const struct command_option_data* options;
 };
 
 struct command_option_spec {
@@ -67,9 +73,15 @@ struct command_spec {
     uint64_t guild_id;
 };
 
+/* registers the command with discord and creates it locally */
 command_t* command_register(const struct command_spec* spec);
+
+/* local only; for commands discord already knows about */
+command_t* command_create(const struct command_spec* spec);
+
 void command_free(command_t* cmd);
 
+/* interned; see core/intern.h */
 const char* command_get_name(const command_t* cmd);
 
 /* from types/interaction.h */
@@ -77,4 +89,9 @@ struct interaction;
 
 bool command_invoke(command_t* cmd, const struct interaction* event);
 
+/* value is NULL if the option was sent without one. false if the option was not sent; if it was
+ * sent more than once, the first wins */
+bool command_get_option(const struct command_invocation_context* context, const char* name,
+                        const char** value);
+
 #endif
@@ -1,13 +1,11 @@
 #include "component.h"
 
-#include "../core/base64.h"
+#include "custom_id.h"
 
 #include <assert.h>
 
 #include <log.h>
 
-#include <nyoravim/mem.h>
-
 static void serialize_action_row(json_object* result, const struct action_row* data) {
     json_object* children = json_object_new_array();
     assert(children);
@@ -35,14 +33,99 @@ static void serialize_button(json_object* result, const struct button* data) {
     assert(field);
     json_object_object_add(result, "disabled", field);
 
-    char* b64_data = base64_encode(data->data, data->data_size);
-    assert(b64_data);
+    char custom_id[CUSTOM_ID_MAX_LENGTH + 1];
+    if (!custom_id_encode(data->route, data->data, data->data_size, custom_id)) {
+        log_error("failed to encode button custom_id; button will not be interactable");
+        return;
+    }
 
-    field = json_object_new_string(b64_data);
+    field = json_object_new_string(custom_id);
     assert(field);
+    json_object_object_add(result, "custom_id", field);
+}
+
+static void serialize_string_select(json_object* result, const struct string_select* data) {
+    char custom_id[CUSTOM_ID_MAX_LENGTH + 1];
+    if (!custom_id_encode(data->route, data->data, data->data_size, custom_id)) {
+        log_error("failed to encode select custom_id; select will not be interactable");
+        return;
+    }
 
+    json_object* field = json_object_new_string(custom_id);
+    assert(field);
     json_object_object_add(result, "custom_id", field);
-    nv_free(b64_data);
+
+    if (data->placeholder) {
+        field = json_object_new_string(data->placeholder);
+        assert(field);
+        json_object_object_add(result, "placeholder", field);
+    }
+
+    if (data->min_values > 0) {
+        field = json_object_new_int((int32_t)data->min_values);
+        assert(field);
+        json_object_object_add(result, "min_values", field);
+    }
+
+    if (data->max_values > 0) {
+        field = json_object_new_int((int32_t)data->max_values);
+        assert(field);
+        json_object_object_add(result, "max_values", field);
+    }
+
+    json_object* options = json_object_new_array();
+    assert(options);
+
+    for (size_t i = 0; i < data->num_options; i++) {
+        json_object* option = json_object_new_object();
+        assert(option);
+
+        field = json_object_new_string(data->options[i].label);
+        assert(field);
+        json_object_object_add(option, "label", field);
+
+        field = json_object_new_string(data->options[i].value);
+        assert(field);
+        json_object_object_add(option, "value", field);
+
+        json_object_array_add(options, option);
+    }
+
+    json_object_object_add(result, "options", options);
+}
+
+static void serialize_text_input(json_object* result, const struct text_input* data) {
+    json_object* field = json_object_new_string(data->id);
+    assert(field);
+    json_object_object_add(result, "custom_id", field);
+
+    field = json_object_new_int((int32_t)data->style);
+    assert(field);
+    json_object_object_add(result, "style", field);
+
+    field = json_object_new_boolean((json_bool)data->required);
+    assert(field);
+    json_object_object_add(result, "required", field);
+
+    if (data->placeholder) {
+        field = json_object_new_string(data->placeholder);
+        assert(field);
+        json_object_object_add(result, "placeholder", field);
+    }
+}
+
+static void serialize_label(json_object* result, const struct label* data) {
+    json_object* field = json_object_new_string(data->label);
+    assert(field);
+    json_object_object_add(result, "label", field);
+
+    if (data->description) {
+        field = json_object_new_string(data->description);
+        assert(field);
+        json_object_object_add(result, "description", field);
+    }
+
+    json_object_object_add(result, "component", component_serialize(data->child));
 }
 
 static void serialize_text_display(json_object* result, const struct text_display* data) {
@@ -62,9 +145,18 @@ json_object* component_serialize(const struct component* comp) {
     case COMPONENT_TYPE_BUTTON:
         serialize_button(result, &comp->button);
         break;
+    case COMPONENT_TYPE_STRING_SELECT:
+        serialize_string_select(result, &comp->string_select);
+        break;
+    case COMPONENT_TYPE_TEXT_INPUT:
+        serialize_text_input(result, &comp->text_input);
+        break;
     case COMPONENT_TYPE_TEXT_DISPLAY:
         serialize_text_display(result, &comp->text_display);
         break;
+    case COMPONENT_TYPE_LABEL:
+        serialize_label(result, &comp->label);
+        break;
     default:
         log_error("unsupported component type: %" PRIu32, comp->type);
 
@@ -35,6 +35,11 @@ enum {
     BUTTON_STYLE_LINK = 5,
 };
 
+enum {
+    TEXT_INPUT_STYLE_SHORT = 1,
+    TEXT_INPUT_STYLE_PARAGRAPH = 2,
+};
+
 struct action_row {
     size_t num_children;
     const struct component* children;
@@ -44,12 +49,45 @@ struct button {
     uint32_t style;
     const char* label;
 
+    /* encoded into custom_id; see custom_id.h */
+    uint8_t route;
     const void* data;
     size_t data_size;
 
     bool disabled;
 };
 
+struct select_option {
+    const char* label;
+    const char* value;
+};
+
+struct string_select {
+    /* encoded into custom_id; see custom_id.h */
+    uint8_t route;
+    const void* data;
+    size_t data_size;
+
+    /* can be NULL */
+    const char* placeholder;
+
+    size_t num_options;
+    const struct select_option* options;
+
+    uint32_t min_values, max_values;
+};
+
+struct text_input {
+    /* handed back verbatim in the modal submit; not encoded */
+    const char* id;
+    uint32_t style;
+
+    /* can be NULL */
+    const char* placeholder;
+
+    bool required;
+};
+
 struct text_display {
     const char* content;
 };
@@ -69,6 +107,8 @@ struct component {
     union {
         struct action_row action_row;
         struct button button;
+        struct string_select string_select;
+        struct text_input text_input;
         struct text_display text_display;
         struct label label;
     };
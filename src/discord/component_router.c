@@ -0,0 +1,124 @@
+#include "component_router.h"
+
+#include "types/interaction.h"
+
+#include <assert.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <log.h>
+
+#include <nyoravim/mem.h>
+
+#define MAX_ROUTES 256
+
+struct component_handler {
+    const char* name;
+
+    void* user;
+    component_invocation_callback callback;
+};
+
+typedef struct component_router {
+    /* indexed by route; callback is NULL for free routes */
+    struct component_handler handlers[MAX_ROUTES];
+} component_router_t;
+
+component_router_t* component_router_create() {
+    component_router_t* router = nv_alloc(sizeof(component_router_t));
+    assert(router);
+
+    memset(router, 0, sizeof(component_router_t));
+    return router;
+}
+
+void component_router_free(component_router_t* router) { nv_free(router); }
+
+bool component_router_register(component_router_t* router,
+                               const struct component_handler_spec* spec) {
+    struct component_handler* handler = &router->handlers[spec->route];
+    if (handler->callback) {
+        log_error("component route %" PRIu8 " already taken by %s", spec->route,
+                  handler->name ? handler->name : "<unnamed>");
+
+        return false;
+    }
+
+    if (!spec->callback) {
+        log_error("no callback passed for component route %" PRIu8, spec->route);
+        return false;
+    }
+
+    handler->name = spec->name;
+    handler->user = spec->user;
+    handler->callback = spec->callback;
+
+    log_debug("registered component route %" PRIu8 ": %s", spec->route,
+              spec->name ? spec->name : "<unnamed>");
+
+    return true;
+}
+
+bool component_router_dispatch(const component_router_t* router, const struct interaction* event) {
+    struct component_invocation_context context;
+    memset(&context, 0, sizeof(struct component_invocation_context));
+    context.interaction = event;
+
+    const void* data;
+    size_t data_size;
+
+    switch (event->type) {
+    case INTERACTION_TYPE_MESSAGE_COMPONENT: {
+        const struct interaction_component_data* comp = event->component_data;
+
+        context.route = comp->route;
+        context.component_type = comp->type;
+        context.num_values = comp->num_values;
+        context.values = comp->values;
+
+        data = comp->data;
+        data_size = comp->data_size;
+        break;
+    }
+    case INTERACTION_TYPE_MODEL_SUBMIT: {
+        const struct interaction_modal_data* modal = event->modal_data;
+
+        context.route = modal->route;
+        context.num_fields = modal->num_fields;
+        context.fields = modal->fields;
+
+        data = modal->data;
+        data_size = modal->data_size;
+        break;
+    }
+    default:
+        log_warn("interaction type %" PRIu32 " cannot be routed by custom_id", event->type);
+        return false;
+    }
+
+    const struct component_handler* handler = &router->handlers[context.route];
+    if (!handler->callback) {
+        log_warn("no handler for component route %" PRIu8, context.route);
+        return false;
+    }
+
+    log_trace("routing component interaction to %s", handler->name ? handler->name : "<unnamed>");
+
+    context.user = handler->user;
+    record_reader_init(&context.payload, data, data_size);
+
+    handler->callback(&context);
+    return true;
+}
+
+const struct modal_field* component_get_modal_field(
+    const struct component_invocation_context* context, const char* id) {
+    for (size_t i = 0; i < context->num_fields; i++) {
+        const struct modal_field* field = &context->fields[i];
+        if (strcmp(field->custom_id, id) == 0) {
+            return field;
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,67 @@
+#ifndef _COMPONENT_ROUTER_H
+#define _COMPONENT_ROUTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "../core/record.h"
+
+/* routes component and modal submit interactions to handlers by the route tag embedded in their
+ * custom_id (see custom_id.h). lookup is a direct index into a 256 entry table */
+
+typedef struct component_router component_router_t;
+
+/* from types/interaction.h */
+struct interaction;
+struct modal_field;
+
+struct component_invocation_context {
+    void* user;
+    const struct interaction* interaction;
+
+    uint8_t route;
+
+    /* COMPONENT_TYPE_* of the component used, or 0 for modal submits */
+    uint32_t component_type;
+
+    /* custom_id payload positioned at the first field. copy it to read */
+    struct record_reader payload;
+
+    /* select menus */
+    size_t num_values;
+    char* const* values;
+
+    /* modal submits */
+    size_t num_fields;
+    const struct modal_field* fields;
+};
+
+typedef void (*component_invocation_callback)(const struct component_invocation_context* context);
+
+struct component_handler_spec {
+    uint8_t route;
+
+    /* for logging; not copied */
+    const char* name;
+
+    void* user;
+    component_invocation_callback callback;
+};
+
+component_router_t* component_router_create();
+void component_router_free(component_router_t* router);
+
+/* fails if the route is already taken */
+bool component_router_register(component_router_t* router,
+                               const struct component_handler_spec* spec);
+
+/* returns false if the interaction is not a component or modal submit, or nothing handles its
+ * route */
+bool component_router_dispatch(const component_router_t* router, const struct interaction* event);
+
+/* finds a submitted modal field by the id its text input was created with */
+const struct modal_field* component_get_modal_field(
+    const struct component_invocation_context* context, const char* id);
+
+#endif
@@ -57,6 +57,9 @@ struct credentials* credentials_read_from_path(const char* path) {
         creds->guild_scope = 0;
     }
 
+    const char* public_key = get_object_string(json, "public_key");
+    creds->public_key = public_key ? strdup(public_key) : NULL;
+
     json_object_put(json);
     return creds;
 }
@@ -70,6 +73,7 @@ struct credentials* credentials_dup(const struct credentials* src) {
     dst->token = strdup(src->token);
     dst->app_id = src->app_id;
     dst->guild_scope = src->guild_scope;
+    dst->public_key = src->public_key ? strdup(src->public_key) : NULL;
 
     return dst;
 }
@@ -80,5 +84,6 @@ void credentials_free(struct credentials* creds) {
     }
 
     free(creds->token);
+    free(creds->public_key);
     free(creds);
 }
@@ -9,6 +9,10 @@ struct credentials {
     char* token;
     uint64_t app_id;
     uint64_t guild_scope;
+
+    /* hex ed25519 key from the developer portal; NULL if not given. only http interactions need it,
+     * to verify that requests came from discord */
+    char* public_key;
 };
 
 struct credentials* credentials_read_from_path(const char* path);
@@ -0,0 +1,372 @@
+#include "custom_id.h"
+
+#include "../core/base64.h"
+#include "../core/database.h"
+
+#include <assert.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <sys/random.h>
+
+#include <hiredis/hiredis.h>
+
+#include <log.h>
+
+#include <nyoravim/mem.h>
+
+/* neither is part of the base64 alphabet, so old ids are never mistaken for new ones */
+#define MARKER_INLINE '.'
+#define MARKER_SPILLED '~'
+
+#define TOKEN_SIZE sizeof(uint64_t)
+#define SPILL_KEY_PREFIX "customid:"
+#define DEFAULT_TTL_SECONDS (30 * 24 * 60 * 60)
+
+/* the largest binary blob whose unpadded base64 still fits after the marker */
+#define MAX_BINARY_SIZE ((CUSTOM_ID_MAX_LENGTH - 1) * 3 / 4)
+
+struct cache_entry {
+    uint64_t token;
+
+    void* data;
+    size_t size;
+
+    /* indices into the entry array; -1 terminates */
+    int32_t bucket_next;
+    int32_t lru_prev, lru_next;
+};
+
+/* fixed capacity LRU of spilled payloads keyed by token. tokens are random so the low bits make a
+ * fine bucket index */
+struct spill_cache {
+    struct cache_entry* entries;
+    size_t capacity, count;
+
+    int32_t* buckets;
+    size_t bucket_mask;
+
+    /* head is the most recently used */
+    int32_t lru_head, lru_tail;
+};
+
+static redisContext* spill_db = NULL;
+static uint32_t spill_ttl = DEFAULT_TTL_SECONDS;
+static struct spill_cache cache;
+
+static void cache_init(size_t capacity) {
+    memset(&cache, 0, sizeof(struct spill_cache));
+    cache.lru_head = cache.lru_tail = -1;
+
+    if (capacity == 0) {
+        return;
+    }
+
+    size_t bucket_count = 1;
+    while (bucket_count < capacity) {
+        bucket_count <<= 1;
+    }
+
+    cache.capacity = capacity;
+    cache.entries = nv_calloc(capacity, sizeof(struct cache_entry));
+    assert(cache.entries);
+
+    cache.bucket_mask = bucket_count - 1;
+    cache.buckets = nv_alloc(bucket_count * sizeof(int32_t));
+    assert(cache.buckets);
+
+    for (size_t i = 0; i < bucket_count; i++) {
+        cache.buckets[i] = -1;
+    }
+}
+
+static void cache_cleanup() {
+    for (size_t i = 0; i < cache.count; i++) {
+        nv_free(cache.entries[i].data);
+    }
+
+    nv_free(cache.entries);
+    nv_free(cache.buckets);
+
+    memset(&cache, 0, sizeof(struct spill_cache));
+}
+
+static void lru_unlink(int32_t index) {
+    struct cache_entry* entry = &cache.entries[index];
+
+    if (entry->lru_prev >= 0) {
+        cache.entries[entry->lru_prev].lru_next = entry->lru_next;
+    } else {
+        cache.lru_head = entry->lru_next;
+    }
+
+    if (entry->lru_next >= 0) {
+        cache.entries[entry->lru_next].lru_prev = entry->lru_prev;
+    } else {
+        cache.lru_tail = entry->lru_prev;
+    }
+}
+
+static void lru_push_front(int32_t index) {
+    struct cache_entry* entry = &cache.entries[index];
+    entry->lru_prev = -1;
+    entry->lru_next = cache.lru_head;
+
+    if (cache.lru_head >= 0) {
+        cache.entries[cache.lru_head].lru_prev = index;
+    }
+
+    cache.lru_head = index;
+    if (cache.lru_tail < 0) {
+        cache.lru_tail = index;
+    }
+}
+
+static void bucket_unlink(int32_t index) {
+    int32_t* link = &cache.buckets[cache.entries[index].token & cache.bucket_mask];
+    while (*link != index) {
+        link = &cache.entries[*link].bucket_next;
+    }
+
+    *link = cache.entries[index].bucket_next;
+}
+
+static const struct cache_entry* cache_find(uint64_t token) {
+    if (cache.capacity == 0) {
+        return NULL;
+    }
+
+    int32_t index = cache.buckets[token & cache.bucket_mask];
+    while (index >= 0 && cache.entries[index].token != token) {
+        index = cache.entries[index].bucket_next;
+    }
+
+    if (index < 0) {
+        return NULL;
+    }
+
+    if (cache.lru_head != index) {
+        lru_unlink(index);
+        lru_push_front(index);
+    }
+
+    return &cache.entries[index];
+}
+
+static void cache_insert(uint64_t token, const void* data, size_t size) {
+    if (cache.capacity == 0) {
+        return;
+    }
+
+    int32_t index;
+    if (cache.count < cache.capacity) {
+        index = (int32_t)cache.count++;
+    } else {
+        /* evict the least recently used */
+        index = cache.lru_tail;
+
+        lru_unlink(index);
+        bucket_unlink(index);
+        nv_free(cache.entries[index].data);
+    }
+
+    struct cache_entry* entry = &cache.entries[index];
+    entry->token = token;
+    entry->size = size;
+    entry->data = NULL;
+
+    if (size > 0) {
+        entry->data = nv_alloc(size);
+        assert(entry->data);
+
+        memcpy(entry->data, data, size);
+    }
+
+    int32_t* bucket = &cache.buckets[token & cache.bucket_mask];
+    entry->bucket_next = *bucket;
+    *bucket = index;
+
+    lru_push_front(index);
+}
+
+void custom_id_init(redisContext* db, uint32_t ttl_seconds, size_t cache_capacity) {
+    spill_db = db;
+    spill_ttl = ttl_seconds > 0 ? ttl_seconds : DEFAULT_TTL_SECONDS;
+
+    cache_cleanup();
+    cache_init(cache_capacity);
+}
+
+void custom_id_shutdown() {
+    cache_cleanup();
+    spill_db = NULL;
+}
+
+static void encode_binary(char marker, const uint8_t* binary, size_t size, char* dst) {
+    char encoded[BASE64_ENCODED_LENGTH(MAX_BINARY_SIZE) + 1];
+    size_t length = base64_encode_to(binary, size, encoded);
+
+    /* padding is implied by the length */
+    while (length > 0 && encoded[length - 1] == '=') {
+        length--;
+    }
+
+    dst[0] = marker;
+    memcpy(dst + 1, encoded, length);
+    dst[length + 1] = '\0';
+}
+
+static bool spill(const void* data, size_t size, uint64_t* token) {
+    if (!spill_db) {
+        log_error("custom_id payload of %zu bytes is too large and there is no spill store", size);
+        return false;
+    }
+
+    if (getrandom(token, TOKEN_SIZE, 0) != TOKEN_SIZE) {
+        log_error("failed to generate custom_id spill token");
+        return false;
+    }
+
+    redisReply* reply = db_command(spill_db, "SET " SPILL_KEY_PREFIX "%016" PRIx64 " %b EX %u",
+                                   *token, data, size, spill_ttl);
+
+    bool success = reply && reply->type == REDIS_REPLY_STATUS;
+    if (!success) {
+        log_error("failed to spill custom_id payload to redis");
+    }
+
+    freeReplyObject(reply);
+    if (success) {
+        /* the click usually comes back to this process soon after */
+        cache_insert(*token, data, size);
+    }
+
+    return success;
+}
+
+bool custom_id_encode(uint8_t route, const void* data, size_t size, char* dst) {
+    uint8_t binary[MAX_BINARY_SIZE];
+    binary[0] = route;
+
+    if (size + 1 <= MAX_BINARY_SIZE) {
+        if (size > 0) {
+            memcpy(binary + 1, data, size);
+        }
+
+        encode_binary(MARKER_INLINE, binary, size + 1, dst);
+        return true;
+    }
+
+    uint64_t token;
+    if (!spill(data, size, &token)) {
+        return false;
+    }
+
+    log_trace("spilled %zu byte custom_id payload to token %016" PRIx64, size, token);
+
+    memcpy(binary + 1, &token, TOKEN_SIZE);
+    encode_binary(MARKER_SPILLED, binary, TOKEN_SIZE + 1, dst);
+
+    return true;
+}
+
+static void* dup_payload(const void* data, size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+
+    void* block = nv_alloc(size);
+    assert(block);
+
+    memcpy(block, data, size);
+    return block;
+}
+
+static bool load_spilled(uint64_t token, void** data, size_t* size) {
+    const struct cache_entry* entry = cache_find(token);
+    if (entry) {
+        *data = dup_payload(entry->data, entry->size);
+        *size = entry->size;
+
+        return true;
+    }
+
+    if (!spill_db) {
+        log_error("spilled custom_id received but there is no spill store");
+        return false;
+    }
+
+    redisReply* reply = db_command(spill_db, "GET " SPILL_KEY_PREFIX "%016" PRIx64, token);
+    if (!reply || reply->type != REDIS_REPLY_STRING) {
+        log_warn("spilled custom_id payload %016" PRIx64 " is missing or expired", token);
+
+        freeReplyObject(reply);
+        return false;
+    }
+
+    *data = dup_payload(reply->str, reply->len);
+    *size = reply->len;
+
+    cache_insert(token, reply->str, reply->len);
+    freeReplyObject(reply);
+
+    return true;
+}
+
+static bool decode_legacy(const char* custom_id, size_t length, void** data, size_t* size) {
+    size_t capacity = BASE64_DECODED_MAX_SIZE(length);
+    *data = capacity > 0 ? nv_alloc(capacity) : NULL;
+
+    if (!base64_decode_to(custom_id, length, *data, capacity, size) || *size == 0) {
+        nv_free(*data);
+        *data = NULL;
+        *size = 0;
+
+        return false;
+    }
+
+    return true;
+}
+
+bool custom_id_decode(const char* custom_id, size_t length, uint8_t* route, void** data,
+                      size_t* size) {
+    *data = NULL;
+    *size = 0;
+
+    if (length == 0 || length > CUSTOM_ID_MAX_LENGTH) {
+        return false;
+    }
+
+    char marker = custom_id[0];
+    if (marker != MARKER_INLINE && marker != MARKER_SPILLED) {
+        *route = 0;
+        return decode_legacy(custom_id, length, data, size);
+    }
+
+    uint8_t binary[MAX_BINARY_SIZE];
+
+    size_t binary_size;
+    if (!base64_decode_to(custom_id + 1, length - 1, binary, sizeof(binary), &binary_size) ||
+        binary_size < 1) {
+        log_warn("malformed custom_id");
+        return false;
+    }
+
+    *route = binary[0];
+    if (marker == MARKER_INLINE) {
+        *size = binary_size - 1;
+        *data = dup_payload(binary + 1, *size);
+
+        return true;
+    }
+
+    if (binary_size != TOKEN_SIZE + 1) {
+        log_warn("malformed spilled custom_id");
+        return false;
+    }
+
+    uint64_t token;
+    memcpy(&token, binary + 1, TOKEN_SIZE);
+
+    return load_spilled(token, data, size);
+}
@@ -0,0 +1,31 @@
+#ifndef _CUSTOM_ID_H
+#define _CUSTOM_ID_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* from hiredis/hiredis.h */
+typedef struct redisContext redisContext;
+
+/* https://discord.com/developers/docs/components/reference#anatomy-of-a-component-custom-id */
+#define CUSTOM_ID_MAX_LENGTH 100
+
+/* custom_ids are a marker character followed by unpadded base64 of a route tag byte and the
+ * payload, which callers usually pack with core/record.h. payloads that do not fit are spilled to
+ * redis under a random token and only the route and token are embedded. ids without a marker are
+ * from before this format and decode as route 0 with the raw base64 contents */
+
+/* db can be NULL, in which case payloads that do not fit fail to encode. ttl is how long spilled
+ * payloads live in redis; 0 picks a default. not thread safe */
+void custom_id_init(redisContext* db, uint32_t ttl_seconds, size_t cache_capacity);
+void custom_id_shutdown();
+
+/* dst must hold CUSTOM_ID_MAX_LENGTH + 1 bytes */
+bool custom_id_encode(uint8_t route, const void* data, size_t size, char* dst);
+
+/* data is allocated with nv_alloc, or NULL if the payload is empty */
+bool custom_id_decode(const char* custom_id, size_t length, uint8_t* route, void** data,
+                      size_t* size);
+
+#endif
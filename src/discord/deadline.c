@@ -0,0 +1,351 @@
+/* https://discord.com/developers/docs/interactions/receiving-and-responding */
+
+#include "deadline.h"
+
+#include "types/snowflake.h"
+
+#include "../core/clock.h"
+#include "../core/metrics.h"
+#include "../core/rest.h"
+
+#include <log.h>
+
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <nyoravim/mem.h>
+#include <nyoravim/util.h>
+
+/* type 5, with no data */
+#define DEFERRAL_BODY "{\"type\":5}"
+
+enum {
+    /* the handler has not responded and the deadline has not fired */
+    DEADLINE_PENDING,
+
+    /* the handler responded, or returned without responding */
+    DEADLINE_CLAIMED,
+
+    DEADLINE_DEFERRING,
+    DEADLINE_DEFERRED,
+    DEADLINE_DEFER_FAILED,
+};
+
+typedef struct interaction_deadline {
+    uint64_t id;
+    char* token;
+
+    uint64_t due_ns;
+    uint32_t state;
+
+    /* freed once neither the handler nor the queue holds it */
+    bool armed, queued;
+
+    struct interaction_deadline* next;
+} interaction_deadline_t;
+
+typedef struct deadline_watchdog {
+    rest_t* rest;
+
+    char* base_url;
+    uint32_t api;
+    char* auth_header;
+
+    uint64_t budget_ns;
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+
+    /* the queue or a state changed */
+    pthread_cond_t changed;
+
+    /* in due order. interactions arrive mostly in creation order, so arming mostly appends */
+    interaction_deadline_t* head;
+    interaction_deadline_t* tail;
+
+    bool running;
+} deadline_watchdog_t;
+
+static struct metric_family deferrals = METRIC_COUNTER_FAMILY(
+    "tasks_interaction_deferrals_total", "interactions deferred because a handler ran long");
+
+static void free_deadline(interaction_deadline_t* deadline) {
+    nv_free(deadline->token);
+    nv_free(deadline);
+}
+
+static bool send_deferral(deadline_watchdog_t* watchdog, const interaction_deadline_t* deadline) {
+    char url[1024];
+    snprintf(url, sizeof(url), "%s/v%" PRIu32 "/interactions/%" PRIu64 "/%s/callback",
+             watchdog->base_url, watchdog->api, deadline->id, deadline->token);
+
+    const char* headers[] = { watchdog->auth_header, "Content-Type: application/json" };
+
+    struct http_request req;
+    req.url = url;
+    req.method = "POST";
+    req.headers = headers;
+    req.num_headers = 2;
+    req.data = DEFERRAL_BODY;
+    req.size = strlen(DEFERRAL_BODY);
+
+    struct http_response response;
+    if (!rest_send_await(watchdog->rest, &req, &response)) {
+        return false;
+    }
+
+    nv_free(response.content);
+    return response.status >= 200 && response.status < 300;
+}
+
+/* with the mutex held. the deadline stays marked as queued until the thread is done with it */
+static interaction_deadline_t* pop_deadline(deadline_watchdog_t* watchdog) {
+    interaction_deadline_t* deadline = watchdog->head;
+
+    watchdog->head = deadline->next;
+    if (!watchdog->head) {
+        watchdog->tail = NULL;
+    }
+
+    return deadline;
+}
+
+static void fire(deadline_watchdog_t* watchdog, interaction_deadline_t* deadline) {
+    deadline->state = DEADLINE_DEFERRING;
+    pthread_mutex_unlock(&watchdog->mutex);
+
+    log_warn("interaction %" PRIu64 " is over its response budget; deferring", deadline->id);
+
+    bool success = send_deferral(watchdog, deadline);
+    if (success) {
+        metric_inc(metric_get(&deferrals, NULL));
+    } else {
+        log_error("failed to defer interaction %" PRIu64, deadline->id);
+    }
+
+    pthread_mutex_lock(&watchdog->mutex);
+    deadline->state = success ? DEADLINE_DEFERRED : DEADLINE_DEFER_FAILED;
+
+    pthread_cond_broadcast(&watchdog->changed);
+}
+
+static void* watchdog_thread(void* arg) {
+    deadline_watchdog_t* watchdog = arg;
+    pthread_mutex_lock(&watchdog->mutex);
+
+    while (watchdog->running) {
+        interaction_deadline_t* head = watchdog->head;
+        if (!head) {
+            pthread_cond_wait(&watchdog->changed, &watchdog->mutex);
+            continue;
+        }
+
+        if (head->state == DEADLINE_PENDING) {
+            uint64_t now = time_now_ns();
+
+            if (now < head->due_ns) {
+                struct timespec due;
+                due.tv_sec = (time_t)(head->due_ns / 1000000000);
+                due.tv_nsec = (long)(head->due_ns % 1000000000);
+
+                pthread_cond_timedwait(&watchdog->changed, &watchdog->mutex, &due);
+                continue;
+            }
+
+            fire(watchdog, pop_deadline(watchdog));
+        } else {
+            pop_deadline(watchdog);
+        }
+
+        head->queued = false;
+        if (!head->armed) {
+            free_deadline(head);
+        }
+    }
+
+    pthread_mutex_unlock(&watchdog->mutex);
+    return NULL;
+}
+
+deadline_watchdog_t* deadline_watchdog_create(const char* base_url, uint32_t api,
+                                              const char* token, uint32_t budget_ms) {
+    rest_t* rest = rest_init();
+    if (!rest) {
+        log_error("failed to create a REST handle for the deadline watchdog");
+        return NULL;
+    }
+
+    deadline_watchdog_t* watchdog = nv_alloc(sizeof(deadline_watchdog_t));
+    assert(watchdog);
+    memset(watchdog, 0, sizeof(deadline_watchdog_t));
+
+    watchdog->rest = rest;
+    watchdog->base_url = nv_strdup(base_url);
+    watchdog->api = api;
+    watchdog->budget_ns = (uint64_t)budget_ms * 1000000;
+
+    char auth_header[256];
+    snprintf(auth_header, sizeof(auth_header), "Authorization: Bot %s", token);
+    watchdog->auth_header = nv_strdup(auth_header);
+
+    /* deadlines are monotonic */
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+    pthread_mutex_init(&watchdog->mutex, NULL);
+    pthread_cond_init(&watchdog->changed, &attr);
+    pthread_condattr_destroy(&attr);
+
+    watchdog->running = true;
+    if (pthread_create(&watchdog->thread, NULL, watchdog_thread, watchdog) != 0) {
+        log_error("failed to start the deadline watchdog thread");
+
+        watchdog->running = false;
+        deadline_watchdog_free(watchdog);
+
+        return NULL;
+    }
+
+    log_debug("deferring interaction responses after %" PRIu32 " ms", budget_ms);
+    return watchdog;
+}
+
+void deadline_watchdog_free(deadline_watchdog_t* watchdog) {
+    if (!watchdog) {
+        return;
+    }
+
+    pthread_mutex_lock(&watchdog->mutex);
+    bool was_running = watchdog->running;
+
+    watchdog->running = false;
+    pthread_cond_broadcast(&watchdog->changed);
+    pthread_mutex_unlock(&watchdog->mutex);
+
+    if (was_running) {
+        pthread_join(watchdog->thread, NULL);
+    }
+
+    /* handlers have all returned by now, so anything left is only queued */
+    while (watchdog->head) {
+        free_deadline(pop_deadline(watchdog));
+    }
+
+    pthread_cond_destroy(&watchdog->changed);
+    pthread_mutex_destroy(&watchdog->mutex);
+
+    rest_shutdown(watchdog->rest);
+
+    nv_free(watchdog->base_url);
+    nv_free(watchdog->auth_header);
+    nv_free(watchdog);
+}
+
+/* the deadline in monotonic time, from how long ago discord created the interaction. a clock
+ * behind discord's counts as no time elapsed */
+static uint64_t get_due_ns(const deadline_watchdog_t* watchdog, uint64_t interaction_id) {
+    uint64_t created_ms = snowflake_get_time_ms(interaction_id);
+    uint64_t now_ms = time_unix_ms();
+
+    uint64_t elapsed_ns = now_ms > created_ms ? (now_ms - created_ms) * 1000000 : 0;
+    uint64_t now = time_now_ns();
+
+    if (elapsed_ns >= watchdog->budget_ns) {
+        return now;
+    }
+
+    return now + watchdog->budget_ns - elapsed_ns;
+}
+
+/* with the mutex held */
+static void insert_deadline(deadline_watchdog_t* watchdog, interaction_deadline_t* deadline) {
+    if (!watchdog->head || deadline->due_ns < watchdog->head->due_ns) {
+        deadline->next = watchdog->head;
+        watchdog->head = deadline;
+
+        if (!watchdog->tail) {
+            watchdog->tail = deadline;
+        }
+
+        /* the thread may be waiting on an empty queue, or for a later head */
+        pthread_cond_broadcast(&watchdog->changed);
+        return;
+    }
+
+    if (deadline->due_ns >= watchdog->tail->due_ns) {
+        watchdog->tail->next = deadline;
+        watchdog->tail = deadline;
+        return;
+    }
+
+    interaction_deadline_t* prev = watchdog->head;
+    while (prev->next->due_ns <= deadline->due_ns) {
+        prev = prev->next;
+    }
+
+    deadline->next = prev->next;
+    prev->next = deadline;
+}
+
+interaction_deadline_t* deadline_arm(deadline_watchdog_t* watchdog, uint64_t interaction_id,
+                                     const char* token) {
+    interaction_deadline_t* deadline = nv_alloc(sizeof(interaction_deadline_t));
+    assert(deadline);
+
+    deadline->id = interaction_id;
+    deadline->token = nv_strdup(token);
+    deadline->due_ns = get_due_ns(watchdog, interaction_id);
+    deadline->state = DEADLINE_PENDING;
+    deadline->armed = true;
+    deadline->queued = true;
+    deadline->next = NULL;
+
+    pthread_mutex_lock(&watchdog->mutex);
+    insert_deadline(watchdog, deadline);
+    pthread_mutex_unlock(&watchdog->mutex);
+
+    return deadline;
+}
+
+bool deadline_claim(deadline_watchdog_t* watchdog, interaction_deadline_t* deadline) {
+    pthread_mutex_lock(&watchdog->mutex);
+
+    if (deadline->state == DEADLINE_PENDING) {
+        deadline->state = DEADLINE_CLAIMED;
+    }
+
+    while (deadline->state == DEADLINE_DEFERRING) {
+        pthread_cond_wait(&watchdog->changed, &watchdog->mutex);
+    }
+
+    /* a failed deferral leaves nothing to edit; the initial response is the only option left */
+    bool deferred = deadline->state == DEADLINE_DEFERRED;
+    pthread_mutex_unlock(&watchdog->mutex);
+
+    return !deferred;
+}
+
+void deadline_disarm(deadline_watchdog_t* watchdog, interaction_deadline_t* deadline) {
+    pthread_mutex_lock(&watchdog->mutex);
+
+    if (deadline->state == DEADLINE_PENDING) {
+        deadline->state = DEADLINE_CLAIMED;
+    } else if (deadline->state == DEADLINE_DEFERRED) {
+        /* the watchdog has no way of knowing whether the handler edited @original */
+        log_debug("deferred interaction %" PRIu64 " finished", deadline->id);
+    }
+
+    deadline->armed = false;
+    bool queued = deadline->queued;
+
+    pthread_mutex_unlock(&watchdog->mutex);
+
+    if (!queued) {
+        free_deadline(deadline);
+    }
+}
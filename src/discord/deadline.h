@@ -0,0 +1,38 @@
+#ifndef _DEADLINE_H
+#define _DEADLINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* discord fails an interaction that has no initial response within 3 seconds. the watchdog runs on
+ * its own thread with its own REST handle, so it can send a deferred response (type 5) for a
+ * handler that is still blocked on redis or the network once the budget runs out. the budget is
+ * counted from the interaction's creation, as discord counts, so time spent in the gateway or a
+ * stream before dispatch comes out of it. the handler's eventual response then has to edit the
+ * original message instead; see interaction.c.
+ *
+ * the deferral carries no flags, so it is public. a late response that asked to be ephemeral is
+ * sent as an ephemeral follow-up in place of the deferred message rather than edited into it */
+
+typedef struct deadline_watchdog deadline_watchdog_t;
+typedef struct interaction_deadline interaction_deadline_t;
+
+/* base_url and token are what bot.c sends REST requests with */
+deadline_watchdog_t* deadline_watchdog_create(const char* base_url, uint32_t api,
+                                              const char* token, uint32_t budget_ms);
+
+void deadline_watchdog_free(deadline_watchdog_t* watchdog);
+
+/* queues the interaction's deadline, budget_ms after its snowflake time. token is copied */
+interaction_deadline_t* deadline_arm(deadline_watchdog_t* watchdog, uint64_t interaction_id,
+                                     const char* token);
+
+/* call before sending an initial response. true if nothing has been sent and the deadline can no
+ * longer fire. false if a deferral went out, in which case the response must edit @original;
+ * if the deferral is still in flight this waits for it */
+bool deadline_claim(deadline_watchdog_t* watchdog, interaction_deadline_t* deadline);
+
+/* once the handler has returned. frees deadline, or leaves that to the watchdog thread */
+void deadline_disarm(deadline_watchdog_t* watchdog, interaction_deadline_t* deadline);
+
+#endif
@@ -1,20 +1,39 @@
 #include "dispatch.h"
 
 #include "bot.h"
+#include "cache.h"
+#include "deadline.h"
+#include "followup.h"
 #include "gateway.h"
+#include "interaction_stream.h"
+#include "member_request.h"
+#include "session_store.h"
 
 #include "types/application.h"
 #include "types/user.h"
 #include "types/interaction.h"
+#include "types/snowflake.h"
+
+#include "../core/clock.h"
+#include "../core/metrics.h"
+#include "../core/trace.h"
 
 #include <log.h>
 
+#include <stdio.h>
+#include <assert.h>
 #include <string.h>
 #include <ctype.h>
 
 #include <nyoravim/mem.h>
 #include <nyoravim/util.h>
 
+/* deferred channel message, as the watchdog sends */
+#define DEFERRAL_TYPE 5
+
+/* how far ahead of discord's clock ours may run before a replayed interaction looks stale */
+#define INTERACTION_CLOCK_SKEW_MS 1000
+
 struct ready_frame {
     bool has_app;
     struct application app;
@@ -83,9 +102,32 @@ static void on_ready(gateway_t* gw, const json_object* data) {
     nv_free(ready.resume_gateway_url);
 }
 
-static void on_interaction_create(gateway_t* gw, const json_object* data) {
+static struct metric_family interaction_duration = METRIC_LATENCY_FAMILY(
+    "tasks_interaction_duration_seconds", "time spent parsing and handling an interaction by type");
+
+/* the http reply when nothing else answered in time */
+static json_object* create_deferral() {
+    json_object* response = json_object_new_object();
+    assert(response);
+
+    json_object* field = json_object_new_int(DEFERRAL_TYPE);
+    assert(field);
+    json_object_object_add(response, "type", field);
+
+    return response;
+}
+
+void dispatch_interaction(bot_t* bot, const json_object* data, struct interaction_reply* reply) {
+    uint64_t start = time_now_ns();
+
+    struct trace_span span;
+    trace_begin(&span, "interaction_parse");
+
     struct interaction interaction;
-    if (!interaction_parse(&interaction, data)) {
+    bool parsed = interaction_parse(&interaction, data);
+
+    trace_end(&span);
+    if (!parsed) {
         log_error("failed to parse interaction from discord; ignoring");
         return;
     }
@@ -93,7 +135,9 @@ static void on_interaction_create(gateway_t* gw, const json_object* data) {
     log_debug("interaction received: %" PRIu64, interaction.id);
     log_trace("token: %s", interaction.token);
 
-    bot_t* bot = gateway_get_bot(gw);
+    entity_cache_put_interaction(bot_get_cache(bot), &interaction);
+    interaction.reply = reply;
+
     const struct bot_callbacks* callbacks = bot_get_callbacks(bot);
 
     if (callbacks->on_interaction) {
@@ -101,21 +145,127 @@ static void on_interaction_create(gateway_t* gw, const json_object* data) {
         bc.bot = bot;
         bc.user = callbacks->user;
 
+        /* autocomplete cannot be deferred, and pings are answered before they get here */
+        deadline_watchdog_t* watchdog = bot_get_deadline_watchdog(bot);
+        if (watchdog && (interaction.type == INTERACTION_TYPE_APPLICATION_COMMAND ||
+                         interaction.type == INTERACTION_TYPE_MESSAGE_COMPONENT ||
+                         interaction.type == INTERACTION_TYPE_MODEL_SUBMIT)) {
+            interaction.deadline = deadline_arm(watchdog, interaction.id, interaction.token);
+        }
+
+        /* webhook requests cannot go out before the initial response */
+        followup_queue_t* followups = bot_get_followup_queue(bot);
+        followup_hold(followups, interaction.id);
+
+        trace_begin(&span, "on_interaction");
         callbacks->on_interaction(&bc, &interaction);
+        trace_end(&span);
+
+        /* a handler that did not respond leaves discord waiting on the http request; defer unless
+         * the watchdog already did */
+        if (reply && !reply->sent &&
+            (!interaction.deadline || deadline_claim(watchdog, interaction.deadline))) {
+            json_object* deferral = create_deferral();
+
+            reply->sent = true;
+            reply->send(reply->user, deferral);
+
+            json_object_put(deferral);
+        }
+
+        if (interaction.deadline) {
+            deadline_disarm(watchdog, interaction.deadline);
+            interaction.deadline = NULL;
+        }
+
+        /* whether or not anything was sent, holding on would only make them later */
+        followup_release(followups, interaction.id);
     }
 
+    char labels[32];
+    snprintf(labels, sizeof(labels), "type=\"%" PRIu32 "\"", interaction.type);
+
     interaction_cleanup(&interaction);
+    metric_observe(metric_get(&interaction_duration, labels), time_now_ns() - start);
+}
+
+static struct metric_family dropped_interactions = METRIC_COUNTER_FAMILY(
+    "tasks_interactions_dropped_total", "gateway interactions not handled, by reason");
+
+/* a resume replays what came after the last checkpoint, and an interaction replayed after its
+ * response window can only fail; one handled before the restart must not be handled again. live
+ * traffic skips both checks, since it is neither late nor seen before */
+static bool should_handle_interaction(gateway_t* gw, const json_object* data) {
+    if (!gateway_is_resuming(gw) || gateway_is_replaying(gw)) {
+        return true;
+    }
+
+    json_object* field;
+    uint64_t id;
+
+    if (!json_object_object_get_ex(data, "id", &field) || !snowflake_parse(&id, field)) {
+        /* dispatch_interaction logs it */
+        return true;
+    }
+
+    /* negative when our clock is behind discord's */
+    int64_t age_ms = (int64_t)(time_unix_ms() - snowflake_get_time_ms(id));
+    if (age_ms >= (int64_t)(INTERACTION_RESPONSE_WINDOW_MS + INTERACTION_CLOCK_SKEW_MS)) {
+        log_warn("interaction %" PRIu64 " replayed %" PRId64 " ms after it was created, past its "
+                 "%llu ms window and %d ms of skew allowance; dropping",
+                 id, age_ms, INTERACTION_RESPONSE_WINDOW_MS, INTERACTION_CLOCK_SKEW_MS);
+
+        metric_inc(metric_get(&dropped_interactions, "reason=\"stale\""));
+        return false;
+    }
+
+    session_store_t* store = gateway_get_session_store(gw);
+    if (store && !session_store_claim_interaction(store, id)) {
+        log_info("interaction %" PRIu64 " was already handled; dropping", id);
+
+        metric_inc(metric_get(&dropped_interactions, "reason=\"duplicate\""));
+        return false;
+    }
+
+    return true;
 }
 
 /* assumes type is uppercase */
 static void do_dispatch(gateway_t* gw, const char* type, const json_object* data) {
+    /* before any handler, so handlers see the state after the event */
+    entity_cache_update(bot_get_cache(gateway_get_bot(gw)), type, data);
+
     if (strcmp(type, "READY") == 0) {
         on_ready(gw, data);
         return;
     }
 
+    if (strcmp(type, "GUILD_MEMBERS_CHUNK") == 0) {
+        /* the cache has taken the members already */
+        member_requests_handle_chunk(bot_get_member_requests(gateway_get_bot(gw)), data);
+        return;
+    }
+
+    if (strcmp(type, "RESUMED") == 0) {
+        /* events missed while disconnected have been replayed by now */
+        log_info("gateway session resumed");
+        return;
+    }
+
     if (strcmp(type, "INTERACTION_CREATE") == 0) {
-        on_interaction_create(gw, data);
+        bot_t* bot = gateway_get_bot(gw);
+        if (!should_handle_interaction(gw, data)) {
+            return;
+        }
+
+        /* a worker picks it up instead. if none can, handling it here late beats dropping it */
+        interaction_stream_t* stream = bot_get_interaction_stream(bot);
+        if (stream && interaction_stream_get_role(stream) == INTERACTION_STREAM_PRODUCER &&
+            interaction_stream_push(stream, data)) {
+            return;
+        }
+
+        dispatch_interaction(bot, data, NULL);
         return;
     }
 
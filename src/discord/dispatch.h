@@ -8,4 +8,15 @@ typedef struct gateway gateway_t;
 
 void dispatch_event(gateway_t* gw, const char* type, const json_object* data);
 
+/* from bot.h */
+typedef struct bot bot_t;
+
+/* from types/interaction.h */
+struct interaction_reply;
+
+/* parses an interaction and hands it to the bot's on_interaction callback. reply is NULL for the
+ * gateway; over http it sends the initial response as the handler makes it, or a deferral once the
+ * handler returns if it sent none and the watchdog had not deferred already */
+void dispatch_interaction(bot_t* bot, const json_object* data, struct interaction_reply* reply);
+
 #endif
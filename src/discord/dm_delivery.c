@@ -0,0 +1,655 @@
+/* https://discord.com/developers/docs/resources/user#create-dm */
+
+#include "dm_delivery.h"
+
+#include "types/snowflake.h"
+
+#include "../core/clock.h"
+#include "../core/database.h"
+#include "../core/hashmap.h"
+#include "../core/metrics.h"
+#include "../core/rest.h"
+
+#include <log.h>
+
+#include <json.h>
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hiredis/hiredis.h>
+
+#include <nyoravim/mem.h>
+#include <nyoravim/util.h>
+
+#define CHANNEL_KEY_PREFIX "tasks:dm:"
+
+/* past this many, the memory cache starts over; redis still has them */
+#define MAX_CACHED_CHANNELS 65536
+
+/* a DM channel object, or an error */
+#define MAX_RESPONSE_LENGTH 4096
+
+/* when a 429 does not say how long to wait */
+#define DEFAULT_RETRY_AFTER_MS 1000
+
+enum recipient_state {
+    /* the window is open; in the waiting list */
+    RECIPIENT_WAITING,
+
+    /* the window has closed; in the ready queue */
+    RECIPIENT_READY,
+
+    /* a request is in flight */
+    RECIPIENT_OPENING,
+    RECIPIENT_SENDING,
+};
+
+struct recipient {
+    dm_delivery_t* delivery;
+
+    uint64_t user_id;
+    enum recipient_state state;
+
+    /* not yet part of a batch, oldest first */
+    char** messages;
+    size_t num_messages, messages_capacity;
+
+    /* when the oldest of them came in */
+    uint64_t first_ns;
+
+    /* when it leaves the waiting list */
+    uint64_t due_ns;
+
+    /* the joined messages being delivered. kept until the send succeeds or is given up on */
+    char* batch;
+    size_t batch_count;
+
+    /* 0 until known */
+    uint64_t channel_id;
+    bool reopened;
+
+    char response[MAX_RESPONSE_LENGTH];
+    size_t response_length;
+
+    /* in the waiting list or the ready queue */
+    struct recipient* next;
+};
+
+HASHMAP_DECLARE(recipient_map, uint64_t, struct recipient*, hashmap_hash_u64,
+                HASHMAP_EQUALS_SCALAR)
+
+HASHMAP_DECLARE(channel_map, uint64_t, uint64_t, hashmap_hash_u64, HASHMAP_EQUALS_SCALAR)
+
+typedef struct dm_delivery {
+    rest_t* rest;
+
+    char* base_url;
+    uint32_t api;
+    char* auth_header;
+
+    /* NULL if channels are only cached in memory */
+    redisContext* db;
+
+    uint64_t coalesce_ns;
+    uint32_t max_in_flight;
+    uint32_t in_flight;
+
+    /* everyone with messages pending or in flight */
+    recipient_map_t recipients;
+
+    /* by due time. windows are all the same length, so new ones almost always go at the end */
+    struct recipient* waiting;
+    struct recipient* waiting_tail;
+
+    struct recipient* ready;
+    struct recipient* ready_tail;
+
+    /* user id to DM channel id */
+    channel_map_t channels;
+
+    size_t pending;
+} dm_delivery_t;
+
+static struct metric_family messages_finished = METRIC_COUNTER_FAMILY(
+    "tasks_dm_messages_total", "direct messages queued for delivery by result");
+
+static struct metric_family requests_finished = METRIC_COUNTER_FAMILY(
+    "tasks_dm_requests_total", "REST requests made to deliver direct messages by kind and result");
+
+static struct metric_family channel_lookups = METRIC_COUNTER_FAMILY(
+    "tasks_dm_channel_lookups_total", "DM channel lookups by where the channel was found");
+
+static void count_messages(const char* result, size_t count) {
+    char labels[32];
+    snprintf(labels, sizeof(labels), "result=\"%s\"", result);
+
+    metric_add(metric_get(&messages_finished, labels), count);
+}
+
+static void count_request(const char* kind, const char* result) {
+    char labels[64];
+    snprintf(labels, sizeof(labels), "kind=\"%s\",result=\"%s\"", kind, result);
+
+    metric_inc(metric_get(&requests_finished, labels));
+}
+
+static void count_lookup(const char* source) {
+    char labels[32];
+    snprintf(labels, sizeof(labels), "source=\"%s\"", source);
+
+    metric_inc(metric_get(&channel_lookups, labels));
+}
+
+dm_delivery_t* dm_delivery_create(const struct dm_delivery_spec* spec) {
+    dm_delivery_t* delivery = nv_alloc(sizeof(dm_delivery_t));
+    assert(delivery);
+    memset(delivery, 0, sizeof(dm_delivery_t));
+
+    delivery->rest = spec->rest;
+    delivery->base_url = nv_strdup(spec->base_url);
+    delivery->api = spec->api;
+    delivery->db = spec->db;
+
+    uint32_t coalesce_ms = spec->coalesce_ms > 0 ? spec->coalesce_ms : DEFAULT_DM_COALESCE_MS;
+    delivery->coalesce_ns = (uint64_t)coalesce_ms * 1000000;
+    delivery->max_in_flight =
+        spec->max_in_flight > 0 ? spec->max_in_flight : DEFAULT_DM_MAX_IN_FLIGHT;
+
+    char auth_header[256];
+    snprintf(auth_header, sizeof(auth_header), "Authorization: Bot %s", spec->token);
+    delivery->auth_header = nv_strdup(auth_header);
+
+    recipient_map_init(&delivery->recipients);
+    channel_map_init(&delivery->channels);
+
+    return delivery;
+}
+
+static void free_recipient(struct recipient* recipient) {
+    for (size_t i = 0; i < recipient->num_messages; i++) {
+        nv_free(recipient->messages[i]);
+    }
+
+    nv_free(recipient->messages);
+    nv_free(recipient->batch);
+    nv_free(recipient);
+}
+
+void dm_delivery_free(dm_delivery_t* delivery) {
+    if (!delivery) {
+        return;
+    }
+
+    if (delivery->pending > 0) {
+        log_warn("dropping %zu undelivered direct messages", delivery->pending);
+        count_messages("dropped", delivery->pending);
+    }
+
+    HASHMAP_FOR_EACH(&delivery->recipients, i) {
+        free_recipient(delivery->recipients.values[i]);
+    }
+
+    recipient_map_free(&delivery->recipients);
+    channel_map_free(&delivery->channels);
+
+    nv_free(delivery->base_url);
+    nv_free(delivery->auth_header);
+    nv_free(delivery);
+}
+
+static void insert_waiting(dm_delivery_t* delivery, struct recipient* recipient) {
+    recipient->state = RECIPIENT_WAITING;
+
+    struct recipient** link = &delivery->waiting;
+    if (delivery->waiting_tail && delivery->waiting_tail->due_ns <= recipient->due_ns) {
+        link = &delivery->waiting_tail->next;
+    } else {
+        while (*link && (*link)->due_ns <= recipient->due_ns) {
+            link = &(*link)->next;
+        }
+    }
+
+    recipient->next = *link;
+    *link = recipient;
+
+    if (!recipient->next) {
+        delivery->waiting_tail = recipient;
+    }
+}
+
+static void push_ready(dm_delivery_t* delivery, struct recipient* recipient) {
+    recipient->state = RECIPIENT_READY;
+    recipient->next = NULL;
+
+    if (delivery->ready_tail) {
+        delivery->ready_tail->next = recipient;
+    } else {
+        delivery->ready = recipient;
+    }
+
+    delivery->ready_tail = recipient;
+}
+
+static struct recipient* pop_ready(dm_delivery_t* delivery) {
+    struct recipient* recipient = delivery->ready;
+
+    delivery->ready = recipient->next;
+    if (!delivery->ready) {
+        delivery->ready_tail = NULL;
+    }
+
+    recipient->next = NULL;
+    return recipient;
+}
+
+/* longest prefix of whole characters that fits */
+static size_t truncate_utf8(const char* content, size_t length, size_t max_length) {
+    if (length <= max_length) {
+        return length;
+    }
+
+    length = max_length;
+    while (length > 0 && ((uint8_t)content[length] & 0xC0) == 0x80) {
+        length--;
+    }
+
+    return length;
+}
+
+bool dm_delivery_enqueue(dm_delivery_t* delivery, uint64_t user_id, const char* content) {
+    size_t length = strlen(content);
+    if (length == 0) {
+        return false;
+    }
+
+    if (length > DM_MAX_CONTENT_LENGTH) {
+        log_warn("direct message to %" PRIu64 " is %zu bytes; cutting it to %d", user_id, length,
+                 DM_MAX_CONTENT_LENGTH);
+
+        length = truncate_utf8(content, length, DM_MAX_CONTENT_LENGTH);
+    }
+
+    char* message = nv_alloc(length + 1);
+    assert(message);
+
+    memcpy(message, content, length);
+    message[length] = '\0';
+
+    struct recipient** existing = recipient_map_get(&delivery->recipients, user_id);
+    struct recipient* recipient = existing ? *existing : NULL;
+
+    if (!recipient) {
+        recipient = nv_alloc(sizeof(struct recipient));
+        assert(recipient);
+        memset(recipient, 0, sizeof(struct recipient));
+
+        recipient->delivery = delivery;
+        recipient->user_id = user_id;
+
+        recipient_map_insert(&delivery->recipients, user_id, recipient);
+    }
+
+    if (recipient->num_messages == recipient->messages_capacity) {
+        size_t capacity = recipient->messages_capacity > 0 ? recipient->messages_capacity * 2 : 4;
+
+        recipient->messages = nv_realloc(recipient->messages, capacity * sizeof(char*));
+        assert(recipient->messages);
+
+        recipient->messages_capacity = capacity;
+    }
+
+    if (recipient->num_messages == 0) {
+        recipient->first_ns = time_now_ns();
+    }
+
+    recipient->messages[recipient->num_messages++] = message;
+    delivery->pending++;
+
+    /* otherwise it joins a window that is already open, or goes after what is in flight */
+    if (!existing) {
+        recipient->due_ns = recipient->first_ns + delivery->coalesce_ns;
+        insert_waiting(delivery, recipient);
+    }
+
+    return true;
+}
+
+/* joins as many pending messages as fit in one, one per line */
+static void take_batch(struct recipient* recipient) {
+    size_t count = 0, length = 0;
+    while (count < recipient->num_messages) {
+        size_t next = strlen(recipient->messages[count]) + (count > 0 ? 1 : 0);
+        if (length + next > DM_MAX_CONTENT_LENGTH) {
+            break;
+        }
+
+        length += next;
+        count++;
+    }
+
+    char* batch = nv_alloc(length + 1);
+    assert(batch);
+
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) {
+            batch[offset++] = '\n';
+        }
+
+        size_t message_length = strlen(recipient->messages[i]);
+        memcpy(batch + offset, recipient->messages[i], message_length);
+        offset += message_length;
+
+        nv_free(recipient->messages[i]);
+    }
+
+    batch[offset] = '\0';
+
+    recipient->num_messages -= count;
+    memmove(recipient->messages, recipient->messages + count,
+            recipient->num_messages * sizeof(char*));
+
+    recipient->batch = batch;
+    recipient->batch_count = count;
+    recipient->reopened = false;
+}
+
+static uint64_t lookup_channel(dm_delivery_t* delivery, uint64_t user_id) {
+    uint64_t* cached = channel_map_get(&delivery->channels, user_id);
+    if (cached) {
+        count_lookup("memory");
+        return *cached;
+    }
+
+    if (!delivery->db) {
+        return 0;
+    }
+
+    redisReply* reply = db_command(delivery->db, "GET " CHANNEL_KEY_PREFIX "%" PRIu64, user_id);
+
+    uint64_t channel_id = 0;
+    if (reply && reply->type == REDIS_REPLY_STRING) {
+        channel_id = strtoull(reply->str, NULL, 10);
+    }
+
+    freeReplyObject(reply);
+    if (channel_id == 0) {
+        return 0;
+    }
+
+    count_lookup("redis");
+
+    if (delivery->channels.count >= MAX_CACHED_CHANNELS) {
+        channel_map_free(&delivery->channels);
+        channel_map_init(&delivery->channels);
+    }
+
+    channel_map_insert(&delivery->channels, user_id, channel_id);
+    return channel_id;
+}
+
+static void save_channel(dm_delivery_t* delivery, uint64_t user_id, uint64_t channel_id) {
+    if (delivery->channels.count >= MAX_CACHED_CHANNELS) {
+        channel_map_free(&delivery->channels);
+        channel_map_init(&delivery->channels);
+    }
+
+    channel_map_remove(&delivery->channels, user_id, NULL);
+    channel_map_insert(&delivery->channels, user_id, channel_id);
+
+    if (!delivery->db) {
+        return;
+    }
+
+    redisReply* reply =
+        db_command(delivery->db, "SET " CHANNEL_KEY_PREFIX "%" PRIu64 " %" PRIu64 " EX %u",
+                   user_id, channel_id, DM_CHANNEL_TTL_S);
+
+    if (!reply || reply->type != REDIS_REPLY_STATUS) {
+        log_warn("failed to cache DM channel of %" PRIu64 " in redis", user_id);
+    }
+
+    freeReplyObject(reply);
+}
+
+static void forget_channel(dm_delivery_t* delivery, uint64_t user_id) {
+    channel_map_remove(&delivery->channels, user_id, NULL);
+
+    if (delivery->db) {
+        freeReplyObject(db_command(delivery->db, "DEL " CHANNEL_KEY_PREFIX "%" PRIu64, user_id));
+    }
+}
+
+static void on_receive(void* user, const void* data, size_t size) {
+    struct recipient* recipient = user;
+
+    size_t available = sizeof(recipient->response) - 1 - recipient->response_length;
+    size_t to_copy = size > available ? available : size;
+
+    memcpy(recipient->response + recipient->response_length, data, to_copy);
+    recipient->response_length += to_copy;
+    recipient->response[recipient->response_length] = '\0';
+}
+
+static void on_done(void* user, CURLcode code, int64_t status);
+
+static bool send_request(struct recipient* recipient, const char* path, json_object* body) {
+    dm_delivery_t* delivery = recipient->delivery;
+
+    char url[2048];
+    snprintf(url, sizeof(url), "%s/v%" PRIu32 "/%s", delivery->base_url, delivery->api, path);
+
+    const char* headers[] = { delivery->auth_header, "Content-Type: application/json" };
+    const char* data = json_object_to_json_string(body);
+
+    struct http_request req;
+    req.url = url;
+    req.method = "POST";
+    req.headers = headers;
+    req.num_headers = 2;
+    req.data = data;
+    req.size = strlen(data);
+
+    struct rest_callbacks callbacks;
+    callbacks.user = recipient;
+    callbacks.receive_data_callback = on_receive;
+    callbacks.done_callback = on_done;
+
+    recipient->response_length = 0;
+    recipient->response[0] = '\0';
+
+    bool sent = rest_send(delivery->rest, &req, &callbacks);
+    json_object_put(body);
+
+    return sent;
+}
+
+static bool open_channel(struct recipient* recipient) {
+    json_object* body = json_object_new_object();
+    assert(body);
+
+    json_object_object_add(body, "recipient_id", snowflake_serialize(recipient->user_id));
+
+    recipient->state = RECIPIENT_OPENING;
+    return send_request(recipient, "users/@me/channels", body);
+}
+
+static bool send_batch(struct recipient* recipient) {
+    char path[64];
+    snprintf(path, sizeof(path), "channels/%" PRIu64 "/messages", recipient->channel_id);
+
+    json_object* body = json_object_new_object();
+    assert(body);
+
+    json_object_object_add(body, "content", json_object_new_string(recipient->batch));
+
+    recipient->state = RECIPIENT_SENDING;
+    return send_request(recipient, path, body);
+}
+
+/* the batch is done with, one way or another. waits out a new window if more came in meanwhile */
+static void finish_batch(struct recipient* recipient, const char* result) {
+    dm_delivery_t* delivery = recipient->delivery;
+
+    count_messages(result, recipient->batch_count);
+    delivery->pending -= recipient->batch_count;
+
+    nv_free(recipient->batch);
+    recipient->batch = NULL;
+    recipient->batch_count = 0;
+
+    if (recipient->num_messages > 0) {
+        recipient->due_ns = recipient->first_ns + delivery->coalesce_ns;
+        insert_waiting(delivery, recipient);
+        return;
+    }
+
+    recipient_map_remove(&delivery->recipients, recipient->user_id, NULL);
+    free_recipient(recipient);
+}
+
+static void start_delivery(struct recipient* recipient) {
+    dm_delivery_t* delivery = recipient->delivery;
+    delivery->in_flight++;
+
+    /* a batch that was rate limited is sent again as it was */
+    if (!recipient->batch) {
+        take_batch(recipient);
+    }
+
+    if (recipient->channel_id == 0) {
+        recipient->channel_id = lookup_channel(delivery, recipient->user_id);
+    }
+
+    bool sent = recipient->channel_id != 0 ? send_batch(recipient) : open_channel(recipient);
+    if (!sent) {
+        log_error("failed to send direct message to %" PRIu64, recipient->user_id);
+
+        delivery->in_flight--;
+        finish_batch(recipient, "failed");
+    }
+}
+
+static uint64_t get_retry_after_ns(const char* response) {
+    uint64_t retry_after_ms = DEFAULT_RETRY_AFTER_MS;
+
+    json_object* data = json_tokener_parse(response);
+    json_object* field = data ? json_object_object_get(data, "retry_after") : NULL;
+
+    if (field) {
+        /* seconds, fractional */
+        double seconds = json_object_get_double(field);
+        if (seconds > 0) {
+            retry_after_ms = (uint64_t)(seconds * 1000) + 1;
+        }
+    }
+
+    json_object_put(data);
+    return retry_after_ms * 1000000;
+}
+
+static uint64_t parse_channel_id(const char* response) {
+    json_object* data = json_tokener_parse(response);
+    json_object* id = data ? json_object_object_get(data, "id") : NULL;
+
+    uint64_t channel_id = 0;
+    if (id && !snowflake_parse(&channel_id, id)) {
+        channel_id = 0;
+    }
+
+    json_object_put(data);
+    return channel_id;
+}
+
+static void on_done(void* user, CURLcode code, int64_t status) {
+    struct recipient* recipient = user;
+    dm_delivery_t* delivery = recipient->delivery;
+
+    bool opening = recipient->state == RECIPIENT_OPENING;
+    const char* kind = opening ? "open" : "send";
+
+    if (code != CURLE_OK) {
+        log_error("DM %s request for %" PRIu64 " failed: %s", kind, recipient->user_id,
+                  curl_easy_strerror(code));
+
+        count_request(kind, "failed");
+        delivery->in_flight--;
+
+        finish_batch(recipient, "failed");
+        return;
+    }
+
+    if (status == 429) {
+        uint64_t delay_ns = get_retry_after_ns(recipient->response);
+        log_warn("DM %s request for %" PRIu64 " rate limited; retrying in %" PRIu64 " ms", kind,
+                 recipient->user_id, delay_ns / 1000000);
+
+        count_request(kind, "rate_limited");
+        delivery->in_flight--;
+
+        recipient->due_ns = time_now_ns() + delay_ns;
+        insert_waiting(delivery, recipient);
+        return;
+    }
+
+    bool ok = status >= 200 && status < 300;
+    count_request(kind, ok ? "ok" : "failed");
+
+    if (opening && ok) {
+        recipient->channel_id = parse_channel_id(recipient->response);
+        if (recipient->channel_id != 0) {
+            count_lookup("api");
+            save_channel(delivery, recipient->user_id, recipient->channel_id);
+
+            if (send_batch(recipient)) {
+                return;
+            }
+        }
+
+        log_error("failed to open DM channel for %" PRIu64, recipient->user_id);
+        ok = false;
+    } else if (!ok && !opening && status == 404 && !recipient->reopened) {
+        /* the channel is gone; the user gets a new one */
+        log_debug("DM channel %" PRIu64 " of %" PRIu64 " is unknown; reopening",
+                  recipient->channel_id, recipient->user_id);
+
+        forget_channel(delivery, recipient->user_id);
+        recipient->channel_id = 0;
+        recipient->reopened = true;
+
+        if (open_channel(recipient)) {
+            return;
+        }
+    } else if (!ok) {
+        /* 403 is a user who does not take DMs from the bot; nothing to retry */
+        log_error("DM %s request for %" PRIu64 " returned %" PRIi64 ": %s", kind,
+                  recipient->user_id, status, recipient->response);
+    }
+
+    delivery->in_flight--;
+    finish_batch(recipient, ok ? "sent" : "failed");
+}
+
+void dm_delivery_poll(dm_delivery_t* delivery) {
+    uint64_t now = time_now_ns();
+    while (delivery->waiting && delivery->waiting->due_ns <= now) {
+        struct recipient* recipient = delivery->waiting;
+
+        delivery->waiting = recipient->next;
+        if (!delivery->waiting) {
+            delivery->waiting_tail = NULL;
+        }
+
+        push_ready(delivery, recipient);
+    }
+
+    while (delivery->ready && delivery->in_flight < delivery->max_in_flight) {
+        start_delivery(pop_ready(delivery));
+    }
+}
+
+size_t dm_delivery_pending(const dm_delivery_t* delivery) { return delivery->pending; }
@@ -0,0 +1,69 @@
+#ifndef _DM_DELIVERY_H
+#define _DM_DELIVERY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* delivers direct messages, such as reminders, to users. a DM needs the user's DM channel, which
+ * takes a POST /users/@me/channels to open, and then a message in it, so sending each one as it
+ * comes due costs two requests. when many come due together (a monday morning), this instead:
+ *
+ * - holds a user's first message for a short window, and sends everything that came due for them
+ *   in it as one message, split only where discord's length limit requires
+ * - remembers each user's channel in memory and in redis, so the channel is only opened once
+ * - sends for at most a fixed number of users at once on the bot's REST handle, and queues the
+ *   rest in the order their windows closed
+ *
+ * a message to a channel discord no longer knows reopens it once. users who do not accept DMs
+ * (403) are logged and their messages dropped */
+
+typedef struct dm_delivery dm_delivery_t;
+
+/* from rest.h */
+typedef struct rest rest_t;
+
+/* from hiredis/hiredis.h */
+typedef struct redisContext redisContext;
+
+#define DEFAULT_DM_COALESCE_MS 2000
+#define DEFAULT_DM_MAX_IN_FLIGHT 8
+
+/* channel ids do not change, but users come and go */
+#define DM_CHANNEL_TTL_S (30 * 24 * 60 * 60)
+
+/* https://discord.com/developers/docs/resources/message#create-message */
+#define DM_MAX_CONTENT_LENGTH 2000
+
+struct dm_delivery_spec {
+    /* borrowed, and must outlive any request in flight; polling it drives deliveries */
+    rest_t* rest;
+
+    const char* base_url;
+    uint32_t api;
+    const char* token;
+
+    /* where channel ids persist across restarts. borrowed. NULL keeps them in memory only */
+    redisContext* db;
+
+    /* 0 for DEFAULT_DM_COALESCE_MS and DEFAULT_DM_MAX_IN_FLIGHT */
+    uint32_t coalesce_ms;
+    uint32_t max_in_flight;
+};
+
+dm_delivery_t* dm_delivery_create(const struct dm_delivery_spec* spec);
+
+/* after rest_shutdown, so no completion can reach freed state. drops what is still pending */
+void dm_delivery_free(dm_delivery_t* delivery);
+
+/* content is copied, and cut to DM_MAX_CONTENT_LENGTH bytes. joins anything else pending for the
+ * user on its own line. false if it is empty */
+bool dm_delivery_enqueue(dm_delivery_t* delivery, uint64_t user_id, const char* content);
+
+/* sends for users whose windows have closed, as far as the concurrency limit allows */
+void dm_delivery_poll(dm_delivery_t* delivery);
+
+/* messages queued or in flight */
+size_t dm_delivery_pending(const dm_delivery_t* delivery);
+
+#endif
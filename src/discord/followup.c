@@ -0,0 +1,399 @@
+/* https://discord.com/developers/docs/interactions/receiving-and-responding#followup-messages */
+
+#include "followup.h"
+
+#include "types/interaction.h"
+#include "types/snowflake.h"
+
+#include "../core/clock.h"
+#include "../core/metrics.h"
+#include "../core/rest.h"
+
+#include <log.h>
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <nyoravim/mem.h>
+#include <nyoravim/util.h>
+
+/* give up slightly early rather than race the expiry over the network */
+#define EXPIRY_MARGIN_MS 5000
+
+/* of an error response, for the log */
+#define MAX_ERROR_LENGTH 512
+
+struct followup {
+    const char* method;
+    char* path;
+
+    /* NULL if there is no body */
+    char* body;
+
+    struct followup* next;
+};
+
+struct followup_chain {
+    followup_queue_t* queue;
+
+    uint64_t interaction_id;
+    uint64_t expires_ms;
+
+    struct followup* head;
+    struct followup* tail;
+
+    /* the head has been sent */
+    bool in_flight;
+
+    /* waiting for the initial response; see followup_hold */
+    bool held;
+    /* the last request queued by followup_enqueue_response while held */
+    struct followup* response_tail;
+
+    char error[MAX_ERROR_LENGTH];
+    size_t error_length;
+
+    struct followup_chain* previous;
+    struct followup_chain* next;
+};
+
+typedef struct followup_queue {
+    rest_t* rest;
+
+    char* base_url;
+    uint32_t api;
+    char* auth_header;
+
+    /* interactions with follow-up work are few and short lived, so a list is enough */
+    struct followup_chain* chains;
+    size_t pending;
+} followup_queue_t;
+
+static struct metric_family followups = METRIC_COUNTER_FAMILY(
+    "tasks_followups_total", "interaction webhook requests by method and result");
+
+static void count_followup(const char* method, const char* result) {
+    char labels[64];
+    snprintf(labels, sizeof(labels), "method=\"%s\",result=\"%s\"", method, result);
+
+    metric_inc(metric_get(&followups, labels));
+}
+
+static uint64_t get_expiry_ms(uint64_t interaction_id) {
+    return snowflake_get_time_ms(interaction_id) + INTERACTION_TOKEN_LIFETIME_MS - EXPIRY_MARGIN_MS;
+}
+
+static void free_followup(struct followup* followup) {
+    nv_free(followup->path);
+    nv_free(followup->body);
+    nv_free(followup);
+}
+
+static void free_chain(struct followup_chain* chain) {
+    struct followup* current = chain->head;
+    while (current) {
+        struct followup* next = current->next;
+        free_followup(current);
+
+        current = next;
+    }
+
+    nv_free(chain);
+}
+
+static void unlink_chain(followup_queue_t* queue, struct followup_chain* chain) {
+    if (chain->previous) {
+        chain->previous->next = chain->next;
+    } else {
+        queue->chains = chain->next;
+    }
+
+    if (chain->next) {
+        chain->next->previous = chain->previous;
+    }
+}
+
+static struct followup* pop_followup(struct followup_chain* chain) {
+    struct followup* followup = chain->head;
+
+    chain->head = followup->next;
+    if (!chain->head) {
+        chain->tail = NULL;
+    }
+
+    chain->queue->pending--;
+    return followup;
+}
+
+static void on_receive(void* user, const void* data, size_t size) {
+    struct followup_chain* chain = user;
+
+    size_t available = sizeof(chain->error) - 1 - chain->error_length;
+    size_t to_copy = size > available ? available : size;
+
+    memcpy(chain->error + chain->error_length, data, to_copy);
+    chain->error_length += to_copy;
+    chain->error[chain->error_length] = '\0';
+}
+
+static void on_done(void* user, CURLcode code, int64_t status);
+
+/* sends the head of the chain, or frees the chain if there is nothing left to send */
+static void send_next(struct followup_chain* chain) {
+    followup_queue_t* queue = chain->queue;
+    if (chain->held) {
+        return;
+    }
+
+    while (chain->head) {
+        if (time_unix_ms() >= chain->expires_ms) {
+            log_warn("interaction %" PRIu64 " token expired; dropping queued follow-ups",
+                     chain->interaction_id);
+
+            while (chain->head) {
+                struct followup* followup = pop_followup(chain);
+                count_followup(followup->method, "expired");
+
+                free_followup(followup);
+            }
+
+            break;
+        }
+
+        struct followup* followup = chain->head;
+
+        char url[2048];
+        snprintf(url, sizeof(url), "%s/v%" PRIu32 "/%s", queue->base_url, queue->api,
+                 followup->path);
+
+        const char* headers[] = { queue->auth_header, "Content-Type: application/json" };
+
+        struct http_request req;
+        req.url = url;
+        req.method = followup->method;
+        req.headers = headers;
+        req.num_headers = followup->body ? 2 : 1;
+        req.data = followup->body;
+        req.size = followup->body ? strlen(followup->body) : 0;
+
+        struct rest_callbacks callbacks;
+        callbacks.user = chain;
+        callbacks.receive_data_callback = on_receive;
+        callbacks.done_callback = on_done;
+
+        chain->error_length = 0;
+        chain->error[0] = '\0';
+
+        if (rest_send(queue->rest, &req, &callbacks)) {
+            chain->in_flight = true;
+            return;
+        }
+
+        log_error("failed to send follow-up for interaction %" PRIu64, chain->interaction_id);
+        count_followup(followup->method, "failed");
+
+        free_followup(pop_followup(chain));
+    }
+
+    unlink_chain(queue, chain);
+    free_chain(chain);
+}
+
+static void on_done(void* user, CURLcode code, int64_t status) {
+    struct followup_chain* chain = user;
+    chain->in_flight = false;
+
+    struct followup* followup = pop_followup(chain);
+    if (code == CURLE_OK && status >= 200 && status < 300) {
+        count_followup(followup->method, "sent");
+    } else {
+        count_followup(followup->method, "failed");
+
+        if (code != CURLE_OK) {
+            log_error("follow-up %s %s failed: %s", followup->method, followup->path,
+                      curl_easy_strerror(code));
+        } else {
+            log_error("follow-up %s for interaction %" PRIu64 " returned %" PRIi64 ": %s",
+                      followup->method, chain->interaction_id, status, chain->error);
+        }
+    }
+
+    free_followup(followup);
+    send_next(chain);
+}
+
+followup_queue_t* followup_queue_create(rest_t* rest, const char* base_url, uint32_t api,
+                                        const char* token) {
+    followup_queue_t* queue = nv_alloc(sizeof(followup_queue_t));
+    assert(queue);
+
+    queue->rest = rest;
+    queue->base_url = nv_strdup(base_url);
+    queue->api = api;
+    queue->chains = NULL;
+    queue->pending = 0;
+
+    char auth_header[256];
+    snprintf(auth_header, sizeof(auth_header), "Authorization: Bot %s", token);
+    queue->auth_header = nv_strdup(auth_header);
+
+    return queue;
+}
+
+void followup_queue_free(followup_queue_t* queue) {
+    if (!queue) {
+        return;
+    }
+
+    if (queue->pending > 0) {
+        log_warn("dropping %zu queued follow-ups", queue->pending);
+    }
+
+    struct followup_chain* chain = queue->chains;
+    while (chain) {
+        struct followup_chain* next = chain->next;
+        free_chain(chain);
+
+        chain = next;
+    }
+
+    nv_free(queue->base_url);
+    nv_free(queue->auth_header);
+    nv_free(queue);
+}
+
+static struct followup_chain* find_chain(followup_queue_t* queue, uint64_t interaction_id) {
+    for (struct followup_chain* chain = queue->chains; chain; chain = chain->next) {
+        if (chain->interaction_id == interaction_id) {
+            return chain;
+        }
+    }
+
+    return NULL;
+}
+
+static struct followup_chain* get_chain(followup_queue_t* queue, uint64_t interaction_id) {
+    struct followup_chain* chain = find_chain(queue, interaction_id);
+    if (chain) {
+        return chain;
+    }
+
+    chain = nv_alloc(sizeof(struct followup_chain));
+    assert(chain);
+
+    chain->queue = queue;
+    chain->interaction_id = interaction_id;
+    chain->expires_ms = get_expiry_ms(interaction_id);
+    chain->head = chain->tail = NULL;
+    chain->in_flight = false;
+    chain->held = false;
+    chain->response_tail = NULL;
+    chain->error_length = 0;
+    chain->error[0] = '\0';
+
+    chain->previous = NULL;
+    chain->next = queue->chains;
+
+    if (queue->chains) {
+        queue->chains->previous = chain;
+    }
+
+    queue->chains = chain;
+    return chain;
+}
+
+/* NULL if the token has expired */
+static struct followup* create_followup(uint64_t interaction_id, const char* method,
+                                        const char* path, json_object* body) {
+    if (time_unix_ms() >= get_expiry_ms(interaction_id)) {
+        log_warn("interaction %" PRIu64 " token expired; not sending %s", interaction_id, method);
+        count_followup(method, "expired");
+
+        return NULL;
+    }
+
+    struct followup* followup = nv_alloc(sizeof(struct followup));
+    assert(followup);
+
+    followup->method = method;
+    followup->path = nv_strdup(path[0] == '/' ? path + 1 : path);
+    followup->body = body ? nv_strdup(json_object_to_json_string(body)) : NULL;
+    followup->next = NULL;
+
+    return followup;
+}
+
+/* after previous, or at the head if it is NULL */
+static void insert_followup(struct followup_chain* chain, struct followup* previous,
+                            struct followup* followup) {
+    struct followup** link = previous ? &previous->next : &chain->head;
+
+    followup->next = *link;
+    *link = followup;
+
+    if (!followup->next) {
+        chain->tail = followup;
+    }
+
+    chain->queue->pending++;
+}
+
+bool followup_enqueue(followup_queue_t* queue, uint64_t interaction_id, const char* method,
+                      const char* path, json_object* body) {
+    struct followup* followup = create_followup(interaction_id, method, path, body);
+    if (!followup) {
+        return false;
+    }
+
+    struct followup_chain* chain = get_chain(queue, interaction_id);
+    insert_followup(chain, chain->tail, followup);
+
+    /* otherwise it goes out when the one ahead of it finishes, or on release */
+    if (!chain->in_flight) {
+        send_next(chain);
+    }
+
+    return true;
+}
+
+bool followup_enqueue_response(followup_queue_t* queue, uint64_t interaction_id,
+                               const char* method, const char* path, json_object* body) {
+    struct followup_chain* chain = find_chain(queue, interaction_id);
+    if (!chain || !chain->held) {
+        return followup_enqueue(queue, interaction_id, method, path, body);
+    }
+
+    struct followup* followup = create_followup(interaction_id, method, path, body);
+    if (!followup) {
+        return false;
+    }
+
+    /* nothing goes out while held, so the head is free to move */
+    insert_followup(chain, chain->response_tail, followup);
+    chain->response_tail = followup;
+
+    return true;
+}
+
+void followup_hold(followup_queue_t* queue, uint64_t interaction_id) {
+    get_chain(queue, interaction_id)->held = true;
+}
+
+void followup_release(followup_queue_t* queue, uint64_t interaction_id) {
+    struct followup_chain* chain = find_chain(queue, interaction_id);
+    if (!chain || !chain->held) {
+        return;
+    }
+
+    chain->held = false;
+    chain->response_tail = NULL;
+
+    /* frees the chain if nothing was queued */
+    if (!chain->in_flight) {
+        send_next(chain);
+    }
+}
+
+size_t followup_pending(const followup_queue_t* queue) { return queue->pending; }
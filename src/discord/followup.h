@@ -0,0 +1,51 @@
+#ifndef _FOLLOWUP_H
+#define _FOLLOWUP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <json.h>
+
+/* outbound queue for interaction webhooks: follow-ups and edits or deletes of the original
+ * response. requests go out on the bot's REST handle without blocking the caller. each interaction
+ * has its own chain with at most one request in flight, so requests for one interaction arrive in
+ * the order they were queued while different interactions proceed independently.
+ *
+ * a webhook request before the initial response fails, so while a handler runs, its interaction's
+ * chain is held until the response or a deferral has gone out, or the handler returns.
+ *
+ * interaction tokens are valid for 15 minutes from the interaction's creation, which is encoded in
+ * its snowflake. work for an expired token is dropped without touching the network */
+
+typedef struct followup_queue followup_queue_t;
+
+/* from rest.h */
+typedef struct rest rest_t;
+
+/* rest is borrowed and must outlive any request in flight; polling it drives the queue */
+followup_queue_t* followup_queue_create(rest_t* rest, const char* base_url, uint32_t api,
+                                        const char* token);
+
+/* after rest_shutdown, so no completion can reach freed chains */
+void followup_queue_free(followup_queue_t* queue);
+
+/* path is relative to the versioned api url and is copied, as is body, which may be NULL. method
+ * must be a string literal. false if the token has expired */
+bool followup_enqueue(followup_queue_t* queue, uint64_t interaction_id, const char* method,
+                      const char* path, json_object* body);
+
+/* for the initial response when it goes through the queue. while held, it goes ahead of what the
+ * handler queued in the meantime, after any earlier response request */
+bool followup_enqueue_response(followup_queue_t* queue, uint64_t interaction_id,
+                               const char* method, const char* path, json_object* body);
+
+/* queues for the interaction without sending until followup_release */
+void followup_hold(followup_queue_t* queue, uint64_t interaction_id);
+
+/* sends what was queued while held. nothing if it was not held */
+void followup_release(followup_queue_t* queue, uint64_t interaction_id);
+
+/* requests queued or in flight */
+size_t followup_pending(const followup_queue_t* queue);
+
+#endif
@@ -2,17 +2,26 @@
 
 #include "bot.h"
 #include "dispatch.h"
+#include "session_store.h"
 
+#include "../core/clock.h"
+#include "../core/metrics.h"
+#include "../core/trace.h"
 #include "../core/websocket.h"
+#include "../core/ws_recorder.h"
 
 #include <json.h>
 
 #include <log.h>
 
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#include <sys/random.h>
+
 #include <nyoravim/mem.h>
 #include <nyoravim/util.h>
 
@@ -45,6 +54,10 @@ enum {
     OPCODE_DISPATCH = 0,
     OPCODE_HEARTBEAT = 1,
     OPCODE_IDENTIFY = 2,
+    OPCODE_PRESENCE_UPDATE = 3,
+    OPCODE_RESUME = 6,
+    OPCODE_RECONNECT = 7,
+    OPCODE_INVALID_SESSION = 9,
     OPCODE_HELLO = 10,
     OPCODE_HEARTBEAT_ACK = 11,
 };
@@ -56,24 +69,137 @@ struct gateway_session {
     char* resume_url;
 };
 
+/* a failed connection attempt waits this long before the next */
+#define RECONNECT_DELAY_NS 5000000000ull
+
+/* https://discord.com/developers/docs/events/gateway-events#invalid-session: wait a random 1-5
+ * seconds before identifying again */
+#define INVALID_SESSION_MIN_DELAY_NS 1000000000ull
+#define INVALID_SESSION_MAX_DELAY_NS 5000000000ull
+
+/* how often a moved sequence is written to the session store. a restart resumes from the last
+ * checkpoint, so this bounds how many events it replays */
+#define CHECKPOINT_INTERVAL_NS 1000000000ull
+
+/* the saved session expires unless refreshed, so an idle one is still written this often */
+#define CHECKPOINT_REFRESH_NS (SAVED_SESSION_TTL_S * 1000000000ull / 3)
+
+/* anything but 1000 and 1001 leaves the session resumable */
+#define RESTART_CLOSE_CODE 4000
+
+/* https://discord.com/developers/docs/events/gateway#rate-limiting: more than 120 commands in 60
+ * seconds closes the connection. a bucket of half that, refilled at half that a minute, can never
+ * send more than 120 in any 60 seconds */
+#define SEND_BUCKET_SIZE 60
+#define SEND_REFILL_NS (60000000000ull / SEND_BUCKET_SIZE)
+
+/* queued commands leave this many tokens for heartbeats, identify and resume, which cannot wait.
+ * heartbeats come less than twice a minute */
+#define SEND_RESERVE 6
+
+#define MAX_QUEUED_COMMANDS 1024
+
+/* a queued command the websocket refused for backpressure waits at the head of the queue until the
+ * websocket's own queue is below this */
+#define SEND_RESUME_BYTES (WS_QUEUE_HIGH_WATER / 2)
+
+/* waiting for the send bucket */
+struct queued_command {
+    struct queued_command* next;
+
+    int32_t opcode;
+    json_object* data;
+};
+
 typedef struct gateway {
     ws_t* ws;
     bot_t* bot;
 
+    /* from /gateway/bot, with query string. NULL for an offline gateway */
+    char* url;
+
+    /* not owned; NULL unless recording */
+    ws_recorder_t* recorder;
+    bool replaying;
+
     struct gateway_session session;
 
     bool has_sequence;
     uint64_t sequence;
 
+    /* not owned; NULL unless sessions are persisted */
+    session_store_t* store;
+    bool checkpointed;
+    uint64_t checkpointed_sequence;
+    uint64_t checkpointed_at_ns;
+
     uint64_t heartbeat_interval_ms;
-    struct timespec last_heartbeat;
+    uint64_t next_heartbeat_ns;
+
+    /* set when a heartbeat goes out and cleared by its ack. still set when the next one is due
+     * means the connection is a zombie */
+    bool awaiting_ack;
+    uint64_t heartbeat_sent_ns;
+
+    struct gateway_latency latency;
+
+    /* per connection. goes negative when heartbeats and the like dip past the reserve */
+    double send_tokens;
+    uint64_t send_refilled_ns;
 
-    char* message_buffer;
-    size_t buffer_size;
+    /* READY or RESUMED has arrived on this connection; commands before then close it */
+    bool authenticated;
+    /* a resume has gone out and RESUMED has not come back; dispatches meanwhile are replayed */
+    bool resuming;
+
+    struct queued_command* queue_head;
+    struct queued_command* queue_tail;
+    size_t queued_commands;
+    bool queue_paused;
+
+    /* commands ever queued, and ever taken off the queue; see gateway_get_commands_taken */
+    uint64_t commands_taken;
+    uint64_t commands_flushed;
+
+    /* set from frame handlers, which run inside ws_poll; the socket is swapped after it returns */
+    const char* reconnect_reason;
+    uint64_t reconnect_delay_ns;
+
+    /* while disconnected, when to try again */
+    uint64_t reconnect_at_ns;
+
+    /* fed each piece of a message as it arrives, so a large one is parsed once rather than again
+     * with every piece */
+    json_tokener* tokener;
+
+    /* bytes of the message being parsed so far */
+    size_t message_size;
 } gateway_t;
 
+static struct metric_family frames_received = METRIC_COUNTER_FAMILY(
+    "tasks_gateway_frames_total", "gateway messages received by opcode and event type");
+
+static struct metric_family bytes_received = METRIC_COUNTER_FAMILY(
+    "tasks_gateway_bytes_total", "gateway message bytes received by opcode and event type");
+
+static struct metric_family heartbeat_rtt = METRIC_LATENCY_FAMILY(
+    "tasks_gateway_heartbeat_rtt_seconds", "time from sending a heartbeat to its ack");
+
+static struct metric_family reconnects = METRIC_COUNTER_FAMILY(
+    "tasks_gateway_reconnects_total", "gateway connections dropped and reopened by reason");
+
+static struct metric_family queued_commands = METRIC_GAUGE_FAMILY(
+    "tasks_gateway_queued_commands", "gateway commands waiting for the send rate limit");
+
 /* takes ownership of data */
-static bool send_packet(ws_t* ws, int32_t opcode, json_object* data) {
+static enum ws_send_result send_packet(ws_t* ws, int32_t opcode, json_object* data) {
+    if (!ws) {
+        log_trace("offline gateway; dropping packet with opcode %" PRIi32, opcode);
+
+        json_object_put(data);
+        return WS_SEND_ERROR;
+    }
+
     json_object* packet = json_object_new_object();
     assert(packet);
 
@@ -86,13 +212,134 @@ static bool send_packet(ws_t* ws, int32_t opcode, json_object* data) {
     const char* content = json_object_to_json_string(packet);
     size_t length = strlen(content);
 
-    bool success = ws_send(ws, content, length, CURLWS_TEXT);
+    /* a heartbeat stuck behind a backlog would look like a zombie connection */
+    uint32_t priority = opcode == OPCODE_HEARTBEAT ? WS_PRIORITY_URGENT : WS_PRIORITY_NORMAL;
+
+    enum ws_send_result result = ws_send(ws, content, length, CURLWS_TEXT, priority);
     json_object_put(packet);
 
-    return success;
+    return result;
+}
+
+/* uniform in [0, 1). seeded per process so that a fleet started together spreads out */
+static double get_random_unit() {
+    uint32_t bits;
+    if (getrandom(&bits, sizeof(bits), 0) != sizeof(bits)) {
+        bits = (uint32_t)rand();
+    }
+
+    return (double)bits / 4294967296.0;
 }
 
-static void get_heartbeat_time(struct timespec* now) { clock_gettime(CLOCK_MONOTONIC, now); }
+static void reset_send_bucket(gateway_t* gw) {
+    gw->send_tokens = SEND_BUCKET_SIZE;
+    gw->send_refilled_ns = time_now_ns();
+}
+
+static void refill_send_bucket(gateway_t* gw) {
+    uint64_t now = time_now_ns();
+
+    gw->send_tokens += (double)(now - gw->send_refilled_ns) / (double)SEND_REFILL_NS;
+    if (gw->send_tokens > SEND_BUCKET_SIZE) {
+        gw->send_tokens = SEND_BUCKET_SIZE;
+    }
+
+    gw->send_refilled_ns = now;
+}
+
+/* heartbeats, identify and resume go out regardless, but still count against the limit */
+static bool send_priority_packet(gateway_t* gw, int32_t opcode, json_object* data) {
+    refill_send_bucket(gw);
+    gw->send_tokens -= 1;
+
+    if (gw->send_tokens < 0) {
+        log_warn("gateway send bucket overdrawn (%.1f tokens)", gw->send_tokens);
+    }
+
+    enum ws_send_result result = send_packet(gw->ws, opcode, data);
+    if (result == WS_SEND_BACKPRESSURE) {
+        log_warn("gateway send queue is full; dropped packet with opcode %" PRIi32, opcode);
+    }
+
+    return result == WS_SEND_OK;
+}
+
+static void update_queue_metric(const gateway_t* gw) {
+    metric_set(metric_get(&queued_commands, NULL), (int64_t)gw->queued_commands);
+}
+
+/* sends what the bucket allows, keeping SEND_RESERVE back */
+static void flush_command_queue(gateway_t* gw) {
+    if (!gw->queue_head || !gw->ws || !gw->authenticated) {
+        return;
+    }
+
+    if (gw->queue_paused) {
+        if (ws_get_queued_bytes(gw->ws) >= SEND_RESUME_BYTES) {
+            return;
+        }
+
+        gw->queue_paused = false;
+    }
+
+    refill_send_bucket(gw);
+
+    while (gw->queue_head && gw->send_tokens >= SEND_RESERVE + 1) {
+        struct queued_command* command = gw->queue_head;
+
+        /* send_packet takes one reference; the queue keeps another in case it has to wait */
+        json_object_get(command->data);
+
+        enum ws_send_result result = send_packet(gw->ws, command->opcode, command->data);
+        if (result == WS_SEND_BACKPRESSURE) {
+            /* not sent, so no token is spent */
+            log_debug("gateway send queue is full; holding %zu commands", gw->queued_commands);
+
+            gw->queue_paused = true;
+            break;
+        }
+
+        json_object_put(command->data);
+
+        gw->queue_head = command->next;
+        if (!gw->queue_head) {
+            gw->queue_tail = NULL;
+        }
+
+        gw->queued_commands--;
+        gw->commands_flushed++;
+        gw->send_tokens -= 1;
+
+        if (result != WS_SEND_OK) {
+            log_warn("failed to send queued gateway command with opcode %" PRIi32,
+                     command->opcode);
+        }
+
+        nv_free(command);
+    }
+
+    update_queue_metric(gw);
+}
+
+static void clear_command_queue(gateway_t* gw) {
+    struct queued_command* command = gw->queue_head;
+    while (command) {
+        struct queued_command* next = command->next;
+
+        json_object_put(command->data);
+        nv_free(command);
+
+        command = next;
+    }
+
+    gw->queue_head = NULL;
+    gw->queue_tail = NULL;
+
+    gw->commands_flushed += gw->queued_commands;
+    gw->queued_commands = 0;
+
+    update_queue_metric(gw);
+}
 
 static json_object* create_heartbeat(bool has_sequence, uint64_t sequence) {
     json_object* data = json_object_new_object();
@@ -114,8 +361,15 @@ static bool send_heartbeat(gateway_t* gw) {
     json_object* d =
         gw->has_sequence ? json_object_new_uint64(gw->sequence) : json_object_new_null();
 
-    if (send_packet(gw->ws, OPCODE_HEARTBEAT, d)) {
+    if (send_priority_packet(gw, OPCODE_HEARTBEAT, d)) {
         log_debug("sent heartbeat");
+
+        /* if one is already outstanding, its ack is the one that comes back first */
+        if (!gw->awaiting_ack) {
+            gw->awaiting_ack = true;
+            gw->heartbeat_sent_ns = time_now_ns();
+        }
+
         return true;
     } else {
         log_error("failed to sent heartbeat");
@@ -124,11 +378,12 @@ static bool send_heartbeat(gateway_t* gw) {
 }
 
 static uint64_t get_intents(const bot_t* bot) {
-    /* do we need any basic ones? dont think so */
-    uint64_t intents = 0;
+    /* guild and channel events, to fill the entity cache */
+    uint64_t intents = INTENT_GUILDS;
 
-    const struct bot_callbacks* callbacks = bot_get_callbacks(bot);
-    /* todo: set intents by checking callbacks */
+    if (bot_caches_members(bot)) {
+        intents |= INTENT_GUILD_MEMBERS;
+    }
 
     return intents;
 }
@@ -167,13 +422,42 @@ static void identify_bot(gateway_t* gw) {
     json_object_object_add(identify_packet, "intents", intents_obj);
     json_object_object_add(identify_packet, "properties", create_runtime_properties());
 
-    if (send_packet(gw->ws, OPCODE_IDENTIFY, identify_packet)) {
+    if (send_priority_packet(gw, OPCODE_IDENTIFY, identify_packet)) {
         log_debug("sent identify packet to discord");
+
+        if (gw->store) {
+            session_store_count_start(gw->store);
+        }
     } else {
         log_error("failed to identify!");
     }
 }
 
+static void resume_session(gateway_t* gw) {
+    json_object* resume_packet = json_object_new_object();
+    assert(resume_packet);
+
+    json_object* token_obj = json_object_new_string(bot_get_token(gw->bot));
+    assert(token_obj);
+
+    json_object* session_obj = json_object_new_string(gw->session.id);
+    assert(session_obj);
+
+    json_object* sequence_obj =
+        gw->has_sequence ? json_object_new_uint64(gw->sequence) : json_object_new_null();
+
+    json_object_object_add(resume_packet, "token", token_obj);
+    json_object_object_add(resume_packet, "session_id", session_obj);
+    json_object_object_add(resume_packet, "seq", sequence_obj);
+
+    if (send_priority_packet(gw, OPCODE_RESUME, resume_packet)) {
+        log_info("resuming session %s", gw->session.id);
+        gw->resuming = true;
+    } else {
+        log_error("failed to resume!");
+    }
+}
+
 static void handle_hello(const json_object* data, gateway_t* gw) {
     assert(data);
 
@@ -185,11 +469,82 @@ static void handle_hello(const json_object* data, gateway_t* gw) {
     gw->heartbeat_interval_ms = json_object_get_uint64(field);
     log_debug("heartbeat interval: %" PRIu64 " ms", gw->heartbeat_interval_ms);
 
-    /* discord expects heartbeat right away */
-    send_heartbeat(gw);
-    get_heartbeat_time(&gw->last_heartbeat);
+    /* https://discord.com/developers/docs/events/gateway#sending-heartbeats: the first heartbeat
+     * waits interval * jitter so that clients which connected together do not beat together */
+    double first_delay_ms = (double)gw->heartbeat_interval_ms * get_random_unit();
+    gw->next_heartbeat_ns = time_now_ns() + (uint64_t)(first_delay_ms * 1e6);
+    gw->awaiting_ack = false;
+
+    if (gw->session.started) {
+        resume_session(gw);
+    } else {
+        identify_bot(gw);
+    }
+}
+
+static void update_latency(struct gateway_latency* latency, uint64_t rtt) {
+    latency->last_ns = rtt;
+
+    /* rfc 6298, as tcp smooths its rtt */
+    if (latency->samples == 0) {
+        latency->smoothed_ns = rtt;
+        latency->jitter_ns = rtt / 2;
+    } else {
+        uint64_t deviation =
+            rtt > latency->smoothed_ns ? rtt - latency->smoothed_ns : latency->smoothed_ns - rtt;
+
+        latency->jitter_ns = (latency->jitter_ns * 3 + deviation) / 4;
+        latency->smoothed_ns = (latency->smoothed_ns * 7 + rtt) / 8;
+    }
+
+    latency->samples++;
+}
 
-    identify_bot(gw);
+static void handle_heartbeat_ack(gateway_t* gw) {
+    if (!gw->awaiting_ack) {
+        log_debug("heartbeat acknowledged, but none was outstanding");
+        return;
+    }
+
+    gw->awaiting_ack = false;
+
+    uint64_t rtt = time_now_ns() - gw->heartbeat_sent_ns;
+    update_latency(&gw->latency, rtt);
+    metric_observe(metric_get(&heartbeat_rtt, NULL), rtt);
+
+    log_trace("heartbeat acknowledged after %" PRIu64 " us", rtt / 1000);
+}
+
+static void request_reconnect(gateway_t* gw, const char* reason, uint64_t delay_ns) {
+    gw->reconnect_reason = reason;
+    gw->reconnect_delay_ns = delay_ns;
+}
+
+static void clear_session(gateway_t* gw) {
+    nv_free(gw->session.id);
+    nv_free(gw->session.resume_url);
+    memset(&gw->session, 0, sizeof(struct gateway_session));
+
+    gw->has_sequence = false;
+}
+
+static void handle_invalid_session(const json_object* data, gateway_t* gw) {
+    bool resumable = data && json_object_get_type(data) == json_type_boolean &&
+                     json_object_get_boolean(data);
+
+    if (!resumable) {
+        log_warn("gateway session invalidated; identifying again");
+        clear_session(gw);
+
+        if (gw->store) {
+            session_store_clear(gw->store);
+            gw->checkpointed = false;
+        }
+    }
+
+    double spread = (double)(INVALID_SESSION_MAX_DELAY_NS - INVALID_SESSION_MIN_DELAY_NS);
+    request_reconnect(gw, "invalid_session",
+                      INVALID_SESSION_MIN_DELAY_NS + (uint64_t)(spread * get_random_unit()));
 }
 
 static bool get_opcode(const json_object* data, int32_t* opcode) {
@@ -206,7 +561,22 @@ static bool get_opcode(const json_object* data, int32_t* opcode) {
     return true;
 }
 
-static void handle_frame(const json_object* frame, gateway_t* gw) {
+static void count_frame(int32_t opcode, const char* type, size_t size) {
+    /* event names are upper snake case; anything else would need escaping */
+    if (!type) {
+        type = "";
+    } else if (strspn(type, "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_") != strlen(type)) {
+        type = "unknown";
+    }
+
+    char labels[128];
+    snprintf(labels, sizeof(labels), "opcode=\"%" PRIi32 "\",event=\"%.64s\"", opcode, type);
+
+    metric_inc(metric_get(&frames_received, labels));
+    metric_add(metric_get(&bytes_received, labels), size);
+}
+
+static void handle_frame(const json_object* frame, size_t size, gateway_t* gw) {
     int32_t opcode;
     if (!get_opcode(frame, &opcode)) {
         log_warn("no opcode on gateway frame! not handling");
@@ -235,8 +605,15 @@ static void handle_frame(const json_object* frame, gateway_t* gw) {
         log_trace("t: %s", type);
     }
 
+    count_frame(opcode, type, size);
+
     switch (opcode) {
     case OPCODE_DISPATCH:
+        if (type && (strcmp(type, "READY") == 0 || strcmp(type, "RESUMED") == 0)) {
+            gw->authenticated = true;
+            gw->resuming = false;
+        }
+
         if (type) {
             log_trace("dispatching event %s", type);
             dispatch_event(gw, type, data);
@@ -253,7 +630,14 @@ static void handle_frame(const json_object* frame, gateway_t* gw) {
         handle_hello(data, gw);
         break;
     case OPCODE_HEARTBEAT_ACK:
-        log_trace("heartbeat acknowledged");
+        handle_heartbeat_ack(gw);
+        break;
+    case OPCODE_RECONNECT:
+        log_info("discord asked us to reconnect");
+        request_reconnect(gw, "requested", 0);
+        break;
+    case OPCODE_INVALID_SESSION:
+        handle_invalid_session(data, gw);
         break;
     }
 }
@@ -268,53 +652,23 @@ static void read_sequence(const json_object* frame, gateway_t* gw) {
     gw->sequence = json_object_get_uint64(sequence_field);
 }
 
-/* manage message buffer while parsing data. note that this assumes that the websocket receives
- * completely valid json and memory will start leaking if it does not */
+/* NULL until the message is complete or if it is not valid json, which drops it */
 static json_object* parse_websocket_data(const char* data, size_t size, gateway_t* gw) {
-    bool buffered;
-    const char* parseable;
-
-    /* message_buffer is gibberish unless buffer_size > 0 */
-    if (gw->buffer_size > 0) {
-        buffered = true;
-        log_trace("previously buffered data; reallocating and extending buffer to parse");
-
-        size_t new_size = gw->buffer_size + size;
-        gw->message_buffer = nv_realloc(gw->message_buffer, new_size + 1);
-        assert(gw->message_buffer);
-
-        memcpy(gw->message_buffer + gw->buffer_size, data, size);
-        gw->message_buffer[new_size] = '\0';
-
-        gw->buffer_size = new_size;
-        parseable = gw->message_buffer;
-    } else {
-        log_trace("no previously buffered data; not allocating anything");
-
-        buffered = false;
-        parseable = data;
+    json_object* parsed = json_tokener_parse_ex(gw->tokener, data, (int)size);
+    if (parsed) {
+        json_tokener_reset(gw->tokener);
+        return parsed;
     }
 
-    json_object* parsed = json_tokener_parse(parseable);
-    if (parsed) {
-        /* if previously buffered, we can clear data now */
-        if (buffered) {
-            nv_free(gw->message_buffer);
-            gw->buffer_size = 0;
-        }
-    } else {
-        /* otherwise, if we failed to parse and it wasnt previously buffered, allocate a new buffer
-         * for storage */
-        if (!buffered) {
-            /* buffer will be appended to regardless; we do not need a null terminator */
-            gw->message_buffer = nv_alloc(size);
-            memcpy(gw->message_buffer, data, size);
-
-            gw->buffer_size = size;
-        }
+    enum json_tokener_error error = json_tokener_get_error(gw->tokener);
+    if (error != json_tokener_continue) {
+        log_error("failed to parse gateway message: %s", json_tokener_error_desc(error));
+
+        json_tokener_reset(gw->tokener);
+        gw->message_size = 0;
     }
 
-    return parsed;
+    return NULL;
 }
 
 static void on_frame_received(void* user, const char* data, size_t size,
@@ -325,82 +679,324 @@ static void on_frame_received(void* user, const char* data, size_t size,
 
     log_debug("packet received from gateway (len %zu)", size);
 
-    json_object* parsed = parse_websocket_data(data, size, user);
+    /* sampling is decided per frame; everything it leads to is part of the same trace */
+    struct trace_span root, span;
+    trace_root_begin(&root, "on_frame_received");
+
+    /* including the earlier pieces of the same message */
+    gateway_t* gw = user;
+    gw->message_size += size;
+
+    trace_begin(&span, "json_parse");
+    json_object* parsed = parse_websocket_data(data, size, gw);
+    trace_end(&span);
+
     if (!parsed) {
-        log_debug(
-            "failed to parse received frame; assuming valid json and carrying over to next packet");
+        log_trace("gateway message incomplete after %zu bytes; waiting for more",
+                  gw->message_size);
 
+        trace_root_end(&root);
         return;
     }
 
-    handle_frame(parsed, user);
-    read_sequence(parsed, user);
+    size_t message_size = gw->message_size;
+    gw->message_size = 0;
+
+    handle_frame(parsed, message_size, gw);
+    read_sequence(parsed, gw);
 
     json_object_put(parsed);
+    trace_root_end(&root);
 }
 
-gateway_t* gateway_open(const char* url, bot_t* bot) {
+static void on_ws_frame(void* user, const char* data, size_t size,
+                        const struct curl_ws_frame* meta) {
+    gateway_t* gw = user;
+    if (gw->recorder) {
+        ws_recorder_write(gw->recorder, data, size, meta);
+    }
+
+    on_frame_received(gw, data, size, meta);
+}
+
+static ws_t* open_websocket(gateway_t* gw, const char* url) {
+    struct websocket_callbacks callbacks;
+    callbacks.user = gw;
+    callbacks.on_frame_received = on_ws_frame;
+
+    ws_t* ws = ws_open(url, &callbacks);
+    if (!ws) {
+        log_error("failed to open websocket to url %s", url);
+        return NULL;
+    }
+
+    /* the limit is per connection */
+    reset_send_bucket(gw);
+    gw->authenticated = false;
+    gw->resuming = false;
+    gw->queue_paused = false;
+
+    return ws;
+}
+
+/* https://discord.com/developers/docs/events/gateway#resuming: resumes go to the url from ready,
+ * which carries no query string */
+static void format_resume_url(const gateway_t* gw, char* buffer, size_t size) {
+    snprintf(buffer, size, "%s/?v=%" PRIu32 "&encoding=json", gw->session.resume_url,
+             bot_get_api_version(gw->bot));
+}
+
+static gateway_t* create_gateway(bot_t* bot) {
     gateway_t* gw = nv_alloc(sizeof(gateway_t));
     assert(gw);
+    memset(gw, 0, sizeof(gateway_t));
 
     gw->bot = bot;
-    gw->has_sequence = false;
-    gw->heartbeat_interval_ms = 0;
-    gw->buffer_size = 0;
 
-    memset(&gw->session, 0, sizeof(struct gateway_session));
+    gw->tokener = json_tokener_new();
+    assert(gw->tokener);
 
-    struct websocket_callbacks callbacks;
-    callbacks.user = gw;
-    callbacks.on_frame_received = on_frame_received;
+    return gw;
+}
+
+gateway_t* gateway_open(const char* url, bot_t* bot) {
+    gateway_t* gw = create_gateway(bot);
 
-    gw->ws = ws_open(url, &callbacks);
+    if (!url) {
+        log_debug("opening offline gateway");
+        return gw;
+    }
+
+    gw->ws = open_websocket(gw, url);
     if (!gw->ws) {
-        log_error("failed to open websocket to url %s", url);
+        json_tokener_free(gw->tokener);
+        nv_free(gw);
 
+        return NULL;
+    }
+
+    gw->url = nv_strdup(url);
+    return gw;
+}
+
+gateway_t* gateway_resume(const struct saved_session* saved, bot_t* bot) {
+    gateway_t* gw = create_gateway(bot);
+
+    gw->session.started = true;
+    gw->session.id = nv_strdup(saved->id);
+    gw->session.resume_url = nv_strdup(saved->resume_url);
+
+    gw->has_sequence = saved->has_sequence;
+    gw->sequence = saved->sequence;
+
+    char resume_url[512];
+    format_resume_url(gw, resume_url, sizeof(resume_url));
+
+    /* hello on this connection resumes, since the session is already started */
+    gw->ws = open_websocket(gw, resume_url);
+    if (!gw->ws) {
+        clear_session(gw);
+
+        json_tokener_free(gw->tokener);
         nv_free(gw);
+
         return NULL;
     }
 
+    gw->url = nv_strdup(saved->url);
     return gw;
 }
 
+static void checkpoint_session(gateway_t* gw) {
+    struct saved_session saved;
+    saved.url = gw->url;
+    saved.id = gw->session.id;
+    saved.resume_url = gw->session.resume_url;
+    saved.has_sequence = gw->has_sequence;
+    saved.sequence = gw->sequence;
+
+    if (session_store_save(gw->store, &saved)) {
+        gw->checkpointed = true;
+        gw->checkpointed_sequence = gw->sequence;
+    }
+
+    /* a failed write is retried after the interval too */
+    gw->checkpointed_at_ns = time_now_ns();
+}
+
 void gateway_close(gateway_t* gw) {
     if (!gw) {
         return;
     }
 
-    nv_free(gw->session.id);
-    nv_free(gw->session.resume_url);
+    /* a persisted session should outlive this process, so it is not ended with 1000 */
+    bool persisted = gw->store && gw->session.started && gw->url;
+    if (persisted) {
+        checkpoint_session(gw);
+    }
+
+    clear_session(gw);
+    clear_command_queue(gw);
+
+    if (persisted) {
+        ws_close(gw->ws, RESTART_CLOSE_CODE, "restarting");
+    } else {
+        ws_close(gw->ws, 1000, "bot triggered close");
+    }
+
+    json_tokener_free(gw->tokener);
 
-    ws_close(gw->ws, 1000, "bot triggered close");
+    nv_free(gw->url);
     nv_free(gw);
 }
 
+/* drops the connection without a close frame, since closing normally would end the session, and
+ * schedules a new one. hello on the new connection resumes if there is a session to resume */
+static void disconnect(gateway_t* gw, const char* reason, uint64_t delay_ns) {
+    log_warn("reconnecting to gateway: %s", reason);
+
+    char labels[64];
+    snprintf(labels, sizeof(labels), "reason=\"%s\"", reason);
+    metric_inc(metric_get(&reconnects, labels));
+
+    ws_disconnect(gw->ws);
+    gw->ws = NULL;
+
+    gw->heartbeat_interval_ms = 0;
+    gw->awaiting_ack = false;
+    gw->authenticated = false;
+    gw->resuming = false;
+    gw->latency.reconnects++;
+
+    /* a partial message will never be completed */
+    json_tokener_reset(gw->tokener);
+    gw->message_size = 0;
+
+    gw->reconnect_at_ns = time_now_ns() + delay_ns;
+}
+
+static void try_reconnect(gateway_t* gw) {
+    uint64_t now = time_now_ns();
+    if (now < gw->reconnect_at_ns) {
+        return;
+    }
+
+    char resume_url[512];
+    const char* url = gw->url;
+
+    if (gw->session.started) {
+        format_resume_url(gw, resume_url, sizeof(resume_url));
+        url = resume_url;
+    }
+
+    gw->ws = open_websocket(gw, url);
+    if (!gw->ws) {
+        gw->reconnect_at_ns = now + RECONNECT_DELAY_NS;
+    }
+}
+
 static void check_heartbeat_timer(gateway_t* gw) {
     if (gw->heartbeat_interval_ms == 0) {
         return;
     }
 
-    struct timespec now;
-    get_heartbeat_time(&now);
+    uint64_t now = time_now_ns();
+    if (now < gw->next_heartbeat_ns) {
+        return;
+    }
 
-    const struct timespec* last = &gw->last_heartbeat;
-    int64_t diff_seconds = (int64_t)now.tv_sec - (int64_t)last->tv_sec;
-    int64_t diff_nano = (int64_t)now.tv_nsec - (int64_t)last->tv_nsec;
-    int64_t diff_ms = diff_seconds * 1e3 + diff_nano / 1e6;
+    /* https://discord.com/developers/docs/events/gateway#heartbeat-interval: no ack between two
+     * heartbeats means the connection is dead even if tcp has not noticed */
+    if (gw->awaiting_ack) {
+        gw->latency.missed_acks++;
+        disconnect(gw, "zombie", 0);
 
-    if (diff_ms >= gw->heartbeat_interval_ms) {
-        log_trace("timeout elapsed; sending heartbeat");
-        send_heartbeat(gw);
+        return;
+    }
+
+    log_trace("timeout elapsed; sending heartbeat");
+    send_heartbeat(gw);
+
+    gw->next_heartbeat_ns = now + gw->heartbeat_interval_ms * 1000000;
+}
+
+static void check_checkpoint_timer(gateway_t* gw) {
+    if (!gw->store || !gw->session.started) {
+        return;
+    }
 
-        memcpy(&gw->last_heartbeat, &now, sizeof(struct timespec));
+    bool moved = !gw->checkpointed || gw->sequence != gw->checkpointed_sequence;
+    uint64_t interval = moved ? CHECKPOINT_INTERVAL_NS : CHECKPOINT_REFRESH_NS;
+
+    if (time_now_ns() >= gw->checkpointed_at_ns + interval) {
+        checkpoint_session(gw);
     }
 }
 
 void gateway_poll(gateway_t* gw) {
-    ws_poll(gw->ws);
+    if (!gw->url) {
+        return; /* offline */
+    }
+
+    if (!gw->ws) {
+        try_reconnect(gw);
+        return;
+    }
+
+    if (!ws_poll(gw->ws)) {
+        disconnect(gw, "error", 0);
+        return;
+    }
+
+    if (gw->reconnect_reason) {
+        disconnect(gw, gw->reconnect_reason, gw->reconnect_delay_ns);
+        gw->reconnect_reason = NULL;
+
+        return;
+    }
+
     check_heartbeat_timer(gw);
+    check_checkpoint_timer(gw);
+    flush_command_queue(gw);
+}
+
+bool gateway_send_command(gateway_t* gw, int32_t opcode, json_object* data) {
+    if (!gw->url) {
+        log_trace("offline gateway; dropping command with opcode %" PRIi32, opcode);
+
+        json_object_put(data);
+        return false;
+    }
+
+    if (gw->queued_commands >= MAX_QUEUED_COMMANDS) {
+        log_warn("gateway command queue full; dropping command with opcode %" PRIi32, opcode);
+
+        json_object_put(data);
+        return false;
+    }
+
+    struct queued_command* command = nv_alloc(sizeof(struct queued_command));
+    assert(command);
+
+    command->next = NULL;
+    command->opcode = opcode;
+    command->data = data;
+
+    if (gw->queue_tail) {
+        gw->queue_tail->next = command;
+    } else {
+        gw->queue_head = command;
+    }
+
+    gw->queue_tail = command;
+    gw->queued_commands++;
+    gw->commands_taken++;
+
+    /* right away if the bucket allows */
+    flush_command_queue(gw);
+    update_queue_metric(gw);
+
+    return true;
 }
 
 void gateway_start_session(gateway_t* gw, const char* id, const char* resume_url) {
@@ -419,6 +1015,66 @@ void gateway_start_session(gateway_t* gw, const char* id, const char* resume_url
     gw->session.resume_url = nv_strdup(resume_url);
 
     log_debug("session started: %s", id);
+
+    if (gw->store) {
+        checkpoint_session(gw);
+    }
 }
 
 bot_t* gateway_get_bot(const gateway_t* gw) { return gw->bot; }
+
+bool gateway_get_latency(const gateway_t* gw, struct gateway_latency* latency) {
+    memcpy(latency, &gw->latency, sizeof(struct gateway_latency));
+    return gw->latency.samples > 0;
+}
+
+void gateway_set_recorder(gateway_t* gw, ws_recorder_t* recorder) { gw->recorder = recorder; }
+
+void gateway_set_session_store(gateway_t* gw, session_store_t* store) { gw->store = store; }
+session_store_t* gateway_get_session_store(const gateway_t* gw) { return gw->store; }
+
+bool gateway_is_replaying(const gateway_t* gw) { return gw->replaying; }
+bool gateway_is_resuming(const gateway_t* gw) { return gw->resuming; }
+
+size_t gateway_get_queued_commands(const gateway_t* gw) { return gw->queued_commands; }
+
+uint64_t gateway_get_commands_taken(const gateway_t* gw) { return gw->commands_taken; }
+uint64_t gateway_get_commands_flushed(const gateway_t* gw) { return gw->commands_flushed; }
+
+static void sleep_until_ns(uint64_t deadline) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)(deadline / 1000000000);
+    ts.tv_nsec = (long)(deadline % 1000000000);
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+        /* interrupted; go back to sleep */
+    }
+}
+
+bool gateway_replay(gateway_t* gw, ws_replayer_t* replayer, double speed,
+                    struct gateway_replay_stats* stats) {
+    if (gw->ws) {
+        log_error("refusing to replay into a live gateway");
+        return false;
+    }
+
+    memset(stats, 0, sizeof(struct gateway_replay_stats));
+    uint64_t start = time_now_ns();
+    gw->replaying = true;
+
+    struct ws_recorded_frame frame;
+    while (ws_replayer_next(replayer, &frame)) {
+        if (speed > 0) {
+            sleep_until_ns(start + (uint64_t)((double)frame.timestamp_ns / speed));
+        }
+
+        on_frame_received(gw, frame.data, frame.size, &frame.meta);
+
+        stats->frames++;
+        stats->bytes += frame.size;
+    }
+
+    gw->replaying = false;
+    stats->elapsed_ns = time_now_ns() - start;
+    return true;
+}
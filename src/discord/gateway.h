@@ -1,18 +1,104 @@
 #ifndef _GATEWAY_H
 #define _GATEWAY_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <json.h>
+
 typedef struct gateway gateway_t;
 
 /* from bot.h */
 typedef struct bot bot_t;
 
+/* url can be NULL for an offline gateway that never connects and drops outgoing packets */
 gateway_t* gateway_open(const char* url, bot_t* bot);
+
+/* from session_store.h */
+typedef struct session_store session_store_t;
+struct saved_session;
+
+/* connects straight to the saved session's resume url and resumes it on hello. if discord refuses,
+ * the gateway identifies again at the saved url */
+gateway_t* gateway_resume(const struct saved_session* saved, bot_t* bot);
 void gateway_close(gateway_t* gw);
 
 void gateway_poll(gateway_t* gw);
 
 void gateway_start_session(gateway_t* gw, const char* id, const char* resume_url);
 
+/* https://discord.com/developers/docs/topics/opcodes-and-status-codes#gateway-gateway-opcodes */
+enum {
+    GATEWAY_OPCODE_PRESENCE_UPDATE = 3,
+    GATEWAY_OPCODE_VOICE_STATE_UPDATE = 4,
+    GATEWAY_OPCODE_REQUEST_GUILD_MEMBERS = 8,
+};
+
+/* queues a command, taking ownership of data. commands go out in order as the gateway's send
+ * rate limit allows, leaving room for heartbeats, and only once the connection has identified or
+ * resumed. they wait rather than being dropped while the connection is backed up, and survive a
+ * reconnect. false if the gateway is offline or the queue is full */
+bool gateway_send_command(gateway_t* gw, int32_t opcode, json_object* data);
+
+/* commands still waiting to be sent */
+size_t gateway_get_queued_commands(const gateway_t* gw);
+
+/* running counts of commands gateway_send_command has queued, and of those that have since left
+ * the queue, whether they were sent or dropped. the queue is in order, so a command is out of it
+ * once the flushed count reaches the taken count as it was right after queueing it */
+uint64_t gateway_get_commands_taken(const gateway_t* gw);
+uint64_t gateway_get_commands_flushed(const gateway_t* gw);
+
 bot_t* gateway_get_bot(const gateway_t* gw);
 
+struct gateway_latency {
+    /* the most recent heartbeat round trip */
+    uint64_t last_ns;
+
+    /* smoothed the way tcp smooths rtt; jitter is the mean deviation from it */
+    uint64_t smoothed_ns;
+    uint64_t jitter_ns;
+
+    /* acknowledged heartbeats */
+    uint64_t samples;
+
+    /* heartbeats that were never acknowledged, each of which forced a reconnect */
+    uint64_t missed_acks;
+    uint64_t reconnects;
+};
+
+/* false until a heartbeat has been acknowledged, though latency is filled in regardless */
+bool gateway_get_latency(const gateway_t* gw, struct gateway_latency* latency);
+
+/* from core/ws_recorder.h */
+typedef struct ws_recorder ws_recorder_t;
+typedef struct ws_replayer ws_replayer_t;
+
+/* every inbound frame is written to recorder before it is handled. recorder is not owned; NULL
+ * stops recording */
+void gateway_set_recorder(gateway_t* gw, ws_recorder_t* recorder);
+
+/* the session is checkpointed to store once started, and not ended on close so that the next
+ * process can resume it. store is not owned; NULL stops persisting */
+void gateway_set_session_store(gateway_t* gw, session_store_t* store);
+session_store_t* gateway_get_session_store(const gateway_t* gw);
+
+struct gateway_replay_stats {
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t elapsed_ns;
+};
+
+/* feeds a recording through the same path live frames take. gw must be offline. speed scales the
+ * recorded timing (1 is real time, 2 twice as fast); 0 or less replays as fast as possible */
+bool gateway_replay(gateway_t* gw, ws_replayer_t* replayer, double speed,
+                    struct gateway_replay_stats* stats);
+
+/* while gateway_replay runs. recorded interactions are long past their response window */
+bool gateway_is_replaying(const gateway_t* gw);
+
+/* between sending a resume and RESUMED, while discord replays what the session missed */
+bool gateway_is_resuming(const gateway_t* gw);
+
 #endif
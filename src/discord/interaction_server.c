@@ -0,0 +1,274 @@
+/* https://discord.com/developers/docs/interactions/overview#setting-up-an-endpoint */
+
+#include "interaction_server.h"
+
+#include "dispatch.h"
+
+#include "types/interaction.h"
+
+#include "../core/http_server.h"
+#include "../core/metrics.h"
+
+#include <log.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <openssl/evp.h>
+
+#include <nyoravim/mem.h>
+
+#define PUBLIC_KEY_SIZE 32
+#define SIGNATURE_SIZE 64
+
+/* past this, discord is not the one talking to us */
+#define MAX_TIMESTAMP_LENGTH 32
+
+/* a signed request further than this from our clock is refused, so a captured one cannot be
+ * replayed later */
+#define MAX_TIMESTAMP_SKEW_S 5
+
+#define PONG_BODY "{\"type\":1}"
+
+typedef struct interaction_server {
+    bot_t* bot;
+    http_server_t* http;
+
+    EVP_PKEY* public_key;
+} interaction_server_t;
+
+static struct metric_family requests = METRIC_COUNTER_FAMILY(
+    "tasks_http_interactions_total", "interaction webhook requests by result");
+
+static void count_request(const char* result) {
+    char labels[32];
+    snprintf(labels, sizeof(labels), "result=\"%s\"", result);
+
+    metric_inc(metric_get(&requests, labels));
+}
+
+static int decode_nibble(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+
+    return -1;
+}
+
+/* exactly size bytes' worth of hex, or false */
+static bool decode_hex(const char* hex, uint8_t* dst, size_t size) {
+    if (strlen(hex) != size * 2) {
+        return false;
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        int high = decode_nibble(hex[i * 2]);
+        int low = decode_nibble(hex[i * 2 + 1]);
+
+        if (high < 0 || low < 0) {
+            return false;
+        }
+
+        dst[i] = (uint8_t)(high << 4 | low);
+    }
+
+    return true;
+}
+
+/* unix seconds, close to now */
+static bool is_timestamp_fresh(const char* timestamp) {
+    char* end;
+    errno = 0;
+    long long seconds = strtoll(timestamp, &end, 10);
+
+    if (end == timestamp || *end != '\0' || errno != 0) {
+        return false;
+    }
+
+    long long now = (long long)time(NULL);
+    return seconds >= now - MAX_TIMESTAMP_SKEW_S && seconds <= now + MAX_TIMESTAMP_SKEW_S;
+}
+
+/* discord signs the timestamp header followed by the raw body */
+static bool verify_request(const interaction_server_t* server,
+                           const struct http_server_request* req) {
+    const char* signature_hex = http_server_get_header(req, "X-Signature-Ed25519");
+    const char* timestamp = http_server_get_header(req, "X-Signature-Timestamp");
+
+    if (!signature_hex || !timestamp) {
+        return false;
+    }
+
+    /* before the copy and the signature check, which cost more */
+    if (!is_timestamp_fresh(timestamp)) {
+        log_debug("interaction request timestamp %s is stale", timestamp);
+        return false;
+    }
+
+    uint8_t signature[SIGNATURE_SIZE];
+    size_t timestamp_length = strlen(timestamp);
+
+    if (!decode_hex(signature_hex, signature, sizeof(signature)) ||
+        timestamp_length > MAX_TIMESTAMP_LENGTH) {
+        return false;
+    }
+
+    /* ed25519 takes the whole message in one go */
+    size_t message_size = timestamp_length + req->body_size;
+    uint8_t* message = nv_alloc(message_size);
+    assert(message);
+
+    memcpy(message, timestamp, timestamp_length);
+    memcpy(message + timestamp_length, req->body, req->body_size);
+
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    assert(ctx);
+
+    bool valid = EVP_DigestVerifyInit(ctx, NULL, NULL, NULL, server->public_key) == 1 &&
+                 EVP_DigestVerify(ctx, signature, sizeof(signature), message, message_size) == 1;
+
+    EVP_MD_CTX_free(ctx);
+    nv_free(message);
+
+    return valid;
+}
+
+static void respond_json(http_connection_t* conn, const char* body) {
+    http_server_respond(conn, 200, "application/json", body, strlen(body));
+}
+
+/* goes out on the connection right away; the handler may still be running */
+static bool send_reply(void* user, json_object* body) {
+    count_request("answered");
+
+    const char* json = json_object_to_json_string(body);
+    return http_server_respond(user, 200, "application/json", json, strlen(json));
+}
+
+static void on_request(void* user, http_connection_t* conn, const struct http_server_request* req) {
+    interaction_server_t* server = user;
+
+    if (strcmp(req->method, "POST") != 0) {
+        http_server_respond(conn, 405, NULL, NULL, 0);
+        return;
+    }
+
+    /* discord sends invalid signatures on purpose when the endpoint is configured, and refuses
+     * endpoints that accept them */
+    if (!verify_request(server, req)) {
+        log_warn("rejecting interaction request with a bad, missing or stale signature");
+        count_request("unauthorized");
+
+        http_server_respond(conn, 401, NULL, NULL, 0);
+        return;
+    }
+
+    json_tokener* tokener = json_tokener_new();
+    assert(tokener);
+
+    json_object* data = json_tokener_parse_ex(tokener, req->body, (int)req->body_size);
+    json_tokener_free(tokener);
+
+    json_object* field = json_object_object_get(data, "type");
+    if (!field || json_object_get_type(field) != json_type_int) {
+        log_error("interaction request has no type");
+        count_request("invalid");
+
+        json_object_put(data);
+        http_server_respond(conn, 400, NULL, NULL, 0);
+        return;
+    }
+
+    if (json_object_get_int(field) == INTERACTION_TYPE_PING) {
+        log_debug("answering interaction endpoint ping");
+        count_request("ping");
+
+        json_object_put(data);
+        respond_json(conn, PONG_BODY);
+        return;
+    }
+
+    struct interaction_reply reply;
+    reply.send = send_reply;
+    reply.user = conn;
+    reply.sent = false;
+
+    dispatch_interaction(server->bot, data, &reply);
+    json_object_put(data);
+
+    if (!reply.sent) {
+        /* the watchdog deferred over REST while the handler ran, or the interaction was bad */
+        count_request("accepted");
+        http_server_respond(conn, 202, NULL, NULL, 0);
+    }
+}
+
+interaction_server_t* interaction_server_create(bot_t* bot, const char* address, uint16_t port,
+                                                const char* public_key) {
+    uint8_t key[PUBLIC_KEY_SIZE];
+    if (!public_key || !decode_hex(public_key, key, sizeof(key))) {
+        log_error("http interactions need the application's public key as %d hex characters",
+                  PUBLIC_KEY_SIZE * 2);
+
+        return NULL;
+    }
+
+    EVP_PKEY* pkey = EVP_PKEY_new_raw_public_key(EVP_PKEY_ED25519, NULL, key, sizeof(key));
+    if (!pkey) {
+        log_error("failed to load the application's public key");
+        return NULL;
+    }
+
+    interaction_server_t* server = nv_alloc(sizeof(interaction_server_t));
+    assert(server);
+
+    server->bot = bot;
+    server->public_key = pkey;
+
+    struct http_server_callbacks callbacks;
+    memset(&callbacks, 0, sizeof(struct http_server_callbacks));
+    callbacks.on_request = on_request;
+    callbacks.user = server;
+
+    server->http = http_server_create(address, port, &callbacks);
+    if (!server->http) {
+        log_error("failed to start interactions server on %s:%u", address, (unsigned)port);
+
+        interaction_server_free(server);
+        return NULL;
+    }
+
+    log_info("accepting http interactions on %s:%u", address,
+             (unsigned)http_server_get_port(server->http));
+
+    return server;
+}
+
+void interaction_server_free(interaction_server_t* server) {
+    if (!server) {
+        return;
+    }
+
+    http_server_free(server->http);
+    EVP_PKEY_free(server->public_key);
+    nv_free(server);
+}
+
+uint16_t interaction_server_get_port(const interaction_server_t* server) {
+    return http_server_get_port(server->http);
+}
+
+bool interaction_server_poll(interaction_server_t* server) {
+    return http_server_poll(server->http, 0);
+}
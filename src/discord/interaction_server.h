@@ -0,0 +1,36 @@
+#ifndef _INTERACTION_SERVER_H
+#define _INTERACTION_SERVER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* receives interactions as outgoing webhooks instead of over the gateway. set the interactions
+ * endpoint url in the developer portal to wherever this is reachable. every request is checked
+ * against the application's ed25519 public key, pings are answered directly, and everything else
+ * goes to the same on_interaction callback as gateway interactions.
+ *
+ * the handler's initial response is written back as the http response body the moment the handler
+ * sends it, rather than as its own REST request. a handler that returns without responding gets a
+ * deferral in its place. nothing
+ * here keeps state between requests, so any number of instances can share one endpoint behind a
+ * load balancer.
+ *
+ * requests are handled on whichever thread polls the server, which for the bot is the main loop */
+
+typedef struct interaction_server interaction_server_t;
+
+/* from bot.h */
+typedef struct bot bot_t;
+
+/* public_key is hex, as the developer portal shows it */
+interaction_server_t* interaction_server_create(bot_t* bot, const char* address, uint16_t port,
+                                                const char* public_key);
+
+void interaction_server_free(interaction_server_t* server);
+
+uint16_t interaction_server_get_port(const interaction_server_t* server);
+
+/* handles whatever requests are ready without waiting */
+bool interaction_server_poll(interaction_server_t* server);
+
+#endif
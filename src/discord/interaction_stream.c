@@ -0,0 +1,462 @@
+/* https://redis.io/docs/latest/develop/data-types/streams/ */
+
+#include "interaction_stream.h"
+
+#include "dispatch.h"
+
+#include "types/interaction.h"
+#include "types/snowflake.h"
+
+#include "../core/clock.h"
+#include "../core/database.h"
+#include "../core/metrics.h"
+#include "../core/shm_ring.h"
+
+#include <log.h>
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hiredis/hiredis.h>
+
+#include <nyoravim/mem.h>
+#include <nyoravim/util.h>
+
+#define DEFAULT_ADDRESS "127.0.0.1"
+#define DEFAULT_PORT 6379
+
+/* entries per XREADGROUP or XAUTOCLAIM */
+#define BATCH_SIZE 16
+
+/* the one field of every entry */
+#define PAYLOAD_FIELD "d"
+
+/* the start of the pending entries list */
+#define CLAIM_START "0-0"
+
+typedef struct interaction_stream {
+    bot_t* bot;
+    uint32_t role;
+
+    /* exactly one of these */
+    redisContext* db;
+    shm_ring_t* ring;
+
+    /* popped ring messages; workers only */
+    char* buffer;
+
+    char* key;
+    char* group;
+    char* consumer;
+
+    uint32_t claim_idle_ms;
+    uint64_t next_claim_ns;
+
+    /* XAUTOCLAIM resumes where the last call stopped */
+    char claim_cursor[64];
+} interaction_stream_t;
+
+static struct metric_family entries = METRIC_COUNTER_FAMILY(
+    "tasks_stream_entries_total", "interaction stream entries by result");
+
+static void count_entry(const char* result) {
+    char labels[32];
+    snprintf(labels, sizeof(labels), "result=\"%s\"", result);
+
+    metric_inc(metric_get(&entries, labels));
+}
+
+static bool create_group(interaction_stream_t* stream) {
+    /* new groups start at the end; whatever was pushed before any worker existed is stale */
+    redisReply* reply =
+        db_command(stream->db, "XGROUP CREATE %s %s $ MKSTREAM", stream->key, stream->group);
+
+    if (!reply) {
+        log_error("failed to create stream consumer group: %s", stream->db->errstr);
+        return false;
+    }
+
+    bool success = reply->type == REDIS_REPLY_STATUS ||
+                   (reply->type == REDIS_REPLY_ERROR && strncmp(reply->str, "BUSYGROUP", 9) == 0);
+
+    if (!success) {
+        log_error("failed to create stream consumer group: %s", reply->str);
+    }
+
+    freeReplyObject(reply);
+    return success;
+}
+
+static char* get_default_consumer() {
+    char host[256];
+    if (gethostname(host, sizeof(host)) != 0) {
+        strcpy(host, "worker");
+    }
+
+    host[sizeof(host) - 1] = '\0';
+
+    char consumer[300];
+    snprintf(consumer, sizeof(consumer), "%s-%d", host, (int)getpid());
+
+    return nv_strdup(consumer);
+}
+
+static interaction_stream_t* create_ring_stream(bot_t* bot,
+                                                const struct interaction_stream_spec* spec) {
+    const char* name = spec->key ? spec->key : DEFAULT_STREAM_SHM_NAME;
+
+    shm_ring_t* ring = spec->role == INTERACTION_STREAM_PRODUCER
+                           ? shm_ring_create(name, STREAM_RING_CAPACITY, STREAM_RING_SLOT_SIZE)
+                           : shm_ring_open(name);
+
+    if (!ring) {
+        return NULL;
+    }
+
+    interaction_stream_t* stream = nv_alloc(sizeof(interaction_stream_t));
+    assert(stream);
+    memset(stream, 0, sizeof(interaction_stream_t));
+
+    stream->bot = bot;
+    stream->role = spec->role;
+    stream->ring = ring;
+    stream->key = nv_strdup(name);
+
+    if (stream->role == INTERACTION_STREAM_WORKER) {
+        /* plus a terminator for the tokener's sake */
+        stream->buffer = nv_alloc(shm_ring_get_max_size(ring) + 1);
+        assert(stream->buffer);
+
+        log_info("consuming interactions from shared memory %s", name);
+    } else {
+        log_info("producing interactions to shared memory %s", name);
+    }
+
+    return stream;
+}
+
+interaction_stream_t* interaction_stream_create(bot_t* bot,
+                                                const struct interaction_stream_spec* spec) {
+    if (spec->transport == INTERACTION_STREAM_SHARED_MEMORY) {
+        return create_ring_stream(bot, spec);
+    }
+
+    const char* address = spec->address ? spec->address : DEFAULT_ADDRESS;
+    uint16_t port = spec->port > 0 ? spec->port : DEFAULT_PORT;
+
+    redisContext* db = redisConnect(address, port);
+    if (!db || db->err != 0) {
+        log_error("failed to connect to redis for the interaction stream: %s",
+                  db ? db->errstr : "out of memory");
+
+        redisFree(db);
+        return NULL;
+    }
+
+    interaction_stream_t* stream = nv_alloc(sizeof(interaction_stream_t));
+    assert(stream);
+    memset(stream, 0, sizeof(interaction_stream_t));
+
+    stream->bot = bot;
+    stream->db = db;
+    stream->role = spec->role;
+
+    stream->key = nv_strdup(spec->key ? spec->key : DEFAULT_STREAM_KEY);
+    stream->group = nv_strdup(spec->group ? spec->group : DEFAULT_STREAM_GROUP);
+    stream->consumer = spec->consumer ? nv_strdup(spec->consumer) : get_default_consumer();
+
+    stream->claim_idle_ms =
+        spec->claim_idle_ms > 0 ? spec->claim_idle_ms : DEFAULT_STREAM_CLAIM_IDLE_MS;
+
+    stream->next_claim_ns = 0;
+    strcpy(stream->claim_cursor, CLAIM_START);
+
+    if (stream->role == INTERACTION_STREAM_WORKER) {
+        if (!create_group(stream)) {
+            interaction_stream_free(stream);
+            return NULL;
+        }
+
+        log_info("consuming interactions from stream %s as %s in group %s", stream->key,
+                 stream->consumer, stream->group);
+    } else {
+        log_info("producing interactions to stream %s", stream->key);
+    }
+
+    return stream;
+}
+
+void interaction_stream_free(interaction_stream_t* stream) {
+    if (!stream) {
+        return;
+    }
+
+    if (stream->db) {
+        redisFree(stream->db);
+    }
+
+    shm_ring_close(stream->ring);
+    nv_free(stream->buffer);
+
+    nv_free(stream->key);
+    nv_free(stream->group);
+    nv_free(stream->consumer);
+    nv_free(stream);
+}
+
+uint32_t interaction_stream_get_role(const interaction_stream_t* stream) { return stream->role; }
+
+bool interaction_stream_push(interaction_stream_t* stream, const json_object* data) {
+    assert(stream->role == INTERACTION_STREAM_PRODUCER);
+
+    size_t size;
+    const char* payload =
+        json_object_to_json_string_length((json_object*)data, JSON_C_TO_STRING_PLAIN, &size);
+
+    if (stream->ring) {
+        bool pushed = shm_ring_push(stream->ring, payload, size);
+        count_entry(pushed ? "pushed" : "failed");
+
+        if (!pushed) {
+            log_error("failed to push %zu byte interaction; ring full or entry too large", size);
+        }
+
+        return pushed;
+    }
+
+    redisReply* reply =
+        db_command(stream->db, "XADD %s MAXLEN ~ %d * " PAYLOAD_FIELD " %b", stream->key,
+                   DEFAULT_STREAM_MAX_LENGTH, payload, size);
+
+    bool success = reply && reply->type == REDIS_REPLY_STRING;
+    if (success) {
+        count_entry("pushed");
+    } else {
+        log_error("failed to push interaction to stream: %s",
+                  reply ? reply->str : stream->db->errstr);
+
+        count_entry("failed");
+    }
+
+    freeReplyObject(reply);
+    return success;
+}
+
+static void acknowledge(interaction_stream_t* stream, const char* id) {
+    redisReply* reply = db_command(stream->db, "XACK %s %s %s", stream->key, stream->group, id);
+    if (!reply || reply->type != REDIS_REPLY_INTEGER) {
+        log_error("failed to acknowledge stream entry %s", id);
+    }
+
+    freeReplyObject(reply);
+}
+
+static json_object* parse_payload(const char* payload, size_t size) {
+    json_tokener* tokener = json_tokener_new();
+    assert(tokener);
+
+    json_object* data = json_tokener_parse_ex(tokener, payload, (int)size);
+    json_tokener_free(tokener);
+
+    return data;
+}
+
+/* NULL if the entry is malformed */
+static json_object* parse_entry(const redisReply* fields) {
+    if (!fields || fields->type != REDIS_REPLY_ARRAY) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i + 1 < fields->elements; i += 2) {
+        const redisReply* name = fields->element[i];
+        const redisReply* value = fields->element[i + 1];
+
+        if (name->type != REDIS_REPLY_STRING || strcmp(name->str, PAYLOAD_FIELD) != 0 ||
+            value->type != REDIS_REPLY_STRING) {
+            continue;
+        }
+
+        return parse_payload(value->str, value->len);
+    }
+
+    return NULL;
+}
+
+/* past the response window, discord has already told the user the interaction failed, and a
+ * handler could only edit or follow up on a response that was never made */
+static bool is_expired(const json_object* data) {
+    uint64_t id;
+    if (!snowflake_parse(&id, json_object_object_get(data, "id"))) {
+        return false;
+    }
+
+    return time_unix_ms() >= snowflake_get_time_ms(id) + INTERACTION_RESPONSE_WINDOW_MS;
+}
+
+/* id is only for the log; data may be NULL if the entry was malformed */
+static void handle_payload(interaction_stream_t* stream, const char* id, const json_object* data,
+                           bool reclaimed) {
+    if (!data) {
+        log_error("stream entry %s has no interaction; dropping", id);
+        count_entry("invalid");
+    } else if (is_expired(data)) {
+        log_warn("stream entry %s is past its response window; dropping", id);
+        count_entry("expired");
+    } else {
+        if (reclaimed) {
+            log_warn("handling stream entry %s abandoned by another worker", id);
+        }
+
+        dispatch_interaction(stream->bot, data, NULL);
+        count_entry(reclaimed ? "reclaimed" : "handled");
+    }
+}
+
+/* entry is [id, [field, value, ...]]; it is acknowledged whether or not it could be handled */
+static void handle_entry(interaction_stream_t* stream, const redisReply* entry, bool reclaimed) {
+    if (entry->type != REDIS_REPLY_ARRAY || entry->elements < 2 ||
+        entry->element[0]->type != REDIS_REPLY_STRING) {
+        /* deleted while pending; nothing to acknowledge by */
+        return;
+    }
+
+    const char* id = entry->element[0]->str;
+    json_object* data = parse_entry(entry->element[1]);
+
+    handle_payload(stream, id, data, reclaimed);
+
+    json_object_put(data);
+    acknowledge(stream, id);
+}
+
+static void handle_entries(interaction_stream_t* stream, const redisReply* list, bool reclaimed) {
+    if (!list || list->type != REDIS_REPLY_ARRAY) {
+        return;
+    }
+
+    for (size_t i = 0; i < list->elements; i++) {
+        handle_entry(stream, list->element[i], reclaimed);
+    }
+}
+
+/* reply is [[key, [entry, ...]]], or nil on timeout */
+static bool read_new(interaction_stream_t* stream, uint32_t timeout_ms) {
+    redisReply* reply = db_command(
+        stream->db, "XREADGROUP GROUP %s %s COUNT %d BLOCK %u STREAMS %s >", stream->group,
+        stream->consumer, BATCH_SIZE, timeout_ms > 0 ? timeout_ms : 1, stream->key);
+
+    if (!reply) {
+        log_error("failed to read interaction stream: %s", stream->db->errstr);
+        return false;
+    }
+
+    if (reply->type == REDIS_REPLY_ERROR) {
+        /* NOGROUP after the stream was deleted; recreate and carry on */
+        log_error("failed to read interaction stream: %s", reply->str);
+
+        freeReplyObject(reply);
+        return create_group(stream);
+    }
+
+    if (reply->type == REDIS_REPLY_ARRAY) {
+        for (size_t i = 0; i < reply->elements; i++) {
+            const redisReply* key = reply->element[i];
+            if (key->type == REDIS_REPLY_ARRAY && key->elements >= 2) {
+                handle_entries(stream, key->element[1], false);
+            }
+        }
+    }
+
+    freeReplyObject(reply);
+    return true;
+}
+
+/* reply is [next cursor, [entry, ...], deleted ids] */
+static bool claim_abandoned(interaction_stream_t* stream) {
+    redisReply* reply = db_command(stream->db, "XAUTOCLAIM %s %s %s %u %s COUNT %d", stream->key,
+                                   stream->group, stream->consumer, stream->claim_idle_ms,
+                                   stream->claim_cursor, BATCH_SIZE);
+
+    if (!reply) {
+        log_error("failed to claim abandoned stream entries: %s", stream->db->errstr);
+        return false;
+    }
+
+    if (reply->type == REDIS_REPLY_ARRAY && reply->elements >= 2 &&
+        reply->element[0]->type == REDIS_REPLY_STRING) {
+        snprintf(stream->claim_cursor, sizeof(stream->claim_cursor), "%s", reply->element[0]->str);
+        handle_entries(stream, reply->element[1], true);
+    } else {
+        log_error("unexpected XAUTOCLAIM reply; is redis older than 6.2?");
+        strcpy(stream->claim_cursor, CLAIM_START);
+    }
+
+    freeReplyObject(reply);
+    return true;
+}
+
+/* the producer restarted and made a new ring. the old one is drained by now, since this is only
+ * checked once a pop times out. until the new one is up, keep waiting on the old */
+static void reopen_ring(interaction_stream_t* stream) {
+    shm_ring_t* ring = shm_ring_open(stream->key);
+    if (!ring) {
+        return;
+    }
+
+    shm_ring_close(stream->ring);
+    stream->ring = ring;
+
+    nv_free(stream->buffer);
+    stream->buffer = nv_alloc(shm_ring_get_max_size(ring) + 1);
+    assert(stream->buffer);
+
+    log_info("reattached to shared memory %s", stream->key);
+}
+
+/* one message per poll keeps the rest of the bot's loop turning */
+static void pop_ring(interaction_stream_t* stream, uint32_t timeout_ms) {
+    size_t size;
+    if (!shm_ring_pop(stream->ring, stream->buffer, &size, (int32_t)timeout_ms)) {
+        if (!shm_ring_is_current(stream->ring)) {
+            reopen_ring(stream);
+        }
+
+        return;
+    }
+
+    stream->buffer[size] = '\0';
+
+    json_object* data = parse_payload(stream->buffer, size);
+    handle_payload(stream, "from shared memory", data, false);
+
+    json_object_put(data);
+}
+
+bool interaction_stream_poll(interaction_stream_t* stream, uint32_t timeout_ms) {
+    assert(stream->role == INTERACTION_STREAM_WORKER);
+
+    if (stream->ring) {
+        pop_ring(stream, timeout_ms);
+        return true;
+    }
+
+    if (!read_new(stream, timeout_ms)) {
+        return false;
+    }
+
+    /* a full pass over the pending list every half idle period; a cursor of 0-0 means the last
+     * call reached the end of it */
+    uint64_t now = time_now_ns();
+    if (now < stream->next_claim_ns && strcmp(stream->claim_cursor, CLAIM_START) == 0) {
+        return true;
+    }
+
+    if (strcmp(stream->claim_cursor, CLAIM_START) == 0) {
+        stream->next_claim_ns = now + (uint64_t)stream->claim_idle_ms * 1000000 / 2;
+    }
+
+    return claim_abandoned(stream);
+}
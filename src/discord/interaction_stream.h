@@ -0,0 +1,97 @@
+#ifndef _INTERACTION_STREAM_H
+#define _INTERACTION_STREAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <json.h>
+
+/* splits receiving interactions from handling them, across processes, with a redis stream or a
+ * shared memory ring. a producer holds the gateway connection and appends every INTERACTION_CREATE
+ * payload to the stream instead of handling it. workers have no gateway connection; they read the
+ * stream as one consumer group, so each entry goes to one worker, hand entries to on_interaction
+ * as if they had come off the gateway, and acknowledge them once the handler returns. adding
+ * workers adds handler capacity without adding gateway connections.
+ *
+ * discord expects the initial response within INTERACTION_RESPONSE_WINDOW_MS of the interaction's
+ * creation, so an entry read after that, whether the workers fell behind or it was reclaimed, is
+ * acknowledged and dropped unhandled.
+ *
+ * over redis, an entry a worker read but never acknowledged, because it crashed or was killed, is
+ * claimed by another worker once it has been idle for claim_idle_ms. this should be longer than
+ * the slowest handler, or a live worker's entry gets handled twice. with the default, a reclaimed
+ * entry is always past its window, so claiming only clears it from the group's pending list; an
+ * interaction whose worker dies is lost, as over shared memory.
+ *
+ * the shared memory ring (see core/shm_ring.h) skips the redis round trips for workers on the
+ * producer's host. it keeps nothing once popped, so an interaction whose worker dies is lost, and
+ * the producer must be started before its workers. a restarted producer makes a new ring, which
+ * idle workers attach to on their own */
+
+typedef struct interaction_stream interaction_stream_t;
+
+/* from bot.h */
+typedef struct bot bot_t;
+
+enum {
+    INTERACTION_STREAM_PRODUCER,
+    INTERACTION_STREAM_WORKER,
+};
+
+enum {
+    INTERACTION_STREAM_REDIS,
+    INTERACTION_STREAM_SHARED_MEMORY,
+};
+
+#define DEFAULT_STREAM_KEY "tasks:interactions"
+#define DEFAULT_STREAM_SHM_NAME "/tasks-interactions"
+#define DEFAULT_STREAM_GROUP "tasks:workers"
+
+/* the stream is trimmed to roughly this many entries, handled or not */
+#define DEFAULT_STREAM_MAX_LENGTH 100000
+
+/* well past the response window; see above */
+#define DEFAULT_STREAM_CLAIM_IDLE_MS 30000
+
+/* shared memory only; interactions without resolved data are a few kilobytes */
+#define STREAM_RING_CAPACITY 1024
+#define STREAM_RING_SLOT_SIZE (16 * 1024)
+
+struct interaction_stream_spec {
+    uint32_t role;
+    uint32_t transport;
+
+    /* redis only; NULL and 0 for 127.0.0.1:6379 */
+    const char* address;
+    uint16_t port;
+
+    /* the stream's key, or the segment's name for shared memory. NULL for the defaults above */
+    const char* key;
+
+    /* redis only from here. NULL for the default above */
+    const char* group;
+
+    /* workers only, and unique among them. NULL for the hostname and pid */
+    const char* consumer;
+
+    /* workers only. 0 for DEFAULT_STREAM_CLAIM_IDLE_MS */
+    uint32_t claim_idle_ms;
+};
+
+/* opens its own redis connection, and workers create the consumer group if it does not exist. for
+ * shared memory, the producer creates the ring and workers attach to it */
+interaction_stream_t* interaction_stream_create(bot_t* bot,
+                                                const struct interaction_stream_spec* spec);
+
+void interaction_stream_free(interaction_stream_t* stream);
+
+uint32_t interaction_stream_get_role(const interaction_stream_t* stream);
+
+/* producers only. false if redis did not take it or the ring is full */
+bool interaction_stream_push(interaction_stream_t* stream, const json_object* data);
+
+/* workers only. waits at most timeout_ms for new entries and handles them, then reclaims entries
+ * abandoned by other workers every so often. false once the redis connection is unusable */
+bool interaction_stream_poll(interaction_stream_t* stream, uint32_t timeout_ms);
+
+#endif
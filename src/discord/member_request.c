@@ -0,0 +1,273 @@
+#include "member_request.h"
+#include "gateway.h"
+
+#include "types/member.h"
+#include "types/snowflake.h"
+
+#include "../core/clock.h"
+#include "../core/metrics.h"
+
+#include <log.h>
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/random.h>
+
+#include <nyoravim/mem.h>
+
+/* discord allows 32 characters */
+#define NONCE_SIZE 33
+
+struct member_request {
+    struct member_request* next;
+
+    char nonce[NONCE_SIZE];
+    uint64_t guild_id;
+
+    struct member_request_callbacks callbacks;
+
+    uint64_t members;
+
+    /* the timeout starts once the command has left the gateway's queue, which can take a while
+     * under its rate limit. until then, flushed_at is the gateway's taken count after queueing */
+    bool sent;
+    uint64_t flushed_at;
+    uint64_t deadline_ns;
+};
+
+typedef struct member_requests {
+    gateway_t* gw;
+
+    /* few are in flight at once */
+    struct member_request* pending;
+    size_t num_pending;
+
+    /* nonces are the prefix and a counter, so that chunks for a previous process's requests on a
+     * resumed session are not mistaken for ours */
+    uint64_t nonce_prefix;
+    uint32_t next_nonce;
+} member_requests_t;
+
+static struct metric_family members_received = METRIC_COUNTER_FAMILY(
+    "tasks_member_request_members_total", "members received in response to member requests");
+
+static struct metric_family requests_finished = METRIC_COUNTER_FAMILY(
+    "tasks_member_requests_total", "member requests finished by result");
+
+member_requests_t* member_requests_create(gateway_t* gw) {
+    member_requests_t* requests = nv_alloc(sizeof(member_requests_t));
+    assert(requests);
+    memset(requests, 0, sizeof(member_requests_t));
+
+    requests->gw = gw;
+
+    if (getrandom(&requests->nonce_prefix, sizeof(uint64_t), 0) != sizeof(uint64_t)) {
+        requests->nonce_prefix = ((uint64_t)rand() << 32) | (uint64_t)rand();
+    }
+
+    return requests;
+}
+
+static void finish_request(member_requests_t* requests, struct member_request* request,
+                           const char* result) {
+    struct member_request** link = &requests->pending;
+    while (*link != request) {
+        link = &(*link)->next;
+    }
+
+    *link = request->next;
+    requests->num_pending--;
+
+    char labels[32];
+    snprintf(labels, sizeof(labels), "result=\"%s\"", result);
+    metric_inc(metric_get(&requests_finished, labels));
+
+    bool complete = strcmp(result, "complete") == 0;
+    log_debug("member request %s for guild %" PRIu64 " finished (%s) with %" PRIu64 " members",
+              request->nonce, request->guild_id, result, request->members);
+
+    if (request->callbacks.on_complete) {
+        request->callbacks.on_complete(request->callbacks.user, request->guild_id, complete);
+    }
+
+    nv_free(request);
+}
+
+void member_requests_free(member_requests_t* requests) {
+    if (!requests) {
+        return;
+    }
+
+    while (requests->pending) {
+        finish_request(requests, requests->pending, "cancelled");
+    }
+
+    nv_free(requests);
+}
+
+static json_object* create_request_data(const struct member_request_spec* spec,
+                                        const char* nonce) {
+    json_object* data = json_object_new_object();
+    assert(data);
+
+    json_object_object_add(data, "guild_id", snowflake_serialize(spec->guild_id));
+
+    if (spec->num_user_ids > 0) {
+        json_object* user_ids = json_object_new_array();
+        assert(user_ids);
+
+        for (size_t i = 0; i < spec->num_user_ids; i++) {
+            json_object_array_add(user_ids, snowflake_serialize(spec->user_ids[i]));
+        }
+
+        json_object_object_add(data, "user_ids", user_ids);
+    } else {
+        const char* query = spec->query ? spec->query : "";
+
+        json_object_object_add(data, "query", json_object_new_string(query));
+        json_object_object_add(data, "limit", json_object_new_uint64(spec->limit));
+    }
+
+    json_object_object_add(data, "nonce", json_object_new_string(nonce));
+    return data;
+}
+
+bool member_requests_send(member_requests_t* requests, const struct member_request_spec* spec) {
+    if (spec->guild_id == 0) {
+        log_error("member request needs a guild");
+        return false;
+    }
+
+    if (spec->num_user_ids > MEMBER_REQUEST_MAX_USER_IDS) {
+        log_error("member request for %zu users; at most %d at once", spec->num_user_ids,
+                  MEMBER_REQUEST_MAX_USER_IDS);
+
+        return false;
+    }
+
+    struct member_request* request = nv_alloc(sizeof(struct member_request));
+    assert(request);
+    memset(request, 0, sizeof(struct member_request));
+
+    snprintf(request->nonce, sizeof(request->nonce), "%016" PRIx64 "%08" PRIx32,
+             requests->nonce_prefix, requests->next_nonce++);
+
+    request->guild_id = spec->guild_id;
+
+    if (spec->callbacks) {
+        memcpy(&request->callbacks, spec->callbacks, sizeof(struct member_request_callbacks));
+    }
+
+    json_object* data = create_request_data(spec, request->nonce);
+    if (!gateway_send_command(requests->gw, GATEWAY_OPCODE_REQUEST_GUILD_MEMBERS, data)) {
+        nv_free(request);
+        return false;
+    }
+
+    request->flushed_at = gateway_get_commands_taken(requests->gw);
+    request->next = requests->pending;
+    requests->pending = request;
+    requests->num_pending++;
+
+    log_debug("requested members of guild %" PRIu64 " with nonce %s", spec->guild_id,
+              request->nonce);
+
+    return true;
+}
+
+static struct member_request* find_request(member_requests_t* requests, const char* nonce) {
+    for (struct member_request* request = requests->pending; request; request = request->next) {
+        if (strcmp(request->nonce, nonce) == 0) {
+            return request;
+        }
+    }
+
+    return NULL;
+}
+
+static uint32_t get_uint32_field(const json_object* data, const char* name) {
+    json_object* field = json_object_object_get(data, name);
+    return field ? (uint32_t)json_object_get_uint64(field) : 0;
+}
+
+void member_requests_handle_chunk(member_requests_t* requests, const json_object* data) {
+    json_object* nonce = json_object_object_get(data, "nonce");
+    if (!nonce || json_object_get_type(nonce) != json_type_string) {
+        return;
+    }
+
+    struct member_request* request = find_request(requests, json_object_get_string(nonce));
+    if (!request) {
+        log_debug("members chunk for unknown nonce %s", json_object_get_string(nonce));
+        return;
+    }
+
+    json_object* members = json_object_object_get(data, "members");
+    size_t count = members && json_object_get_type(members) == json_type_array
+                       ? json_object_array_length(members)
+                       : 0;
+
+    /* one member parsed at a time; the chunk itself goes when the event has been dispatched */
+    if (request->callbacks.on_member) {
+        for (size_t i = 0; i < count; i++) {
+            struct member member;
+            if (!member_parse(&member, json_object_array_get_idx(members, i))) {
+                continue;
+            }
+
+            request->callbacks.on_member(request->callbacks.user, request->guild_id, &member);
+            member_cleanup(&member);
+        }
+    }
+
+    request->members += count;
+    request->sent = true;
+    request->deadline_ns = time_now_ns() + MEMBER_REQUEST_TIMEOUT_MS * 1000000ull;
+    metric_add(metric_get(&members_received, NULL), count);
+
+    uint32_t index = get_uint32_field(data, "chunk_index");
+    uint32_t total = get_uint32_field(data, "chunk_count");
+
+    log_trace("members chunk %" PRIu32 "/%" PRIu32 " for %s: %zu members", index + 1, total,
+              request->nonce, count);
+
+    if (total == 0 || index + 1 >= total) {
+        finish_request(requests, request, "complete");
+    }
+}
+
+void member_requests_poll(member_requests_t* requests) {
+    if (!requests->pending) {
+        return;
+    }
+
+    uint64_t now = time_now_ns();
+    uint64_t flushed = gateway_get_commands_flushed(requests->gw);
+
+    struct member_request* request = requests->pending;
+    while (request) {
+        struct member_request* next = request->next;
+
+        if (!request->sent) {
+            if (flushed >= request->flushed_at) {
+                request->sent = true;
+                request->deadline_ns = now + MEMBER_REQUEST_TIMEOUT_MS * 1000000ull;
+            }
+        } else if (now >= request->deadline_ns) {
+            log_warn("member request %s for guild %" PRIu64 " timed out", request->nonce,
+                     request->guild_id);
+
+            finish_request(requests, request, "timeout");
+        }
+
+        request = next;
+    }
+}
+
+size_t member_requests_pending(const member_requests_t* requests) {
+    return requests->num_pending;
+}
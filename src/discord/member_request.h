@@ -0,0 +1,79 @@
+#ifndef _MEMBER_REQUEST_H
+#define _MEMBER_REQUEST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <json.h>
+
+/* requests guild members over the gateway (opcode 8). discord answers with GUILD_MEMBERS_CHUNK
+ * events of up to 1000 members each, tagged with the request's nonce. each chunk fills the entity
+ * cache as it is dispatched and is handed to the request's callback one member at a time, then
+ * dropped, so a large guild never has more than one chunk in memory.
+ *
+ * requests go through the gateway's command queue and its rate limit. asking for every member of
+ * a guild (no query, no user ids) needs the privileged server members intent; see
+ * bot_spec.cache_members */
+
+typedef struct member_requests member_requests_t;
+
+/* from gateway.h */
+typedef struct gateway gateway_t;
+
+/* from types/member.h */
+struct member;
+
+/* a request that has not finished this long after it was sent, or after its last chunk, is given
+ * up on. time spent in the gateway's command queue does not count */
+#define MEMBER_REQUEST_TIMEOUT_MS 60000
+
+/* https://discord.com/developers/docs/events/gateway-events#request-guild-members */
+#define MEMBER_REQUEST_MAX_USER_IDS 100
+
+struct member_request_callbacks {
+    void* user;
+
+    /* each member as its chunk arrives. the member only lives for the call. NULL to only fill the
+     * cache */
+    void (*on_member)(void* user, uint64_t guild_id, const struct member* member);
+
+    /* exactly once: after the last chunk with complete true, or with complete false if the
+     * request timed out or the bot shut down first */
+    void (*on_complete)(void* user, uint64_t guild_id, bool complete);
+};
+
+struct member_request_spec {
+    uint64_t guild_id;
+
+    /* members whose username starts with query, at most limit of them. NULL and 0 for everyone */
+    const char* query;
+    uint32_t limit;
+
+    /* or these members instead of a query */
+    size_t num_user_ids;
+    const uint64_t* user_ids;
+
+    /* copied; may be NULL */
+    const struct member_request_callbacks* callbacks;
+};
+
+/* gw is borrowed */
+member_requests_t* member_requests_create(gateway_t* gw);
+
+/* completes what is still pending with complete false */
+void member_requests_free(member_requests_t* requests);
+
+/* false if the spec is invalid or the gateway would not queue it; callbacks are not called then */
+bool member_requests_send(member_requests_t* requests, const struct member_request_spec* spec);
+
+/* from GUILD_MEMBERS_CHUNK. chunks without a nonce of ours are ignored */
+void member_requests_handle_chunk(member_requests_t* requests, const json_object* data);
+
+/* times out stalled requests */
+void member_requests_poll(member_requests_t* requests);
+
+/* requests sent and not yet complete */
+size_t member_requests_pending(const member_requests_t* requests);
+
+#endif
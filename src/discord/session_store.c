@@ -0,0 +1,254 @@
+#include "session_store.h"
+
+#include "../core/database.h"
+
+#include <log.h>
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <hiredis/hiredis.h>
+
+#include <nyoravim/mem.h>
+#include <nyoravim/util.h>
+
+#define SESSION_KEY_PREFIX "tasks:gateway:session:"
+#define GATEWAY_INFO_KEY_PREFIX "tasks:gateway:bot:"
+#define INTERACTION_KEY_PREFIX "tasks:interaction:"
+
+typedef struct session_store {
+    redisContext* db;
+
+    char key[64];
+    char info_key[64];
+} session_store_t;
+
+session_store_t* session_store_create(redisContext* db, uint64_t app_id) {
+    session_store_t* store = nv_alloc(sizeof(session_store_t));
+    assert(store);
+
+    store->db = db;
+    snprintf(store->key, sizeof(store->key), SESSION_KEY_PREFIX "%" PRIu64, app_id);
+    snprintf(store->info_key, sizeof(store->info_key), GATEWAY_INFO_KEY_PREFIX "%" PRIu64, app_id);
+
+    return store;
+}
+
+void session_store_free(session_store_t* store) {
+    if (!store) {
+        return;
+    }
+
+    nv_free(store);
+}
+
+static char* dup_reply_string(const redisReply* reply) {
+    if (reply->type != REDIS_REPLY_STRING || reply->len == 0) {
+        return NULL;
+    }
+
+    return nv_strdup(reply->str);
+}
+
+bool session_store_load(session_store_t* store, struct saved_session* session) {
+    memset(session, 0, sizeof(struct saved_session));
+
+    redisReply* reply = db_command(store->db, "HMGET %s url id resume_url seq", store->key);
+    if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != 4) {
+        log_error("failed to load saved gateway session");
+
+        freeReplyObject(reply);
+        return false;
+    }
+
+    session->url = dup_reply_string(reply->element[0]);
+    session->id = dup_reply_string(reply->element[1]);
+    session->resume_url = dup_reply_string(reply->element[2]);
+
+    const redisReply* sequence = reply->element[3];
+    if (sequence->type == REDIS_REPLY_STRING && sequence->len > 0) {
+        session->has_sequence = true;
+        session->sequence = strtoull(sequence->str, NULL, 10);
+    }
+
+    freeReplyObject(reply);
+
+    if (!session->url || !session->id || !session->resume_url) {
+        saved_session_cleanup(session);
+        return false;
+    }
+
+    return true;
+}
+
+bool session_store_save(session_store_t* store, const struct saved_session* session) {
+    /* an empty sequence is how "none yet" is stored */
+    char sequence[32] = "";
+    if (session->has_sequence) {
+        snprintf(sequence, sizeof(sequence), "%" PRIu64, session->sequence);
+    }
+
+    redisReply* reply = db_command(store->db, "HSET %s url %s id %s resume_url %s seq %s",
+                                   store->key, session->url, session->id, session->resume_url,
+                                   sequence);
+
+    bool success = reply && reply->type == REDIS_REPLY_INTEGER;
+    freeReplyObject(reply);
+
+    if (success) {
+        reply = db_command(store->db, "EXPIRE %s %d", store->key, SAVED_SESSION_TTL_S);
+        success = reply && reply->type == REDIS_REPLY_INTEGER;
+
+        freeReplyObject(reply);
+    }
+
+    if (!success) {
+        log_warn("failed to checkpoint gateway session");
+    }
+
+    return success;
+}
+
+void session_store_clear(session_store_t* store) {
+    redisReply* reply = db_command(store->db, "DEL %s", store->key);
+    if (!reply || reply->type != REDIS_REPLY_INTEGER) {
+        log_warn("failed to clear saved gateway session");
+    }
+
+    freeReplyObject(reply);
+}
+
+void saved_session_cleanup(struct saved_session* session) {
+    nv_free(session->url);
+    nv_free(session->id);
+    nv_free(session->resume_url);
+
+    memset(session, 0, sizeof(struct saved_session));
+}
+
+bool session_store_claim_interaction(session_store_t* store, uint64_t id) {
+    redisReply* reply =
+        db_command(store->db, "SET " INTERACTION_KEY_PREFIX "%" PRIu64 " 1 NX EX %d", id,
+                   CLAIMED_INTERACTION_TTL_S);
+
+    if (!reply || reply->type == REDIS_REPLY_ERROR) {
+        log_warn("failed to claim interaction %" PRIu64, id);
+
+        freeReplyObject(reply);
+        return true;
+    }
+
+    /* NX answers nil when the key already exists */
+    bool claimed = reply->type != REDIS_REPLY_NIL;
+    freeReplyObject(reply);
+
+    return claimed;
+}
+
+static bool read_reply_integer(const redisReply* reply, int64_t* value) {
+    if (reply->type != REDIS_REPLY_STRING || reply->len == 0) {
+        return false;
+    }
+
+    *value = strtoll(reply->str, NULL, 10);
+    return true;
+}
+
+bool session_store_load_gateway_info(session_store_t* store, struct gateway_info* info) {
+    memset(info, 0, sizeof(struct gateway_info));
+
+    redisReply* reply = db_command(store->db, "HMGET %s url shards total remaining concurrency",
+                                   store->info_key);
+
+    if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != 5) {
+        log_error("failed to load cached gateway info");
+
+        freeReplyObject(reply);
+        return false;
+    }
+
+    int64_t shards, total, concurrency;
+    info->url = dup_reply_string(reply->element[0]);
+
+    bool complete = info->url && read_reply_integer(reply->element[1], &shards) &&
+                    read_reply_integer(reply->element[2], &total) &&
+                    read_reply_integer(reply->element[3], &info->remaining_starts) &&
+                    read_reply_integer(reply->element[4], &concurrency);
+
+    freeReplyObject(reply);
+
+    if (!complete) {
+        gateway_info_cleanup(info);
+        return false;
+    }
+
+    info->shards = (uint32_t)shards;
+    info->total_starts = (uint32_t)total;
+    info->max_concurrency = (uint32_t)concurrency;
+
+    /* the key expires when the limit resets */
+    reply = db_command(store->db, "PTTL %s", store->info_key);
+    if (reply && reply->type == REDIS_REPLY_INTEGER && reply->integer > 0) {
+        info->reset_after_ms = (uint64_t)reply->integer;
+    }
+
+    freeReplyObject(reply);
+    return true;
+}
+
+bool session_store_save_gateway_info(session_store_t* store, const struct gateway_info* info) {
+    uint64_t ttl_ms = info->reset_after_ms;
+    if (ttl_ms == 0 || ttl_ms > GATEWAY_INFO_MAX_AGE_MS) {
+        ttl_ms = GATEWAY_INFO_MAX_AGE_MS;
+    }
+
+    redisReply* reply = db_command(
+        store->db, "HSET %s url %s shards %" PRIu32 " total %" PRIu32 " remaining %" PRIi64
+                   " concurrency %" PRIu32,
+        store->info_key, info->url, info->shards, info->total_starts, info->remaining_starts,
+        info->max_concurrency);
+
+    bool success = reply && reply->type == REDIS_REPLY_INTEGER;
+    freeReplyObject(reply);
+
+    if (success) {
+        reply = db_command(store->db, "PEXPIRE %s %" PRIu64, store->info_key, ttl_ms);
+        success = reply && reply->type == REDIS_REPLY_INTEGER;
+
+        freeReplyObject(reply);
+    }
+
+    if (!success) {
+        log_warn("failed to cache gateway info");
+    }
+
+    return success;
+}
+
+void session_store_count_start(session_store_t* store) {
+    /* HINCRBY alone would create a hash without a ttl if the cache had expired */
+    redisReply* reply = db_command(store->db, "HEXISTS %s remaining", store->info_key);
+    bool cached = reply && reply->type == REDIS_REPLY_INTEGER && reply->integer == 1;
+    freeReplyObject(reply);
+
+    if (!cached) {
+        return;
+    }
+
+    reply = db_command(store->db, "HINCRBY %s remaining -1", store->info_key);
+    if (reply && reply->type == REDIS_REPLY_INTEGER) {
+        log_debug("%lld session starts left", reply->integer);
+    } else {
+        log_warn("failed to count session start");
+    }
+
+    freeReplyObject(reply);
+}
+
+void gateway_info_cleanup(struct gateway_info* info) {
+    nv_free(info->url);
+    memset(info, 0, sizeof(struct gateway_info));
+}
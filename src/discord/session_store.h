@@ -0,0 +1,85 @@
+#ifndef _SESSION_STORE_H
+#define _SESSION_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* keeps the gateway session in redis so that a restarted bot can resume it rather than identify
+ * again, which costs a READY, counts against the daily session start limit, and loses whatever
+ * was dispatched while the bot was down. the gateway checkpoints its sequence every so often, so a
+ * resume may replay a few events the previous process already handled.
+ *
+ * discord only keeps a disconnected session for a few minutes, so saved sessions expire in redis
+ * after SAVED_SESSION_TTL_S without a checkpoint.
+ *
+ * it also caches /gateway/bot, so a start that has to identify can connect without asking for the
+ * url first, and counts identifies against the cached session start limit so that a bot restarting
+ * in a loop notices before it runs out */
+
+typedef struct session_store session_store_t;
+
+/* from hiredis/hiredis.h */
+typedef struct redisContext redisContext;
+
+#define SAVED_SESSION_TTL_S 180
+
+/* INTERACTION_TOKEN_LIFETIME_MS */
+#define CLAIMED_INTERACTION_TTL_S (15 * 60)
+
+struct saved_session {
+    /* from /gateway/bot, with query string; where to identify if the resume fails */
+    char* url;
+
+    char* id;
+    char* resume_url;
+
+    bool has_sequence;
+    uint64_t sequence;
+};
+
+/* db is borrowed. sessions are kept per application */
+session_store_t* session_store_create(redisContext* db, uint64_t app_id);
+void session_store_free(session_store_t* store);
+
+/* false if nothing is saved. free what was loaded with saved_session_cleanup */
+bool session_store_load(session_store_t* store, struct saved_session* session);
+
+bool session_store_save(session_store_t* store, const struct saved_session* session);
+
+/* once the session is no longer resumable */
+void session_store_clear(session_store_t* store);
+
+void saved_session_cleanup(struct saved_session* session);
+
+/* a resume replays whatever came after the last checkpoint, interactions included. an interaction
+ * is claimed once, for as long as its token lives; false if it was claimed before. if redis cannot
+ * be reached it is handled anyway */
+bool session_store_claim_interaction(session_store_t* store, uint64_t id);
+
+/* the cache is refreshed at least this often, and when the start limit resets */
+#define GATEWAY_INFO_MAX_AGE_MS (60 * 60 * 1000)
+
+/* https://discord.com/developers/docs/events/gateway#get-gateway-bot */
+struct gateway_info {
+    /* with query string */
+    char* url;
+    uint32_t shards;
+
+    /* from session_start_limit. remaining counts down with every identify since the fetch */
+    uint32_t total_starts;
+    int64_t remaining_starts;
+    uint64_t reset_after_ms;
+    uint32_t max_concurrency;
+};
+
+/* false if nothing is cached. free what was loaded with gateway_info_cleanup */
+bool session_store_load_gateway_info(session_store_t* store, struct gateway_info* info);
+
+bool session_store_save_gateway_info(session_store_t* store, const struct gateway_info* info);
+
+/* takes one from the cached remaining starts, if anything is cached */
+void session_store_count_start(session_store_t* store);
+
+void gateway_info_cleanup(struct gateway_info* info);
+
+#endif
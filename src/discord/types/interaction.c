@@ -6,8 +6,12 @@
 
 #include "../bot.h"
 #include "../component.h"
+#include "../deadline.h"
+#include "../followup.h"
 
-#include "../../core/base64.h"
+#include "../custom_id.h"
+
+#include "../../core/intern.h"
 
 #include <string.h>
 #include <assert.h>
@@ -32,7 +36,6 @@ static void free_command_options(struct command_option_data* data, size_t count)
     for (size_t i = 0; i < count; i++) {
         const struct command_option_data* option = &data[i];
 
-        nv_free(option->name);
         nv_free(option->value);
     }
 
@@ -45,7 +48,6 @@ static void free_command_data(struct interaction_command_data* data) {
     }
 
     free_command_options(data->options, data->num_options);
-    nv_free(data->name);
     nv_free(data);
 }
 
@@ -65,7 +67,7 @@ static void parse_option_data(struct command_option_data* option, const json_obj
     }
 
     const char* name = json_object_get_string(field);
-    option->name = nv_strdup(name);
+    option->name = intern_find(name);
 
     field = json_object_object_get(data, "value");
     if (field) {
@@ -105,7 +107,11 @@ static struct interaction_command_data* parse_command_data(const json_object* da
     }
 
     const char* name = json_object_get_string(field);
-    cmd->name = nv_strdup(name);
+    cmd->name = intern_find(name);
+
+    if (!cmd->name) {
+        log_debug("command %s is not registered", name);
+    }
 
     field = json_object_object_get(data, "type");
     if (!field || json_object_get_type(field) != json_type_int) {
@@ -141,11 +147,58 @@ static struct interaction_command_data* parse_command_data(const json_object* da
     return cmd;
 }
 
+static void free_string_array(char** strings, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        nv_free(strings[i]);
+    }
+
+    nv_free(strings);
+}
+
+static char** parse_string_array(const json_object* data, size_t* count) {
+    *count = 0;
+    if (!data || json_object_get_type(data) != json_type_array) {
+        return NULL;
+    }
+
+    size_t length = json_object_array_length(data);
+    if (length == 0) {
+        return NULL;
+    }
+
+    char** strings = nv_calloc(length, sizeof(char*));
+    assert(strings);
+
+    for (size_t i = 0; i < length; i++) {
+        json_object* element = json_object_array_get_idx(data, i);
+        strings[i] = nv_strdup(element ? json_object_get_string(element) : "");
+    }
+
+    *count = length;
+    return strings;
+}
+
+static void parse_custom_id(const json_object* data, uint8_t* route, void** payload,
+                            size_t* size) {
+    json_object* field = json_object_object_get(data, "custom_id");
+    if (!field || json_object_get_type(field) != json_type_string) {
+        return;
+    }
+
+    const char* custom_id = json_object_get_string(field);
+    size_t length = (size_t)json_object_get_string_len(field);
+
+    if (!custom_id_decode(custom_id, length, route, payload, size)) {
+        log_warn("failed to decode custom_id %s; ignoring", custom_id);
+    }
+}
+
 static void free_component_data(struct interaction_component_data* data) {
     if (!data) {
         return;
     }
 
+    free_string_array(data->values, data->num_values);
     nv_free(data->data);
     nv_free(data);
 }
@@ -168,19 +221,107 @@ static struct interaction_component_data* parse_component_data(const json_object
     }
 
     comp->type = (uint32_t)json_object_get_int(field);
+    parse_custom_id(data, &comp->route, &comp->data, &comp->data_size);
+
+    field = json_object_object_get(data, "values");
+    comp->values = parse_string_array(field, &comp->num_values);
+
+    return comp;
+}
+
+static void free_modal_data(struct interaction_modal_data* data) {
+    if (!data) {
+        return;
+    }
+
+    for (size_t i = 0; i < data->num_fields; i++) {
+        struct modal_field* field = &data->fields[i];
+
+        nv_free(field->custom_id);
+        nv_free(field->value);
+        free_string_array(field->values, field->num_values);
+    }
+
+    nv_free(data->fields);
+    nv_free(data->data);
+    nv_free(data);
+}
+
+static void add_modal_field(struct interaction_modal_data* modal, const json_object* data) {
+    json_object* field = json_object_object_get(data, "type");
+    if (!field || json_object_get_type(field) != json_type_int) {
+        log_warn("modal component has no type; skipping");
+        return;
+    }
+
+    size_t new_size = (modal->num_fields + 1) * sizeof(struct modal_field);
+    modal->fields =
+        modal->num_fields > 0 ? nv_realloc(modal->fields, new_size) : nv_alloc(new_size);
+    assert(modal->fields);
+
+    struct modal_field* result = &modal->fields[modal->num_fields++];
+    memset(result, 0, sizeof(struct modal_field));
+
+    result->type = (uint32_t)json_object_get_int(field);
 
     field = json_object_object_get(data, "custom_id");
+    result->custom_id = nv_strdup(field ? json_object_get_string(field) : "");
+
+    field = json_object_object_get(data, "value");
     if (field && json_object_get_type(field) == json_type_string) {
-        const char* custom_id = json_object_get_string(field);
+        result->value = nv_strdup(json_object_get_string(field));
+    }
+
+    field = json_object_object_get(data, "values");
+    result->values = parse_string_array(field, &result->num_values);
+}
 
-        comp->data_size = base64_decode(custom_id, NULL);
-        if (comp->data_size > 0) {
-            comp->data = nv_alloc(comp->data_size);
-            base64_decode(custom_id, comp->data);
+/* submitted values are nested in action rows or labels; anything with a custom_id is a field */
+static void collect_modal_fields(struct interaction_modal_data* modal, const json_object* data) {
+    if (!data) {
+        return;
+    }
+
+    if (json_object_get_type(data) == json_type_array) {
+        size_t length = json_object_array_length(data);
+        for (size_t i = 0; i < length; i++) {
+            collect_modal_fields(modal, json_object_array_get_idx(data, i));
         }
+
+        return;
     }
 
-    return comp;
+    if (json_object_get_type(data) != json_type_object) {
+        return;
+    }
+
+    if (json_object_object_get(data, "custom_id")) {
+        add_modal_field(modal, data);
+        return;
+    }
+
+    /* action rows */
+    collect_modal_fields(modal, json_object_object_get(data, "components"));
+
+    /* labels */
+    collect_modal_fields(modal, json_object_object_get(data, "component"));
+}
+
+static struct interaction_modal_data* parse_modal_data(const json_object* data) {
+    if (!data) {
+        return NULL;
+    }
+
+    struct interaction_modal_data* modal = nv_alloc(sizeof(struct interaction_modal_data));
+    assert(modal);
+    memset(modal, 0, sizeof(struct interaction_modal_data));
+
+    parse_custom_id(data, &modal->route, &modal->data, &modal->data_size);
+
+    json_object* field = json_object_object_get(data, "components");
+    collect_modal_fields(modal, field);
+
+    return modal;
 }
 
 bool interaction_parse(struct interaction* interaction, const json_object* data) {
@@ -236,6 +377,16 @@ bool interaction_parse(struct interaction* interaction, const json_object* data)
             return false;
         }
 
+        break;
+    case INTERACTION_TYPE_MODEL_SUBMIT:
+        interaction->modal_data = parse_modal_data(field);
+        if (!interaction->modal_data) {
+            log_error("modal submit had no data!");
+
+            interaction_cleanup(interaction);
+            return false;
+        }
+
         break;
     default:
         log_debug("unsupported interaction type with data = %s", json_object_to_json_string(field));
@@ -291,6 +442,9 @@ void interaction_cleanup(const struct interaction* interaction) {
     case INTERACTION_TYPE_MESSAGE_COMPONENT:
         free_component_data(interaction->component_data);
         break;
+    case INTERACTION_TYPE_MODEL_SUBMIT:
+        free_modal_data(interaction->modal_data);
+        break;
     default:
         if (interaction->reserved) {
             log_warn("potentially leaking memory from interaction; no data associated with "
@@ -313,19 +467,74 @@ void interaction_cleanup(const struct interaction* interaction) {
     nv_free(interaction->token);
 }
 
-bool interaction_respond_with_message(const struct interaction* interaction, bot_t* bot,
-                                      const struct message_response* data) {
+static json_object* serialize_components(const struct component* components, size_t count) {
+    json_object* array = json_object_new_array();
+    assert(array);
+
+    for (size_t i = 0; i < count; i++) {
+        json_object* serialized = component_serialize(&components[i]);
+        json_object_array_add(array, serialized);
+    }
+
+    return array;
+}
+
+/* takes ownership of data */
+static bool send_callback(const struct interaction* interaction, bot_t* bot, int32_t type,
+                          json_object* data) {
     json_object* response = json_object_new_object();
     assert(response);
 
-    json_object* field = json_object_new_int(RESPONSE_TYPE_CHANNEL_MESSAGE_WITH_SOURCE);
+    json_object* field = json_object_new_int(type);
     assert(field);
     json_object_object_add(response, "type", field);
 
+    if (data) {
+        json_object_object_add(response, "data", data);
+    }
+
+    struct interaction_reply* reply = interaction->reply;
+    if (reply) {
+        bool success = !reply->sent;
+        if (success) {
+            reply->sent = true;
+            success = reply->send(reply->user, response);
+        } else {
+            log_error("interaction %" PRIu64 " already has an initial response", interaction->id);
+        }
+
+        json_object_put(response);
+        return success;
+    }
+
+    static char path[512];
+    snprintf(path, sizeof(path), "/interactions/%" PRIu64 "/%s/callback", interaction->id,
+             interaction->token);
+
+    json_object* result = bot_send_api_request(bot, path, "POST", response);
+    json_object_put(response);
+
+    bool success = result != NULL;
+    json_object_put(result);
+
+    return success;
+}
+
+/* false if the watchdog already sent a deferred response */
+static bool claim_response(const struct interaction* interaction, bot_t* bot) {
+    deadline_watchdog_t* watchdog = bot_get_deadline_watchdog(bot);
+    if (!watchdog || !interaction->deadline) {
+        return true;
+    }
+
+    return deadline_claim(watchdog, interaction->deadline);
+}
+
+static json_object* serialize_message(const struct message_response* data, uint32_t flags) {
     json_object* message = json_object_new_object();
     assert(message);
 
-    field = json_object_new_int((int32_t)data->flags);
+    json_object* field = json_object_new_int((int32_t)flags);
     assert(field);
     json_object_object_add(message, "flags", field);
 
@@ -337,27 +546,116 @@ bool interaction_respond_with_message(const struct interaction* interaction, bot
     }
 
     if (data->num_components > 0) {
-        field = json_object_new_array();
-        assert(field);
+        field = serialize_components(data->components, data->num_components);
+        json_object_object_add(message, "components", field);
+    }
 
-        for (size_t i = 0; i < data->num_components; i++) {
-            const struct component* comp = &data->components[i];
-            json_object* serialized = component_serialize(comp);
+    return message;
+}
 
-            json_object_array_add(field, serialized);
-        }
+/* a response goes ahead of whatever the handler queued while it was being made */
+static bool enqueue_webhook(const struct interaction* interaction, bot_t* bot, bool response,
+                            const char* method, const char* suffix, json_object* body) {
+    char path[512];
+    snprintf(path, sizeof(path), "/webhooks/%" PRIu64 "/%s%s", interaction->application_id,
+             interaction->token, suffix);
 
-        json_object_object_add(message, "components", field);
+    followup_queue_t* queue = bot_get_followup_queue(bot);
+    return response ? followup_enqueue_response(queue, interaction->id, method, path, body)
+                    : followup_enqueue(queue, interaction->id, method, path, body);
+}
+
+static bool send_followup(const struct interaction* interaction, bot_t* bot, bool response,
+                          const struct message_response* data) {
+    json_object* message = serialize_message(data, data->flags);
+    bool success = enqueue_webhook(interaction, bot, response, "POST", "", message);
+
+    json_object_put(message);
+    return success;
+}
+
+static bool edit_original(const struct interaction* interaction, bot_t* bot, bool response,
+                          const struct message_response* data) {
+    json_object* message = serialize_message(data, data->flags & MESSAGE_IS_COMPONENTS_V2);
+    bool success =
+        enqueue_webhook(interaction, bot, response, "PATCH", "/messages/@original", message);
+
+    json_object_put(message);
+    return success;
+}
+
+static bool delete_original(const struct interaction* interaction, bot_t* bot, bool response) {
+    return enqueue_webhook(interaction, bot, response, "DELETE", "/messages/@original", NULL);
+}
+
+bool interaction_respond_with_message(const struct interaction* interaction, bot_t* bot,
+                                      const struct message_response* data) {
+    bool deferred = !claim_response(interaction, bot);
+
+    /* the deferral was public, so editing it would show everyone. the first follow-up to a
+     * deferral would edit it too, so the delete is queued ahead of the follow-up */
+    bool success;
+    if (deferred && (data->flags & MESSAGE_EPHEMERAL)) {
+        success = delete_original(interaction, bot, true) &&
+                  send_followup(interaction, bot, true, data);
+    } else if (deferred) {
+        success = edit_original(interaction, bot, true, data);
+    } else {
+        json_object* message = serialize_message(data, data->flags);
+        success = send_callback(interaction, bot, RESPONSE_TYPE_CHANNEL_MESSAGE_WITH_SOURCE,
+                                message);
     }
 
-    json_object_object_add(response, "data", message);
+    /* webhook requests queued by the handler so far were waiting on this */
+    followup_release(bot_get_followup_queue(bot), interaction->id);
+    return success;
+}
 
-    static char path[512];
-    snprintf(path, sizeof(path), "/interactions/%" PRIu64 "/%s/callback", interaction->id,
-             interaction->token);
+bool interaction_respond_with_modal(const struct interaction* interaction, bot_t* bot,
+                                    const struct modal_response* data) {
+    if (!claim_response(interaction, bot)) {
+        log_error("interaction %" PRIu64 " was deferred; too late to respond with a modal",
+                  interaction->id);
 
-    bool success = bot_send_api_request(bot, path, "POST", response);
-    json_object_put(response);
+        return false;
+    }
+
+    char custom_id[CUSTOM_ID_MAX_LENGTH + 1];
+    if (!custom_id_encode(data->route, data->data, data->data_size, custom_id)) {
+        log_error("failed to encode modal custom_id");
+        return false;
+    }
+
+    json_object* modal = json_object_new_object();
+    assert(modal);
+
+    json_object* field = json_object_new_string(custom_id);
+    assert(field);
+    json_object_object_add(modal, "custom_id", field);
+
+    field = json_object_new_string(data->title);
+    assert(field);
+    json_object_object_add(modal, "title", field);
+
+    field = serialize_components(data->components, data->num_components);
+    json_object_object_add(modal, "components", field);
+
+    bool success = send_callback(interaction, bot, RESPONSE_TYPE_MODAL, modal);
+    followup_release(bot_get_followup_queue(bot), interaction->id);
 
     return success;
 }
+
+bool interaction_send_followup(const struct interaction* interaction, bot_t* bot,
+                               const struct message_response* data) {
+    return send_followup(interaction, bot, false, data);
+}
+
+bool interaction_edit_original(const struct interaction* interaction, bot_t* bot,
+                               const struct message_response* data) {
+    return edit_original(interaction, bot, false, data);
+}
+
+bool interaction_delete_original(const struct interaction* interaction, bot_t* bot) {
+    return delete_original(interaction, bot, false);
+}
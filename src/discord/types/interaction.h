@@ -7,6 +7,12 @@
 
 #include <json.h>
 
+/* from the interaction's creation, for responses and webhooks alike */
+#define INTERACTION_TOKEN_LIFETIME_MS (15 * 60 * 1000ull)
+
+/* from the interaction's creation, for the initial response or deferral */
+#define INTERACTION_RESPONSE_WINDOW_MS 3000ull
+
 enum {
     INTERACTION_TYPE_PING = 1,
     INTERACTION_TYPE_APPLICATION_COMMAND = 2,
@@ -16,7 +22,8 @@ enum {
 };
 
 struct command_option_data {
-    char* name;
+    /* interned; NULL if no registered command has an option by this name. see core/intern.h */
+    const char* name;
 
     uint32_t type;
     char* value;
@@ -26,7 +33,9 @@ struct command_option_data {
 
 struct interaction_command_data {
     uint64_t id;
-    char* name;
+
+    /* interned; NULL if no command by this name was registered */
+    const char* name;
 
     uint32_t type;
 
@@ -42,8 +51,50 @@ struct interaction_command_data {
 struct interaction_component_data {
     uint32_t type;
 
+    /* decoded from custom_id; see custom_id.h */
+    uint8_t route;
+    void* data;
+    size_t data_size;
+
+    /* select menus only */
+    size_t num_values;
+    char** values;
+};
+
+struct modal_field {
+    /* as passed to the text input; not encoded */
+    char* custom_id;
+    uint32_t type;
+
+    /* text inputs */
+    char* value;
+
+    /* selects */
+    size_t num_values;
+    char** values;
+};
+
+struct interaction_modal_data {
+    /* decoded from custom_id; see custom_id.h */
+    uint8_t route;
     void* data;
     size_t data_size;
+
+    size_t num_fields;
+    struct modal_field* fields;
+};
+
+/* interactions received over http are answered in the http response rather than with a separate
+ * REST request; see interaction_server.h */
+struct interaction_reply {
+    /* writes the initial response the moment a handler sends it, so the handler can keep working
+     * after responding without holding the response back. body is borrowed. false if it could not
+     * be written */
+    bool (*send)(void* user, json_object* body);
+    void* user;
+
+    /* an initial response has gone out */
+    bool sent;
 };
 
 struct interaction {
@@ -54,6 +105,7 @@ struct interaction {
     union {
         struct interaction_command_data* command_data;
         struct interaction_component_data* component_data;
+        struct interaction_modal_data* modal_data;
 
         void* reserved;
     };
@@ -71,6 +123,12 @@ struct interaction {
 
     /* token for creating response */
     char* token;
+
+    /* set while a handler runs, if the bot defers slow responses; see deadline.h */
+    struct interaction_deadline* deadline;
+
+    /* set while a handler runs, if discord is waiting for the initial response over http */
+    struct interaction_reply* reply;
 };
 
 bool interaction_parse(struct interaction* interaction, const json_object* data);
@@ -90,10 +148,42 @@ struct message_response {
     const struct component* components;
 };
 
+struct modal_response {
+    const char* title;
+
+    /* encoded into custom_id and handed back on submit; see custom_id.h */
+    uint8_t route;
+    const void* data;
+    size_t data_size;
+
+    /* labels wrapping text inputs or selects */
+    size_t num_components;
+    const struct component* components;
+};
+
 /* from bot.h */
 typedef struct bot bot_t;
 
+/* if the response budget already ran out, this edits the deferred response instead. the deferral is
+ * public, so an ephemeral message replaces it with an ephemeral follow-up; see deadline.h */
 bool interaction_respond_with_message(const struct interaction* interaction, bot_t* bot,
                                       const struct message_response* data);
 
+/* fails if the response budget already ran out; a modal cannot follow a deferral */
+bool interaction_respond_with_modal(const struct interaction* interaction, bot_t* bot,
+                                    const struct modal_response* data);
+
+/* these only queue the request and return; see followup.h. requests for one interaction are sent
+ * in the order they were made, and only after the initial response. false if the interaction's
+ * token has expired */
+
+bool interaction_send_followup(const struct interaction* interaction, bot_t* bot,
+                               const struct message_response* data);
+
+/* flags other than components v2 are ignored */
+bool interaction_edit_original(const struct interaction* interaction, bot_t* bot,
+                               const struct message_response* data);
+
+bool interaction_delete_original(const struct interaction* interaction, bot_t* bot);
+
 #endif
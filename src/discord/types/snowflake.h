@@ -9,4 +9,10 @@
 bool snowflake_parse(uint64_t* id, json_object* data);
 json_object* snowflake_serialize(uint64_t id);
 
+/* https://discord.com/developers/docs/reference#snowflakes */
+#define DISCORD_EPOCH_MS 1420070400000ull
+
+/* when the id was made, in unix milliseconds */
+static inline uint64_t snowflake_get_time_ms(uint64_t id) { return (id >> 22) + DISCORD_EPOCH_MS; }
+
 #endif
@@ -2,42 +2,72 @@
 #include "discord/credentials.h"
 #include "discord/command.h"
 #include "discord/component.h"
+#include "discord/custom_id.h"
+#include "discord/component_router.h"
+#include "discord/interaction_stream.h"
 
 #include "discord/types/user.h"
 #include "discord/types/interaction.h"
 
 #include "core/database.h"
+#include "core/compress.h"
+#include "core/hashmap.h"
+#include "core/intern.h"
+#include "core/record.h"
+#include "core/metrics.h"
+#include "core/trace.h"
 
 #include "status.h"
 
 #include <log.h>
 
 #include <signal.h>
+#include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
 
 #include <hiredis/hiredis.h>
 
-#include <nyoravim/map.h>
+#include <nyoravim/mem.h>
 #include <nyoravim/util.h>
 
-static bool string_keys_equal(void* user, const void* lhs, const void* rhs) {
-    return strcmp(lhs, rhs) == 0;
-}
+/* keyed by interned name, which inbound command names resolve to; see core/intern.h */
+HASHMAP_DECLARE(command_map, const char*, command_t*, hashmap_hash_ptr, HASHMAP_EQUALS_SCALAR)
+
+/* trained with `tasks train-status-dict`; records are stored uncompressed if there are none.
+ * TASKS_DICTIONARY_DIR overrides the directory */
+#define DEFAULT_DICTIONARY_DIR "."
+#define STATUS_DICTIONARY_MAX_SIZE (16 * 1024)
 
-static size_t hash_string(void* user, const void* key) { return nv_hash_string(key); }
+/* spilled custom_id payloads kept in memory */
+#define CUSTOM_ID_CACHE_SIZE 1024
+
+/* custom_id route tags */
+enum {
+    ROUTE_BOOP = 1,
+};
 
-static void free_command(void* user, void* value) { command_free(value); }
+/* boop payload fields */
+enum {
+    BOOP_FIELD_NAME = 1,
+};
 
 struct bot_data {
     redisContext* db;
+    compressor_t* status_compressor;
 
     bot_t* bot;
 
-    /* keys owned by values */
-    nv_map_t* commands;
+    command_map_t commands;
+
+    component_router_t* components;
 
     uint64_t guild_scope;
+
+    /* handles interactions from the stream; the producer registers commands with discord */
+    bool stream_worker;
 };
 
 static bot_t* active_bot;
@@ -49,6 +79,11 @@ static void sigint_handler(int sig) {
     bot_stop(active_bot);
 }
 
+#define DEFAULT_TRACE_PATH "tasks-trace.json"
+
+static const char* trace_path = DEFAULT_TRACE_PATH;
+static void sigusr1_handler(int sig) { trace_request_dump(trace_path); }
+
 static void log_status(redisContext* db, uint64_t user) {
     struct status status;
     if (!status_get(db, user, &status)) {
@@ -68,7 +103,7 @@ static void on_fill_form(const struct command_invocation_context* context) {
     log_status(data->db, context->interaction->user->id);
 
     const char* name = NULL;
-    assert(nv_map_get(context->options, "name", (void**)&name));
+    assert(command_get_option(context, "name", &name));
 
     char buffer[256];
     if (name) {
@@ -78,12 +113,17 @@ static void on_fill_form(const struct command_invocation_context* context) {
                 sizeof(buffer));
     }
 
+    struct record_writer payload;
+    record_writer_init(&payload, 64);
+    record_write_string(&payload, BOOP_FIELD_NAME, name);
+
     struct component button;
     memset(&button, 0, sizeof(struct component));
     button.type = COMPONENT_TYPE_BUTTON;
     button.button.style = BUTTON_STYLE_PRIMARY;
-    button.button.data = name;
-    button.button.data_size = strlen(name) + 1;
+    button.button.route = ROUTE_BOOP;
+    button.button.data = payload.data;
+    button.button.data_size = payload.size;
     button.button.label = "boop";
 
     struct component comp[2];
@@ -104,28 +144,64 @@ static void on_fill_form(const struct command_invocation_context* context) {
     response.components = comp;
 
     interaction_respond_with_message(context->interaction, data->bot, &response);
+    record_writer_cleanup(&payload);
+}
+
+static void on_boop(const struct component_invocation_context* context) {
+    struct bot_data* data = context->user;
+
+    char* name = NULL;
+
+    struct record_reader payload = context->payload;
+    struct record_field field;
+
+    while (record_read_field(&payload, &field)) {
+        if (field.id == BOOP_FIELD_NAME) {
+            nv_free(name);
+            name = record_field_dup_string(&field);
+        }
+    }
+
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "booping %s... success!", name ? name : "nobody");
+    nv_free(name);
+
+    struct message_response response;
+    memset(&response, 0, sizeof(struct message_response));
+
+    response.content = buffer;
+
+    interaction_respond_with_message(context->interaction, data->bot, &response);
+}
+
+static void register_components(struct bot_data* data) {
+    struct component_handler_spec spec;
+    memset(&spec, 0, sizeof(struct component_handler_spec));
+
+    spec.route = ROUTE_BOOP;
+    spec.name = "boop";
+    spec.user = data;
+    spec.callback = on_boop;
+
+    assert(component_router_register(data->components, &spec));
 }
 
 static void register_command(struct bot_data* data, const struct command_spec* spec) {
-    if (nv_map_contains(data->commands, spec->name)) {
+    if (command_map_get(&data->commands, intern_find(spec->name))) {
         log_error("command %s already registered!", spec->name);
         return;
     }
 
-    command_t* cmd = command_register(spec);
+    command_t* cmd = data->stream_worker ? command_create(spec) : command_register(spec);
     if (!cmd) {
         log_error("failed to register command %s", spec->name);
         return;
     }
 
-    const char* name = command_get_name(cmd);
-    assert(nv_map_insert(data->commands, (void*)name, cmd));
+    command_map_insert(&data->commands, command_get_name(cmd), cmd);
 }
 
-static void on_ready(const struct bot_context* context, const struct bot_ready_event* event) {
-    struct bot_data* data = context->user;
-    log_info("authenticated as user: %s#%s", event->user->username, event->user->discriminator);
-
+static void register_commands(struct bot_data* data, bot_t* bot) {
     struct command_option_spec option;
     memset(&option, 0, sizeof(struct command_option_spec));
     option.name = "name";
@@ -138,7 +214,7 @@ static void on_ready(const struct bot_context* context, const struct bot_ready_e
 
     spec.name = "fill-form";
     spec.description = "fill basic chat form";
-    spec.bot = context->bot;
+    spec.bot = bot;
     spec.user = data;
     spec.callback = on_fill_form;
     spec.type = COMMAND_TYPE_CHAT_INPUT;
@@ -149,38 +225,30 @@ static void on_ready(const struct bot_context* context, const struct bot_ready_e
     register_command(data, &spec);
 }
 
-static void handle_command(const struct bot_context* context, const struct interaction* event) {
-    command_t* cmd;
+static void on_ready(const struct bot_context* context, const struct bot_ready_event* event) {
+    log_info("authenticated as user: %s#%s", event->user->username, event->user->discriminator);
+}
 
+static void handle_command(const struct bot_context* context, const struct interaction* event) {
     struct bot_data* data = context->user;
-    if (!nv_map_get(data->commands, event->command_data->name, (void**)&cmd)) {
-        log_error("command not found: %s", event->command_data->name);
+
+    const struct interaction_command_data* command = event->command_data;
+
+    /* names that were never registered are not interned */
+    command_t** cmd = command->name ? command_map_get(&data->commands, command->name) : NULL;
+    if (!cmd) {
+        log_error("command not found: %" PRIu64, command->id);
         return;
     }
 
-    if (!command_invoke(cmd, event)) {
-        log_error("failed to invoke command: %s", event->command_data->name);
+    if (!command_invoke(*cmd, event)) {
+        log_error("failed to invoke command: %s", command->name);
     }
 }
 
 static void handle_component(const struct bot_context* context, const struct interaction* event) {
-    if (event->component_data->type != COMPONENT_TYPE_BUTTON) {
-        return;
-    }
-
-    /* assuming boop */
-    const char* name = event->component_data->data;
-    assert(name);
-
-    char buffer[256];
-    snprintf(buffer, sizeof(buffer), "booping %s... success!", name);
-
-    struct message_response response;
-    memset(&response, 0, sizeof(struct message_response));
-
-    response.content = buffer;
-
-    interaction_respond_with_message(event, context->bot, &response);
+    struct bot_data* data = context->user;
+    component_router_dispatch(data->components, event);
 }
 
 static void on_interaction(const struct bot_context* context, const struct interaction* event) {
@@ -190,6 +258,7 @@ static void on_interaction(const struct bot_context* context, const struct inter
         handle_command(context, event);
         break;
     case INTERACTION_TYPE_MESSAGE_COMPONENT:
+    case INTERACTION_TYPE_MODEL_SUBMIT:
         handle_component(context, event);
         break;
     }
@@ -215,6 +284,77 @@ static bool create_bot(struct bot_data* user) {
 
     spec.creds = creds;
     spec.callbacks = &callbacks;
+    spec.api_url = getenv("TASKS_API_URL");
+
+    /* zstd compressed when available */
+    spec.record_path = getenv("TASKS_RECORD_GATEWAY");
+    spec.record_compressed = true;
+
+    /* 0 (unset or invalid) picks the default */
+    const char* budget = getenv("TASKS_RESPONSE_BUDGET_MS");
+    spec.response_budget_ms = budget ? (uint32_t)strtoul(budget, NULL, 10) : 0;
+
+    /* TASKS_INTERACTIONS_PORT takes interactions as http webhooks too, or instead of the gateway
+     * with TASKS_INTERACTIONS_ONLY */
+    const char* port_string = getenv("TASKS_INTERACTIONS_PORT");
+    if (port_string && *port_string) {
+        char* end;
+        unsigned long port = strtoul(port_string, &end, 10);
+
+        if (*end != '\0' || port == 0 || port > UINT16_MAX) {
+            log_error("invalid TASKS_INTERACTIONS_PORT: %s", port_string);
+
+            credentials_free(creds);
+            return false;
+        }
+
+        spec.interactions_port = (uint16_t)port;
+        spec.interactions_address = getenv("TASKS_INTERACTIONS_ADDRESS");
+    }
+
+    const char* only = getenv("TASKS_INTERACTIONS_ONLY");
+    spec.interactions_only = only && strcmp(only, "1") == 0;
+
+    /* restarts resume the last gateway session and reuse /gateway/bot unless
+     * TASKS_GATEWAY_RESUME=0. not against another api, whose urls would mix with discord's */
+    const char* resume = getenv("TASKS_GATEWAY_RESUME");
+    if (!spec.api_url && (!resume || strcmp(resume, "0") != 0)) {
+        spec.session_db = user->db;
+    }
+
+    /* DM channels belong to whichever api opened them, too */
+    if (!spec.api_url) {
+        spec.dm_channel_db = user->db;
+    }
+
+    /* TASKS_STREAM_ROLE splits gateway and handlers across processes over redis */
+    struct interaction_stream_spec stream;
+    memset(&stream, 0, sizeof(struct interaction_stream_spec));
+
+    const char* role = getenv("TASKS_STREAM_ROLE");
+    if (role && *role) {
+        if (strcmp(role, "producer") == 0) {
+            stream.role = INTERACTION_STREAM_PRODUCER;
+        } else if (strcmp(role, "worker") == 0) {
+            stream.role = INTERACTION_STREAM_WORKER;
+        } else {
+            log_error("invalid TASKS_STREAM_ROLE: %s", role);
+
+            credentials_free(creds);
+            return false;
+        }
+
+        stream.consumer = getenv("TASKS_STREAM_CONSUMER");
+
+        /* redis unless asked otherwise */
+        const char* transport = getenv("TASKS_STREAM_TRANSPORT");
+        if (transport && strcmp(transport, "shm") == 0) {
+            stream.transport = INTERACTION_STREAM_SHARED_MEMORY;
+        }
+
+        spec.stream = &stream;
+        user->stream_worker = stream.role == INTERACTION_STREAM_WORKER;
+    }
 
     user->bot = bot_create(&spec);
     credentials_free(creds);
@@ -222,30 +362,103 @@ static bool create_bot(struct bot_data* user) {
     return user->bot != NULL;
 }
 
-static bool initialize_client(struct bot_data* bot) {
-    memset(bot, 0, sizeof(struct bot_data));
+static const char* get_dictionary_dir() {
+    const char* directory = getenv("TASKS_DICTIONARY_DIR");
+    return directory && *directory ? directory : DEFAULT_DICTIONARY_DIR;
+}
+
+static void load_status_dictionary(struct bot_data* bot) {
+    bot->status_compressor = status_load_dictionaries(get_dictionary_dir(), 0);
+    status_set_compressor(bot->status_compressor);
+}
 
+static bool connect_database(struct bot_data* bot) {
     bot->db = redisConnect("127.0.0.1", 6379);
     if (bot->db->err != 0) {
         log_error("failed to connect to redis database: %s", bot->db->errstr);
         return false;
     }
 
+    load_status_dictionary(bot);
+    custom_id_init(bot->db, 0, CUSTOM_ID_CACHE_SIZE);
+
+    return true;
+}
+
+/* one-off maintenance commands that only need the database */
+static bool run_maintenance(struct bot_data* data, const char* command) {
+    if (strcmp(command, "migrate-status") == 0) {
+        status_migrate_all(data->db);
+        return true;
+    }
+
+    if (strcmp(command, "train-status-dict") == 0) {
+        return status_train_dictionary(data->db, get_dictionary_dir(), STATUS_DICTIONARY_MAX_SIZE);
+    }
+
+    log_error("unknown command: %s", command);
+    return false;
+}
+
+static bool initialize_client(struct bot_data* bot) {
     if (!create_bot(bot)) {
         log_error("failed to create discord client!");
         return false;
     }
 
-    struct nv_map_callbacks callbacks;
-    memset(&callbacks, 0, sizeof(struct nv_map_callbacks));
+    command_map_init(&bot->commands);
+    bot->components = component_router_create();
+    register_components(bot);
+
+    /* not from on_ready, which a resumed session never gets */
+    register_commands(bot, bot->bot);
+
+    return true;
+}
+
+/* TASKS_METRICS_PORT opts in to a localhost prometheus endpoint */
+static void start_metrics() {
+    const char* port_string = getenv("TASKS_METRICS_PORT");
+    if (!port_string || !*port_string) {
+        return;
+    }
+
+    char* end;
+    unsigned long port = strtoul(port_string, &end, 10);
+
+    if (*end != '\0' || port == 0 || port > UINT16_MAX) {
+        log_error("invalid TASKS_METRICS_PORT: %s", port_string);
+        return;
+    }
+
+    metrics_serve("127.0.0.1", (uint16_t)port);
+}
+
+/* TASKS_TRACE_SAMPLE is the fraction of gateway frames to trace; SIGUSR1 writes what has been
+ * recorded to TASKS_TRACE_PATH */
+static bool start_tracing() {
+    const char* rate_string = getenv("TASKS_TRACE_SAMPLE");
+    if (!rate_string || !*rate_string) {
+        return false;
+    }
+
+    char* end;
+    double rate = strtod(rate_string, &end);
 
-    callbacks.free_value = free_command;
-    callbacks.hash = hash_string;
-    callbacks.equals = string_keys_equal;
+    if (*end != '\0' || rate <= 0) {
+        log_error("invalid TASKS_TRACE_SAMPLE: %s", rate_string);
+        return false;
+    }
+
+    const char* path = getenv("TASKS_TRACE_PATH");
+    if (path && *path) {
+        trace_path = path;
+    }
 
-    bot->commands = nv_map_alloc(64, &callbacks);
-    assert(bot->commands);
+    trace_init(rate, 0);
+    signal(SIGUSR1, sigusr1_handler);
 
+    log_info("send SIGUSR1 to write traces to %s", trace_path);
     return true;
 }
 
@@ -253,8 +466,27 @@ int main(int argc, const char** argv) {
     bool initialized = false;
 
     struct bot_data data;
+    memset(&data, 0, sizeof(struct bot_data));
+
+    if (!connect_database(&data)) {
+        redisFree(data.db);
+        return 1;
+    }
+
+    if (argc > 1) {
+        bool success = run_maintenance(&data, argv[1]);
+
+        custom_id_shutdown();
+        compressor_free(data.status_compressor);
+        redisFree(data.db);
+
+        return success ? 0 : 1;
+    }
+
     if (initialize_client(&data)) {
         initialized = true;
+        start_metrics();
+        bool tracing = start_tracing();
 
         active_bot = data.bot;
         __sighandler_t prev_handler = signal(SIGINT, sigint_handler);
@@ -263,10 +495,26 @@ int main(int argc, const char** argv) {
 
         signal(SIGINT, prev_handler);
         active_bot = NULL;
+        metrics_stop();
+
+        if (tracing) {
+            signal(SIGUSR1, SIG_DFL);
+            trace_shutdown();
+        }
     }
 
-    nv_map_free(data.commands);
+    HASHMAP_FOR_EACH(&data.commands, i) {
+        command_free(data.commands.values[i]);
+    }
+
+    command_map_free(&data.commands);
+    component_router_free(data.components);
     bot_destroy(data.bot);
+
+    /* after everything holding interned names is gone */
+    intern_shutdown();
+    custom_id_shutdown();
+    compressor_free(data.status_compressor);
     redisFree(data.db);
 
     return initialized ? 0 : 1;
@@ -1,7 +1,21 @@
 #include "status.h"
 
+#include "core/record.h"
+#include "core/compress.h"
+#include "core/database.h"
+#include "core/trace.h"
+
 #include <inttypes.h>
 #include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
 
 #include <hiredis/hiredis.h>
 
@@ -14,6 +28,30 @@
 #define STATUS_DESCRIPTION_KEY "status"
 #define CURRENT_THOUGHT_KEY "thought"
 
+/* status.<dictionary id>.dict, and the single file from before dictionaries were kept apart */
+#define DICTIONARY_PREFIX "status."
+#define DICTIONARY_SUFFIX ".dict"
+#define LEGACY_DICTIONARY_NAME "status.dict"
+
+#define LEGACY_KEY_PREFIX "status:"
+#define RECORD_KEY_PREFIX "statusrec:"
+
+/* header byte: low nibble is the version, high bit marks a zstd frame */
+#define RECORD_VERSION 1
+#define RECORD_VERSION_MASK 0x0F
+#define RECORD_FLAG_COMPRESSED 0x80
+
+/* field ids are part of the format; never reuse one */
+enum {
+    FIELD_DISPLAY_NAME = 1,
+    FIELD_STATUS_DESCRIPTION = 2,
+    FIELD_CURRENT_THOUGHT = 3,
+};
+
+static compressor_t* record_compressor = NULL;
+
+void status_set_compressor(compressor_t* comp) { record_compressor = comp; }
+
 static void update_status_field(struct status* status, const char* key, const char* value) {
     if (strcmp(key, DISPLAY_NAME_KEY) == 0) {
         status->display_name = nv_strdup(value);
@@ -33,17 +71,19 @@ static void update_status_field(struct status* status, const char* key, const ch
     log_warn("unassociated key in status hash: %s", key);
 }
 
-bool status_get(redisContext* db, uint64_t user, struct status* status) {
+/* returns false on a redis error. *found is false if the hash does not exist */
+static bool read_legacy_hash(redisContext* db, uint64_t user, struct status* status, bool* found) {
     memset(status, 0, sizeof(struct status));
 
-    redisReply* reply = redisCommand(db, "HGETALL status:%" PRIu64, user);
-    if (reply->type != REDIS_REPLY_ARRAY || reply->elements % 2 != 0) {
+    redisReply* reply = db_command(db, "HGETALL " LEGACY_KEY_PREFIX "%" PRIu64, user);
+    if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements % 2 != 0) {
         log_error("invalid redis response");
 
         freeReplyObject(reply);
         return false;
     }
 
+    *found = reply->elements > 0;
     for (size_t i = 0; i < reply->elements; i += 2) {
         redisReply* key_reply = reply->element[i];
         if (key_reply->type != REDIS_REPLY_STRING) {
@@ -64,8 +104,503 @@ bool status_get(redisContext* db, uint64_t user, struct status* status) {
     return true;
 }
 
+uint8_t* status_encode(const struct status* status, size_t* size) {
+    struct record_writer writer;
+    record_writer_init(&writer, 64);
+
+    uint8_t header = RECORD_VERSION;
+    record_write_raw(&writer, &header, 1);
+
+    record_write_string(&writer, FIELD_DISPLAY_NAME, status->display_name);
+    record_write_string(&writer, FIELD_STATUS_DESCRIPTION, status->status_description);
+    record_write_string(&writer, FIELD_CURRENT_THOUGHT, status->current_thought);
+
+    if (!record_compressor) {
+        return record_writer_release(&writer, size);
+    }
+
+    /* only keep the compressed form if it actually saves space */
+    size_t payload_size = writer.size - 1;
+    if (payload_size <= 1) {
+        return record_writer_release(&writer, size);
+    }
+
+    uint8_t* compressed = nv_alloc(writer.size);
+    assert(compressed);
+
+    size_t compressed_size = compressor_compress(record_compressor, writer.data + 1, payload_size,
+                                                 compressed + 1, payload_size - 1);
+
+    if (compressed_size == 0) {
+        nv_free(compressed);
+        return record_writer_release(&writer, size);
+    }
+
+    compressed[0] = header | RECORD_FLAG_COMPRESSED;
+    *size = compressed_size + 1;
+
+    record_writer_cleanup(&writer);
+    return compressed;
+}
+
+static bool decode_fields(const void* data, size_t size, struct status* status) {
+    struct record_reader reader;
+    record_reader_init(&reader, data, size);
+
+    struct record_field field;
+    while (record_read_field(&reader, &field)) {
+        char** target;
+        switch (field.id) {
+        case FIELD_DISPLAY_NAME:
+            target = &status->display_name;
+            break;
+        case FIELD_STATUS_DESCRIPTION:
+            target = &status->status_description;
+            break;
+        case FIELD_CURRENT_THOUGHT:
+            target = &status->current_thought;
+            break;
+        default:
+            log_trace("skipping unknown status field %" PRIu32, field.id);
+            continue;
+        }
+
+        nv_free(*target);
+        *target = record_field_dup_string(&field);
+    }
+
+    if (!record_reader_done(&reader)) {
+        log_error("malformed status record");
+        return false;
+    }
+
+    return true;
+}
+
+bool status_decode(const void* data, size_t size, struct status* status) {
+    memset(status, 0, sizeof(struct status));
+    if (size < 1) {
+        log_error("empty status record");
+        return false;
+    }
+
+    const uint8_t* bytes = data;
+    uint8_t header = bytes[0];
+
+    if ((header & RECORD_VERSION_MASK) != RECORD_VERSION) {
+        log_error("unsupported status record version %d", header & RECORD_VERSION_MASK);
+        return false;
+    }
+
+    bool success;
+    if (header & RECORD_FLAG_COMPRESSED) {
+        if (!record_compressor) {
+            log_error("status record is compressed but no compressor is configured");
+            return false;
+        }
+
+        size_t payload_size;
+        void* payload =
+            compressor_decompress(record_compressor, bytes + 1, size - 1, &payload_size);
+        if (!payload) {
+            return false;
+        }
+
+        success = decode_fields(payload, payload_size, status);
+        nv_free(payload);
+    } else {
+        success = decode_fields(bytes + 1, size - 1, status);
+    }
+
+    if (!success) {
+        status_cleanup(status);
+        memset(status, 0, sizeof(struct status));
+    }
+
+    return success;
+}
+
+bool status_set(redisContext* db, uint64_t user, const struct status* status) {
+    size_t size;
+    uint8_t* record = status_encode(status, &size);
+
+    redisReply* reply =
+        db_command(db, "SET " RECORD_KEY_PREFIX "%" PRIu64 " %b", user, record, size);
+    nv_free(record);
+
+    bool success = reply && reply->type == REDIS_REPLY_STATUS;
+    if (!success) {
+        log_error("failed to store status record for user %" PRIu64, user);
+    }
+
+    freeReplyObject(reply);
+    return success;
+}
+
+/* writes the record and drops the hash. if we die in between, the record wins on the next read */
+static bool replace_legacy_hash(redisContext* db, uint64_t user, const struct status* status) {
+    if (!status_set(db, user, status)) {
+        return false;
+    }
+
+    redisReply* reply = db_command(db, "DEL " LEGACY_KEY_PREFIX "%" PRIu64, user);
+    freeReplyObject(reply);
+
+    log_debug("migrated status hash for user %" PRIu64, user);
+    return true;
+}
+
+static bool read_status(redisContext* db, uint64_t user, struct status* status) {
+    memset(status, 0, sizeof(struct status));
+
+    redisReply* reply = db_command(db, "GET " RECORD_KEY_PREFIX "%" PRIu64, user);
+    if (!reply || (reply->type != REDIS_REPLY_STRING && reply->type != REDIS_REPLY_NIL)) {
+        log_error("invalid redis response");
+
+        freeReplyObject(reply);
+        return false;
+    }
+
+    if (reply->type == REDIS_REPLY_STRING) {
+        bool success = status_decode(reply->str, reply->len, status);
+
+        freeReplyObject(reply);
+        return success;
+    }
+
+    freeReplyObject(reply);
+
+    bool found;
+    if (!read_legacy_hash(db, user, status, &found)) {
+        return false;
+    }
+
+    if (found) {
+        /* best effort; the caller still gets the hash contents if this fails */
+        replace_legacy_hash(db, user, status);
+    }
+
+    return true;
+}
+
+bool status_get(redisContext* db, uint64_t user, struct status* status) {
+    struct trace_span span;
+    trace_begin(&span, "status_get");
+
+    bool success = read_status(db, user, status);
+
+    trace_end(&span);
+    return success;
+}
+
 void status_cleanup(const struct status* status) {
     nv_free(status->display_name);
     nv_free(status->status_description);
     nv_free(status->current_thought);
 }
+
+bool status_migrate(redisContext* db, uint64_t user) {
+    struct status status;
+
+    bool found;
+    if (!read_legacy_hash(db, user, &status, &found)) {
+        return false;
+    }
+
+    bool success = !found || replace_legacy_hash(db, user, &status);
+    status_cleanup(&status);
+
+    return success;
+}
+
+typedef void (*scan_callback)(redisContext* db, const char* key, void* user);
+
+static bool scan_keys(redisContext* db, const char* pattern, const char* type,
+                      scan_callback callback, void* user) {
+    char cursor[32] = "0";
+
+    do {
+        redisReply* reply =
+            db_command(db, "SCAN %s MATCH %s COUNT 512 TYPE %s", cursor, pattern, type);
+
+        if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2 ||
+            reply->element[0]->type != REDIS_REPLY_STRING ||
+            reply->element[1]->type != REDIS_REPLY_ARRAY) {
+            log_error("invalid SCAN response");
+
+            freeReplyObject(reply);
+            return false;
+        }
+
+        snprintf(cursor, sizeof(cursor), "%s", reply->element[0]->str);
+
+        redisReply* keys = reply->element[1];
+        for (size_t i = 0; i < keys->elements; i++) {
+            if (keys->element[i]->type == REDIS_REPLY_STRING) {
+                callback(db, keys->element[i]->str, user);
+            }
+        }
+
+        freeReplyObject(reply);
+    } while (strcmp(cursor, "0") != 0);
+
+    return true;
+}
+
+static bool parse_user_from_key(const char* key, const char* prefix, uint64_t* user) {
+    size_t prefix_length = strlen(prefix);
+    if (strncmp(key, prefix, prefix_length) != 0) {
+        return false;
+    }
+
+    const char* id = key + prefix_length;
+
+    char* end;
+    *user = strtoull(id, &end, 10);
+    return end != id && *end == '\0';
+}
+
+static void migrate_key(redisContext* db, const char* key, void* user) {
+    size_t* migrated = user;
+
+    uint64_t id;
+    if (!parse_user_from_key(key, LEGACY_KEY_PREFIX, &id)) {
+        return;
+    }
+
+    if (status_migrate(db, id)) {
+        (*migrated)++;
+    }
+}
+
+size_t status_migrate_all(redisContext* db) {
+    size_t migrated = 0;
+    scan_keys(db, LEGACY_KEY_PREFIX "*", "hash", migrate_key, &migrated);
+
+    log_info("migrated %zu status hashes to records", migrated);
+    return migrated;
+}
+
+struct sample_set {
+    struct record_writer samples;
+
+    size_t* sizes;
+    size_t count, capacity;
+
+    /* compressed with a dictionary that is not loaded */
+    size_t skipped;
+};
+
+static void collect_sample(redisContext* db, const char* key, void* user) {
+    struct sample_set* set = user;
+
+    redisReply* reply = db_command(db, "GET %s", key);
+    if (!reply || reply->type != REDIS_REPLY_STRING || reply->len < 1) {
+        freeReplyObject(reply);
+        return;
+    }
+
+    /* train on payloads as they were before compression, with whichever dictionary made them */
+    const void* payload = reply->str + 1;
+    size_t payload_size = reply->len - 1;
+
+    void* decompressed = NULL;
+    if (reply->str[0] & RECORD_FLAG_COMPRESSED) {
+        decompressed = record_compressor ? compressor_decompress(record_compressor, payload,
+                                                                 payload_size, &payload_size)
+                                         : NULL;
+
+        if (!decompressed) {
+            set->skipped++;
+
+            freeReplyObject(reply);
+            return;
+        }
+
+        payload = decompressed;
+    }
+
+    if (set->count == set->capacity) {
+        set->capacity = set->capacity > 0 ? set->capacity * 2 : 256;
+        set->sizes = set->sizes ? nv_realloc(set->sizes, set->capacity * sizeof(size_t))
+                                : nv_alloc(set->capacity * sizeof(size_t));
+        assert(set->sizes);
+    }
+
+    record_write_raw(&set->samples, payload, payload_size);
+    set->sizes[set->count++] = payload_size;
+
+    nv_free(decompressed);
+    freeReplyObject(reply);
+}
+
+static void format_dictionary_path(char* buffer, size_t size, const char* directory,
+                                   unsigned id) {
+    snprintf(buffer, size, "%s/" DICTIONARY_PREFIX "%u" DICTIONARY_SUFFIX, directory, id);
+}
+
+bool status_train_dictionary(redisContext* db, const char* directory, size_t max_size) {
+    if (!compress_available()) {
+        log_error("cannot train a dictionary; built without zstd");
+        return false;
+    }
+
+    struct sample_set set;
+    memset(&set, 0, sizeof(struct sample_set));
+    record_writer_init(&set.samples, 4096);
+
+    bool success = false;
+    void* dictionary = NULL;
+
+    if (!scan_keys(db, RECORD_KEY_PREFIX "*", "string", collect_sample, &set)) {
+        goto cleanup;
+    }
+
+    if (set.skipped > 0) {
+        log_warn("%zu records are compressed with a dictionary that is not loaded; not training "
+                 "on them",
+                 set.skipped);
+    }
+
+    log_info("training status dictionary on %zu records", set.count);
+
+    dictionary = nv_alloc(max_size);
+    assert(dictionary);
+
+    size_t size =
+        compress_train_dictionary(dictionary, max_size, set.samples.data, set.sizes, set.count);
+
+    if (size == 0) {
+        goto cleanup;
+    }
+
+    /* every dictionary gets its own file, since records made with the old ones still need them */
+    char path[PATH_MAX], temporary_path[PATH_MAX + 8];
+    format_dictionary_path(path, sizeof(path), directory,
+                           compress_get_dictionary_id(dictionary, size));
+    snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", path);
+
+    if (access(path, F_OK) == 0) {
+        log_error("%s already exists; not replacing it", path);
+        goto cleanup;
+    }
+
+    FILE* file = fopen(temporary_path, "wb");
+    if (!file) {
+        log_error("failed to open %s for writing", temporary_path);
+        goto cleanup;
+    }
+
+    success = fwrite(dictionary, 1, size, file) == size;
+    success = fclose(file) == 0 && success;
+
+    /* a partly written dictionary is never picked up */
+    if (success && rename(temporary_path, path) != 0) {
+        log_error("failed to rename %s to %s: %s", temporary_path, path, strerror(errno));
+        success = false;
+    }
+
+    if (success) {
+        log_info("wrote %zu byte dictionary to %s", size, path);
+    } else {
+        unlink(temporary_path);
+    }
+
+cleanup:
+    nv_free(dictionary);
+    nv_free(set.sizes);
+    record_writer_cleanup(&set.samples);
+
+    return success;
+}
+
+static bool is_dictionary_name(const char* name) {
+    size_t length = strlen(name);
+    size_t prefix_length = strlen(DICTIONARY_PREFIX);
+    size_t suffix_length = strlen(DICTIONARY_SUFFIX);
+
+    if (strcmp(name, LEGACY_DICTIONARY_NAME) == 0) {
+        return true;
+    }
+
+    return length > prefix_length + suffix_length &&
+           strncmp(name, DICTIONARY_PREFIX, prefix_length) == 0 &&
+           strcmp(name + length - suffix_length, DICTIONARY_SUFFIX) == 0;
+}
+
+compressor_t* status_load_dictionaries(const char* directory, int level) {
+    if (!compress_available()) {
+        return NULL;
+    }
+
+    DIR* dir = opendir(directory);
+    if (!dir) {
+        log_debug("no dictionary directory %s: %s", directory, strerror(errno));
+        return NULL;
+    }
+
+    /* the newest compresses; all of them decompress */
+    char newest[PATH_MAX] = "";
+    struct timespec newest_time = { 0, 0 };
+
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        if (!is_dictionary_name(entry->d_name)) {
+            continue;
+        }
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+
+        struct stat info;
+        if (stat(path, &info) != 0 || !S_ISREG(info.st_mode)) {
+            continue;
+        }
+
+        if (newest[0] == '\0' || info.st_mtim.tv_sec > newest_time.tv_sec ||
+            (info.st_mtim.tv_sec == newest_time.tv_sec &&
+             info.st_mtim.tv_nsec > newest_time.tv_nsec)) {
+            snprintf(newest, sizeof(newest), "%s", path);
+            newest_time = info.st_mtim;
+        }
+    }
+
+    if (newest[0] == '\0') {
+        closedir(dir);
+        return NULL;
+    }
+
+    compressor_t* comp = compressor_create_from_file(newest, level);
+    if (!comp) {
+        closedir(dir);
+        return NULL;
+    }
+
+    size_t loaded = 1;
+
+    rewinddir(dir);
+    while ((entry = readdir(dir))) {
+        if (!is_dictionary_name(entry->d_name)) {
+            continue;
+        }
+
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+
+        if (strcmp(path, newest) == 0) {
+            continue;
+        }
+
+        /* records that need a dictionary that failed to load fail on their own */
+        if (compressor_add_dictionary_file(comp, path)) {
+            loaded++;
+        }
+    }
+
+    closedir(dir);
+
+    log_info("loaded %zu status dictionaries; compressing with %u", loaded,
+             compressor_get_dictionary_id(comp));
+
+    return comp;
+}
@@ -3,17 +3,46 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 /* from hiredis/hiredis.h */
 typedef struct redisContext redisContext;
 
+/* from core/compress.h */
+typedef struct compressor compressor_t;
+
 struct status {
     char* display_name;
     char* status_description;
     char* current_thought;
 };
 
+/* reads the binary record, falling back to (and migrating) the legacy status:<id> hash */
 bool status_get(redisContext* db, uint64_t user, struct status* status);
+bool status_set(redisContext* db, uint64_t user, const struct status* status);
 void status_cleanup(const struct status* status);
 
+/* records are stored as a header byte (version, flags) followed by varint-keyed fields; see
+ * core/record.h. the encoded buffer is allocated with nv_alloc */
+uint8_t* status_encode(const struct status* status, size_t* size);
+bool status_decode(const void* data, size_t size, struct status* status);
+
+/* not owned by the status module. NULL (the default) stores records uncompressed; records that
+ * were compressed still need a compressor with the same dictionary to be read back */
+void status_set_compressor(compressor_t* comp);
+
+/* rewrites one or every legacy hash as a record. status_migrate_all returns the number of
+ * migrated users */
+bool status_migrate(redisContext* db, uint64_t user);
+size_t status_migrate_all(redisContext* db);
+
+/* trains a zstd dictionary on every stored record and writes it to status.<id>.dict in
+ * directory. records compressed with a loaded dictionary are trained on as well. older
+ * dictionaries are left in place, since records compressed with them still need them */
+bool status_train_dictionary(redisContext* db, const char* directory, size_t max_size);
+
+/* loads every dictionary in directory. the newest compresses, and records pick whichever they
+ * were compressed with. NULL if there are none */
+compressor_t* status_load_dictionaries(const char* directory, int level);
+
 #endif
@@ -0,0 +1,737 @@
+/* a stand-in for discord: serves the handful of rest endpoints the bot touches and a gateway that
+ * fires INTERACTION_CREATE at a fixed rate, then measures how long the bot takes to post the
+ * interaction callback. point the bot at it with TASKS_API_URL=http://127.0.0.1:<port>/api */
+
+#include "core/clock.h"
+#include "core/http_server.h"
+
+#include "discord/types/snowflake.h"
+
+#include <log.h>
+
+#include <json.h>
+
+#include <assert.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <nyoravim/mem.h>
+#include <nyoravim/util.h>
+
+#define DEFAULT_PORT 8080
+#define DEFAULT_RATE 1000
+#define DEFAULT_REPORT_SECONDS 5
+#define DEFAULT_HEARTBEAT_MS 41250
+
+/* how long to wait for stragglers once --count events have gone out */
+#define DRAIN_TIMEOUT_NS (5ull * 1000 * 1000 * 1000)
+
+/* in flight interactions we can still match a callback to. must be a power of two */
+#define PENDING_CAPACITY (1 << 18)
+
+/* the low bits of a snowflake; the rest is its creation time */
+#define SNOWFLAKE_COUNTER_BITS 22
+
+enum {
+    OPCODE_DISPATCH = 0,
+    OPCODE_HEARTBEAT = 1,
+    OPCODE_IDENTIFY = 2,
+    OPCODE_RESUME = 6,
+    OPCODE_HELLO = 10,
+    OPCODE_HEARTBEAT_ACK = 11,
+};
+
+struct options {
+    const char* address;
+    uint16_t port;
+
+    /* interactions per second */
+    double rate;
+
+    /* stop after this many; 0 runs until interrupted */
+    uint64_t count;
+
+    /* NULL picks the first command the bot registers */
+    const char* command;
+
+    uint64_t report_seconds;
+    uint64_t heartbeat_ms;
+};
+
+struct registered_command {
+    char* name;
+
+    /* the raw registration body; options are filled from it */
+    json_object* spec;
+};
+
+struct pending_interaction {
+    uint64_t id;
+    uint64_t emitted_ns;
+};
+
+struct latencies {
+    uint64_t* samples;
+    size_t count, capacity;
+};
+
+struct mock {
+    struct options options;
+    http_server_t* server;
+
+    /* the identified bot; one at a time */
+    http_connection_t* gateway;
+    bool ready;
+    uint64_t sequence;
+    uint64_t sessions;
+
+    uint64_t app_id;
+    uint64_t guild_id;
+
+    struct registered_command* commands;
+    size_t num_commands;
+
+    struct pending_interaction* pending;
+    uint64_t id_counter;
+
+    uint64_t emitted, answered, unmatched;
+    uint64_t next_emit_ns, emit_interval_ns;
+
+    struct latencies total, interval;
+    uint64_t interval_answered;
+};
+
+static volatile sig_atomic_t running = true;
+
+static void on_sigint(int signal) { running = false; }
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void latencies_add(struct latencies* latencies, uint64_t sample) {
+    if (latencies->count >= latencies->capacity) {
+        latencies->capacity = latencies->capacity > 0 ? latencies->capacity * 2 : 4096;
+
+        size_t size = latencies->capacity * sizeof(uint64_t);
+        latencies->samples = latencies->samples ? nv_realloc(latencies->samples, size)
+                                                : nv_alloc(size);
+
+        assert(latencies->samples);
+    }
+
+    latencies->samples[latencies->count++] = sample;
+}
+
+static int compare_samples(const void* lhs, const void* rhs) {
+    uint64_t a = *(const uint64_t*)lhs;
+    uint64_t b = *(const uint64_t*)rhs;
+
+    return (a > b) - (a < b);
+}
+
+static double percentile_ms(const struct latencies* sorted, double p) {
+    size_t rank = (size_t)(p * (double)sorted->count);
+    if (rank >= sorted->count) {
+        rank = sorted->count - 1;
+    }
+
+    return (double)sorted->samples[rank] / 1e6;
+}
+
+static void print_latencies(const char* label, struct latencies* latencies, uint64_t answered,
+                            double seconds) {
+    if (latencies->count == 0) {
+        printf("%s: no callbacks received\n", label);
+        return;
+    }
+
+    qsort(latencies->samples, latencies->count, sizeof(uint64_t), compare_samples);
+
+    printf("%s: %" PRIu64 " callbacks (%.0f/s)  p50 %.2f ms  p99 %.2f ms  p999 %.2f ms  max %.2f "
+           "ms\n",
+           label, answered, seconds > 0 ? (double)answered / seconds : 0,
+           percentile_ms(latencies, 0.5), percentile_ms(latencies, 0.99),
+           percentile_ms(latencies, 0.999), percentile_ms(latencies, 1.0));
+
+    fflush(stdout);
+}
+
+static void send_json(http_connection_t* conn, json_object* object) {
+    const char* content = json_object_to_json_string_ext(object, JSON_C_TO_STRING_PLAIN);
+    http_server_ws_send(conn, content, strlen(content), true);
+}
+
+/* takes ownership of data */
+static void send_packet(struct mock* mock, int32_t opcode, const char* type, json_object* data) {
+    json_object* packet = json_object_new_object();
+    assert(packet);
+
+    json_object_object_add(packet, "op", json_object_new_int(opcode));
+    json_object_object_add(packet, "d", data);
+
+    if (type) {
+        json_object_object_add(packet, "t", json_object_new_string(type));
+        json_object_object_add(packet, "s", json_object_new_uint64(++mock->sequence));
+    }
+
+    send_json(mock->gateway, packet);
+    json_object_put(packet);
+}
+
+static json_object* new_snowflake(uint64_t id) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%" PRIu64, id);
+
+    json_object* snowflake = json_object_new_string(buffer);
+    assert(snowflake);
+
+    return snowflake;
+}
+
+static json_object* create_mock_user() {
+    json_object* user = json_object_new_object();
+    assert(user);
+
+    json_object_object_add(user, "id", new_snowflake(80351110224678912));
+    json_object_object_add(user, "username", json_object_new_string("mock"));
+    json_object_object_add(user, "discriminator", json_object_new_string("0"));
+    json_object_object_add(user, "global_name", json_object_new_string("Mock"));
+
+    return user;
+}
+
+static void get_gateway_url(const struct mock* mock, char* buffer, size_t max_length) {
+    snprintf(buffer, max_length, "ws://%s:%" PRIu16, mock->options.address,
+             http_server_get_port(mock->server));
+}
+
+static void send_ready(struct mock* mock) {
+    char session_id[64];
+    snprintf(session_id, sizeof(session_id), "mock-session-%" PRIu64, ++mock->sessions);
+
+    char url[256];
+    get_gateway_url(mock, url, sizeof(url));
+
+    json_object* application = json_object_new_object();
+    assert(application);
+
+    json_object_object_add(application, "id", new_snowflake(mock->app_id));
+    json_object_object_add(application, "flags", json_object_new_int(0));
+
+    json_object* user = create_mock_user();
+    json_object_object_add(user, "bot", json_object_new_boolean(true));
+
+    json_object* ready = json_object_new_object();
+    assert(ready);
+
+    json_object_object_add(ready, "v", json_object_new_int(10));
+    json_object_object_add(ready, "user", user);
+    json_object_object_add(ready, "guilds", json_object_new_array());
+    json_object_object_add(ready, "session_id", json_object_new_string(session_id));
+    json_object_object_add(ready, "resume_gateway_url", json_object_new_string(url));
+    json_object_object_add(ready, "application", application);
+
+    send_packet(mock, OPCODE_DISPATCH, "READY", ready);
+
+    mock->ready = true;
+    mock->next_emit_ns = now_ns();
+
+    log_info("bot identified; session %s", session_id);
+}
+
+static void on_ws_open(void* user, http_connection_t* conn, const struct http_server_request* req) {
+    struct mock* mock = user;
+    if (mock->gateway) {
+        log_warn("second gateway connection; dropping the first");
+        http_server_close(mock->gateway);
+    }
+
+    mock->gateway = conn;
+    mock->ready = false;
+
+    json_object* hello = json_object_new_object();
+    assert(hello);
+
+    json_object_object_add(hello, "heartbeat_interval",
+                           json_object_new_uint64(mock->options.heartbeat_ms));
+
+    send_packet(mock, OPCODE_HELLO, NULL, hello);
+}
+
+static void on_ws_message(void* user, http_connection_t* conn, const char* data, size_t size,
+                          bool text) {
+    struct mock* mock = user;
+    if (conn != mock->gateway) {
+        return;
+    }
+
+    json_object* frame = json_tokener_parse(data);
+    if (!frame) {
+        log_warn("unparseable gateway frame from bot");
+        return;
+    }
+
+    int32_t opcode = json_object_get_int(json_object_object_get(frame, "op"));
+    switch (opcode) {
+    case OPCODE_HEARTBEAT:
+        send_packet(mock, OPCODE_HEARTBEAT_ACK, NULL, NULL);
+        break;
+    case OPCODE_IDENTIFY:
+        send_ready(mock);
+        break;
+    case OPCODE_RESUME:
+        send_packet(mock, OPCODE_DISPATCH, "RESUMED", NULL);
+        mock->ready = true;
+
+        break;
+    default:
+        log_debug("ignoring gateway opcode %" PRIi32, opcode);
+        break;
+    }
+
+    json_object_put(frame);
+}
+
+static void on_close(void* user, http_connection_t* conn) {
+    struct mock* mock = user;
+    if (conn == mock->gateway) {
+        log_info("bot disconnected from gateway");
+
+        mock->gateway = NULL;
+        mock->ready = false;
+    }
+}
+
+static void respond_json(http_connection_t* conn, uint32_t status, json_object* body) {
+    const char* content = json_object_to_json_string_ext(body, JSON_C_TO_STRING_PLAIN);
+    http_server_respond(conn, status, "application/json", content, strlen(content));
+
+    json_object_put(body);
+}
+
+static void respond_not_found(http_connection_t* conn) {
+    json_object* body = json_object_new_object();
+    assert(body);
+
+    json_object_object_add(body, "message", json_object_new_string("404: Not Found"));
+    json_object_object_add(body, "code", json_object_new_int(0));
+
+    respond_json(conn, 404, body);
+}
+
+static void handle_gateway_bot(struct mock* mock, http_connection_t* conn) {
+    char url[256];
+    get_gateway_url(mock, url, sizeof(url));
+
+    json_object* limit = json_object_new_object();
+    assert(limit);
+
+    json_object_object_add(limit, "total", json_object_new_int(1000));
+    json_object_object_add(limit, "remaining", json_object_new_int(1000));
+    json_object_object_add(limit, "reset_after", json_object_new_int(0));
+    json_object_object_add(limit, "max_concurrency", json_object_new_int(1));
+
+    json_object* body = json_object_new_object();
+    assert(body);
+
+    json_object_object_add(body, "url", json_object_new_string(url));
+    json_object_object_add(body, "shards", json_object_new_int(1));
+    json_object_object_add(body, "session_start_limit", limit);
+
+    respond_json(conn, 200, body);
+}
+
+/* /applications/<app>[/guilds/<guild>]/commands */
+static void handle_register_command(struct mock* mock, http_connection_t* conn, const char* route,
+                                    const struct http_server_request* req) {
+    uint64_t app_id = strtoull(route + strlen("/applications/"), NULL, 10);
+
+    const char* guild = strstr(route, "/guilds/");
+    uint64_t guild_id = guild ? strtoull(guild + strlen("/guilds/"), NULL, 10) : 0;
+
+    json_object* spec = json_tokener_parse(req->body);
+    const char* name = json_object_get_string(json_object_object_get(spec, "name"));
+
+    if (!name) {
+        json_object_put(spec);
+        http_server_respond(conn, 400, NULL, NULL, 0);
+
+        return;
+    }
+
+    mock->app_id = app_id;
+    if (guild_id > 0) {
+        mock->guild_id = guild_id;
+    }
+
+    mock->commands =
+        nv_realloc(mock->commands, (mock->num_commands + 1) * sizeof(struct registered_command));
+    assert(mock->commands);
+
+    struct registered_command* cmd = &mock->commands[mock->num_commands++];
+    cmd->name = nv_strdup(name);
+    cmd->spec = spec;
+
+    log_info("registered command /%s for app %" PRIu64, name, app_id);
+
+    json_object_object_add(spec, "id", new_snowflake(1297023578613661759 + mock->num_commands));
+    respond_json(conn, 201, json_object_get(spec));
+}
+
+/* /interactions/<id>/<token>/callback */
+static void handle_interaction_callback(struct mock* mock, http_connection_t* conn,
+                                        const char* route) {
+    uint64_t now = now_ns();
+    uint64_t id = strtoull(route + strlen("/interactions/"), NULL, 10);
+
+    struct pending_interaction* pending = &mock->pending[id & (PENDING_CAPACITY - 1)];
+    if (id != 0 && pending->id == id) {
+        uint64_t latency = now - pending->emitted_ns;
+        latencies_add(&mock->total, latency);
+        latencies_add(&mock->interval, latency);
+
+        pending->id = 0;
+        mock->answered++;
+        mock->interval_answered++;
+    } else {
+        mock->unmatched++;
+    }
+
+    http_server_respond(conn, 204, NULL, NULL, 0);
+}
+
+static void on_request(void* user, http_connection_t* conn, const struct http_server_request* req) {
+    struct mock* mock = user;
+    log_trace("%s %s", req->method, req->path);
+
+    /* strip /api and the version, if present */
+    const char* route = req->path;
+    if (strncmp(route, "/api", 4) == 0) {
+        route += 4;
+    }
+
+    if (strncmp(route, "/v", 2) == 0) {
+        const char* slash = strchr(route + 1, '/');
+        route = slash ? slash : "";
+    }
+
+    bool post = strcmp(req->method, "POST") == 0;
+    if (strcmp(route, "/gateway/bot") == 0 || strcmp(route, "/gateway") == 0) {
+        handle_gateway_bot(mock, conn);
+    } else if (post && strncmp(route, "/applications/", 14) == 0 && strstr(route, "/commands")) {
+        handle_register_command(mock, conn, route, req);
+    } else if (post && strncmp(route, "/interactions/", 14) == 0 && strstr(route, "/callback")) {
+        handle_interaction_callback(mock, conn, route);
+    } else if (strncmp(route, "/webhooks/", 10) == 0) {
+        /* follow ups and edits; accept and move on */
+        respond_json(conn, 200, json_object_new_object());
+    } else {
+        respond_not_found(conn);
+    }
+}
+
+static const struct registered_command* pick_command(const struct mock* mock) {
+    for (size_t i = 0; i < mock->num_commands; i++) {
+        const struct registered_command* cmd = &mock->commands[i];
+        if (!mock->options.command || strcmp(cmd->name, mock->options.command) == 0) {
+            return cmd;
+        }
+    }
+
+    return NULL;
+}
+
+/* a plausible value for every option the command declared */
+static json_object* create_options(const struct registered_command* cmd) {
+    json_object* options = json_object_new_array();
+    assert(options);
+
+    json_object* specs = json_object_object_get(cmd->spec, "options");
+    size_t num_specs = specs ? json_object_array_length(specs) : 0;
+
+    for (size_t i = 0; i < num_specs; i++) {
+        json_object* spec = json_object_array_get_idx(specs, i);
+        int32_t type = json_object_get_int(json_object_object_get(spec, "type"));
+
+        json_object* value;
+        switch (type) {
+        case 4:
+        case 10:
+            value = json_object_new_int(1);
+            break;
+        case 5:
+            value = json_object_new_boolean(true);
+            break;
+        case 6:
+        case 7:
+        case 8:
+        case 9:
+            value = new_snowflake(80351110224678912);
+            break;
+        default:
+            value = json_object_new_string("mock");
+            break;
+        }
+
+        json_object* option = json_object_new_object();
+        assert(option);
+
+        json_object_object_add(option, "name",
+                               json_object_get(json_object_object_get(spec, "name")));
+        json_object_object_add(option, "type", json_object_new_int(type));
+        json_object_object_add(option, "value", value);
+
+        json_object_array_add(options, option);
+    }
+
+    return options;
+}
+
+/* stamped with the current time like discord's, since the bot drops interactions too old to
+ * answer. the counter keeps ids unique and spreads them over the pending table */
+static uint64_t next_interaction_id(struct mock* mock) {
+    uint64_t counter = mock->id_counter++ & ((1ull << SNOWFLAKE_COUNTER_BITS) - 1);
+    return ((time_unix_ms() - DISCORD_EPOCH_MS) << SNOWFLAKE_COUNTER_BITS) | counter;
+}
+
+static void emit_interaction(struct mock* mock, const struct registered_command* cmd,
+                             uint64_t scheduled_ns) {
+    uint64_t id = next_interaction_id(mock);
+
+    /* long enough for the bot's rest metrics to fold it into :token like a real one */
+    char token[64];
+    snprintf(token, sizeof(token), "mock-interaction-token-%" PRIu64, id);
+
+    json_object* data = json_object_new_object();
+    assert(data);
+
+    json_object_object_add(data, "id", new_snowflake(1297023578613661759));
+    json_object_object_add(data, "name", json_object_new_string(cmd->name));
+    json_object_object_add(data, "type", json_object_new_int(1));
+    json_object_object_add(data, "options", create_options(cmd));
+
+    json_object* member = json_object_new_object();
+    assert(member);
+
+    json_object_object_add(member, "user", create_mock_user());
+    json_object_object_add(member, "nick", json_object_new_string("mocky"));
+
+    json_object* interaction = json_object_new_object();
+    assert(interaction);
+
+    json_object_object_add(interaction, "id", new_snowflake(id));
+    json_object_object_add(interaction, "application_id", new_snowflake(mock->app_id));
+    json_object_object_add(interaction, "type", json_object_new_int(2));
+    json_object_object_add(interaction, "data", data);
+    json_object_object_add(interaction, "channel_id", new_snowflake(1197368302655078442));
+    json_object_object_add(interaction, "token", json_object_new_string(token));
+    json_object_object_add(interaction, "version", json_object_new_int(1));
+
+    if (mock->guild_id > 0) {
+        json_object_object_add(interaction, "guild_id", new_snowflake(mock->guild_id));
+        json_object_object_add(interaction, "member", member);
+    } else {
+        json_object* user = json_object_object_get(member, "user");
+        json_object_object_add(interaction, "user", json_object_get(user));
+
+        json_object_put(member);
+    }
+
+    struct pending_interaction* pending = &mock->pending[id & (PENDING_CAPACITY - 1)];
+    if (pending->id != 0) {
+        /* never answered and about to be forgotten */
+        mock->unmatched++;
+    }
+
+    /* measured from when it was due rather than when it went out, so a stalled mock does not hide
+     * a stalled bot */
+    pending->id = id;
+    pending->emitted_ns = scheduled_ns;
+
+    send_packet(mock, OPCODE_DISPATCH, "INTERACTION_CREATE", interaction);
+    mock->emitted++;
+}
+
+static void emit_due(struct mock* mock) {
+    if (!mock->ready || !mock->gateway) {
+        return;
+    }
+
+    const struct registered_command* cmd = pick_command(mock);
+    if (!cmd) {
+        return;
+    }
+
+    uint64_t now = now_ns();
+    while (mock->next_emit_ns <= now &&
+           (mock->options.count == 0 || mock->emitted < mock->options.count)) {
+        emit_interaction(mock, cmd, mock->next_emit_ns);
+        mock->next_emit_ns += mock->emit_interval_ns;
+    }
+}
+
+static void print_usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s [--listen <address>] [--port <port>] [--rate <per second>] [--count <n>]\n"
+            "          [--command <name>] [--report <seconds>] [--heartbeat <ms>]\n",
+            program);
+}
+
+static bool parse_options(struct options* options, int argc, const char** argv) {
+    memset(options, 0, sizeof(struct options));
+    options->address = "127.0.0.1";
+    options->port = DEFAULT_PORT;
+    options->rate = DEFAULT_RATE;
+    options->report_seconds = DEFAULT_REPORT_SECONDS;
+    options->heartbeat_ms = DEFAULT_HEARTBEAT_MS;
+
+    for (int i = 1; i < argc; i += 2) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (!value) {
+            return false;
+        }
+
+        if (strcmp(arg, "--listen") == 0) {
+            options->address = value;
+        } else if (strcmp(arg, "--port") == 0) {
+            options->port = (uint16_t)strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--rate") == 0) {
+            options->rate = strtod(value, NULL);
+        } else if (strcmp(arg, "--count") == 0) {
+            options->count = strtoull(value, NULL, 10);
+        } else if (strcmp(arg, "--command") == 0) {
+            options->command = value;
+        } else if (strcmp(arg, "--report") == 0) {
+            options->report_seconds = strtoull(value, NULL, 10);
+        } else if (strcmp(arg, "--heartbeat") == 0) {
+            options->heartbeat_ms = strtoull(value, NULL, 10);
+        } else {
+            return false;
+        }
+    }
+
+    return options->rate > 0;
+}
+
+static bool finished(const struct mock* mock, uint64_t now, uint64_t* drain_deadline) {
+    if (mock->options.count == 0 || mock->emitted < mock->options.count) {
+        return false;
+    }
+
+    if (mock->answered + mock->unmatched >= mock->emitted) {
+        return true;
+    }
+
+    if (*drain_deadline == 0) {
+        *drain_deadline = now + DRAIN_TIMEOUT_NS;
+    }
+
+    return now >= *drain_deadline;
+}
+
+static void free_mock(struct mock* mock) {
+    http_server_free(mock->server);
+
+    for (size_t i = 0; i < mock->num_commands; i++) {
+        nv_free(mock->commands[i].name);
+        json_object_put(mock->commands[i].spec);
+    }
+
+    nv_free(mock->commands);
+    nv_free(mock->pending);
+    nv_free(mock->total.samples);
+    nv_free(mock->interval.samples);
+}
+
+int main(int argc, const char** argv) {
+    struct mock mock;
+    memset(&mock, 0, sizeof(struct mock));
+
+    if (!parse_options(&mock.options, argc, argv)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    mock.emit_interval_ns = (uint64_t)(1e9 / mock.options.rate);
+
+    mock.pending = nv_calloc(PENDING_CAPACITY, sizeof(struct pending_interaction));
+    assert(mock.pending);
+
+    struct http_server_callbacks callbacks;
+    memset(&callbacks, 0, sizeof(struct http_server_callbacks));
+    callbacks.user = &mock;
+    callbacks.on_request = on_request;
+    callbacks.on_ws_open = on_ws_open;
+    callbacks.on_ws_message = on_ws_message;
+    callbacks.on_close = on_close;
+
+    mock.server = http_server_create(mock.options.address, mock.options.port, &callbacks);
+    if (!mock.server) {
+        free_mock(&mock);
+        return 1;
+    }
+
+    printf("mock discord listening; run the bot with TASKS_API_URL=http://%s:%" PRIu16 "/api\n",
+           mock.options.address, http_server_get_port(mock.server));
+
+    fflush(stdout);
+    signal(SIGINT, on_sigint);
+
+    uint64_t start = now_ns();
+    uint64_t report_interval = mock.options.report_seconds * 1000000000;
+    uint64_t next_report = start + report_interval;
+    uint64_t last_report = start;
+    uint64_t drain_deadline = 0;
+
+    while (running) {
+        uint64_t now = now_ns();
+
+        /* wake up for the next emit, but never sleep past a millisecond of it */
+        int32_t timeout = 0;
+        if (!mock.ready || mock.next_emit_ns > now + 1000000) {
+            timeout = 1;
+        }
+
+        http_server_poll(mock.server, timeout);
+        emit_due(&mock);
+
+        now = now_ns();
+        if (report_interval > 0 && now >= next_report) {
+            char label[64];
+            snprintf(label, sizeof(label), "[%6.1fs] emitted %" PRIu64, (now - start) / 1e9,
+                     mock.emitted);
+
+            print_latencies(label, &mock.interval, mock.interval_answered,
+                            (now - last_report) / 1e9);
+
+            mock.interval.count = 0;
+            mock.interval_answered = 0;
+
+            last_report = now;
+            next_report = now + report_interval;
+        }
+
+        if (finished(&mock, now, &drain_deadline)) {
+            break;
+        }
+    }
+
+    double elapsed = (now_ns() - start) / 1e9;
+    printf("\nemitted %" PRIu64 ", answered %" PRIu64 ", unmatched or dropped %" PRIu64 "\n",
+           mock.emitted, mock.answered, mock.unmatched);
+
+    print_latencies("total", &mock.total, mock.answered, elapsed);
+
+    free_mock(&mock);
+    return 0;
+}
@@ -0,0 +1,130 @@
+/* feeds a gateway recording (see TASKS_RECORD_GATEWAY) through the parse and dispatch path of an
+ * offline bot, with no network, and reports how fast it went */
+
+#include "core/ws_recorder.h"
+
+#include "discord/bot.h"
+#include "discord/credentials.h"
+#include "discord/gateway.h"
+
+#include <log.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct replay_counts {
+    uint64_t ready;
+    uint64_t interactions;
+};
+
+static void on_ready(const struct bot_context* context, const struct bot_ready_event* event) {
+    struct replay_counts* counts = context->user;
+    counts->ready++;
+}
+
+static void on_interaction(const struct bot_context* context, const struct interaction* event) {
+    struct replay_counts* counts = context->user;
+    counts->interactions++;
+}
+
+static void print_usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s <recording> [--speed <multiplier, 0 for max>] [--loops <n>] [--verbose]\n",
+            program);
+}
+
+int main(int argc, const char** argv) {
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    const char* path = argv[1];
+    double speed = 1;
+    uint64_t loops = 1;
+    bool verbose = false;
+
+    for (int i = 2; i < argc; i++) {
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(argv[i], "--speed") == 0 && value) {
+            speed = strtod(value, NULL);
+            i++;
+        } else if (strcmp(argv[i], "--loops") == 0 && value) {
+            loops = strtoull(value, NULL, 10);
+            i++;
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            verbose = true;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!verbose) {
+        log_set_level(LOG_WARN);
+    }
+
+    struct replay_counts counts;
+    memset(&counts, 0, sizeof(struct replay_counts));
+
+    struct credentials creds;
+    memset(&creds, 0, sizeof(struct credentials));
+    creds.token = "replay";
+
+    struct bot_callbacks callbacks;
+    memset(&callbacks, 0, sizeof(struct bot_callbacks));
+    callbacks.user = &counts;
+    callbacks.on_ready = on_ready;
+    callbacks.on_interaction = on_interaction;
+
+    struct bot_spec spec;
+    memset(&spec, 0, sizeof(struct bot_spec));
+    spec.creds = &creds;
+    spec.callbacks = &callbacks;
+    spec.offline = true;
+
+    bot_t* bot = bot_create(&spec);
+    if (!bot) {
+        return 1;
+    }
+
+    struct gateway_replay_stats total;
+    memset(&total, 0, sizeof(struct gateway_replay_stats));
+
+    int status = 0;
+    for (uint64_t i = 0; i < loops; i++) {
+        ws_replayer_t* replayer = ws_replayer_open(path);
+        if (!replayer) {
+            status = 1;
+            break;
+        }
+
+        struct gateway_replay_stats stats;
+        bool replayed = gateway_replay(bot_get_gateway(bot), replayer, speed, &stats);
+        ws_replayer_close(replayer);
+
+        if (!replayed) {
+            status = 1;
+            break;
+        }
+
+        total.frames += stats.frames;
+        total.bytes += stats.bytes;
+        total.elapsed_ns += stats.elapsed_ns;
+    }
+
+    double seconds = (double)total.elapsed_ns / 1e9;
+    printf("replayed %" PRIu64 " frames (%.2f MB) in %.3f s: %.0f frames/s, %.1f MB/s\n",
+           total.frames, (double)total.bytes / (1024 * 1024), seconds,
+           seconds > 0 ? (double)total.frames / seconds : 0,
+           seconds > 0 ? (double)total.bytes / (1024 * 1024) / seconds : 0);
+
+    printf("dispatched %" PRIu64 " READY and %" PRIu64 " INTERACTION_CREATE\n", counts.ready,
+           counts.interactions);
+
+    bot_destroy(bot);
+    return status;
+}